@@ -0,0 +1,6 @@
+#version 430 core
+
+// depth only, the depth of the terrain for the occlusion culling
+void main(void)
+{
+}
@@ -1,9 +1,19 @@
 #version 430 core
+#extension GL_ARB_bindless_texture : enable
 
 layout(binding = 0) uniform sampler2D heightmap;
-layout(binding = 1) uniform sampler2D normalmap;
 layout(binding = 2) uniform sampler2D occlusmap;
-layout(binding = 4) uniform sampler2D basemap;
+layout(binding = 4) uniform sampler2DArray atlases; // the color and normal atlas as layers, without bindless textures
+
+struct forestdraw {
+	vec2 band;
+	uint layers[2]; // color and normal
+	uvec2 handles[2];
+};
+
+layout(std430, binding = 3) readonly buffer DrawData {
+	forestdraw draws[];
+};
 
 uniform float mapscale;
 uniform vec3 camerapos;
@@ -15,8 +25,21 @@ out vec4 color;
 in VERTEX {
 	vec3 position;
 	vec2 texcoord;
+	flat vec2 rotation;
+	vec3 root;
+	flat int draw;
 } fragment;
 
+// the handles are the same for all fragments of a draw
+vec4 atlas_texture(int slot, vec2 uv)
+{
+#ifdef GL_ARB_bindless_texture
+	uvec2 handle = draws[fragment.draw].handles[slot];
+	if (handle != uvec2(0)) { return texture(sampler2D(handle), uv); }
+#endif
+	return texture(atlases, vec3(uv, float(draws[fragment.draw].layers[slot])));
+}
+
 vec3 fog(vec3 c, float dist, float height)
 {
 	float de = fogfactor * smoothstep(0.0, 3.3, 1.0 - height);
@@ -32,48 +55,26 @@ void main(void)
 	const vec3 lightdirection = vec3(0.5, 0.5, 0.5);
 	const vec3 ambient = vec3(0.5, 0.5, 0.5);
 	const vec3 lightcolor = vec3(1.0, 1.0, 1.0);
-	const vec3 viewspace = vec3(distance(fragment.position.x, camerapos.x), distance(fragment.position.y, camerapos.y), distance(fragment.position.z, camerapos.z));
 
-	color = texture(basemap, fragment.texcoord);
+	color = atlas_texture(0, fragment.texcoord);
 	if(color.a < 0.5) { discard; }
 	color.a = 1.0;
 
-	color.rgb = mix(vec3(0.34, 0.5, 0.09), color.rgb, 0.5);
-	color.rgb *= 0.8;
-
-	//vec3 normal = vec3(0.0, 1.0, 0.0);
-	vec3 normal = texture(normalmap, mapscale * fragment.position.xz).rgb;
+	// the baked normals are in the space of the tree
+	vec3 normal = atlas_texture(1, fragment.texcoord).rgb;
 	normal = (normal * 2.0) - 1.0;
-	float diffuse = max(0.0, dot(normal, lightdirection));
-	diffuse = clamp(diffuse, 0.2, 1.0);
-	
-	color.rgb *= texture(occlusmap, mapscale * fragment.position.xz).r;
+	float c = fragment.rotation.x;
+	float s = fragment.rotation.y;
+	normal = normalize(vec3(c * normal.x + s * normal.z, normal.y, -s * normal.x + c * normal.z));
 
+	float diffuse = clamp(dot(normal, lightdirection), 0.2, 1.0);
 	vec3 scatteredlight = ambient + lightcolor * diffuse;
 	color.rgb = min(color.rgb * scatteredlight, vec3(1.0));
+	color.rgb *= texture(occlusmap, mapscale * fragment.root.xz).r;
 
 	float height = texture(heightmap, mapscale * fragment.position.xz).r;
-	color.rgb = fog(color.rgb, length(viewspace), height);
+	color.rgb = fog(color.rgb, distance(fragment.position, camerapos), height);
 
 	float gamma = 1.5;
 	color.rgb = pow(color.rgb, vec3(1.0/gamma));
-	/*
-
-
-	color.rgb *= texture(occlusmap, mapscale * fragment.position.xz).r;
-
-	vec3 normal = texture(normalmap, mapscale * fragment.position.xz).rgb;
-	normal = (normal * 2.0) - 1.0;
-
-	float diffuse = max(0.0, dot(normal, lightdirection));
-
-	vec3 scatteredlight = ambient + lightcolor * diffuse;
-	color.rgb = min(color.rgb * scatteredlight, vec3(1.0));
-
-	color.rgb = fog(color.rgb, length(viewspace), 0.007 * fragment.position.y);
-
-	float gamma = 1.6;
-	color.rgb = pow(color.rgb, vec3(1.0/gamma));
-	*/
 }
-
@@ -1,23 +1,100 @@
 #version 430 core
+#extension GL_ARB_shader_draw_parameters : enable
 
-layout(location = 0) in vec3 position;
-layout(location = 1) in vec3 normal;
-layout(location = 2) in vec2 texcoord;
-layout(location = 5) in mat4 model;
+// octahedral impostor, a quad that faces the camera and shows the baked view of the tree closest to the view direction
+
+layout(location = 0) in vec2 corner; // quad corners in [-1, 1]
+layout(location = 5) in vec4 instance; // xyz = root, w = scale
 
 uniform mat4 VIEW_PROJECT;
+uniform vec3 camerapos;
+uniform float radius; // bounding radius of a tree with scale 1
+uniform float center; // height of the bounding sphere center of a tree with scale 1
+uniform int frames; // views per side of the atlas
+
+#ifdef GL_ARB_shader_draw_parameters
+#define DRAW_ID gl_DrawIDARB
+#else
+uniform int drawid; // the draws are submitted one by one
+#define DRAW_ID drawid
+#endif
+
+// one per draw, a draw is a cell of the forest
+struct forestdraw {
+	vec2 band; // squared distances from the camera of the trees this draw keeps
+	uint layers[2];
+	uvec2 handles[2];
+};
+
+layout(std430, binding = 3) readonly buffer DrawData {
+	forestdraw draws[];
+};
 
 out VERTEX {
 	vec3 position;
 	vec2 texcoord;
+	flat vec2 rotation; // cos and sin of the tree rotation
+	vec3 root;
+	flat int draw;
 } vertex;
 
+// has to match the tree shader
+mat3 tree_rotation(vec3 root)
+{
+	float angle = 6.2831853 * fract(sin(dot(root.xz, vec2(12.9898, 78.233))) * 43758.5453);
+	float c = cos(angle);
+	float s = sin(angle);
+
+	return mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+}
+
+// upper hemisphere to the unit square
+vec2 hemi_octahedron(vec3 direction)
+{
+	vec3 d = direction / (abs(direction.x) + abs(direction.y) + abs(direction.z));
+
+	return vec2(d.x + d.z + 1.0, d.z - d.x + 1.0) * 0.5;
+}
+
+vec3 hemi_direction(vec2 uv)
+{
+	float x = uv.x - uv.y;
+	float z = uv.x + uv.y - 1.0;
+
+	return normalize(vec3(x, 1.0 - abs(x) - abs(z), z));
+}
+
 void main(void)
 {
-	vec4 worldpos = model * vec4(position, 1.0);
+	vec3 offset = instance.xyz - camerapos;
+	float distance2 = dot(offset, offset);
+	vec2 band = draws[DRAW_ID].band;
+	if (distance2 < band.x || distance2 >= band.y) {
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // outside the clip volume
+		return;
+	}
+
+	mat3 rotation = tree_rotation(instance.xyz);
+	float scale = instance.w;
+	vec3 middle = instance.xyz + vec3(0.0, center * scale, 0.0);
+
+	// pick the baked view in the space of the tree
+	vec3 view = transpose(rotation) * (camerapos - middle);
+	view.y = max(view.y, 0.0);
+	vec2 frame = min(floor(hemi_octahedron(view) * float(frames)), float(frames - 1));
+	vec3 direction = hemi_direction((frame + 0.5) / float(frames));
+
+	// same basis as the one the view was baked with
+	vec3 right = abs(direction.y) > 0.999 ? vec3(1.0, 0.0, 0.0) : normalize(cross(vec3(0.0, 1.0, 0.0), direction));
+	vec3 up = cross(direction, right);
+
+	vec3 worldpos = middle + rotation * (radius * scale * (corner.x * right + corner.y * up));
 
-	vertex.position = worldpos.xyz;
-	vertex.texcoord = texcoord;
+	vertex.position = worldpos;
+	vertex.texcoord = (frame + 0.5 * corner + 0.5) / float(frames);
+	vertex.rotation = vec2(rotation[0][0], rotation[2][0]);
+	vertex.root = instance.xyz;
+	vertex.draw = DRAW_ID;
 
-	gl_Position = VIEW_PROJECT * worldpos;
+	gl_Position = VIEW_PROJECT * vec4(worldpos, 1.0);
 }
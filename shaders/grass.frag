@@ -21,6 +21,14 @@ in GEOM {
 	float zclipspace;
 } fragment;
 
+// the normal map is BC5 compressed, only x and z are stored
+vec3 terrain_normal(vec2 uv)
+{
+	vec2 xz = texture(normalmap, uv).rg * 2.0 - 1.0;
+
+	return vec3(xz.x, sqrt(max(1.0 - dot(xz, xz), 0.0)), xz.y);
+}
+
 vec3 fog(vec3 c, float dist, float height)
 {
 	float de = fogfactor * smoothstep(0.0, 3.3, 1.0 - height);
@@ -100,8 +108,7 @@ void main(void)
 
 	color.rgb *= texture(occlusmap, mapscale * fragment.position.xz).r;
 
-	vec3 normal = texture(normalmap, mapscale * fragment.position.xz).rgb;
-	normal = (normal * 2.0) - 1.0;
+	vec3 normal = terrain_normal(mapscale * fragment.position.xz);
 	vec3 detail = texture(detailmap, fragment.position.xz*0.01).rgb;
 	detail  = (detail * 2.0) - 1.0;
 	detail = vec3(detail.x, detail.z, detail.y);
@@ -49,7 +49,8 @@ void main(void)
 	skin += weights.w * fetch_joint_matrix(int(joints.w));
 
 	vec4 pos = model * skin * vec4(position, 1.0);
-	vertex.normal = normalize(mat3(transpose(inverse(model * skin))) * normal);
+	// rigid joints and uniform scale, so no inverse transpose is needed for the normals
+	vertex.normal = normalize(mat3(model * skin) * normal);
 	vertex.worldpos = pos.xyz;
 	vertex.texcoord = texcoord;
 
@@ -8,6 +8,7 @@ layout(binding = 4) uniform sampler2D grassmap;
 layout(binding = 5) uniform sampler2D dirtmap;
 layout(binding = 6) uniform sampler2D stonemap;
 layout(binding = 7) uniform sampler2D snowmap;
+layout(binding = 8) uniform sampler2D splatmap; // material weights baked at startup
 
 layout(binding = 10) uniform sampler2DArrayShadow shadowmap;
 
@@ -21,7 +22,7 @@ uniform mat4 shadowspace[4];
 
 out vec4 fcolor;
 
-in TESSEVAL {
+in VERTEX {
 	vec3 position;
 	vec2 texcoord;
 	float zclipspace;
@@ -34,73 +35,12 @@ struct material {
 	vec3 snow;
 };
 
-float random(in vec2 st) 
+// the normal map is BC5 compressed, only x and z are stored
+vec3 terrain_normal(vec2 uv)
 {
-	return fract(sin(dot(st.xy, vec2(12.9898,78.233)))* 43758.5453123);
-}
-
-// Based on Morgan McGuire @morgan3d
-// https://www.shadertoy.com/view/4dS3Wd
-float noise(in vec2 st) 
-{
-	vec2 i = floor(st);
-	vec2 f = fract(st);
-
-	// Four corners in 2D of a tile
-	float a = random(i);
-	float b = random(i + vec2(1.0, 0.0));
-	float c = random(i + vec2(0.0, 1.0));
-	float d = random(i + vec2(1.0, 1.0));
-
-	vec2 u = f * f * (3.0 - 2.0 * f);
-
-	return mix(a, b, u.x) + (c - a)* u.y * (1.0 - u.x) + (d - b) * u.x * u.y;
-}
-
-#define OCTAVES 5
-
-float fbm(in vec2 st) 
-{
-	// Initial values
-	float value = 0.0;
-	float amplitude = .5;
-	float frequency = 0.;
-	//
-	// Loop of octaves
-	for (int i = 0; i < OCTAVES; i++) {
-		value += amplitude * noise(st);
-		st *= 2.;
-		amplitude *= .5;
-	}
-	return value;
-}
+	vec2 xz = texture(normalmap, uv).rg * 2.0 - 1.0;
 
-float shiftfbm(in vec2 _st) 
-{
-	float v = 0.0;
-	float a = 0.5;
-	vec2 shift = vec2(100.0);
-	// Rotate to reduce axial bias
-	mat2 rot = mat2(cos(0.5), sin(0.5),
-		    -sin(0.5), cos(0.50));
-	for (int i = 0; i < OCTAVES; ++i) {
-		v += a * noise(_st);
-		_st = rot * _st * 2.0 + shift;
-		a *= 0.5;
-	}
-	return v;
-}
-
-float warpfbm(vec2 st)
-{
-	vec2 q = vec2(0.);
-	q.x = shiftfbm(st);
-	q.y = shiftfbm(st + vec2(1.0));
-	vec2 r = vec2(0.);
-	r.x = shiftfbm( st + 20.0*q + vec2(1.7,9.2)+ 0.15);
-	r.y = shiftfbm( st + 20.0*q + vec2(8.3,2.8)+ 0.126);
-
-	return shiftfbm(st+r);
+	return vec3(xz.x, sqrt(max(1.0 - dot(xz, xz), 0.0)), xz.y);
 }
 
 vec3 fog(vec3 c, float dist, float height)
@@ -171,10 +111,7 @@ void main(void)
 
 	vec2 uv = fragment.texcoord * mapscale;
 	float height = texture(heightmap, uv).r;
-	vec3 normal = texture(normalmap, uv).rgb;
-	normal = (normal * 2.0) - 1.0;
-
-	float slope = 1.0 - normal.y;
+	vec3 normal = terrain_normal(uv);
 
 	vec3 detail = texture(detailmap, fragment.texcoord*0.01).rgb;
 	detail  = (detail * 2.0) - 1.0;
@@ -189,11 +126,11 @@ void main(void)
 		texture(snowmap, 0.05*fragment.texcoord).rgb
 	);
 
-	float strata = warpfbm(0.05 * fragment.position.xz);
+	vec2 splat = texture(splatmap, uv).rg;
 
-	vec3 color = mix(mat.grass, mat.snow, smoothstep(0.55, 0.6, height + (0.3*strata)));
+	vec3 color = mix(mat.grass, mat.snow, splat.r);
 	vec3 rocks = mix(mat.dirt, mat.stone, smoothstep(0.2, 0.3, height));
-	color = mix(color, rocks, smoothstep(0.4, 0.55, slope - (0.5*strata)));
+	color = mix(color, rocks, splat.g);
 
 	float diffuse = max(0.0, dot(normal, lightdirection));
 	float shadow = 1.0;
@@ -1,8 +1,96 @@
 #version 430 core
 
-layout(location = 0) in vec3 position;
+// geometry clipmap without vertex buffers
+// every instance is a level of grid x grid quads centered on the camera, every quad is six vertices
+// quads covered by the next finer level are collapsed so the levels form nested rings
+
+layout(binding = 0) uniform sampler2D heightmap;
+
+uniform mat4 VIEW_PROJECT;
+uniform vec3 camerapos;
+uniform float amplitude;
+uniform float mapscale;
+uniform float spacing; // quad size of the finest level
+uniform int grid; // quads per side of a level, multiple of 4
+
+out VERTEX {
+	vec3 position;
+	vec2 texcoord;
+	float zclipspace;
+} vertex;
+
+// the depth pre-pass uses this shader in another program, its depth has to match exactly for GL_EQUAL
+invariant gl_Position;
+
+const ivec2 CORNERS[6] = ivec2[6](
+	ivec2(0, 0), ivec2(0, 1), ivec2(1, 1),
+	ivec2(0, 0), ivec2(1, 1), ivec2(1, 0)
+);
+
+// the level is snapped to twice its quad size so it lines up with the vertices of the next coarser level
+vec2 level_origin(float size)
+{
+	return floor(camerapos.xz / (2.0 * size)) * (2.0 * size) - 0.5 * float(grid) * size;
+}
+
+// quads are visited in square rings from the center of the level outwards, so the quads closest to the camera are drawn first
+// ring k starts at quad 4k^2 and has 8k+4 quads, its side is 2k+2
+ivec2 spiral_cell(int quad)
+{
+	int ring = int(floor(sqrt(float(quad)))) / 2;
+	int offset = quad - 4 * ring * ring;
+	int side = 2 * ring + 2;
+
+	ivec2 cell;
+	if (offset < side) {
+		cell = ivec2(offset, 0);
+	} else if (offset < 2 * side - 2) {
+		cell = ivec2(side - 1, offset - side + 1);
+	} else if (offset < 3 * side - 2) {
+		cell = ivec2(3 * side - 3 - offset, side - 1);
+	} else {
+		cell = ivec2(0, 4 * side - 4 - offset);
+	}
+
+	return cell + (grid / 2 - ring - 1);
+}
 
 void main(void)
 {
-	gl_Position = vec4(position, 1.0);
+	const int level = gl_InstanceID;
+	const int quad = gl_VertexID / 6;
+	const ivec2 cell = spiral_cell(quad);
+	const ivec2 node = cell + CORNERS[gl_VertexID % 6];
+
+	float size = spacing * exp2(float(level));
+	vec2 origin = level_origin(size);
+
+	// the hole of a ring falls exactly on its quads since the finer level is snapped to this quad size
+	if (level > 0) {
+		vec2 inner = level_origin(0.5 * size);
+		vec2 corner = origin + vec2(cell) * size;
+		float extent = 0.5 * float(grid) * size;
+		if (all(greaterThanEqual(corner, inner)) && all(lessThanEqual(corner + size, inner + extent))) {
+			gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+			return;
+		}
+	}
+
+	// odd vertices slide onto their even neighbour towards the border of the level
+	// so the outer edge matches the coarser level and there are no cracks or popping
+	vec2 center = origin + 0.5 * float(grid) * size;
+	vec2 pos = origin + vec2(node) * size;
+	vec2 offset = abs(pos - center) / (0.5 * float(grid) * size);
+	float morph = smoothstep(0.7, 0.95, max(offset.x, offset.y));
+	pos -= vec2(node & 1) * size * morph;
+
+	float height = texture(heightmap, clamp(mapscale * pos, 0.0, 1.0)).r;
+	vec4 position = vec4(pos.x, amplitude * height, pos.y, 1.0);
+
+	vertex.position = position.xyz;
+	vertex.texcoord = position.xz;
+
+	gl_Position = VIEW_PROJECT * position;
+
+	vertex.zclipspace = gl_Position.z;
 }
@@ -0,0 +1,62 @@
+#version 430 core
+
+layout(binding = 0) uniform sampler2D heightmap;
+layout(binding = 2) uniform sampler2D occlusmap;
+
+uniform bool bake; // writes unlit color and normals for the impostor atlas
+uniform float mapscale;
+uniform vec3 camerapos;
+uniform vec3 fogcolor;
+uniform float fogfactor;
+
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec4 bakednormal;
+
+in VERTEX {
+	vec3 position;
+	vec3 normal;
+	vec2 texcoord;
+	vec3 root;
+} fragment;
+
+vec3 fog(vec3 c, float dist, float height)
+{
+	float de = fogfactor * smoothstep(0.0, 3.3, 1.0 - height);
+	float di = fogfactor * smoothstep(0.0, 5.5, 1.0 - height);
+	float extinction = exp(-dist * de);
+	float inscattering = exp(-dist * di);
+
+	return c * extinction + fogcolor * (1.0 - inscattering);
+}
+
+void main(void)
+{
+	const vec3 lightdirection = vec3(0.5, 0.5, 0.5);
+	const vec3 ambient = vec3(0.5, 0.5, 0.5);
+	const vec3 lightcolor = vec3(1.0, 1.0, 1.0);
+	const vec3 bark = vec3(0.3, 0.22, 0.15);
+	const vec3 leaves = vec3(0.13, 0.26, 0.1);
+
+	// texcoord.x selects bark or leaves, texcoord.y darkens the inner parts of the tree
+	vec3 albedo = mix(bark, leaves, fragment.texcoord.x) * mix(0.6, 1.0, fragment.texcoord.y);
+	vec3 normal = normalize(fragment.normal);
+
+	if (bake) {
+		color = vec4(albedo, 1.0);
+		bakednormal = vec4(0.5 * normal + 0.5, 1.0);
+		return;
+	}
+
+	float diffuse = clamp(dot(normal, lightdirection), 0.2, 1.0);
+	vec3 scatteredlight = ambient + lightcolor * diffuse;
+	color.rgb = min(albedo * scatteredlight, vec3(1.0));
+	color.rgb *= texture(occlusmap, mapscale * fragment.root.xz).r;
+	color.a = 1.0;
+
+	float height = texture(heightmap, mapscale * fragment.position.xz).r;
+	color.rgb = fog(color.rgb, distance(fragment.position, camerapos), height);
+
+	float gamma = 1.5;
+	color.rgb = pow(color.rgb, vec3(1.0/gamma));
+	bakednormal = vec4(0.0);
+}
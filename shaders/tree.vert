@@ -0,0 +1,69 @@
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : enable
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 texcoord;
+layout(location = 5) in vec4 instance; // xyz = root, w = scale
+
+uniform mat4 VIEW_PROJECT;
+uniform vec3 camerapos;
+uniform bool bake; // a single tree without draw data
+
+#ifdef GL_ARB_shader_draw_parameters
+#define DRAW_ID gl_DrawIDARB
+#else
+uniform int drawid; // the draws are submitted one by one
+#define DRAW_ID drawid
+#endif
+
+// one per draw, a draw is a cell of the forest
+struct forestdraw {
+	vec2 band; // squared distances from the camera of the trees this draw keeps
+	uint layers[2];
+	uvec2 handles[2];
+};
+
+layout(std430, binding = 3) readonly buffer DrawData {
+	forestdraw draws[];
+};
+
+out VERTEX {
+	vec3 position;
+	vec3 normal;
+	vec2 texcoord;
+	vec3 root;
+} vertex;
+
+// random rotation around the y axis, has to match the impostor shader
+mat3 tree_rotation(vec3 root)
+{
+	float angle = 6.2831853 * fract(sin(dot(root.xz, vec2(12.9898, 78.233))) * 43758.5453);
+	float c = cos(angle);
+	float s = sin(angle);
+
+	return mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+}
+
+void main(void)
+{
+	if (bake == false) {
+		vec3 offset = instance.xyz - camerapos;
+		float distance2 = dot(offset, offset);
+		vec2 band = draws[DRAW_ID].band;
+		if (distance2 < band.x || distance2 >= band.y) {
+			gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // outside the clip volume
+			return;
+		}
+	}
+
+	mat3 rotation = tree_rotation(instance.xyz);
+	vec3 worldpos = instance.xyz + rotation * (instance.w * position);
+
+	vertex.position = worldpos;
+	vertex.normal = rotation * normal;
+	vertex.texcoord = texcoord;
+	vertex.root = instance.xyz;
+
+	gl_Position = VIEW_PROJECT * vec4(worldpos, 1.0);
+}
@@ -0,0 +1,38 @@
+#version 430 core
+
+// bilinear upscale with contrast adaptive sharpening
+// the neighbours are a source texel apart, the sharpening is weaker where the contrast is already high so edges do not ring
+layout(binding = 0) uniform sampler2D scene;
+
+uniform vec2 extent;
+uniform vec2 texelsize;
+uniform float sharpness;
+
+in vec2 texcoord;
+
+out vec4 fcolor;
+
+vec3 fetch(vec2 uv)
+{
+	// the texels outside the drawn part of the target are stale
+	return texture(scene, clamp(uv, 0.5 * texelsize, extent - 0.5 * texelsize)).rgb;
+}
+
+void main(void)
+{
+	vec3 center = fetch(texcoord);
+	vec3 north = fetch(texcoord + vec2(0.0, texelsize.y));
+	vec3 south = fetch(texcoord - vec2(0.0, texelsize.y));
+	vec3 east = fetch(texcoord + vec2(texelsize.x, 0.0));
+	vec3 west = fetch(texcoord - vec2(texelsize.x, 0.0));
+
+	vec3 lo = min(center, min(min(north, south), min(east, west)));
+	vec3 hi = max(center, max(max(north, south), max(east, west)));
+
+	vec3 headroom = min(lo, 1.0 - hi) / max(hi, vec3(0.0001));
+	vec3 amount = sharpness * sqrt(clamp(headroom, 0.0, 1.0));
+
+	vec3 sharpened = center + amount * (center - 0.25 * (north + south + east + west));
+
+	fcolor = vec4(clamp(sharpened, lo, hi), 1.0);
+}
@@ -0,0 +1,14 @@
+#version 430 core
+
+uniform vec2 extent; // part of the render target the scene was drawn in
+
+out vec2 texcoord;
+
+// a triangle that covers the screen, without a vertex buffer
+void main(void)
+{
+	vec2 corner = vec2(float((gl_VertexID & 1) << 2), float((gl_VertexID & 2) << 1)) - 1.0;
+	texcoord = (0.5 * corner + 0.5) * extent;
+
+	gl_Position = vec4(corner, 0.0, 1.0);
+}
@@ -1,12 +1,14 @@
 #version 430 core
 
 layout(binding = 0) uniform samplerCube cubemap;
+layout(binding = 2) uniform sampler2D wavenormals;
 layout(binding = 4) uniform sampler2D normalmap;
 
 uniform vec3 camerapos;
 uniform vec3 fogcolor;
 uniform float fogfactor;
 uniform float time;
+uniform float wavescale;
 
 out vec4 fcolor;
 
@@ -16,29 +18,32 @@ in TESSEVAL {
 	vec3 incident;
 } fragment;
 
-void main(void)
+vec3 fog(vec3 c, float dist)
 {
-	const vec3 lightdirection = vec3(0.5, 0.5, 0.5);
-	const vec3 ambient = vec3(0.5, 0.5, 0.5);
-	const vec3 lightcolor = vec3(1.0, 1.0, 1.0);
+	float extinction = exp(-dist * fogfactor);
+
+	return mix(fogcolor, c, extinction);
+}
 
+void main(void)
+{
 	vec2 D1 = vec2(0.5, 0.5) * (0.1*time);
 	vec2 D2 = vec2(-0.5, -0.5) * (0.1*time);
 
-	vec3 normal = texture(normalmap, 0.01*fragment.texcoord + D1).rgb;
-	normal += texture(normalmap, 0.01*fragment.texcoord + D2).rgb;
+	// small ripples from the normal map on top of the waves
+	vec3 ripple = texture(normalmap, 0.01*fragment.texcoord + D1).rgb;
+	ripple += texture(normalmap, 0.01*fragment.texcoord + D2).rgb;
+	ripple = (ripple * 2.0) - 1.0;
+	ripple = vec3(ripple.x, ripple.z, ripple.y);
 
-	normal = (normal * 2.0) - 1.0;
-	float normaly = normal.y;
-	normal.y = normal.z;
-	normal.z = normaly;
-	normal = normalize(normal);
+	vec3 normal = texture(wavenormals, wavescale * fragment.texcoord).xyz;
+	normal = normalize(normal + 0.25 * vec3(ripple.x, 0.0, ripple.z));
 
 	const float eta = 0.33;
 	vec3 incident = normalize(fragment.incident);
 
-	vec3 reflection = reflect(incident, vec3(0.0, 1.0, 0.0) * normal);
-	vec3 refraction = refract(incident, vec3(0.0, 1.0, 0.0) * normal, eta);
+	vec3 reflection = reflect(incident, normal);
+	vec3 refraction = refract(incident, normal, eta);
 
 	vec4 reflectionColor = texture(cubemap, reflection);
 	vec4 refractionColor = texture(cubemap, -refraction);
@@ -47,6 +52,6 @@ void main(void)
 
 	fcolor = mix(refractionColor, reflectionColor, fresnel);
 	fcolor.rgb *= vec3(0.9, 0.95, 1.0) * 0.7;
+	fcolor.rgb = fog(fcolor.rgb, length(fragment.incident));
 	fcolor.a = 0.95;
 }
-
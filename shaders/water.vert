@@ -0,0 +1,8 @@
+#version 430 core
+
+layout(location = 0) in vec3 position;
+
+void main(void)
+{
+	gl_Position = vec4(position, 1.0);
+}
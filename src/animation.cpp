@@ -0,0 +1,251 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "animation.h"
+
+glm::vec4 axis_angle(glm::vec3 axis, float angle)
+{
+	const float s = sinf(0.5f * angle);
+
+	return glm::vec4(axis.x * s, axis.y * s, axis.z * s, cosf(0.5f * angle));
+}
+
+glm::mat4 pose_matrix(const struct jointpose *pose)
+{
+	const glm::vec4 &q = pose->rotation;
+	const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+	return glm::mat4(
+		glm::vec4(1.f - 2.f * (yy + zz), 2.f * (xy + wz), 2.f * (xz - wy), 0.f),
+		glm::vec4(2.f * (xy - wz), 1.f - 2.f * (xx + zz), 2.f * (yz + wx), 0.f),
+		glm::vec4(2.f * (xz + wy), 2.f * (yz - wx), 1.f - 2.f * (xx + yy), 0.f),
+		glm::vec4(pose->translation.x, pose->translation.y, pose->translation.z, 1.f)
+	);
+}
+
+// the bind pose only has rigid transforms so the inverse is the transpose of the rotation and the negated translation
+void compute_inverse_bind(struct skeleton *skel)
+{
+	const size_t joints = skel->parents.size();
+	std::vector<glm::mat4> model(joints);
+
+	skel->inversebind.resize(joints);
+	for (size_t i = 0; i < joints; i++) {
+		const glm::mat4 local = pose_matrix(&skel->bindpose[i]);
+		model[i] = (skel->parents[i] < 0) ? local : model[skel->parents[i]] * local;
+
+		glm::mat4 inverse = glm::mat4(1.f);
+		for (int c = 0; c < 3; c++) {
+			for (int r = 0; r < 3; r++) { inverse[c][r] = model[i][r][c]; }
+		}
+		const glm::vec3 t = glm::vec3(model[i][3]);
+		for (int r = 0; r < 3; r++) {
+			inverse[3][r] = -(inverse[0][r] * t.x + inverse[1][r] * t.y + inverse[2][r] * t.z);
+		}
+		skel->inversebind[i] = inverse;
+	}
+}
+
+// blends the two frames around the time, the clip loops
+void sample_animation(const struct animation *anim, size_t joints, float time, struct jointpose *out)
+{
+	const float position = fmodf(time * anim->framerate, float(anim->framecount));
+	const unsigned int frame = std::min((unsigned int)(position), anim->framecount - 1);
+	const unsigned int next = (frame + 1) % anim->framecount;
+
+	blend_poses(&anim->frames[frame * joints], &anim->frames[next * joints], position - frame, joints, out);
+}
+
+#ifdef __SSE2__
+static inline __m128 dot4(__m128 a, __m128 b)
+{
+	__m128 product = _mm_mul_ps(a, b);
+	__m128 shuffled = _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(product, shuffled);
+	shuffled = _mm_shuffle_ps(sums, sums, _MM_SHUFFLE(1, 0, 3, 2));
+
+	return _mm_add_ps(sums, shuffled);
+}
+
+// normalized lerp of the rotations along the shortest path and lerp of the translations
+void blend_poses(const struct jointpose *a, const struct jointpose *b, float weight, size_t joints, struct jointpose *out)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 t = _mm_set1_ps(weight);
+	const __m128 s = _mm_set1_ps(1.f - weight);
+
+	for (size_t i = 0; i < joints; i++) {
+		const __m128 qa = _mm_loadu_ps(&a[i].rotation.x);
+		__m128 qb = _mm_loadu_ps(&b[i].rotation.x);
+		// flip the second quaternion to the hemisphere of the first
+		const __m128 negative = _mm_cmplt_ps(dot4(qa, qb), zero);
+		qb = _mm_xor_ps(qb, _mm_and_ps(negative, _mm_set1_ps(-0.f)));
+
+		__m128 q = _mm_add_ps(_mm_mul_ps(qa, s), _mm_mul_ps(qb, t));
+		q = _mm_div_ps(q, _mm_sqrt_ps(dot4(q, q)));
+		_mm_storeu_ps(&out[i].rotation.x, q);
+
+		const __m128 ta = _mm_loadu_ps(&a[i].translation.x);
+		const __m128 tb = _mm_loadu_ps(&b[i].translation.x);
+		_mm_storeu_ps(&out[i].translation.x, _mm_add_ps(_mm_mul_ps(ta, s), _mm_mul_ps(tb, t)));
+	}
+}
+
+// column major 4x4 product, each column of the result is a sum of the columns of a
+static inline void multiply_matrix(const float *a, const float *b, float *out)
+{
+	const __m128 c0 = _mm_loadu_ps(a);
+	const __m128 c1 = _mm_loadu_ps(a + 4);
+	const __m128 c2 = _mm_loadu_ps(a + 8);
+	const __m128 c3 = _mm_loadu_ps(a + 12);
+
+	for (int i = 0; i < 4; i++) {
+		const float *column = b + 4 * i;
+		__m128 r = _mm_mul_ps(c0, _mm_set1_ps(column[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(column[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(column[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(column[3])));
+		_mm_storeu_ps(out + 4 * i, r);
+	}
+}
+#else
+void blend_poses(const struct jointpose *a, const struct jointpose *b, float weight, size_t joints, struct jointpose *out)
+{
+	for (size_t i = 0; i < joints; i++) {
+		const glm::vec4 qa = a[i].rotation;
+		glm::vec4 qb = b[i].rotation;
+		if (glm::dot(qa, qb) < 0.f) { qb = -qb; }
+		out[i].rotation = glm::normalize(qa * (1.f - weight) + qb * weight);
+		out[i].translation = a[i].translation * (1.f - weight) + b[i].translation * weight;
+	}
+}
+
+static inline void multiply_matrix(const float *a, const float *b, float *out)
+{
+	for (int i = 0; i < 4; i++) {
+		for (int r = 0; r < 4; r++) {
+			out[4*i+r] = a[r] * b[4*i] + a[4+r] * b[4*i+1] + a[8+r] * b[4*i+2] + a[12+r] * b[4*i+3];
+		}
+	}
+}
+#endif
+
+// concatenates the local poses down the hierarchy in one pass and writes the model * inverse bind matrices
+// out can point into write combined memory, it is only written to in order
+void skinning_matrices(const struct skeleton *skel, const struct jointpose *local, glm::mat4 *scratch, float *out)
+{
+	const size_t joints = skel->parents.size();
+
+	for (size_t i = 0; i < joints; i++) {
+		const glm::mat4 matrix = pose_matrix(&local[i]);
+		const int parent = skel->parents[i];
+		if (parent < 0) {
+			scratch[i] = matrix;
+		} else {
+			multiply_matrix(&scratch[parent][0][0], &matrix[0][0], &scratch[i][0][0]);
+		}
+		multiply_matrix(&scratch[i][0][0], &skel->inversebind[i][0][0], out + 16 * i);
+	}
+}
+
+// about 1.75 high standing on the origin and facing the z axis
+struct skeleton humanoid_skeleton(void)
+{
+	struct skeleton skel;
+
+	skel.parents = { -1, JOINT_HIPS, JOINT_SPINE, JOINT_SPINE, JOINT_UPPERARM_L, JOINT_SPINE, JOINT_UPPERARM_R, JOINT_HIPS, JOINT_THIGH_L, JOINT_HIPS, JOINT_THIGH_R };
+
+	const glm::vec3 offsets[HUMANOID_JOINTS] = {
+		glm::vec3(0.f, 1.f, 0.f), // hips
+		glm::vec3(0.f, 0.15f, 0.f), // spine
+		glm::vec3(0.f, 0.5f, 0.f), // head
+		glm::vec3(0.22f, 0.4f, 0.f), // left arm
+		glm::vec3(0.f, -0.3f, 0.f),
+		glm::vec3(-0.22f, 0.4f, 0.f), // right arm
+		glm::vec3(0.f, -0.3f, 0.f),
+		glm::vec3(0.1f, -0.05f, 0.f), // left leg
+		glm::vec3(0.f, -0.45f, 0.f),
+		glm::vec3(-0.1f, -0.05f, 0.f), // right leg
+		glm::vec3(0.f, -0.45f, 0.f)
+	};
+
+	for (int i = 0; i < HUMANOID_JOINTS; i++) {
+		struct jointpose pose = { glm::vec4(0.f, 0.f, 0.f, 1.f), glm::vec4(offsets[i], 0.f) };
+		skel.bindpose.push_back(pose);
+	}
+
+	compute_inverse_bind(&skel);
+
+	return skel;
+}
+
+static void rotate_joint(struct jointpose *pose, glm::vec3 axis, float angle)
+{
+	pose->rotation = axis_angle(axis, angle);
+}
+
+// one step with each foot per second
+struct animation humanoid_walk(const struct skeleton *skel)
+{
+	struct animation anim = { 30.f, 30 };
+	const glm::vec3 X = glm::vec3(1.f, 0.f, 0.f);
+	const glm::vec3 Y = glm::vec3(0.f, 1.f, 0.f);
+
+	for (unsigned int frame = 0; frame < anim.framecount; frame++) {
+		const float p = 2.f * float(M_PI) * frame / anim.framecount;
+		std::vector<struct jointpose> pose = skel->bindpose;
+
+		pose[JOINT_HIPS].translation.y += 0.03f * cosf(2.f * p);
+		rotate_joint(&pose[JOINT_HIPS], Y, 0.1f * sinf(p));
+		rotate_joint(&pose[JOINT_SPINE], Y, -0.15f * sinf(p));
+		rotate_joint(&pose[JOINT_THIGH_L], X, 0.5f * sinf(p));
+		rotate_joint(&pose[JOINT_THIGH_R], X, -0.5f * sinf(p));
+		rotate_joint(&pose[JOINT_SHIN_L], X, std::max(0.f, 0.8f * sinf(p + 1.2f)));
+		rotate_joint(&pose[JOINT_SHIN_R], X, std::max(0.f, 0.8f * sinf(p + float(M_PI) + 1.2f)));
+		rotate_joint(&pose[JOINT_UPPERARM_L], X, -0.4f * sinf(p));
+		rotate_joint(&pose[JOINT_UPPERARM_R], X, 0.4f * sinf(p));
+		rotate_joint(&pose[JOINT_LOWERARM_L], X, -0.3f - 0.2f * std::max(0.f, -sinf(p)));
+		rotate_joint(&pose[JOINT_LOWERARM_R], X, -0.3f - 0.2f * std::max(0.f, sinf(p)));
+
+		anim.frames.insert(anim.frames.end(), pose.begin(), pose.end());
+	}
+
+	return anim;
+}
+
+// breathing and a bit of sway over three seconds
+struct animation humanoid_idle(const struct skeleton *skel)
+{
+	struct animation anim = { 30.f, 90 };
+	const glm::vec3 X = glm::vec3(1.f, 0.f, 0.f);
+	const glm::vec3 Z = glm::vec3(0.f, 0.f, 1.f);
+
+	for (unsigned int frame = 0; frame < anim.framecount; frame++) {
+		const float p = 2.f * float(M_PI) * frame / anim.framecount;
+		std::vector<struct jointpose> pose = skel->bindpose;
+
+		pose[JOINT_HIPS].translation.y += 0.01f * sinf(p);
+		rotate_joint(&pose[JOINT_HIPS], Z, 0.02f * sinf(p));
+		rotate_joint(&pose[JOINT_SPINE], X, 0.03f * sinf(p));
+		rotate_joint(&pose[JOINT_HEAD], X, -0.05f * sinf(p + 1.f));
+		rotate_joint(&pose[JOINT_UPPERARM_L], Z, 0.08f + 0.03f * sinf(p));
+		rotate_joint(&pose[JOINT_UPPERARM_R], Z, -0.08f - 0.03f * sinf(p));
+		rotate_joint(&pose[JOINT_LOWERARM_L], X, -0.15f);
+		rotate_joint(&pose[JOINT_LOWERARM_R], X, -0.15f);
+
+		anim.frames.insert(anim.frames.end(), pose.begin(), pose.end());
+	}
+
+	return anim;
+}
@@ -0,0 +1,53 @@
+// local transform of a joint relative to its parent, 16 byte aligned so poses can be blended with SIMD
+struct jointpose {
+	glm::vec4 rotation; // quaternion x y z w
+	glm::vec4 translation; // w is unused
+};
+
+// the joints are sorted so a parent always comes before its children
+struct skeleton {
+	std::vector<int> parents; // -1 for the root
+	std::vector<struct jointpose> bindpose;
+	std::vector<glm::mat4> inversebind; // model space to joint space in the bind pose
+};
+
+// looping clip sampled at a fixed rate
+struct animation {
+	float framerate;
+	unsigned int framecount;
+	std::vector<struct jointpose> frames; // framecount * joint count
+};
+
+// joints of the procedural humanoid
+enum {
+	JOINT_HIPS,
+	JOINT_SPINE,
+	JOINT_HEAD,
+	JOINT_UPPERARM_L,
+	JOINT_LOWERARM_L,
+	JOINT_UPPERARM_R,
+	JOINT_LOWERARM_R,
+	JOINT_THIGH_L,
+	JOINT_SHIN_L,
+	JOINT_THIGH_R,
+	JOINT_SHIN_R,
+	HUMANOID_JOINTS
+};
+
+glm::vec4 axis_angle(glm::vec3 axis, float angle);
+
+glm::mat4 pose_matrix(const struct jointpose *pose);
+
+void compute_inverse_bind(struct skeleton *skel);
+
+void sample_animation(const struct animation *anim, size_t joints, float time, struct jointpose *out);
+
+void blend_poses(const struct jointpose *a, const struct jointpose *b, float weight, size_t joints, struct jointpose *out);
+
+void skinning_matrices(const struct skeleton *skel, const struct jointpose *local, glm::mat4 *scratch, float *out);
+
+struct skeleton humanoid_skeleton(void);
+
+struct animation humanoid_walk(const struct skeleton *skel);
+
+struct animation humanoid_idle(const struct skeleton *skel);
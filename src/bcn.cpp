@@ -0,0 +1,333 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <glm/glm.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+#include "parallel.h"
+#include "imp.h"
+#include "bcn.h"
+
+enum { BLOCK_TEXELS = 16 };
+
+size_t block_size(enum blockformat format)
+{
+	switch (format) {
+	case BLOCK_BC1: return 8;
+	case BLOCK_BC3: return 16;
+	case BLOCK_BC4: return 8;
+	case BLOCK_BC5: return 16;
+	}
+
+	return 0;
+}
+
+// copies one channel of a 4x4 block, clamped to the image
+static void fetch_block(const struct rawimage *image, size_t bx, size_t by, unsigned int channel, uint8_t *texels)
+{
+	for (size_t y = 0; y < 4; y++) {
+		const size_t row = std::min(by * 4 + y, image->height - 1);
+		for (size_t x = 0; x < 4; x++) {
+			const size_t col = std::min(bx * 4 + x, image->width - 1);
+			texels[y * 4 + x] = image->data[(row * image->width + col) * image->nchannels + channel];
+		}
+	}
+}
+
+// palette index of each texel for the 8 value mode, endpoints are max and min
+// the palette is max, min, then six steps from max to min
+#ifdef __SSE2__
+static void BC4_indices(const uint8_t *texels, uint8_t lo, uint8_t hi, uint8_t *indices)
+{
+	const int range = hi - lo;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bytes = _mm_loadu_si128((const __m128i*)texels);
+	const __m128i base = _mm_set1_epi16(lo);
+	const __m128i fourteen = _mm_set1_epi16(14);
+
+	// the step of a texel is the number of thresholds it reaches, which rounds (v - lo) * 7 / range
+	__m128i d0 = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(bytes, zero), base), fourteen);
+	__m128i d1 = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(bytes, zero), base), fourteen);
+	__m128i t0 = zero;
+	__m128i t1 = zero;
+	for (int k = 1; k < 8; k++) {
+		const __m128i threshold = _mm_set1_epi16(range * (2 * k - 1) - 1);
+		t0 = _mm_sub_epi16(t0, _mm_cmpgt_epi16(d0, threshold));
+		t1 = _mm_sub_epi16(t1, _mm_cmpgt_epi16(d1, threshold));
+	}
+
+	// step 7 is index 0, step 0 is index 1, the rest count down from 7
+	const __m128i seven = _mm_set1_epi16(7);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i two = _mm_set1_epi16(2);
+	t0 = _mm_and_si128(_mm_sub_epi16(_mm_set1_epi16(8), t0), seven);
+	t1 = _mm_and_si128(_mm_sub_epi16(_mm_set1_epi16(8), t1), seven);
+	t0 = _mm_xor_si128(t0, _mm_and_si128(_mm_cmplt_epi16(t0, two), one));
+	t1 = _mm_xor_si128(t1, _mm_and_si128(_mm_cmplt_epi16(t1, two), one));
+
+	_mm_storeu_si128((__m128i*)indices, _mm_packus_epi16(t0, t1));
+}
+#else
+static void BC4_indices(const uint8_t *texels, uint8_t lo, uint8_t hi, uint8_t *indices)
+{
+	const int range = hi - lo;
+	for (int i = 0; i < BLOCK_TEXELS; i++) {
+		const int step = ((texels[i] - lo) * 14 + range) / (2 * range);
+		const int index = (8 - step) & 7;
+		indices[i] = (index < 2) ? (index ^ 1) : index;
+	}
+}
+#endif
+
+static void encode_BC4_block(const uint8_t *texels, uint8_t *block)
+{
+	uint8_t lo = texels[0];
+	uint8_t hi = texels[0];
+	for (int i = 1; i < BLOCK_TEXELS; i++) {
+		lo = std::min(lo, texels[i]);
+		hi = std::max(hi, texels[i]);
+	}
+
+	block[0] = hi;
+	block[1] = lo;
+	if (hi == lo) {
+		memset(block + 2, 0, 6);
+		return;
+	}
+
+	uint8_t indices[BLOCK_TEXELS];
+	BC4_indices(texels, lo, hi, indices);
+
+	// 16 indices of 3 bits, first texel in the lowest bits
+	uint64_t bits = 0;
+	for (int i = 0; i < BLOCK_TEXELS; i++) {
+		bits |= uint64_t(indices[i]) << (3 * i);
+	}
+	for (int i = 0; i < 6; i++) {
+		block[2 + i] = uint8_t(bits >> (8 * i));
+	}
+}
+
+static inline uint16_t pack_565(const int *color)
+{
+	const int r = (color[0] * 31 + 127) / 255;
+	const int g = (color[1] * 63 + 127) / 255;
+	const int b = (color[2] * 31 + 127) / 255;
+
+	return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static inline void unpack_565(uint16_t packed, int *color)
+{
+	const int r = (packed >> 11) & 31;
+	const int g = (packed >> 5) & 63;
+	const int b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// endpoints are the corners of the bounding box along the main diagonal of the colors, inset by a sixteenth
+static void encode_BC1_block(const uint8_t *texels, uint8_t *block)
+{
+	int lo[3] = { 255, 255, 255 };
+	int hi[3] = { 0, 0, 0 };
+	int mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < BLOCK_TEXELS; i++) {
+		for (int c = 0; c < 3; c++) {
+			lo[c] = std::min(lo[c], int(texels[i * 3 + c]));
+			hi[c] = std::max(hi[c], int(texels[i * 3 + c]));
+			mean[c] += texels[i * 3 + c];
+		}
+	}
+
+	// the channel with the largest extent decides the direction of the others
+	int axis = 0;
+	for (int c = 1; c < 3; c++) {
+		if (hi[c] - lo[c] > hi[axis] - lo[axis]) { axis = c; }
+	}
+	for (int c = 0; c < 3; c++) {
+		if (c == axis) { continue; }
+		int covariance = 0;
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			covariance += (16 * texels[i * 3 + axis] - mean[axis]) * (16 * texels[i * 3 + c] - mean[c]);
+		}
+		if (covariance < 0) { std::swap(lo[c], hi[c]); }
+	}
+
+	int c0[3], c1[3];
+	for (int c = 0; c < 3; c++) {
+		const int inset = (hi[c] - lo[c]) / 16;
+		c0[c] = hi[c] - inset;
+		c1[c] = lo[c] + inset;
+	}
+
+	uint16_t color0 = pack_565(c0);
+	uint16_t color1 = pack_565(c1);
+	// the four color mode needs the first endpoint to be larger
+	if (color0 < color1) { std::swap(color0, color1); }
+
+	block[0] = uint8_t(color0);
+	block[1] = uint8_t(color0 >> 8);
+	block[2] = uint8_t(color1);
+	block[3] = uint8_t(color1 >> 8);
+
+	uint32_t bits = 0;
+	if (color0 != color1) {
+		int palette[4][3];
+		unpack_565(color0, palette[0]);
+		unpack_565(color1, palette[1]);
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			int best = 0;
+			int bestdistance = 1 << 30;
+			for (int p = 0; p < 4; p++) {
+				int distance = 0;
+				for (int c = 0; c < 3; c++) {
+					const int d = int(texels[i * 3 + c]) - palette[p][c];
+					distance += d * d;
+				}
+				if (distance < bestdistance) {
+					bestdistance = distance;
+					best = p;
+				}
+			}
+			bits |= uint32_t(best) << (2 * i);
+		}
+	}
+
+	for (int i = 0; i < 4; i++) {
+		block[4 + i] = uint8_t(bits >> (8 * i));
+	}
+}
+
+static bool valid_source(const struct rawimage *image, unsigned int channels)
+{
+	if (image->data == nullptr || image->format != IMAGE_U8) {
+		std::cerr << "error: block compression needs an 8 bit image\n";
+		return false;
+	}
+	if (image->nchannels < channels) {
+		std::cerr << "error: not enough channels to compress\n";
+		return false;
+	}
+
+	return true;
+}
+
+// encodes the block rows in parallel into blocks, encode writes every block of a row
+// the data of blocks keeps its capacity, so encoding an image of the same size again does not allocate
+static void encode_rows(const struct rawimage *image, enum blockformat format, struct blockimage *blocks, const std::function<void(size_t bx, size_t by, uint8_t *block)> &encode)
+{
+	blocks->format = format;
+	blocks->width = image->width;
+	blocks->height = image->height;
+
+	const size_t cols = (image->width + 3) / 4;
+	const size_t rows = (image->height + 3) / 4;
+	const size_t size = block_size(format);
+	blocks->data.resize(cols * rows * size);
+
+	parallel_for(rows, [&](size_t begin, size_t end) {
+		for (size_t by = begin; by < end; by++) {
+			for (size_t bx = 0; bx < cols; bx++) {
+				encode(bx, by, &blocks->data[(by * cols + bx) * size]);
+			}
+		}
+	});
+}
+
+static struct blockimage encode_rows(const struct rawimage *image, enum blockformat format, const std::function<void(size_t bx, size_t by, uint8_t *block)> &encode)
+{
+	struct blockimage blocks;
+	encode_rows(image, format, &blocks, encode);
+
+	return blocks;
+}
+
+struct blockimage encode_BC1(const struct rawimage *image)
+{
+	if (valid_source(image, 3) == false) { return blockimage{ BLOCK_BC1, 0, 0 }; }
+
+	return encode_rows(image, BLOCK_BC1, [&](size_t bx, size_t by, uint8_t *block) {
+		uint8_t channels[3][BLOCK_TEXELS];
+		uint8_t texels[BLOCK_TEXELS * 3];
+		for (unsigned int c = 0; c < 3; c++) { fetch_block(image, bx, by, c, channels[c]); }
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			for (int c = 0; c < 3; c++) { texels[i * 3 + c] = channels[c][i]; }
+		}
+		encode_BC1_block(texels, block);
+	});
+}
+
+struct blockimage encode_BC3(const struct rawimage *image)
+{
+	if (valid_source(image, 4) == false) { return blockimage{ BLOCK_BC3, 0, 0 }; }
+
+	return encode_rows(image, BLOCK_BC3, [&](size_t bx, size_t by, uint8_t *block) {
+		uint8_t channels[4][BLOCK_TEXELS];
+		uint8_t texels[BLOCK_TEXELS * 3];
+		for (unsigned int c = 0; c < 4; c++) { fetch_block(image, bx, by, c, channels[c]); }
+		for (int i = 0; i < BLOCK_TEXELS; i++) {
+			for (int c = 0; c < 3; c++) { texels[i * 3 + c] = channels[c][i]; }
+		}
+		encode_BC4_block(channels[3], block);
+		encode_BC1_block(texels, block + 8);
+	});
+}
+
+struct blockimage encode_BC4(const struct rawimage *image, unsigned int channel)
+{
+	struct blockimage blocks;
+	encode_BC4(image, channel, &blocks);
+
+	return blocks;
+}
+
+void encode_BC4(const struct rawimage *image, unsigned int channel, struct blockimage *blocks)
+{
+	if (valid_source(image, channel + 1) == false) {
+		*blocks = blockimage{ BLOCK_BC4, 0, 0 };
+		return;
+	}
+
+	encode_rows(image, BLOCK_BC4, blocks, [&](size_t bx, size_t by, uint8_t *block) {
+		uint8_t texels[BLOCK_TEXELS];
+		fetch_block(image, bx, by, channel, texels);
+		encode_BC4_block(texels, block);
+	});
+}
+
+struct blockimage encode_BC5(const struct rawimage *image, unsigned int red, unsigned int green)
+{
+	struct blockimage blocks;
+	encode_BC5(image, red, green, &blocks);
+
+	return blocks;
+}
+
+void encode_BC5(const struct rawimage *image, unsigned int red, unsigned int green, struct blockimage *blocks)
+{
+	if (valid_source(image, std::max(red, green) + 1) == false) {
+		*blocks = blockimage{ BLOCK_BC5, 0, 0 };
+		return;
+	}
+
+	encode_rows(image, BLOCK_BC5, blocks, [&](size_t bx, size_t by, uint8_t *block) {
+		uint8_t texels[BLOCK_TEXELS];
+		fetch_block(image, bx, by, red, texels);
+		encode_BC4_block(texels, block);
+		fetch_block(image, bx, by, green, texels);
+		encode_BC4_block(texels, block + 8);
+	});
+}
@@ -0,0 +1,31 @@
+// block compressed formats, every block covers 4x4 texels
+enum blockformat {
+	BLOCK_BC1, // RGB, 8 bytes per block
+	BLOCK_BC3, // RGB with a BC4 alpha block, 16 bytes per block
+	BLOCK_BC4, // one channel, 8 bytes per block
+	BLOCK_BC5 // two BC4 blocks, 16 bytes per block
+};
+
+struct blockimage {
+	enum blockformat format;
+	size_t width;
+	size_t height;
+	std::vector<uint8_t> data;
+};
+
+size_t block_size(enum blockformat format);
+
+// the encoders take 8 bit images, texels past the border of an image that is not a multiple of 4 repeat the edge
+struct blockimage encode_BC1(const struct rawimage *image);
+
+struct blockimage encode_BC3(const struct rawimage *image);
+
+struct blockimage encode_BC4(const struct rawimage *image, unsigned int channel);
+
+// encode into blocks and reuse the capacity of its data
+void encode_BC4(const struct rawimage *image, unsigned int channel, struct blockimage *blocks);
+
+// normal maps keep x and z, y is derived in the shader
+struct blockimage encode_BC5(const struct rawimage *image, unsigned int red, unsigned int green);
+
+void encode_BC5(const struct rawimage *image, unsigned int red, unsigned int green, struct blockimage *blocks);
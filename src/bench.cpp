@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "timer.h"
+#include "bench.h"
+
+static inline float percentile(const std::vector<float> &sorted, float p)
+{
+	const size_t index = size_t(p * float(sorted.size()-1) + 0.5f);
+
+	return sorted[std::min(index, sorted.size()-1)];
+}
+
+struct benchstats compute_benchstats(std::vector<float> samples)
+{
+	struct benchstats stats = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+	if (samples.empty()) { return stats; }
+
+	std::sort(samples.begin(), samples.end());
+
+	double sum = 0.0;
+	for (const auto &sample : samples) { sum += sample; }
+	const double mean = sum / double(samples.size());
+
+	double variance = 0.0;
+	for (const auto &sample : samples) { variance += (sample - mean) * (sample - mean); }
+	variance /= double(samples.size());
+
+	stats.min = samples.front();
+	stats.max = samples.back();
+	stats.mean = float(mean);
+	stats.median = percentile(samples, 0.5f);
+	stats.p95 = percentile(samples, 0.95f);
+	stats.p99 = percentile(samples, 0.99f);
+	stats.stddev = float(sqrt(variance));
+
+	return stats;
+}
+
+static void print_benchstats(FILE *fp, const struct benchstats *stats)
+{
+	fprintf(fp, "{ \"min\": %.4f, \"max\": %.4f, \"mean\": %.4f, \"median\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"stddev\": %.4f }", stats->min, stats->max, stats->mean, stats->median, stats->p95, stats->p99, stats->stddev);
+}
+
+Benchmark::Benchmark(const struct benchconfig *config)
+{
+	settings = { nullptr, nullptr, 0, 0.f, 0 };
+	if (config != nullptr) { settings = *config; }
+}
+
+void Benchmark::record(float frame_ms, const GPUTimer *timer)
+{
+	frametimes.push_back(frame_ms);
+	for (int pass = 0; pass < PASS_COUNT; pass++) {
+		passtimes[pass].push_back(timer->milliseconds(pass));
+	}
+}
+
+bool Benchmark::write_json(const char *fpath, const char *renderer) const
+{
+	FILE *fp = fopen(fpath, "w");
+	if (fp == nullptr) {
+		perror(fpath);
+		return false;
+	}
+
+	struct benchstats frame = compute_benchstats(frametimes);
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"renderer\": \"%s\",\n", renderer);
+	fprintf(fp, "\t\"path\": \"%s\",\n", settings.pathfile);
+	fprintf(fp, "\t\"seed\": %ld,\n", settings.seed);
+	fprintf(fp, "\t\"timestep\": %.6f,\n", settings.timestep);
+	fprintf(fp, "\t\"warmup\": %u,\n", settings.warmup);
+	fprintf(fp, "\t\"frames\": %zu,\n", frametimes.size());
+	fprintf(fp, "\t\"frame_ms\": ");
+	print_benchstats(fp, &frame);
+	fprintf(fp, ",\n\t\"passes_ms\": {\n");
+	for (int pass = 0; pass < PASS_COUNT; pass++) {
+		struct benchstats stats = compute_benchstats(passtimes[pass]);
+		fprintf(fp, "\t\t\"%s\": ", PASS_NAMES[pass]);
+		print_benchstats(fp, &stats);
+		fprintf(fp, (pass < PASS_COUNT-1) ? ",\n" : "\n");
+	}
+	fprintf(fp, "\t}\n}\n");
+
+	fclose(fp);
+
+	return true;
+}
+
+bool Benchmark::write_csv(const char *fpath) const
+{
+	FILE *fp = fopen(fpath, "w");
+	if (fp == nullptr) {
+		perror(fpath);
+		return false;
+	}
+
+	fprintf(fp, "frame,frame_ms");
+	for (int pass = 0; pass < PASS_COUNT; pass++) {
+		fprintf(fp, ",%s_ms", PASS_NAMES[pass]);
+	}
+	fprintf(fp, "\n");
+
+	for (size_t i = 0; i < frametimes.size(); i++) {
+		fprintf(fp, "%zu,%.4f", i, frametimes[i]);
+		for (int pass = 0; pass < PASS_COUNT; pass++) {
+			fprintf(fp, ",%.4f", passtimes[pass][i]);
+		}
+		fprintf(fp, "\n");
+	}
+
+	fclose(fp);
+
+	return true;
+}
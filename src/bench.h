@@ -0,0 +1,33 @@
+struct benchconfig {
+	const char *pathfile; // recorded camera path to replay
+	const char *output; // results are written to output.json and output.csv
+	long seed;
+	float timestep;
+	unsigned int warmup; // frames rendered before sampling starts
+};
+
+struct benchstats {
+	float min;
+	float max;
+	float mean;
+	float median;
+	float p95;
+	float p99;
+	float stddev;
+};
+
+// collects per frame timings of a benchmark run and writes them in machine readable form
+class Benchmark {
+public:
+	Benchmark(const struct benchconfig *config);
+	void record(float frame_ms, const GPUTimer *timer); // the timer has to hold the results of the same frame, see GPUTimer::resolve
+	bool write_json(const char *fpath, const char *renderer) const;
+	bool write_csv(const char *fpath) const;
+	size_t count(void) const { return frametimes.size(); }
+private:
+	struct benchconfig settings;
+	std::vector<float> frametimes;
+	std::vector<float> passtimes[PASS_COUNT];
+};
+
+struct benchstats compute_benchstats(std::vector<float> samples);
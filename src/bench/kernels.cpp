@@ -0,0 +1,460 @@
+// standalone micro benchmarks for the CPU generation kernels that run at startup
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "../imp.h"
+#include "../memory.h"
+#include "../bcn.h"
+#include "../dds.h"
+#include "../shader.h"
+#include "../parallel.h"
+#include "../erosion.h"
+#include "../glwrapper.h"
+#include "../camera.h"
+#include "../culling.h"
+#include "../water.h"
+#include "../animation.h"
+#include "../timer.h"
+#include "../bench.h"
+
+#define TERRAIN_SEED 333
+#define TERRAIN_FREQ 1.f
+#define CLOUD_FREQ 0.03f
+#define CLOUD_DISTANCE 0.5f
+#define WAVE_TILE 256.f
+#define CROWD_SIZE 512
+
+static const char *DDS_FILES[] = {
+	"media/textures/terrain/detailmap.dds",
+	"media/textures/terrain/grass.dds",
+	"media/textures/terrain/dirt.dds",
+	"media/textures/terrain/stone.dds",
+	"media/textures/terrain/snow.dds",
+	"media/textures/distortion.dds",
+	NULL
+};
+
+static const char *SHADER_FILES[] = {
+	"shaders/terrain.vert",
+	"shaders/terrain.frag",
+	"shaders/grass.vert",
+	"shaders/grass.geom",
+	"shaders/grass.frag",
+	"shaders/skybox.vert",
+	"shaders/skybox.frag",
+	"shaders/cloud.vert",
+	"shaders/cloud.frag",
+	"shaders/water.vert",
+	"shaders/water.tesc",
+	"shaders/water.tese",
+	"shaders/water.frag",
+	"shaders/water.comp",
+	"shaders/tree.vert",
+	"shaders/tree.frag",
+	"shaders/distant_tree.vert",
+	"shaders/distant_tree.frag",
+	"shaders/skinned.vert",
+	"shaders/skinned.frag",
+	NULL
+};
+
+struct kernelconfig {
+	std::vector<size_t> sizes; // 2D image side lengths
+	std::vector<size_t> volumes; // 3D image side lengths
+	std::vector<unsigned int> threads;
+	unsigned int warmup;
+	unsigned int repetitions;
+	const char *csvpath;
+};
+
+struct kernelresult {
+	const char *kernel;
+	size_t size;
+	unsigned int threads;
+	struct benchstats ms;
+	double samples; // samples processed per run
+	double bytes; // bytes read and written per run
+};
+
+static std::vector<size_t> parse_list(const char *arg)
+{
+	std::vector<size_t> values;
+
+	char *end = nullptr;
+	while (*arg) {
+		values.push_back(strtoul(arg, &end, 10));
+		if (*end != ',') { break; }
+		arg = end + 1;
+	}
+
+	return values;
+}
+
+// runs the kernel a few times without measuring, then collects the time of each repetition
+static struct benchstats measure(const struct kernelconfig *config, const std::function<void(void)> &kernel)
+{
+	for (unsigned int i = 0; i < config->warmup; i++) { kernel(); }
+
+	std::vector<float> samples;
+	for (unsigned int i = 0; i < config->repetitions; i++) {
+		auto start = std::chrono::steady_clock::now();
+		kernel();
+		std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		samples.push_back(elapsed.count());
+	}
+
+	return compute_benchstats(samples);
+}
+
+static void report(const struct kernelresult *result, FILE *csv)
+{
+	const double seconds = result->ms.median / 1000.0;
+	const double msamples = (seconds > 0.0) ? result->samples / seconds / 1e6 : 0.0;
+	const double mbytes = (seconds > 0.0) ? result->bytes / seconds / 1e6 : 0.0;
+
+	printf("%-22s %6zu %3u %10.3f %10.3f %8.3f %12.2f %12.2f\n", result->kernel, result->size, result->threads, result->ms.median, result->ms.mean, result->ms.stddev, msamples, mbytes);
+
+	if (csv) {
+		fprintf(csv, "%s,%zu,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", result->kernel, result->size, result->threads, result->ms.min, result->ms.median, result->ms.mean, result->ms.stddev, result->ms.max, msamples, mbytes);
+	}
+}
+
+static struct rawimage heightmap_image(float *heights, size_t size)
+{
+	terrain_image(heights, size, TERRAIN_SEED, TERRAIN_FREQ);
+
+	return quantize_image(heights, size, size, IMAGE_U16);
+}
+
+static void bench_images(const struct kernelconfig *config, size_t size, FILE *csv)
+{
+	const double pixels = double(size) * double(size);
+
+	float *heights = new float[size*size];
+	struct rawimage heightmap = heightmap_image(heights, size);
+	struct rawimage normalmap = gen_normalmap(&heightmap);
+
+	for (const auto nthreads : config->threads) {
+		set_threadcount(nthreads);
+
+		struct kernelresult terrain = { "terrain_image", size, nthreads };
+		terrain.ms = measure(config, [&]() { terrain_image(heights, size, TERRAIN_SEED, TERRAIN_FREQ); });
+		terrain.samples = pixels;
+		terrain.bytes = sizeof(float) * pixels;
+		report(&terrain, csv);
+
+		// same heights on the runtime configured noise
+		struct kernelresult fastnoise = { "terrain_image_fastnoise", size, nthreads };
+		fastnoise.ms = measure(config, [&]() { terrain_image_fastnoise(heights, size, TERRAIN_SEED, TERRAIN_FREQ); });
+		fastnoise.samples = pixels;
+		fastnoise.bytes = sizeof(float) * pixels;
+		report(&fastnoise, csv);
+
+		struct kernelresult quantize = { "quantize_image", size, nthreads };
+		quantize.ms = measure(config, [&]() {
+			struct rawimage image = quantize_image(heights, size, size, IMAGE_U16);
+			tracked_free(image.data);
+		});
+		quantize.samples = pixels;
+		quantize.bytes = (sizeof(float) + sizeof(uint16_t)) * pixels;
+		report(&quantize, csv);
+
+		struct packedimage packed;
+		struct kernelresult pack = { "pack_image", size, nthreads };
+		pack.ms = measure(config, [&]() { packed = pack_image(&heightmap); });
+		pack.samples = pixels;
+		pack.bytes = sizeof(uint16_t) * pixels + packed_size(&packed);
+		report(&pack, csv);
+		if (nthreads == config->threads.front()) {
+			printf("  packed heightmap: %.3f bytes per pixel\n", double(packed_size(&packed)) / pixels);
+		}
+
+		const struct erosionparams params = default_erosionparams(TERRAIN_SEED);
+		std::vector<float> eroded(heights, heights + size * size);
+		struct kernelresult hydraulic = { "hydraulic_erosion", size, nthreads };
+		struct erosionscratch scratch = {};
+		hydraulic.ms = measure(config, [&]() { hydraulic_erosion(eroded.data(), size, size, &params, 0, &scratch); });
+		hydraulic.samples = double(params.droplets) * params.lifetime;
+		hydraulic.bytes = sizeof(float) * pixels;
+		report(&hydraulic, csv);
+
+		struct kernelresult thermal = { "thermal_erosion", size, nthreads };
+		thermal.ms = measure(config, [&]() { thermal_erosion(eroded.data(), size, size, &params); });
+		thermal.samples = pixels * params.thermalsteps;
+		thermal.bytes = 2.0 * sizeof(float) * pixels * params.thermalsteps;
+		report(&thermal, csv);
+
+		struct kernelresult normals = { "gen_normalmap", size, nthreads };
+		normals.ms = measure(config, [&]() {
+			struct rawimage image = gen_normalmap(&heightmap);
+			tracked_free(image.data);
+		});
+		normals.samples = pixels;
+		normals.bytes = sizeof(uint16_t) * pixels + 3.0 * pixels;
+		report(&normals, csv);
+
+		struct kernelresult splat = { "gen_splatmap", size, nthreads };
+		splat.ms = measure(config, [&]() {
+			struct rawimage image = gen_splatmap(&heightmap, &normalmap, 2.f);
+			tracked_free(image.data);
+		});
+		splat.samples = pixels;
+		splat.bytes = (sizeof(uint16_t) + 3.0 + 2.0) * pixels;
+		report(&splat, csv);
+
+		// the normal map stands in for every 8 bit map, the encoders only see bytes
+		struct kernelresult bc1 = { "encode_BC1", size, nthreads };
+		bc1.ms = measure(config, [&]() { struct blockimage blocks = encode_BC1(&normalmap); });
+		bc1.samples = pixels;
+		bc1.bytes = 3.0 * pixels + 0.5 * pixels;
+		report(&bc1, csv);
+
+		struct kernelresult bc4 = { "encode_BC4", size, nthreads };
+		bc4.ms = measure(config, [&]() { struct blockimage blocks = encode_BC4(&normalmap, 1); });
+		bc4.samples = pixels;
+		bc4.bytes = 1.0 * pixels + 0.5 * pixels;
+		report(&bc4, csv);
+
+		struct kernelresult bc5 = { "encode_BC5", size, nthreads };
+		bc5.ms = measure(config, [&]() { struct blockimage blocks = encode_BC5(&normalmap, 0, 2); });
+		bc5.samples = pixels;
+		bc5.bytes = 2.0 * pixels + 1.0 * pixels;
+		report(&bc5, csv);
+
+		struct kernelresult grass = { "scatter_grass_roots", size, nthreads };
+		grass.ms = measure(config, [&]() {
+			std::vector<glm::vec2> roots = scatter_grass_roots(&heightmap, &normalmap, glm::vec2(0.f), glm::vec2(float(size)), 1.f, size * size, TERRAIN_SEED);
+		});
+		grass.samples = pixels;
+		grass.bytes = 2.0 * pixels;
+		report(&grass, csv);
+
+		struct kernelresult trees = { "scatter_trees", size, nthreads };
+		trees.ms = measure(config, [&]() {
+			std::vector<glm::vec4> roots = scatter_trees(&heightmap, &normalmap, float(size), 0.12f, 0.4f, size * size, TERRAIN_SEED);
+		});
+		trees.samples = pixels;
+		trees.bytes = 2.0 * pixels;
+		report(&trees, csv);
+	}
+
+	// these kernels are serial, the thread count does not apply to them
+	set_threadcount(1);
+
+	struct kernelresult occlusion = { "gen_occlusmap", size, 1 };
+	occlusion.ms = measure(config, [&]() {
+		struct rawimage image = gen_occlusmap(&heightmap);
+		tracked_free(image.data);
+	});
+	occlusion.samples = pixels;
+	occlusion.bytes = sizeof(uint16_t) * pixels + pixels;
+	report(&occlusion, csv);
+
+	// random access lookups with precomputed coordinates so the generator is not measured
+	std::mt19937 gen(TERRAIN_SEED);
+	std::uniform_int_distribution<int> coord(0, size-1);
+	std::vector<glm::ivec2> coords(size * size);
+	for (auto &c : coords) { c = glm::ivec2(coord(gen), coord(gen)); }
+
+	volatile float sink = 0.f;
+	struct kernelresult sample = { "sample_image", size, 1 };
+	sample.ms = measure(config, [&]() {
+		float sum = 0.f;
+		for (const auto &c : coords) { sum += sample_image(c.x, c.y, &heightmap, 0); }
+		sink = sum;
+	});
+	sample.samples = pixels;
+	sample.bytes = sizeof(uint16_t) * pixels;
+	report(&sample, csv);
+
+	struct packedimage packed = pack_image(&heightmap);
+	struct kernelresult packedsample = { "sample_packed", size, 1 };
+	packedsample.ms = measure(config, [&]() {
+		float sum = 0.f;
+		for (const auto &c : coords) { sum += sample_packed(c.x, c.y, &packed); }
+		sink = sum;
+	});
+	packedsample.samples = pixels;
+	packedsample.bytes = packed_size(&packed);
+	report(&packedsample, csv);
+
+	delete [] heights;
+	tracked_free(heightmap.data);
+	tracked_free(normalmap.data);
+}
+
+static void bench_volumes(const struct kernelconfig *config, size_t size, FILE *csv)
+{
+	const double voxels = double(size) * double(size) * double(size);
+	unsigned char *image = new unsigned char[size*size*size];
+
+	for (const auto nthreads : config->threads) {
+		set_threadcount(nthreads);
+
+		struct kernelresult billow = { "billow_3D_image", size, nthreads };
+		billow.ms = measure(config, [&]() { billow_3D_image(image, size, CLOUD_FREQ, CLOUD_DISTANCE); });
+		billow.samples = voxels;
+		billow.bytes = voxels;
+		report(&billow, csv);
+	}
+
+	delete [] image;
+}
+
+// the CPU fallback of the water compute shader, runs every frame when compute shaders are missing
+static void bench_waves(const struct kernelconfig *config, FILE *csv)
+{
+	const std::vector<struct wave> waves = gen_wave_spectrum(TERRAIN_SEED, WAVE_TILE, glm::vec2(1.f, 0.4f), MAX_WAVES);
+	const double texels = double(WAVE_RESOLUTION) * double(WAVE_RESOLUTION);
+	std::vector<float> displacement(4 * WAVE_RESOLUTION * WAVE_RESOLUTION);
+	std::vector<float> normals(4 * WAVE_RESOLUTION * WAVE_RESOLUTION);
+
+	float time = 0.f;
+	struct kernelresult field = { "gerstner_field", WAVE_RESOLUTION, 1 };
+	field.ms = measure(config, [&]() {
+		gerstner_field(waves, time, WAVE_RESOLUTION, WAVE_TILE, displacement.data(), normals.data());
+		time += 1.f / 60.f;
+	});
+	field.samples = texels * waves.size();
+	field.bytes = texels * 8.0 * sizeof(float);
+	report(&field, csv);
+}
+
+// pose sampling, blending and skinning matrices of a crowd, the CPU side of the skinned characters
+static void bench_animation(const struct kernelconfig *config, FILE *csv)
+{
+	const struct skeleton skel = humanoid_skeleton();
+	const struct animation walk = humanoid_walk(&skel);
+	const struct animation idle = humanoid_idle(&skel);
+	const size_t njoints = skel.parents.size();
+	std::vector<float> matrices(CROWD_SIZE * njoints * 16);
+
+	for (const auto nthreads : config->threads) {
+		set_threadcount(nthreads);
+
+		float time = 0.f;
+		struct kernelresult crowd = { "skinning_matrices", CROWD_SIZE, nthreads };
+		crowd.ms = measure(config, [&]() {
+			parallel_for(CROWD_SIZE, [&](size_t begin, size_t end) {
+				std::vector<struct jointpose> a(njoints), b(njoints), pose(njoints);
+				std::vector<glm::mat4> scratch(njoints);
+				for (size_t i = begin; i < end; i++) {
+					sample_animation(&walk, njoints, time + i, a.data());
+					sample_animation(&idle, njoints, time + i, b.data());
+					blend_poses(b.data(), a.data(), 0.5f, njoints, pose.data());
+					skinning_matrices(&skel, pose.data(), scratch.data(), &matrices[i * njoints * 16]);
+				}
+			});
+			time += 1.f / 60.f;
+		});
+		crowd.samples = double(CROWD_SIZE) * njoints;
+		crowd.bytes = double(matrices.size()) * sizeof(float);
+		report(&crowd, csv);
+	}
+}
+
+static void bench_files(const struct kernelconfig *config, FILE *csv)
+{
+	size_t ddsbytes = 0;
+	struct kernelresult dds = { "load_DDS", 0, 1 };
+	dds.ms = measure(config, [&]() {
+		ddsbytes = 0;
+		for (const char **fpath = DDS_FILES; *fpath != NULL; fpath++) {
+			struct DDS header;
+			unsigned char *image = load_DDS(*fpath, &header);
+			if (image == nullptr) { continue; }
+			ddsbytes += (header.mip_levels > 1) ? (header.linear_size * 2) : header.linear_size;
+			tracked_free(image);
+		}
+	});
+	dds.samples = 0.0;
+	dds.bytes = double(ddsbytes);
+	report(&dds, csv);
+
+	size_t sourcebytes = 0;
+	struct kernelresult sources = { "importshader", 0, 1 };
+	sources.ms = measure(config, [&]() {
+		sourcebytes = 0;
+		for (const char **fpath = SHADER_FILES; *fpath != NULL; fpath++) {
+			const GLchar *source = importshader(*fpath);
+			if (source == NULL) { continue; }
+			sourcebytes += strlen(source);
+			tracked_free(source);
+		}
+	});
+	sources.samples = 0.0;
+	sources.bytes = double(sourcebytes);
+	report(&sources, csv);
+}
+
+int main(int argc, char *argv[])
+{
+	struct kernelconfig config = {
+		.sizes = { 256, 1024, 4096 },
+		.volumes = { 64, 128 },
+		.threads = { 1, threadcount() },
+		.warmup = 1,
+		.repetitions = 5,
+		.csvpath = nullptr
+	};
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--sizes") == 0 && i+1 < argc) {
+			config.sizes = parse_list(argv[++i]);
+		} else if (strcmp(argv[i], "--volumes") == 0 && i+1 < argc) {
+			config.volumes = parse_list(argv[++i]);
+		} else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+			config.threads.clear();
+			for (const auto n : parse_list(argv[++i])) { config.threads.push_back(n); }
+		} else if (strcmp(argv[i], "--warmup") == 0 && i+1 < argc) {
+			config.warmup = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--reps") == 0 && i+1 < argc) {
+			config.repetitions = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--csv") == 0 && i+1 < argc) {
+			config.csvpath = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [--sizes 256,1024,...,8192] [--volumes 64,128,256] [--threads 1,2,4] [--warmup n] [--reps n] [--csv path]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (config.repetitions == 0) { config.repetitions = 1; }
+
+	FILE *csv = nullptr;
+	if (config.csvpath) {
+		csv = fopen(config.csvpath, "w");
+		if (csv == nullptr) {
+			perror(config.csvpath);
+			exit(EXIT_FAILURE);
+		}
+		fprintf(csv, "kernel,size,threads,min_ms,median_ms,mean_ms,stddev_ms,max_ms,msamples_per_s,mbytes_per_s\n");
+	}
+
+	printf("%-22s %6s %3s %10s %10s %8s %12s %12s\n", "kernel", "size", "thr", "median ms", "mean ms", "stddev", "Msamples/s", "MB/s");
+
+	for (const auto size : config.sizes) { bench_images(&config, size, csv); }
+	for (const auto size : config.volumes) { bench_volumes(&config, size, csv); }
+	bench_waves(&config, csv);
+	bench_animation(&config, csv);
+	bench_files(&config, csv);
+
+	if (csv) { fclose(csv); }
+
+	exit(EXIT_SUCCESS);
+}
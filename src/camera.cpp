@@ -1,4 +1,8 @@
+#include <cstdio>
+#include <iostream>
+#include <vector>
 #include <SDL2/SDL.h>
+#include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
@@ -6,7 +10,7 @@
 
 #include "camera.h"
 
-#define DEFAULT_SENSITIVITY 0.1f
+#define DEFAULT_SENSITIVITY 0.0017f // radians per mouse count, what it was at 60 frames per second when it was scaled by the frame time
 #define DEFAULT_SPEED 50.f
 
 Camera::Camera(glm::vec3 pos, float fov, float aspect, float near, float far) 
@@ -30,14 +34,30 @@ Camera::Camera(glm::vec3 pos, float fov, float aspect, float near, float far)
 	farclip = far;
 }
 
-void Camera::update(float delta)
+struct camerainput sample_camerainput(void)
 {
-	int x, y;
+	struct camerainput input;
 	const Uint8 *keystates = SDL_GetKeyboardState(NULL);
-	SDL_GetRelativeMouseState(&x, &y);
+	SDL_GetRelativeMouseState(&input.dx, &input.dy);
+	input.forward = keystates[SDL_SCANCODE_W];
+	input.backward = keystates[SDL_SCANCODE_S];
+	input.right = keystates[SDL_SCANCODE_D];
+	input.left = keystates[SDL_SCANCODE_A];
+
+	return input;
+}
+
+void Camera::update(float delta)
+{
+	const struct camerainput input = sample_camerainput();
+	steer(&input, delta);
+}
 
-	yaw += (float)x * sensitivity * delta;
-	pitch -= (float)y * sensitivity * delta;
+void Camera::steer(const struct camerainput *input, float delta)
+{
+	// the mouse motion is already a distance, only the movement scales with the time
+	yaw += (float)input->dx * sensitivity;
+	pitch -= (float)input->dy * sensitivity;
 
 	const float MAX_ANGLE = 1.57f;
 	const float MIN_ANGLE = -1.57f;
@@ -52,10 +72,149 @@ void Camera::update(float delta)
 
 	// move the camera in the new direction
 	const float modifier = speed * delta;
-	if (keystates[SDL_SCANCODE_W]) { eye += modifier * center; }
-	if (keystates[SDL_SCANCODE_S]) { eye -= modifier * center; }
-	if (keystates[SDL_SCANCODE_D]) { eye += modifier * glm::normalize(glm::cross(center, up)); }
-	if (keystates[SDL_SCANCODE_A]) { eye -= modifier * glm::normalize(glm::cross(center, up)); }
+	if (input->forward) { eye += modifier * center; }
+	if (input->backward) { eye -= modifier * center; }
+	if (input->right) { eye += modifier * glm::normalize(glm::cross(center, up)); }
+	if (input->left) { eye -= modifier * glm::normalize(glm::cross(center, up)); }
+
+	view = glm::lookAt(eye, eye + center, up);
+}
+
+// place the camera at a position looking in a direction, used when replaying a recorded path
+void Camera::lookat(glm::vec3 pos, glm::vec3 direction)
+{
+	eye = pos;
+	center = glm::normalize(direction);
+
+	// keep the mouse angles in sync so control can be handed back to the user
+	pitch = asin(glm::clamp(center.y, -1.f, 1.f));
+	yaw = atan2(center.z, center.x);
 
 	view = glm::lookAt(eye, eye + center, up);
 }
+
+bool CameraPath::load(const char *fpath)
+{
+	FILE *fp = fopen(fpath, "r");
+	if (fp == nullptr) {
+		perror(fpath);
+		return false;
+	}
+
+	keyframes.clear();
+
+	char line[256];
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || line[0] == '\n') { continue; }
+		struct keyframe key;
+		int n = sscanf(line, "%f %f %f %f %f %f %f", &key.time, &key.position.x, &key.position.y, &key.position.z, &key.direction.x, &key.direction.y, &key.direction.z);
+		if (n != 7) {
+			std::cerr << "error: malformed keyframe in " << fpath << ": " << line;
+			continue;
+		}
+		keyframes.push_back(key);
+	}
+
+	fclose(fp);
+
+	if (empty()) {
+		std::cerr << "error: camera path " << fpath << " needs at least 2 keyframes\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool CameraPath::save(const char *fpath) const
+{
+	FILE *fp = fopen(fpath, "w");
+	if (fp == nullptr) {
+		perror(fpath);
+		return false;
+	}
+
+	fprintf(fp, "# time x y z dirx diry dirz\n");
+	for (const auto &key : keyframes) {
+		fprintf(fp, "%.3f %.3f %.3f %.3f %.4f %.4f %.4f\n", key.time, key.position.x, key.position.y, key.position.z, key.direction.x, key.direction.y, key.direction.z);
+	}
+
+	fclose(fp);
+
+	return true;
+}
+
+void CameraPath::record(float time, const Camera *cam)
+{
+	struct keyframe key = { time, cam->eye, cam->center };
+	keyframes.push_back(key);
+}
+
+float CameraPath::duration(void) const
+{
+	if (keyframes.empty()) { return 0.f; }
+
+	return keyframes.back().time - keyframes.front().time;
+}
+
+static inline glm::vec3 catmull_rom(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t)
+{
+	const float t2 = t * t;
+	const float t3 = t2 * t;
+
+	return 0.5f * ((2.f * p1) + (p2 - p0) * t + (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * t2 + (3.f * p1 - p0 - 3.f * p2 + p3) * t3);
+}
+
+void CameraPath::sample(float time, glm::vec3 *position, glm::vec3 *direction) const
+{
+	if (empty()) { return; }
+
+	time = glm::clamp(time + keyframes.front().time, keyframes.front().time, keyframes.back().time);
+
+	// find the segment containing the time
+	size_t i = 0;
+	while (i < keyframes.size()-2 && keyframes[i+1].time < time) { i++; }
+
+	const struct keyframe &k1 = keyframes[i];
+	const struct keyframe &k2 = keyframes[i+1];
+	const struct keyframe &k0 = (i > 0) ? keyframes[i-1] : k1;
+	const struct keyframe &k3 = (i+2 < keyframes.size()) ? keyframes[i+2] : k2;
+
+	const float span = k2.time - k1.time;
+	const float t = (span > 0.f) ? (time - k1.time) / span : 0.f;
+
+	*position = catmull_rom(k0.position, k1.position, k2.position, k3.position, t);
+	*direction = glm::normalize(catmull_rom(k0.direction, k1.direction, k2.direction, k3.direction, t));
+}
+
+// Gribb-Hartmann plane extraction from the rows of the matrix
+struct frustum extract_frustum(const glm::mat4 &VIEW_PROJECT)
+{
+	struct frustum frustum;
+
+	const glm::mat4 M = glm::transpose(VIEW_PROJECT);
+	frustum.planes[0] = M[3] + M[0]; // left
+	frustum.planes[1] = M[3] - M[0]; // right
+	frustum.planes[2] = M[3] + M[1]; // bottom
+	frustum.planes[3] = M[3] - M[1]; // top
+	frustum.planes[4] = M[3] + M[2]; // near
+	frustum.planes[5] = M[3] - M[2]; // far
+
+	for (int i = 0; i < 6; i++) {
+		frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+	}
+
+	return frustum;
+}
+
+// conservative, only rejects boxes that are fully behind one of the planes
+bool AABB_in_frustum(const struct frustum *frustum, glm::vec3 min, glm::vec3 max)
+{
+	for (int i = 0; i < 6; i++) {
+		const glm::vec4 &plane = frustum->planes[i];
+		// the corner furthest along the plane normal
+		const glm::vec3 corner = glm::vec3(plane.x > 0.f ? max.x : min.x, plane.y > 0.f ? max.y : min.y, plane.z > 0.f ? max.z : min.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.f) { return false; }
+	}
+
+	return true;
+}
@@ -1,3 +1,16 @@
+// mouse motion since the last sample and the movement keys that are held
+struct camerainput {
+	int dx;
+	int dy;
+	bool forward;
+	bool backward;
+	bool left;
+	bool right;
+};
+
+// reads the SDL state, on the thread that pumps the events
+struct camerainput sample_camerainput(void);
+
 class Camera {
 public:
 	glm::vec3 center;
@@ -11,6 +24,8 @@ public:
 public:
 	Camera(glm::vec3 pos, float fov, float aspect, float near, float far);
 	void update(float delta);
+	void steer(const struct camerainput *input, float delta);
+	void lookat(glm::vec3 pos, glm::vec3 direction);
 
 private:
 	float yaw;
@@ -19,3 +34,31 @@ private:
 	float speed;
 	glm::vec3 up;
 };
+
+struct keyframe {
+	float time;
+	glm::vec3 position;
+	glm::vec3 direction;
+};
+
+// recorded camera flight, replayed with a Catmull-Rom spline through the keyframes
+class CameraPath {
+public:
+	bool load(const char *fpath);
+	bool save(const char *fpath) const;
+	void record(float time, const Camera *cam);
+	void sample(float time, glm::vec3 *position, glm::vec3 *direction) const;
+	float duration(void) const;
+	bool empty(void) const { return keyframes.size() < 2; }
+private:
+	std::vector<struct keyframe> keyframes;
+};
+
+// clip planes of a view projection, each plane is a normal pointing inside and a distance
+struct frustum {
+	glm::vec4 planes[6];
+};
+
+struct frustum extract_frustum(const glm::mat4 &VIEW_PROJECT);
+
+bool AABB_in_frustum(const struct frustum *frustum, glm::vec3 min, glm::vec3 max);
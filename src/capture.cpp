@@ -0,0 +1,196 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stbimage/stb_image_write.h"
+
+#include "memory.h"
+#include "capture.h"
+
+#define CAPTURE_CHANNELS 4 // RGBA rows are 4 byte aligned, the fast path of most drivers
+#define CAPTURE_PNG_LEVEL 4 // lower than the stb default of 8, a 1080p frame encodes about twice as fast for a slightly larger file
+
+FrameCapture::FrameCapture(const char *fprefix, enum captureformat fmt, size_t w, size_t h, unsigned int nencoders)
+{
+	prefix = fprefix;
+	format = fmt;
+	width = w;
+	height = h;
+	current = 0;
+	stopping = false;
+	ncaptured = 0;
+	nwritten = 0;
+	stallms = 0.f;
+
+	MemoryScope scope(MEMORY_RENDERER);
+
+	// a shorter ring stalls more often on the readback, with no room for a single buffer nothing is captured
+	const size_t size = width * height * CAPTURE_CHANNELS;
+	nbuffers = CAPTURE_BUFFERS;
+	while (nbuffers > 0 && memory_would_exceed(MEMORY_GPU, nbuffers * size)) { nbuffers--; }
+	if (nbuffers < CAPTURE_BUFFERS) {
+		std::cerr << "error: gpu memory budget leaves room for " << nbuffers << " of " << CAPTURE_BUFFERS << " capture buffers" << std::endl;
+	}
+
+	glGenBuffers(nbuffers, buffers);
+	for (unsigned int i = 0; i < nbuffers; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		track_buffer(buffers[i], size);
+		fences[i] = 0;
+		indices[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	// the framebuffer is bottom up, the encoders write the rows flipped
+	stbi_flip_vertically_on_write(1);
+	stbi_write_png_compression_level = CAPTURE_PNG_LEVEL;
+
+	if (nencoders == 0) { nencoders = 1; }
+	maxqueue = 2 * nencoders;
+	for (unsigned int i = 0; i < nencoders; i++) {
+		encoders.push_back(std::thread(&FrameCapture::encode, this));
+	}
+}
+
+FrameCapture::~FrameCapture(void)
+{
+	finish();
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+		changed.notify_all();
+	}
+	for (auto &encoder : encoders) { encoder.join(); }
+
+	for (unsigned int i = 0; i < nbuffers; i++) { untrack_buffer(buffers[i]); }
+	glDeleteBuffers(nbuffers, buffers);
+}
+
+// starts an asynchronous read of the framebuffer into the current buffer, the frame read into it a ring of buffers ago is handed to the encoders first
+void FrameCapture::capture(unsigned long frame)
+{
+	if (nbuffers == 0) { return; }
+
+	if (fences[current]) { readback(current); }
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[current]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	indices[current] = frame;
+	current = (current + 1) % nbuffers;
+	ncaptured++;
+}
+
+void FrameCapture::finish(void)
+{
+	// oldest first so the frames reach the encoders in order
+	for (unsigned int i = 0; i < nbuffers; i++) {
+		const unsigned int slot = (current + i) % nbuffers;
+		if (fences[slot]) { readback(slot); }
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [&](void) { return nwritten == ncaptured; });
+}
+
+// the fence was set frames ago so the wait rarely blocks, the copy out of the mapped buffer is the only cost on this thread
+void FrameCapture::readback(unsigned int slot)
+{
+	while (glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+	glDeleteSync(fences[slot]);
+	fences[slot] = 0;
+
+	struct frame f;
+	f.index = indices[slot];
+	{
+		// when the encoders fall behind the render thread waits instead of dropping frames
+		auto start = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [&](void) { return queue.size() < maxqueue; });
+		std::chrono::duration<float, std::milli> duration = std::chrono::steady_clock::now() - start;
+		stallms += duration.count();
+		if (!spares.empty()) {
+			f.pixels.swap(spares.back());
+			spares.pop_back();
+		}
+	}
+
+	const size_t size = width * height * CAPTURE_CHANNELS;
+	f.pixels.resize(size);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+	const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (mapped) {
+		memcpy(f.pixels.data(), mapped, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	} else {
+		std::cerr << "error: could not map capture buffer of frame " << f.index << std::endl;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	std::lock_guard<std::mutex> guard(lock);
+	queue.push_back(std::move(f));
+	changed.notify_all();
+}
+
+void FrameCapture::encode(void)
+{
+	while (true) {
+		struct frame f;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			changed.wait(guard, [&](void) { return !queue.empty() || stopping; });
+			if (queue.empty()) { return; }
+			f = std::move(queue.front());
+			queue.pop_front();
+			changed.notify_all();
+		}
+
+		if (write(&f) == false) {
+			std::cerr << "error: could not write captured frame " << f.index << std::endl;
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		spares.push_back(std::move(f.pixels));
+		nwritten++;
+		changed.notify_all();
+	}
+}
+
+bool FrameCapture::write(const struct frame *f) const
+{
+	char number[16];
+	snprintf(number, sizeof(number), "_%06lu", f->index);
+	const std::string fpath = prefix + number + ((format == CAPTURE_PNG) ? ".png" : ".raw");
+
+	if (format == CAPTURE_PNG) {
+		return stbi_write_png(fpath.c_str(), width, height, CAPTURE_CHANNELS, f->pixels.data(), width * CAPTURE_CHANNELS) != 0;
+	}
+
+	std::ofstream file(fpath, std::ios::binary);
+	if (!file.is_open()) { return false; }
+
+	const size_t rowsize = width * CAPTURE_CHANNELS;
+	for (size_t row = height; row-- > 0; ) {
+		file.write((const char*)&f->pixels[row * rowsize], rowsize);
+	}
+
+	return file.good();
+}
@@ -0,0 +1,48 @@
+enum captureformat {
+	CAPTURE_PNG,
+	CAPTURE_RAW // RGBA rows from the top, no header
+};
+
+// frames are read into pixel pack buffers and copied out a few frames later so the readback never stalls the pipeline
+enum { CAPTURE_BUFFERS = 3 };
+
+// captures the framebuffer into an image sequence, the images are encoded and written by a pool of threads
+class FrameCapture {
+public:
+	FrameCapture(const char *prefix, enum captureformat fmt, size_t w, size_t h, unsigned int nencoders);
+	~FrameCapture(void);
+	void capture(unsigned long frame); // after the frame is drawn and before the swap
+	void finish(void); // encodes the frames in flight and waits until all are written
+	unsigned long captured(void) const { return ncaptured; }
+	unsigned long written(void) const { return nwritten; }
+	float stalled(void) const { return stallms; } // time the render thread waited for the encoders
+private:
+	struct frame {
+		unsigned long index;
+		std::vector<unsigned char> pixels;
+	};
+	std::string prefix;
+	enum captureformat format;
+	size_t width;
+	size_t height;
+	unsigned int nbuffers; // fewer than CAPTURE_BUFFERS when the GPU budget has no room for all
+	GLuint buffers[CAPTURE_BUFFERS];
+	GLsync fences[CAPTURE_BUFFERS];
+	unsigned long indices[CAPTURE_BUFFERS];
+	unsigned int current;
+	// encoder pool, the pixel vectors go back to spares once they are written
+	std::vector<std::thread> encoders;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<struct frame> queue;
+	std::vector<std::vector<unsigned char>> spares;
+	size_t maxqueue;
+	bool stopping;
+	unsigned long ncaptured;
+	std::atomic<unsigned long> nwritten;
+	float stallms;
+private:
+	void readback(unsigned int slot);
+	void encode(void);
+	bool write(const struct frame *f) const;
+};
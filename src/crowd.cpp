@@ -0,0 +1,243 @@
+#include <iostream>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <glm/glm.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "imp.h"
+#include "bcn.h"
+#include "dds.h"
+#include "glwrapper.h"
+#include "memory.h"
+#include "parallel.h"
+#include "shader.h"
+#include "culling.h"
+#include "terrain.h"
+#include "animation.h"
+#include "crowd.h"
+
+#define CHARACTER_SCALE 1.2f
+#define WALK_SPEED 1.4f // units per second at full walk
+#define SHORE_MARGIN 0.01f // normalized height above the water characters keep to
+
+struct skinvertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texcoord;
+	GLubyte joints[4];
+	glm::vec4 weights;
+};
+
+// box rigidly attached to a joint, in the bind pose
+static void add_box(std::vector<struct skinvertex> &vertices, std::vector<GLushort> &indices, glm::vec3 center, glm::vec3 half, GLubyte joint)
+{
+	// normal and two tangents with cross(u, v) = normal so the faces wind counter clockwise
+	const glm::vec3 X = glm::vec3(1.f, 0.f, 0.f);
+	const glm::vec3 Y = glm::vec3(0.f, 1.f, 0.f);
+	const glm::vec3 Z = glm::vec3(0.f, 0.f, 1.f);
+	const glm::vec3 faces[6][3] = {
+		{ X, Y, Z }, { -X, Z, Y },
+		{ Y, Z, X }, { -Y, X, Z },
+		{ Z, X, Y }, { -Z, Y, X }
+	};
+	const float corners[4][2] = { { -1.f, -1.f }, { 1.f, -1.f }, { 1.f, 1.f }, { -1.f, 1.f } };
+
+	for (const auto &face : faces) {
+		const GLushort base = vertices.size();
+		for (const auto &corner : corners) {
+			struct skinvertex vertex;
+			vertex.position = center + half * (face[0] + corner[0] * face[1] + corner[1] * face[2]);
+			vertex.normal = face[0];
+			vertex.texcoord = glm::vec2(0.5f * corner[0] + 0.5f, 0.5f * corner[1] + 0.5f);
+			vertex.joints[0] = joint;
+			vertex.joints[1] = vertex.joints[2] = vertex.joints[3] = 0;
+			vertex.weights = glm::vec4(1.f, 0.f, 0.f, 0.f);
+			vertices.push_back(vertex);
+		}
+		indices.insert(indices.end(), { base, GLushort(base+1), GLushort(base+2), base, GLushort(base+2), GLushort(base+3) });
+	}
+}
+
+static struct mesh gen_humanoid_mesh(void)
+{
+	std::vector<struct skinvertex> vertices;
+	std::vector<GLushort> indices;
+
+	add_box(vertices, indices, glm::vec3(0.f, 1.f, 0.f), glm::vec3(0.16f, 0.08f, 0.1f), JOINT_HIPS);
+	add_box(vertices, indices, glm::vec3(0.f, 1.35f, 0.f), glm::vec3(0.18f, 0.22f, 0.11f), JOINT_SPINE);
+	add_box(vertices, indices, glm::vec3(0.f, 1.72f, 0.f), glm::vec3(0.1f, 0.11f, 0.1f), JOINT_HEAD);
+	for (int side = 0; side < 2; side++) {
+		const float x = side ? -1.f : 1.f;
+		add_box(vertices, indices, glm::vec3(x * 0.26f, 1.4f, 0.f), glm::vec3(0.05f, 0.15f, 0.05f), side ? JOINT_UPPERARM_R : JOINT_UPPERARM_L);
+		add_box(vertices, indices, glm::vec3(x * 0.26f, 1.1f, 0.f), glm::vec3(0.045f, 0.15f, 0.045f), side ? JOINT_LOWERARM_R : JOINT_LOWERARM_L);
+		add_box(vertices, indices, glm::vec3(x * 0.1f, 0.72f, 0.f), glm::vec3(0.07f, 0.23f, 0.07f), side ? JOINT_THIGH_R : JOINT_THIGH_L);
+		add_box(vertices, indices, glm::vec3(x * 0.1f, 0.28f, 0.f), glm::vec3(0.06f, 0.22f, 0.06f), side ? JOINT_SHIN_R : JOINT_SHIN_L);
+		add_box(vertices, indices, glm::vec3(x * 0.1f, 0.04f, 0.04f), glm::vec3(0.06f, 0.04f, 0.1f), side ? JOINT_SHIN_R : JOINT_SHIN_L);
+	}
+
+	struct mesh body = {
+		.VAO = 0, .VBO = 0, .EBO = 0,
+		.mode = GL_TRIANGLES,
+		.ecount = GLsizei(indices.size()),
+		.indexed = true
+	};
+
+	glGenVertexArrays(1, &body.VAO);
+	glBindVertexArray(body.VAO);
+
+	glGenBuffers(1, &body.EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, body.EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+	track_buffer(body.EBO, indices.size() * sizeof(GLushort));
+
+	glGenBuffers(1, &body.VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, body.VBO);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(struct skinvertex), vertices.data(), GL_STATIC_DRAW);
+	track_buffer(body.VBO, vertices.size() * sizeof(struct skinvertex));
+
+	const GLsizei stride = sizeof(struct skinvertex);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(offsetof(struct skinvertex, position)));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(offsetof(struct skinvertex, normal)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(offsetof(struct skinvertex, texcoord)));
+	glEnableVertexAttribArray(3);
+	glVertexAttribIPointer(3, 4, GL_UNSIGNED_BYTE, stride, BUFFER_OFFSET(offsetof(struct skinvertex, joints)));
+	glEnableVertexAttribArray(4);
+	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(offsetof(struct skinvertex, weights)));
+
+	glBindVertexArray(0);
+
+	return body;
+}
+
+Crowd::Crowd(const Terrain *terrain, float level, size_t count, unsigned int seed)
+{
+	MemoryScope scope(MEMORY_CROWD);
+
+	heightmap = &terrain->heightimage;
+	mapratio = terrain->mapratio;
+	amplitude = terrain->amplitude;
+	sidelength = terrain->sidelength;
+	sealevel = level;
+
+	skel = humanoid_skeleton();
+	walk = humanoid_walk(&skel);
+	idle = humanoid_idle(&skel);
+	body = gen_humanoid_mesh();
+
+	// spawn on dry land around the center of the map
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> map(0.35f * sidelength, 0.65f * sidelength);
+	std::uniform_real_distribution<float> angle(0.f, 2.f * float(M_PI));
+	std::uniform_real_distribution<float> turn(0.2f, 0.8f);
+	for (size_t attempt = 0; attempt < 16 * count && characters.size() < count; attempt++) {
+		struct character person;
+		person.position = glm::vec2(map(gen), map(gen));
+		person.heading = angle(gen);
+		person.phase = angle(gen);
+		person.turnrate = turn(gen);
+		person.height = groundheight(person.position);
+		if (person.height > (sealevel + SHORE_MARGIN) * amplitude) {
+			characters.push_back(person);
+		}
+	}
+
+	create_ring_TBO(&models, std::max(characters.size(), size_t(1)) * sizeof(glm::mat4), GL_RGBA32F);
+	create_ring_TBO(&joints, std::max(characters.size(), size_t(1)) * jointcount() * sizeof(glm::mat4), GL_RGBA32F);
+}
+
+Crowd::~Crowd(void)
+{
+	delete_ring_TBO(&models);
+	delete_ring_TBO(&joints);
+	delete_mesh(&body);
+}
+
+float Crowd::groundheight(glm::vec2 position) const
+{
+	return amplitude * sample_image(int(position.x / mapratio), int(position.y / mapratio), heightmap, 0);
+}
+
+// moves every character and writes its model and skinning matrices straight into the mapped texture buffers
+void Crowd::update(float time, float delta)
+{
+	if (characters.empty()) { return; }
+
+	float *modeldst = (float*)map_ring_TBO(&models);
+	float *jointdst = (float*)map_ring_TBO(&joints);
+	const size_t njoints = jointcount();
+
+	parallel_for(characters.size(), [&](size_t begin, size_t end) {
+		std::vector<struct jointpose> walkpose(njoints);
+		std::vector<struct jointpose> idlepose(njoints);
+		std::vector<struct jointpose> pose(njoints);
+		std::vector<glm::mat4> scratch(njoints);
+
+		for (size_t i = begin; i < end; i++) {
+			struct character &person = characters[i];
+
+			// wander between walking and standing still, turn around at the shore and the map border
+			const float walking = glm::clamp(2.f * sinf(0.1f * time + person.phase) + 0.5f, 0.f, 1.f);
+			person.heading += person.turnrate * sinf(0.3f * time + person.phase) * delta;
+			const glm::vec2 forward = glm::vec2(sinf(person.heading), cosf(person.heading));
+			const glm::vec2 next = person.position + forward * (walking * WALK_SPEED * delta);
+			const bool inside = next.x > 0.f && next.y > 0.f && next.x < sidelength && next.y < sidelength;
+			const float nextheight = inside ? groundheight(next) : 0.f;
+			if (inside && nextheight > (sealevel + SHORE_MARGIN) * amplitude) {
+				person.position = next;
+				// ease to the new height so the steps of the heightmap don't show
+				person.height += (nextheight - person.height) * std::min(1.f, 8.f * delta);
+			} else {
+				person.heading += float(M_PI);
+			}
+
+			const float c = cosf(person.heading) * CHARACTER_SCALE;
+			const float s = sinf(person.heading) * CHARACTER_SCALE;
+			const glm::mat4 model = glm::mat4(
+				glm::vec4(c, 0.f, -s, 0.f),
+				glm::vec4(0.f, CHARACTER_SCALE, 0.f, 0.f),
+				glm::vec4(s, 0.f, c, 0.f),
+				glm::vec4(person.position.x, person.height, person.position.y, 1.f)
+			);
+			std::copy(&model[0][0], &model[0][0] + 16, modeldst + 16 * i);
+
+			const float clock = time + person.phase;
+			sample_animation(&walk, njoints, clock, walkpose.data());
+			sample_animation(&idle, njoints, clock, idlepose.data());
+			blend_poses(idlepose.data(), walkpose.data(), walking, njoints, pose.data());
+			skinning_matrices(&skel, pose.data(), scratch.data(), jointdst + 16 * njoints * i);
+		}
+	});
+
+	unmap_ring_TBO(&models, characters.size() * sizeof(glm::mat4));
+	unmap_ring_TBO(&joints, characters.size() * njoints * sizeof(glm::mat4));
+}
+
+void Crowd::display(void)
+{
+	if (characters.empty()) { return; }
+
+	activate_texture(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+	activate_texture(GL_TEXTURE5, GL_TEXTURE_BUFFER, models.textures[models.current]);
+	activate_texture(GL_TEXTURE6, GL_TEXTURE_BUFFER, joints.textures[joints.current]);
+
+	glBindVertexArray(body.VAO);
+	glDrawElementsInstanced(body.mode, body.ecount, GL_UNSIGNED_SHORT, NULL, characters.size());
+
+	fence_ring_TBO(&models);
+	fence_ring_TBO(&joints);
+}
@@ -0,0 +1,33 @@
+struct character {
+	glm::vec2 position;
+	float heading; // angle around the y axis, 0 faces the z axis
+	float phase; // random offset of the animation and wandering
+	float turnrate;
+	float height;
+};
+
+// animated characters wandering over the terrain, all of them are drawn with a single instanced draw call
+class Crowd {
+public:
+	Crowd(const Terrain *terrain, float sealevel, size_t count, unsigned int seed);
+	~Crowd(void);
+	void update(float time, float delta);
+	void display(void);
+	size_t count(void) const { return characters.size(); }
+	unsigned int jointcount(void) const { return skel.parents.size(); }
+private:
+	std::vector<struct character> characters;
+	struct skeleton skel;
+	struct animation walk;
+	struct animation idle;
+	struct mesh body;
+	struct ringTBO models; // one model matrix per character
+	struct ringTBO joints; // jointcount skinning matrices per character
+	const struct rawimage *heightmap;
+	float mapratio;
+	float amplitude;
+	float sidelength;
+	float sealevel;
+private:
+	float groundheight(glm::vec2 position) const;
+};
@@ -0,0 +1,311 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "imp.h"
+#include "glwrapper.h"
+#include "memory.h"
+#include "shader.h"
+#include "culling.h"
+
+#define OCCLUDER_NEAR 0.01f // corners closer to the eye plane than this do not rasterize, boxes that reach it are visible
+
+static size_t level_width(int level) { return std::max(HIZ_WIDTH >> level, 1); }
+static size_t level_height(int level) { return std::max(HIZ_HEIGHT >> level, 1); }
+
+OcclusionCuller::OcclusionCuller(const struct rawimage *heightmap, float mapratio, float amplitude)
+{
+	MemoryScope scope(MEMORY_CULLING);
+
+	heights = heightmap;
+	spacing = OCCLUDER_BLOCK * mapratio;
+	scale = amplitude;
+
+	const size_t blocks = (std::max(heights->width, heights->height) - 1 + OCCLUDER_BLOCK - 1) / OCCLUDER_BLOCK;
+	corners = blocks + 1;
+	blockmin.resize(blocks * blocks);
+	cornerheights.resize(corners * corners);
+	projected.resize(corners * corners);
+	viewproject = glm::mat4(1.f);
+
+	for (int level = 0; level < HIZ_LEVELS; level++) {
+		pyramid[level].resize(level_width(level) * level_height(level), INFINITY);
+	}
+
+	const struct rect whole = { 0, 0, int(heights->width), int(heights->height) };
+	update(whole);
+
+	reduction = nullptr;
+	culling = nullptr;
+	depthFBO = depthtexture = pyramidtexture = 0;
+	if (GLEW_ARB_compute_shader == false) { return; }
+
+	struct shaderinfo reducepipeline[] = {
+		{GL_COMPUTE_SHADER, "shaders/hiz.comp"},
+		{GL_NONE, NULL}
+	};
+	reduction = new Shader { reducepipeline };
+	struct shaderinfo cullpipeline[] = {
+		{GL_COMPUTE_SHADER, "shaders/cull.comp"},
+		{GL_NONE, NULL}
+	};
+	culling = new Shader { cullpipeline };
+
+	glGenTextures(1, &depthtexture);
+	glBindTexture(GL_TEXTURE_2D, depthtexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, HIZ_WIDTH, HIZ_HEIGHT);
+	track_texture(depthtexture, texture_bytes(GL_DEPTH_COMPONENT32F, HIZ_WIDTH, HIZ_HEIGHT, 1, 1));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &pyramidtexture);
+	glBindTexture(GL_TEXTURE_2D, pyramidtexture);
+	glTexStorage2D(GL_TEXTURE_2D, HIZ_LEVELS, GL_R32F, HIZ_WIDTH, HIZ_HEIGHT);
+	track_texture(pyramidtexture, texture_bytes(GL_R32F, HIZ_WIDTH, HIZ_HEIGHT, 1, HIZ_LEVELS));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &depthFBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthtexture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "error: occlusion depth framebuffer is incomplete" << std::endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+OcclusionCuller::~OcclusionCuller(void)
+{
+	delete reduction;
+	delete culling;
+
+	if (glIsFramebuffer(depthFBO) == GL_TRUE) { glDeleteFramebuffers(1, &depthFBO); }
+	untrack_texture(depthtexture);
+	untrack_texture(pyramidtexture);
+	if (glIsTexture(depthtexture) == GL_TRUE) { glDeleteTextures(1, &depthtexture); }
+	if (glIsTexture(pyramidtexture) == GL_TRUE) { glDeleteTextures(1, &pyramidtexture); }
+}
+
+// a block includes the texels on its far border, so the occluder quads between the corners never rise above the terrain
+void OcclusionCuller::update(struct rect area)
+{
+	const int blocks = corners - 1;
+	const int bx0 = std::max((area.x0 - 1) / OCCLUDER_BLOCK, 0);
+	const int by0 = std::max((area.y0 - 1) / OCCLUDER_BLOCK, 0);
+	const int bx1 = std::min(area.x1 / OCCLUDER_BLOCK, blocks - 1);
+	const int by1 = std::min(area.y1 / OCCLUDER_BLOCK, blocks - 1);
+
+	for (int by = by0; by <= by1; by++) {
+		for (int bx = bx0; bx <= bx1; bx++) {
+			const int x1 = std::min((bx + 1) * OCCLUDER_BLOCK, int(heights->width) - 1);
+			const int y1 = std::min((by + 1) * OCCLUDER_BLOCK, int(heights->height) - 1);
+			float lowest = 1.f;
+			for (int y = by * OCCLUDER_BLOCK; y <= y1; y++) {
+				for (int x = bx * OCCLUDER_BLOCK; x <= x1; x++) {
+					lowest = std::min(lowest, sample_image(x, y, heights, 0));
+				}
+			}
+			blockmin[by * blocks + bx] = lowest;
+		}
+	}
+
+	for (int cy = by0; cy <= by1 + 1; cy++) {
+		for (int cx = bx0; cx <= bx1 + 1; cx++) {
+			float lowest = 1.f;
+			for (int by = std::max(cy - 1, 0); by <= std::min(cy, blocks - 1); by++) {
+				for (int bx = std::max(cx - 1, 0); bx <= std::min(cx, blocks - 1); bx++) {
+					lowest = std::min(lowest, blockmin[by * blocks + bx]);
+				}
+			}
+			cornerheights[cy * corners + cx] = scale * lowest;
+		}
+	}
+}
+
+// depth is the clip w of the occluder, interpolated as 1/w so it is exact for the planar triangles
+static void rasterize_triangle(std::vector<float> &depth, glm::vec4 a, glm::vec4 b, glm::vec4 c)
+{
+	if (a.w < OCCLUDER_NEAR || b.w < OCCLUDER_NEAR || c.w < OCCLUDER_NEAR) { return; }
+
+	const glm::vec2 size = glm::vec2(HIZ_WIDTH, HIZ_HEIGHT);
+	const glm::vec2 p0 = (0.5f * glm::vec2(a) / a.w + 0.5f) * size;
+	const glm::vec2 p1 = (0.5f * glm::vec2(b) / b.w + 0.5f) * size;
+	const glm::vec2 p2 = (0.5f * glm::vec2(c) / c.w + 0.5f) * size;
+
+	const float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+	if (fabsf(area) < 1e-6f) { return; }
+
+	// pixel centers inside the bounds
+	const glm::vec2 lo = glm::min(p0, glm::min(p1, p2));
+	const glm::vec2 hi = glm::max(p0, glm::max(p1, p2));
+	const int x0 = std::max(int(ceilf(lo.x - 0.5f)), 0);
+	const int y0 = std::max(int(ceilf(lo.y - 0.5f)), 0);
+	const int x1 = std::min(int(floorf(hi.x - 0.5f)), HIZ_WIDTH - 1);
+	const int y1 = std::min(int(floorf(hi.y - 0.5f)), HIZ_HEIGHT - 1);
+
+	const glm::vec3 inverse = glm::vec3(1.f / a.w, 1.f / b.w, 1.f / c.w) / area;
+
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			const glm::vec2 p = glm::vec2(x + 0.5f, y + 0.5f);
+			const float w0 = (p1.x - p.x) * (p2.y - p.y) - (p1.y - p.y) * (p2.x - p.x);
+			const float w1 = (p2.x - p.x) * (p0.y - p.y) - (p2.y - p.y) * (p0.x - p.x);
+			const float w2 = (p0.x - p.x) * (p1.y - p.y) - (p0.y - p.y) * (p1.x - p.x);
+			// the barycentrics have the sign of the area for both windings
+			if (w0 * area < 0.f || w1 * area < 0.f || w2 * area < 0.f) { continue; }
+			const float w = 1.f / (w0 * inverse.x + w1 * inverse.y + w2 * inverse.z);
+			float &texel = depth[y * HIZ_WIDTH + x];
+			texel = std::min(texel, w);
+		}
+	}
+}
+
+void OcclusionCuller::rasterize(const glm::mat4 &VIEW_PROJECT)
+{
+	viewproject = VIEW_PROJECT;
+
+	for (size_t cy = 0; cy < corners; cy++) {
+		for (size_t cx = 0; cx < corners; cx++) {
+			const glm::vec4 position = glm::vec4(cx * spacing, cornerheights[cy * corners + cx], cy * spacing, 1.f);
+			projected[cy * corners + cx] = VIEW_PROJECT * position;
+		}
+	}
+
+	std::vector<float> &depth = pyramid[0];
+	std::fill(depth.begin(), depth.end(), INFINITY);
+	for (size_t cy = 0; cy + 1 < corners; cy++) {
+		for (size_t cx = 0; cx + 1 < corners; cx++) {
+			const glm::vec4 &a = projected[cy * corners + cx];
+			const glm::vec4 &b = projected[cy * corners + cx + 1];
+			const glm::vec4 &c = projected[(cy + 1) * corners + cx];
+			const glm::vec4 &d = projected[(cy + 1) * corners + cx + 1];
+			rasterize_triangle(depth, a, b, d);
+			rasterize_triangle(depth, a, d, c);
+		}
+	}
+
+	for (int level = 1; level < HIZ_LEVELS; level++) {
+		const std::vector<float> &below = pyramid[level - 1];
+		const size_t belowwidth = level_width(level - 1);
+		const size_t belowheight = level_height(level - 1);
+		const size_t width = level_width(level);
+		const size_t height = level_height(level);
+		for (size_t y = 0; y < height; y++) {
+			for (size_t x = 0; x < width; x++) {
+				const size_t x1 = std::min(2 * x + 1, belowwidth - 1);
+				const size_t y1 = std::min(2 * y + 1, belowheight - 1);
+				pyramid[level][y * width + x] = std::max(
+					std::max(below[2 * y * belowwidth + 2 * x], below[2 * y * belowwidth + x1]),
+					std::max(below[y1 * belowwidth + 2 * x], below[y1 * belowwidth + x1])
+				);
+			}
+		}
+	}
+}
+
+// the box is hidden if its nearest corner is behind the furthest occluder in every texel it covers
+// the covered texels grow by one since the occluder is only sampled at the pixel centers
+bool OcclusionCuller::visible(glm::vec3 min, glm::vec3 max) const
+{
+	if (enabled == false) { return true; }
+
+	glm::vec2 lo = glm::vec2(INFINITY);
+	glm::vec2 hi = glm::vec2(-INFINITY);
+	float nearest = INFINITY;
+	for (int i = 0; i < 8; i++) {
+		const glm::vec4 corner = glm::vec4((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z, 1.f);
+		const glm::vec4 clip = viewproject * corner;
+		if (clip.w < OCCLUDER_NEAR) { return true; }
+		const glm::vec2 screen = (0.5f * glm::vec2(clip) / clip.w + 0.5f) * glm::vec2(HIZ_WIDTH, HIZ_HEIGHT);
+		lo = glm::min(lo, screen);
+		hi = glm::max(hi, screen);
+		nearest = std::min(nearest, clip.w);
+	}
+
+	int x0 = std::max(int(floorf(lo.x)) - 1, 0);
+	int y0 = std::max(int(floorf(lo.y)) - 1, 0);
+	int x1 = std::min(int(floorf(hi.x)) + 1, HIZ_WIDTH - 1);
+	int y1 = std::min(int(floorf(hi.y)) + 1, HIZ_HEIGHT - 1);
+	if (x0 > x1 || y0 > y1) { return false; } // off screen
+
+	int level = 0;
+	while (level + 1 < HIZ_LEVELS && (x1 - x0 > 1 || y1 - y0 > 1)) {
+		x0 >>= 1;
+		y0 >>= 1;
+		x1 >>= 1;
+		y1 >>= 1;
+		level++;
+	}
+
+	const size_t width = level_width(level);
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			if (pyramid[level][y * width + x] > nearest) { return true; }
+		}
+	}
+
+	return false;
+}
+
+void OcclusionCuller::begin_depth(void)
+{
+	if (gpu() == false) { return; }
+
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
+	glViewport(0, 0, HIZ_WIDTH, HIZ_HEIGHT);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+// level 0 copies the depth, every next level keeps the furthest depth of the four texels below it
+void OcclusionCuller::end_depth(void)
+{
+	if (gpu() == false) { return; }
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	reduction->bind();
+	activate_texture(GL_TEXTURE0, GL_TEXTURE_2D, depthtexture);
+	for (int level = 0; level < HIZ_LEVELS; level++) {
+		reduction->uniform_int("level", level);
+		glBindImageTexture(0, pyramidtexture, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, pyramidtexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((level_width(level) + 7) / 8, (level_height(level) + 7) / 8, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+// writes a DrawArraysIndirectCommand for every box, with no instances if the box is hidden or further than maxdistance
+void OcclusionCuller::cull_indirect(GLuint boxes, GLuint commands, size_t count, const glm::mat4 &VIEW_PROJECT, glm::vec3 camerapos, float maxdistance) const
+{
+	if (gpu() == false || count == 0) { return; }
+
+	culling->bind();
+	culling->uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
+	culling->uniform_vec3("camerapos", camerapos);
+	culling->uniform_float("maxdistance", maxdistance);
+	culling->uniform_int("boxcount", count);
+	culling->uniform_int("levels", HIZ_LEVELS);
+	culling->uniform_bool("occlusion", enabled);
+
+	activate_texture(GL_TEXTURE0, GL_TEXTURE_2D, pyramidtexture);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, boxes);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commands);
+	glDispatchCompute((count + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
@@ -0,0 +1,54 @@
+// occlusion culling with the terrain as the occluder
+// on the CPU a coarse mesh that stays below the terrain is rasterized into a small depth buffer
+// with compute shaders the terrain depth is also rendered on the GPU, so draws built on the GPU are culled without a readback
+// both keep a pyramid of the furthest depth per texel, a box is hidden when it is behind every texel it covers
+enum {
+	HIZ_WIDTH = 256, // powers of two so every level is exactly half the one below
+	HIZ_HEIGHT = 128,
+	HIZ_LEVELS = 9, // down to 1x1
+	OCCLUDER_BLOCK = 16 // heightmap texels per quad of the occluder mesh
+};
+
+// a range of vertices and its bounds, std430 layout of the boxes in the cull compute shader
+struct cullbox {
+	glm::vec4 min;
+	glm::vec4 max;
+	GLuint first;
+	GLuint count;
+	GLuint padding[2];
+};
+
+class OcclusionCuller {
+public:
+	bool enabled = true;
+public:
+	OcclusionCuller(const struct rawimage *heightmap, float mapratio, float amplitude);
+	~OcclusionCuller(void);
+	void update(struct rect area); // after the heights changed, the area is in heightmap texels
+	// CPU, used for everything that is decided on the CPU
+	void rasterize(const glm::mat4 &VIEW_PROJECT);
+	bool visible(glm::vec3 min, glm::vec3 max) const;
+	// GPU, null operations without compute shaders
+	bool gpu(void) const { return reduction != nullptr; }
+	void begin_depth(void); // draw the terrain with a depth only program in between
+	void end_depth(void);
+	void cull_indirect(GLuint boxes, GLuint commands, size_t count, const glm::mat4 &VIEW_PROJECT, glm::vec3 camerapos, float maxdistance) const;
+private:
+	const struct rawimage *heights;
+	float spacing; // world units between the corners of the occluder
+	float scale; // amplitude
+	size_t corners; // per side
+	std::vector<float> blockmin; // lowest height of every block
+	std::vector<float> cornerheights; // lowest height of the blocks around every corner
+	std::vector<glm::vec4> projected;
+	glm::mat4 viewproject;
+	std::vector<float> pyramid[HIZ_LEVELS]; // furthest clip w, infinity where there is no occluder
+	// GPU pyramid of the furthest depth
+	Shader *reduction;
+	Shader *culling;
+	GLuint depthFBO;
+	GLuint depthtexture;
+	GLuint pyramidtexture;
+	GLint viewport[4]; // of the framebuffer the scene is drawn in
+	GLint framebuffer;
+};
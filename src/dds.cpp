@@ -1,9 +1,17 @@
 #include <cstdlib>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <vector>
 #include <GL/glew.h>
 #include <GL/gl.h>
+#include <glm/glm.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
 
+#include "imp.h"
+#include "memory.h"
+#include "bcn.h"
 #include "dds.h"
 
 unsigned char *load_DDS(const char *fpath, struct DDS *header)
@@ -34,7 +42,7 @@ unsigned char *load_DDS(const char *fpath, struct DDS *header)
 	/* now get the actual image data */
 	unsigned char *image;
 	uint32_t len = (header->mip_levels > 1) ? (header->linear_size * 2) : header->linear_size;
-	image = new unsigned char[len];
+	image = tracked_alloc(len);
 	fread(image, 1, len, fp);
 
 	fclose(fp);
@@ -42,26 +50,56 @@ unsigned char *load_DDS(const char *fpath, struct DDS *header)
 	return image;
 }
 
-GLuint load_DDS_texture(const char *fpath)
+struct ddsimage read_DDS(const char *fpath)
 {
-	struct DDS header;
-	unsigned char *image = load_DDS(fpath, &header);
-	if (image == nullptr) { return 0; }
+	struct ddsimage image;
+	image.data = load_DDS(fpath, &image.header);
+
+	return image;
+}
+
+GLuint upload_DDS_texture(const struct ddsimage *image)
+{
+	if (image->data == nullptr) { return 0; }
+
+	struct DDS header = image->header;
 
 	/* find valid DXT format*/
-	uint32_t components = (header.dxt_codec == FOURCC_DXT1) ? 3 : 4;
 	uint32_t format;
 	uint32_t block_size;
 	switch (header.dxt_codec) {
 	case FOURCC_DXT1: format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; block_size = 8; break;
 	case FOURCC_DXT3: format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; block_size = 16; break;
 	case FOURCC_DXT5: format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; block_size = 16; break;
+	case FOURCC_ATI1: format = GL_COMPRESSED_RED_RGTC1; block_size = 8; break;
+	case FOURCC_ATI2: format = GL_COMPRESSED_RG_RGTC2; block_size = 16; break;
 	default:
-		std::cerr << "error: no valid DXT format found for " << fpath << std::endl;
-		delete [] image;
+		std::cerr << "error: no valid DXT format found\n";
 		return 0;
 	};
 
+	/* levels down to 4x4 blocks and their bytes */
+	unsigned int levels = 0;
+	size_t total = 0;
+	for (uint32_t width = header.width, height = header.height; levels < header.mip_levels && width > 4 && height > 4; width /= 2, height /= 2) {
+		total += ((width+3)/4) * ((height+3)/4) * block_size;
+		levels++;
+	}
+	if (levels == 0) { return 0; }
+
+	/* over the GPU budget the largest levels are dropped, each saves three quarters of what is left */
+	unsigned int skip = 0;
+	size_t skipped = 0;
+	while (skip + 1 < levels && memory_would_exceed(MEMORY_GPU, total - skipped)) {
+		skipped += ((header.width+3)/4) * ((header.height+3)/4) * block_size;
+		header.width = header.width/2;
+		header.height = header.height/2;
+		skip++;
+	}
+	if (skip > 0) {
+		std::cerr << "error: gpu memory budget reached, dropped " << skip << " mip levels of a texture\n";
+	}
+
 	/* now make the opengl texture */
 	GLuint texture;
 
@@ -69,22 +107,18 @@ GLuint load_DDS_texture(const char *fpath)
 	glBindTexture(GL_TEXTURE_2D, texture);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.mip_levels-1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels-skip-1);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-	unsigned int offset = 0;
-	for (unsigned int i = 0; i < header.mip_levels; i++) {
-		if (header.width <= 4 || header.height <= 4) {
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, i-1);
-			break;
-		}
+	size_t offset = skipped;
+	for (unsigned int i = skip; i < levels; i++) {
 		/* now to actually get the compressed image into opengl */
 		unsigned int size = ((header.width+3)/4) * ((header.height+3)/4) * block_size;
-		glCompressedTexImage2D(GL_TEXTURE_2D, i, format,
-		header.width, header.height, 0, size, image + offset);
+		glCompressedTexImage2D(GL_TEXTURE_2D, i-skip, format,
+		header.width, header.height, 0, size, image->data + offset);
 
 		offset += size;
 		header.width = header.width/2;
@@ -93,7 +127,62 @@ GLuint load_DDS_texture(const char *fpath)
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	delete [] image;
+	track_texture(texture, offset - skipped);
 
 	return texture;
 }
+
+GLuint load_DDS_texture(const char *fpath)
+{
+	struct ddsimage image = read_DDS(fpath);
+	GLuint texture = upload_DDS_texture(&image);
+	if (image.data != nullptr && texture == 0) {
+		std::cerr << "error: could not upload " << fpath << std::endl;
+	}
+
+	tracked_free(image.data);
+
+	return texture;
+}
+
+/* writes a single level, with only the fields load_DDS reads and the flags other readers expect */
+bool write_DDS(const char *fpath, const struct blockimage *image)
+{
+	uint32_t fourcc = 0;
+	switch (image->format) {
+	case BLOCK_BC1: fourcc = FOURCC_DXT1; break;
+	case BLOCK_BC3: fourcc = FOURCC_DXT5; break;
+	case BLOCK_BC4: fourcc = FOURCC_ATI1; break;
+	case BLOCK_BC5: fourcc = FOURCC_ATI2; break;
+	}
+
+	uint32_t header[31];
+	memset(header, 0, sizeof(header));
+	header[0] = 124; /* header size */
+	header[1] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000; /* caps, height, width, pixel format, linear size */
+	header[2] = uint32_t(image->height);
+	header[3] = uint32_t(image->width);
+	header[4] = uint32_t(image->data.size());
+	header[6] = 1; /* mip levels */
+	header[18] = 32; /* pixel format size */
+	header[19] = 0x4; /* fourcc */
+	header[20] = fourcc;
+	header[26] = 0x1000; /* texture */
+
+	FILE *fp = fopen(fpath, "wb");
+	if (fp == nullptr) {
+		perror(fpath);
+		return false;
+	}
+
+	bool written = fwrite("DDS ", 1, 4, fp) == 4;
+	written = written && fwrite(header, sizeof(header), 1, fp) == 1;
+	written = written && fwrite(image->data.data(), 1, image->data.size(), fp) == image->data.size();
+	fclose(fp);
+
+	if (written == false) {
+		std::cerr << "error: could not write " << fpath << std::endl;
+	}
+
+	return written;
+}
@@ -2,6 +2,8 @@ enum {
 	FOURCC_DXT1 = 0x31545844, 
 	FOURCC_DXT3 = 0x33545844, 
 	FOURCC_DXT5 = 0x35545844,
+	FOURCC_ATI1 = 0x31495441, // BC4
+	FOURCC_ATI2 = 0x32495441 // BC5
 };
 
 // DDS header
@@ -14,5 +16,15 @@ struct DDS {
 	uint32_t dxt_codec; /* compression type */
 };
 
+// a DDS file read into memory, reading does not need the GL context so it can run on any thread
+struct ddsimage {
+	struct DDS header;
+	unsigned char *data = nullptr;
+};
+
 GLuint load_DDS_texture(const char *fpath);
+struct ddsimage read_DDS(const char *fpath);
+// the caller keeps ownership of the data
+GLuint upload_DDS_texture(const struct ddsimage *image);
 unsigned char *load_DDS(const char *fpath, struct DDS *header);
+bool write_DDS(const char *fpath, const struct blockimage *image);
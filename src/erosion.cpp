@@ -0,0 +1,342 @@
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "memory.h"
+#include "pool.h"
+#include "parallel.h"
+#include "erosion.h"
+
+// droplets are simulated per tile, tiles that run at the same time are two tiles apart
+// so a droplet can wander into the halo around its tile without racing with another tile
+enum {
+	EROSION_TILE = 128,
+	EROSION_HALO = 48
+};
+
+struct erosionparams default_erosionparams(long seed)
+{
+	struct erosionparams params = {
+		.seed = seed,
+		.droplets = 65536,
+		.lifetime = 30,
+		.radius = 3,
+		.inertia = 0.05f,
+		.capacity = 4.f,
+		.mincapacity = 0.01f,
+		.erosion = 0.3f,
+		.deposition = 0.3f,
+		.evaporation = 0.01f,
+		.gravity = 4.f,
+		.thermalsteps = 8,
+		.talus = 0.006f,
+		.thermalrate = 0.2f
+	};
+
+	return params;
+}
+
+static void erosion_brush(int radius, std::vector<struct brushpoint> *brush)
+{
+	brush->clear();
+
+	float sum = 0.f;
+	for (int dy = -radius; dy <= radius; dy++) {
+		for (int dx = -radius; dx <= radius; dx++) {
+			const float weight = float(radius) - sqrtf(float(dx*dx + dy*dy));
+			if (weight > 0.f) {
+				brush->push_back({ dx, dy, weight });
+				sum += weight;
+			}
+		}
+	}
+	for (auto &point : *brush) { point.weight /= sum; }
+}
+
+// bilinear height and gradient at a position
+static inline float height_gradient(const float *heights, size_t width, float x, float y, float *gx, float *gy)
+{
+	const int nodex = int(x);
+	const int nodey = int(y);
+	const float u = x - nodex;
+	const float v = y - nodey;
+
+	const size_t index = nodey * width + nodex;
+	const float NW = heights[index];
+	const float NE = heights[index + 1];
+	const float SW = heights[index + width];
+	const float SE = heights[index + width + 1];
+
+	*gx = (NE - NW) * (1.f - v) + (SE - SW) * v;
+	*gy = (SW - NW) * (1.f - u) + (SE - NE) * u;
+
+	return NW * (1.f - u) * (1.f - v) + NE * u * (1.f - v) + SW * (1.f - u) * v + SE * u * v;
+}
+
+static void erode_tile(float *heights, size_t width, size_t height, size_t tilex, size_t tiley, unsigned int count, const struct erosionparams *params, const std::vector<struct brushpoint> &brush, std::mt19937 &gen)
+{
+	// the droplet dies when its brush would leave the tile and its halo
+	const int margin = params->radius + 1;
+	const int minx = std::max(int(tilex) - EROSION_HALO, 0) + margin;
+	const int miny = std::max(int(tiley) - EROSION_HALO, 0) + margin;
+	const int maxx = std::min(int(tilex) + EROSION_TILE + EROSION_HALO, int(width)) - margin - 1;
+	const int maxy = std::min(int(tiley) + EROSION_TILE + EROSION_HALO, int(height)) - margin - 1;
+	if (minx >= maxx || miny >= maxy) { return; }
+
+	std::uniform_real_distribution<float> startx(std::max(float(tilex), float(minx)), std::min(float(tilex + EROSION_TILE), float(maxx)));
+	std::uniform_real_distribution<float> starty(std::max(float(tiley), float(miny)), std::min(float(tiley + EROSION_TILE), float(maxy)));
+
+	for (unsigned int i = 0; i < count; i++) {
+		float x = startx(gen);
+		float y = starty(gen);
+		float dirx = 0.f;
+		float diry = 0.f;
+		float speed = 1.f;
+		float water = 1.f;
+		float sediment = 0.f;
+
+		for (unsigned int step = 0; step < params->lifetime; step++) {
+			const int nodex = int(x);
+			const int nodey = int(y);
+			const float u = x - nodex;
+			const float v = y - nodey;
+
+			float gx, gy;
+			const float h = height_gradient(heights, width, x, y, &gx, &gy);
+
+			dirx = dirx * params->inertia - gx * (1.f - params->inertia);
+			diry = diry * params->inertia - gy * (1.f - params->inertia);
+			const float len = sqrtf(dirx * dirx + diry * diry);
+			if (len <= 0.f) { break; }
+			dirx /= len;
+			diry /= len;
+			x += dirx;
+			y += diry;
+
+			if (x < minx || y < miny || x >= maxx || y >= maxy) { break; }
+
+			const float newheight = height_gradient(heights, width, x, y, &gx, &gy);
+			const float delta = newheight - h;
+
+			const float capacity = std::max(-delta * speed * water * params->capacity, params->mincapacity);
+
+			const size_t node = nodey * width + nodex;
+			if (sediment > capacity || delta > 0.f) {
+				// fill up the pit when going uphill, else drop the surplus
+				const float amount = (delta > 0.f) ? std::min(delta, sediment) : (sediment - capacity) * params->deposition;
+				sediment -= amount;
+				heights[node] += amount * (1.f - u) * (1.f - v);
+				heights[node + 1] += amount * u * (1.f - v);
+				heights[node + width] += amount * (1.f - u) * v;
+				heights[node + width + 1] += amount * u * v;
+			} else {
+				// never erode more than the height difference or a hole is dug
+				const float amount = std::min((capacity - sediment) * params->erosion, -delta);
+				for (const auto &point : brush) {
+					float &cell = heights[node + point.dy * int(width) + point.dx];
+					const float removed = std::min(cell, amount * point.weight);
+					cell -= removed;
+					sediment += removed;
+				}
+			}
+
+			speed = sqrtf(std::max(speed * speed - delta * params->gravity, 0.f));
+			water *= (1.f - params->evaporation);
+		}
+	}
+}
+
+// the brush is only built again when its radius changes, the tile list keeps its capacity between the passes
+void hydraulic_erosion(float *heights, size_t width, size_t height, const struct erosionparams *params, unsigned int iteration, struct erosionscratch *scratch)
+{
+	if (scratch->brush.empty() || scratch->radius != params->radius) {
+		erosion_brush(params->radius, &scratch->brush);
+		scratch->radius = params->radius;
+	}
+	const std::vector<struct brushpoint> &brush = scratch->brush;
+	std::vector<size_t> &tiles = scratch->tiles;
+
+	const size_t tilecols = (width + EROSION_TILE - 1) / EROSION_TILE;
+	const size_t tilerows = (height + EROSION_TILE - 1) / EROSION_TILE;
+	const unsigned int count = std::max(params->droplets / unsigned(tilecols * tilerows), 1u);
+
+	// four passes of a checkerboard, within a pass no two tiles share a halo
+	for (unsigned int phase = 0; phase < 4; phase++) {
+		tiles.clear();
+		for (size_t row = (phase >> 1); row < tilerows; row += 2) {
+			for (size_t col = (phase & 1); col < tilecols; col += 2) {
+				tiles.push_back(row * tilecols + col);
+			}
+		}
+		parallel_for(tiles.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const size_t tile = tiles[i];
+				// seeded per tile so the result does not depend on the thread count
+				std::mt19937 gen(uint32_t(params->seed) + 7919u * iteration + 104729u * uint32_t(tile));
+				erode_tile(heights, width, height, (tile % tilecols) * EROSION_TILE, (tile / tilecols) * EROSION_TILE, count, params, brush, gen);
+			}
+		});
+	}
+}
+
+// material that slides between a cell and one neighbour, positive if it flows in
+static inline float exchange(float h, float neighbour, float talus)
+{
+	const float d = neighbour - h;
+
+	return std::max(d - talus, 0.f) - std::max(-d - talus, 0.f);
+}
+
+#ifdef __SSE2__
+static inline __m128 exchange(__m128 h, __m128 neighbour, __m128 talus)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 d = _mm_sub_ps(neighbour, h);
+	const __m128 in = _mm_max_ps(_mm_sub_ps(d, talus), zero);
+	const __m128 out = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(zero, d), talus), zero);
+
+	return _mm_sub_ps(in, out);
+}
+#endif
+
+static inline float thermal_cell(const float *heights, size_t width, size_t height, size_t x, size_t y, float talus, float rate)
+{
+	const size_t index = y * width + x;
+	const float h = heights[index];
+
+	float flux = 0.f;
+	if (x > 0) { flux += exchange(h, heights[index-1], talus); }
+	if (x < width-1) { flux += exchange(h, heights[index+1], talus); }
+	if (y > 0) { flux += exchange(h, heights[index-width], talus); }
+	if (y < height-1) { flux += exchange(h, heights[index+width], talus); }
+
+	return h + rate * flux;
+}
+
+// one Jacobi step, the flux between two cells is antisymmetric so no material is lost
+static void thermal_step(const float *heights, float *out, size_t width, size_t height, float talus, float rate)
+{
+	parallel_for(height, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; y++) {
+			if (y == 0 || y == height-1 || width < 3) {
+				for (size_t x = 0; x < width; x++) {
+					out[y * width + x] = thermal_cell(heights, width, height, x, y, talus, rate);
+				}
+				continue;
+			}
+
+			const float *row = &heights[y * width];
+			const float *up = row - width;
+			const float *down = row + width;
+			float *dst = &out[y * width];
+
+			dst[0] = thermal_cell(heights, width, height, 0, y, talus, rate);
+
+			size_t x = 1;
+#ifdef __SSE2__
+			const __m128 T = _mm_set1_ps(talus);
+			const __m128 K = _mm_set1_ps(rate);
+			for (; x + 4 < width; x += 4) {
+				const __m128 h = _mm_loadu_ps(row + x);
+				__m128 flux = exchange(h, _mm_loadu_ps(row + x - 1), T);
+				flux = _mm_add_ps(flux, exchange(h, _mm_loadu_ps(row + x + 1), T));
+				flux = _mm_add_ps(flux, exchange(h, _mm_loadu_ps(up + x), T));
+				flux = _mm_add_ps(flux, exchange(h, _mm_loadu_ps(down + x), T));
+				_mm_storeu_ps(dst + x, _mm_add_ps(h, _mm_mul_ps(K, flux)));
+			}
+#endif
+			for (; x < width-1; x++) {
+				const float h = row[x];
+				const float flux = exchange(h, row[x-1], talus) + exchange(h, row[x+1], talus) + exchange(h, up[x], talus) + exchange(h, down[x], talus);
+				dst[x] = h + rate * flux;
+			}
+
+			dst[width-1] = thermal_cell(heights, width, height, width-1, y, talus, rate);
+		}
+	});
+}
+
+void thermal_erosion(float *heights, size_t width, size_t height, const struct erosionparams *params)
+{
+	if (params->thermalsteps == 0) { return; }
+
+	ArenaScope scratch;
+
+	float *src = heights;
+	float *dst = (float*)scratch.allocate(width * height * sizeof(float));
+	for (unsigned int step = 0; step < params->thermalsteps; step++) {
+		thermal_step(src, dst, width, height, params->talus, params->thermalrate);
+		std::swap(src, dst);
+	}
+
+	if (src != heights) {
+		std::copy(src, src + width * height, heights);
+	}
+}
+
+void erode_image(float *heights, size_t width, size_t height, const struct erosionparams *params, unsigned int iterations)
+{
+	struct erosionscratch scratch = {};
+	for (unsigned int i = 0; i < iterations; i++) {
+		hydraulic_erosion(heights, width, height, params, i, &scratch);
+		thermal_erosion(heights, width, height, params);
+	}
+}
+
+ErosionJob::ErosionJob(const float *heights, size_t w, size_t h, const struct erosionparams *params, unsigned int iterations)
+{
+	settings = *params;
+	width = w;
+	height = h;
+	total = iterations;
+	buffer.assign(heights, heights + width * height);
+	scratch = {};
+	latestiteration = 0;
+	fresh = false;
+	done = 0;
+	cancel = false;
+
+	worker = std::thread(&ErosionJob::run, this);
+}
+
+ErosionJob::~ErosionJob(void)
+{
+	cancel = true;
+	if (worker.joinable()) { worker.join(); }
+}
+
+void ErosionJob::run(void)
+{
+	for (unsigned int i = 0; i < total && !cancel; i++) {
+		hydraulic_erosion(buffer.data(), width, height, &settings, i, &scratch);
+		thermal_erosion(buffer.data(), width, height, &settings);
+
+		std::lock_guard<std::mutex> guard(lock);
+		latest = buffer;
+		latestiteration = i + 1;
+		fresh = true;
+		done++;
+	}
+}
+
+// hands out the newest finished iteration, returns false if there is nothing new since the last poll
+bool ErosionJob::poll(std::vector<float> *snapshot, unsigned int *iteration)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (fresh == false) { return false; }
+
+	snapshot->swap(latest);
+	*iteration = latestiteration;
+	fresh = false;
+
+	return true;
+}
@@ -0,0 +1,66 @@
+struct erosionparams {
+	long seed;
+	// hydraulic erosion
+	unsigned int droplets; // droplets per iteration
+	unsigned int lifetime; // max steps of a droplet
+	int radius; // radius of the erosion brush in pixels
+	float inertia; // how much a droplet keeps its direction
+	float capacity; // sediment a droplet can carry per unit of speed and water
+	float mincapacity;
+	float erosion; // fraction of the free capacity that gets eroded
+	float deposition; // fraction of the surplus sediment that gets deposited
+	float evaporation;
+	float gravity;
+	// thermal erosion
+	unsigned int thermalsteps; // grid relaxation steps per iteration
+	float talus; // height difference between neighbours above which material slides
+	float thermalrate;
+};
+
+struct brushpoint {
+	int dx;
+	int dy;
+	float weight;
+};
+
+// kept by the caller between iterations so the hydraulic erosion does not build its brush and tile lists again
+struct erosionscratch {
+	int radius; // of the brush
+	std::vector<struct brushpoint> brush;
+	std::vector<size_t> tiles; // of the current checkerboard pass
+};
+
+struct erosionparams default_erosionparams(long seed);
+
+void hydraulic_erosion(float *heights, size_t width, size_t height, const struct erosionparams *params, unsigned int iteration, struct erosionscratch *scratch);
+
+void thermal_erosion(float *heights, size_t width, size_t height, const struct erosionparams *params);
+
+void erode_image(float *heights, size_t width, size_t height, const struct erosionparams *params, unsigned int iterations);
+
+// runs erosion iterations on a background thread, intermediate results can be picked up while it runs
+class ErosionJob {
+public:
+	ErosionJob(const float *heights, size_t width, size_t height, const struct erosionparams *params, unsigned int iterations);
+	~ErosionJob(void);
+	bool poll(std::vector<float> *snapshot, unsigned int *iteration);
+	bool finished(void) const { return done == total; }
+	unsigned int progress(void) const { return done; }
+	unsigned int iterations(void) const { return total; }
+private:
+	struct erosionparams settings;
+	size_t width;
+	size_t height;
+	unsigned int total;
+	std::vector<float> buffer; // only touched by the worker
+	struct erosionscratch scratch; // only touched by the worker
+	std::vector<float> latest; // last finished iteration
+	unsigned int latestiteration;
+	bool fresh;
+	std::mutex lock;
+	std::atomic<unsigned int> done;
+	std::atomic<bool> cancel;
+	std::thread worker;
+private:
+	void run(void);
+};
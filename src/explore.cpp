@@ -0,0 +1,223 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+
+#include "external/stbimage/stb_image_write.h"
+
+#include "imp.h"
+#include "memory.h"
+#include "pool.h"
+#include "parallel.h"
+#include "explore.h"
+
+#define GRASS_MAX_SLOPE 0.6f // the rule of the grass roots
+#define GRASS_MAX_HEIGHT 0.4f
+
+// the sobel filter of the normal map with the differences scaled to the texel spacing of the full heightmap
+static glm::vec3 preview_normal(const float *heights, size_t side, size_t x, size_t y, float stride)
+{
+	const float strength = 32.f; // of the normal map
+
+	auto height = [&](int i, int j) -> float {
+		if (i < 0 || j < 0 || i >= int(side) || j >= int(side)) { return 0.f; }
+		return heights[j * side + i];
+	};
+
+	const int i = x;
+	const int j = y;
+	const float dX = (height(i+1, j+1) + 2.f * height(i+1, j) + height(i+1, j-1)) - (height(i-1, j+1) + 2.f * height(i-1, j) + height(i-1, j-1));
+	const float dZ = (height(i-1, j-1) + 2.f * height(i, j-1) + height(i+1, j-1)) - (height(i-1, j+1) + 2.f * height(i, j+1) + height(i+1, j+1));
+
+	return glm::normalize(glm::vec3(-dX / stride, 1.f / strength, dZ / stride));
+}
+
+static struct seedstats measure_seed(const struct exploreconfig *config, long seed, const float *heights)
+{
+	const size_t side = config->resolution;
+	const float stride = float(config->worldsize) / float(side);
+	const float texel = 1.f / float(side * side);
+
+	struct seedstats stats = {};
+	stats.seed = seed;
+
+	for (size_t y = 0; y < side; y++) {
+		for (size_t x = 0; x < side; x++) {
+			const float height = glm::clamp(heights[y * side + x], 0.f, 1.f);
+			// like Terrain::sampleslope
+			const float slope = glm::clamp(1.f - preview_normal(heights, side, x, y, stride).y, 0.f, 1.f);
+			const bool underwater = height < config->waterlevel;
+			const bool grass = slope < GRASS_MAX_SLOPE && height < GRASS_MAX_HEIGHT;
+
+			stats.meanheight += height * texel;
+			if (underwater) { stats.water += texel; }
+			if (grass) { stats.grass += texel; }
+			if (grass && !underwater) { stats.grassland += texel; }
+			if (slope >= GRASS_MAX_SLOPE) { stats.steep += texel; }
+			stats.heights[std::min(int(height * EXPLORE_HEIGHT_BINS), EXPLORE_HEIGHT_BINS-1)] += texel;
+			stats.slopes[std::min(int(slope * EXPLORE_SLOPE_BINS), EXPLORE_SLOPE_BINS-1)] += texel;
+		}
+	}
+
+	// the land the grass, trees and crowd can use
+	stats.score = stats.grassland;
+
+	return stats;
+}
+
+// water, grass and rock colors lit from the north west
+static bool write_thumbnail(const struct exploreconfig *config, const float *heights, const std::string &fpath)
+{
+	const size_t side = config->resolution;
+	const float stride = float(config->worldsize) / float(side);
+	const glm::vec3 light = glm::normalize(glm::vec3(-1.f, 1.f, -1.f));
+
+	std::vector<unsigned char> pixels(side * side * 3);
+	for (size_t y = 0; y < side; y++) {
+		for (size_t x = 0; x < side; x++) {
+			const float height = glm::clamp(heights[y * side + x], 0.f, 1.f);
+			const glm::vec3 normal = preview_normal(heights, side, x, y, stride);
+			const float slope = 1.f - normal.y;
+			const float shade = glm::clamp(0.35f + 0.65f * glm::dot(normal, light), 0.f, 1.f);
+
+			glm::vec3 color;
+			if (height < config->waterlevel) {
+				color = glm::mix(glm::vec3(0.05f, 0.15f, 0.35f), glm::vec3(0.2f, 0.4f, 0.6f), height / config->waterlevel);
+			} else if (slope < GRASS_MAX_SLOPE && height < GRASS_MAX_HEIGHT) {
+				color = glm::vec3(0.3f, 0.5f, 0.2f) * shade;
+			} else {
+				color = glm::mix(glm::vec3(0.45f, 0.4f, 0.35f), glm::vec3(0.95f), glm::smoothstep(0.6f, 0.9f, height)) * shade;
+			}
+
+			unsigned char *pixel = &pixels[(y * side + x) * 3];
+			for (int c = 0; c < 3; c++) { pixel[c] = glm::clamp(color[c], 0.f, 1.f) * 255.f; }
+		}
+	}
+
+	return stbi_write_png(fpath.c_str(), side, side, 3, pixels.data(), side * 3) != 0;
+}
+
+static std::string thumbnail_path(const char *prefix, long seed)
+{
+	return std::string(prefix) + "_" + std::to_string(seed) + ".png";
+}
+
+static void print_bins(FILE *fp, const float *bins, int count)
+{
+	fprintf(fp, "[");
+	for (int i = 0; i < count; i++) { fprintf(fp, (i < count-1) ? "%.4f, " : "%.4f", bins[i]); }
+	fprintf(fp, "]");
+}
+
+static bool write_index(const struct exploreconfig *config, const std::vector<struct seedstats> &ranking)
+{
+	const std::string fpath = std::string(config->output) + ".json";
+	FILE *fp = fopen(fpath.c_str(), "w");
+	if (fp == nullptr) {
+		perror(fpath.c_str());
+		return false;
+	}
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"first_seed\": %ld,\n", config->firstseed);
+	fprintf(fp, "\t\"seeds\": %u,\n", config->seeds);
+	fprintf(fp, "\t\"resolution\": %zu,\n", config->resolution);
+	fprintf(fp, "\t\"world_size\": %zu,\n", config->worldsize);
+	fprintf(fp, "\t\"water_level\": %.4f,\n", config->waterlevel);
+	fprintf(fp, "\t\"ranking\": [\n");
+	for (size_t rank = 0; rank < ranking.size(); rank++) {
+		const struct seedstats *stats = &ranking[rank];
+		fprintf(fp, "\t\t{ \"rank\": %zu, \"seed\": %ld, \"score\": %.4f, \"mean_height\": %.4f, \"water\": %.4f, \"grass\": %.4f, \"grassland\": %.4f, \"steep\": %.4f, ", rank + 1, stats->seed, stats->score, stats->meanheight, stats->water, stats->grass, stats->grassland, stats->steep);
+		fprintf(fp, "\"heights\": ");
+		print_bins(fp, stats->heights, EXPLORE_HEIGHT_BINS);
+		fprintf(fp, ", \"slopes\": ");
+		print_bins(fp, stats->slopes, EXPLORE_SLOPE_BINS);
+		if (rank < config->thumbnails) {
+			fprintf(fp, ", \"thumbnail\": \"%s\" }", thumbnail_path(config->output, stats->seed).c_str());
+		} else {
+			fprintf(fp, ", \"thumbnail\": null }");
+		}
+		fprintf(fp, (rank < ranking.size()-1) ? ",\n" : "\n");
+	}
+	fprintf(fp, "\t]\n}\n");
+
+	fclose(fp);
+
+	return true;
+}
+
+// every thread takes the next seed until they are done, a preview is too small to split over threads
+// the thumbnails are only written for the best seeds, their previews are generated again after the ranking
+bool run_exploration(const struct exploreconfig *config)
+{
+	MemoryScope scope(MEMORY_WORLD);
+
+	if (config->seeds == 0 || config->resolution < 4 || config->resolution > config->worldsize) {
+		std::cerr << "error: exploration needs seeds and a preview size between 4 and the world size" << std::endl;
+		return false;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+
+	const unsigned int hardware = threadcount();
+	const unsigned int nthreads = std::min(hardware, config->seeds);
+	set_threadcount(1);
+
+	std::vector<struct seedstats> ranking(config->seeds);
+	std::atomic<unsigned int> next(0);
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < nthreads; i++) {
+		workers.push_back(std::thread([&](void) {
+			MemoryScope scope(MEMORY_WORLD);
+			unsigned int index;
+			while ((index = next++) < config->seeds) {
+				ArenaScope scratch;
+				float *heights = (float*)scratch.allocate(config->resolution * config->resolution * sizeof(float));
+				const long seed = config->firstseed + long(index);
+				terrain_preview(heights, config->resolution, config->worldsize, seed, 1.f);
+				ranking[index] = measure_seed(config, seed, heights);
+			}
+		}));
+	}
+	for (auto &worker : workers) { worker.join(); }
+
+	std::stable_sort(ranking.begin(), ranking.end(), [](const struct seedstats &a, const struct seedstats &b) { return a.score > b.score; });
+
+	const unsigned int nthumbnails = std::min(config->thumbnails, config->seeds);
+	std::atomic<bool> written(true);
+	next = 0;
+	workers.clear();
+	for (unsigned int i = 0; i < std::min(nthreads, std::max(nthumbnails, 1u)); i++) {
+		workers.push_back(std::thread([&](void) {
+			MemoryScope scope(MEMORY_WORLD);
+			unsigned int rank;
+			while ((rank = next++) < nthumbnails) {
+				ArenaScope scratch;
+				float *heights = (float*)scratch.allocate(config->resolution * config->resolution * sizeof(float));
+				terrain_preview(heights, config->resolution, config->worldsize, ranking[rank].seed, 1.f);
+				const std::string fpath = thumbnail_path(config->output, ranking[rank].seed);
+				if (write_thumbnail(config, heights, fpath) == false) {
+					std::cerr << "error: could not write thumbnail " << fpath << std::endl;
+					written = false;
+				}
+			}
+		}));
+	}
+	for (auto &worker : workers) { worker.join(); }
+
+	set_threadcount(hardware);
+
+	if (write_index(config, ranking) == false) { return false; }
+
+	const std::chrono::duration<float> duration = std::chrono::steady_clock::now() - start;
+	std::cout << "explored " << config->seeds << " seeds at " << config->resolution << " texels in " << duration.count() << " s, best seed " << ranking[0].seed << " with " << int(100.f * ranking[0].grassland) << "% grassland" << std::endl;
+
+	return written;
+}
@@ -0,0 +1,30 @@
+// generates low resolution previews of many seeds on all threads and ranks them by their statistics
+// the previews sample the same world as the full heightmap, so a seed picked from the index looks the same with --seed
+enum {
+	EXPLORE_HEIGHT_BINS = 16,
+	EXPLORE_SLOPE_BINS = 8
+};
+
+struct exploreconfig {
+	const char *output; // prefix of the index and the thumbnails
+	long firstseed;
+	unsigned int seeds;
+	size_t resolution; // preview texels per side
+	size_t worldsize; // texels per side of the full heightmap the previews sample
+	unsigned int thumbnails; // of the best seeds
+	float waterlevel; // normalized height
+};
+
+struct seedstats {
+	long seed;
+	float score;
+	float meanheight;
+	float water; // fraction of the texels under the water level
+	float grass; // fraction where grass can grow, slope under 0.6 and height under 0.4
+	float grassland; // grass above the water
+	float steep; // slope over 0.6
+	float heights[EXPLORE_HEIGHT_BINS]; // fractions of the texels
+	float slopes[EXPLORE_SLOPE_BINS];
+};
+
+bool run_exploration(const struct exploreconfig *config);
@@ -0,0 +1,468 @@
+#include <iostream>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <glm/glm.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "imp.h"
+#include "bcn.h"
+#include "dds.h"
+#include "glwrapper.h"
+#include "memory.h"
+#include "shader.h"
+#include "camera.h"
+#include "culling.h"
+#include "terrain.h"
+#include "submission.h"
+#include "forest.h"
+
+#define TREE_HEIGHT 12.f // height of a tree with scale 1
+#define TREE_LINE 0.4f // normalized height above which no trees grow
+#define TREE_SHORE 0.02f // min normalized height above the water
+#define TREE_LOD_DISTANCE 200.f
+
+struct treevertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texcoord; // x = 0 for bark and 1 for leaves, y = brightness
+};
+
+static void add_trunk(std::vector<struct treevertex> &vertices, std::vector<GLushort> &indices, float radius, float height, int segments)
+{
+	const GLushort base = vertices.size();
+	for (int i = 0; i <= segments; i++) {
+		const float angle = 2.f * float(M_PI) * i / segments;
+		const glm::vec3 direction = glm::vec3(cosf(angle), 0.f, sinf(angle));
+		vertices.push_back({ radius * direction, direction, glm::vec2(0.f, 0.5f) });
+		vertices.push_back({ radius * direction + glm::vec3(0.f, height, 0.f), direction, glm::vec2(0.f, 1.f) });
+	}
+	for (int i = 0; i < segments; i++) {
+		const GLushort a = base + 2*i;
+		indices.insert(indices.end(), { a, GLushort(a+1), GLushort(a+2), GLushort(a+2), GLushort(a+1), GLushort(a+3) });
+	}
+}
+
+// open cone of leaves with a flat bottom
+static void add_cone(std::vector<struct treevertex> &vertices, std::vector<GLushort> &indices, float bottom, float top, float radius, int segments)
+{
+	const float height = top - bottom;
+
+	const GLushort ring = vertices.size();
+	for (int i = 0; i <= segments; i++) {
+		const float angle = 2.f * float(M_PI) * i / segments;
+		const glm::vec3 normal = glm::normalize(glm::vec3(cosf(angle) * height, radius, sinf(angle) * height));
+		vertices.push_back({ glm::vec3(radius * cosf(angle), bottom, radius * sinf(angle)), normal, glm::vec2(1.f, 0.7f) });
+	}
+	// one apex per side so the normals stay smooth around the cone
+	const GLushort apex = vertices.size();
+	for (int i = 0; i < segments; i++) {
+		const float angle = 2.f * float(M_PI) * (i + 0.5f) / segments;
+		const glm::vec3 normal = glm::normalize(glm::vec3(cosf(angle) * height, radius, sinf(angle) * height));
+		vertices.push_back({ glm::vec3(0.f, top, 0.f), normal, glm::vec2(1.f, 1.f) });
+	}
+	const GLushort center = vertices.size();
+	vertices.push_back({ glm::vec3(0.f, bottom, 0.f), glm::vec3(0.f, -1.f, 0.f), glm::vec2(1.f, 0.3f) });
+	const GLushort cap = vertices.size();
+	for (int i = 0; i <= segments; i++) {
+		const float angle = 2.f * float(M_PI) * i / segments;
+		vertices.push_back({ glm::vec3(radius * cosf(angle), bottom, radius * sinf(angle)), glm::vec3(0.f, -1.f, 0.f), glm::vec2(1.f, 0.3f) });
+	}
+
+	for (int i = 0; i < segments; i++) {
+		indices.insert(indices.end(), { GLushort(ring+i), GLushort(apex+i), GLushort(ring+i+1) });
+		indices.insert(indices.end(), { center, GLushort(cap+i), GLushort(cap+i+1) });
+	}
+}
+
+// a conifer of height about 1 with its root at the origin
+static struct mesh gen_tree_mesh(void)
+{
+	std::vector<struct treevertex> vertices;
+	std::vector<GLushort> indices;
+
+	add_trunk(vertices, indices, 0.035f, 0.35f, 8);
+	add_cone(vertices, indices, 0.2f, 0.65f, 0.32f, 12);
+	add_cone(vertices, indices, 0.4f, 0.85f, 0.25f, 12);
+	add_cone(vertices, indices, 0.6f, 1.05f, 0.17f, 12);
+
+	struct mesh tree = {
+		.VAO = 0, .VBO = 0, .EBO = 0,
+		.mode = GL_TRIANGLES,
+		.ecount = GLsizei(indices.size()),
+		.indexed = true
+	};
+
+	glGenVertexArrays(1, &tree.VAO);
+	glBindVertexArray(tree.VAO);
+
+	glGenBuffers(1, &tree.EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tree.EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+	track_buffer(tree.EBO, indices.size() * sizeof(GLushort));
+
+	glGenBuffers(1, &tree.VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, tree.VBO);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(struct treevertex), vertices.data(), GL_STATIC_DRAW);
+	track_buffer(tree.VBO, vertices.size() * sizeof(struct treevertex));
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct treevertex), BUFFER_OFFSET(offsetof(struct treevertex, position)));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(struct treevertex), BUFFER_OFFSET(offsetof(struct treevertex, normal)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(struct treevertex), BUFFER_OFFSET(offsetof(struct treevertex, texcoord)));
+
+	glBindVertexArray(0);
+
+	return tree;
+}
+
+static struct mesh gen_billboard(void)
+{
+	struct mesh billboard = {
+		.VAO = 0, .VBO = 0, .EBO = 0,
+		.mode = GL_TRIANGLE_STRIP,
+		.ecount = 4,
+		.indexed = false
+	};
+
+	const GLfloat corners[] = {
+		-1.f, -1.f,
+		1.f, -1.f,
+		-1.f, 1.f,
+		1.f, 1.f
+	};
+
+	glGenVertexArrays(1, &billboard.VAO);
+	glBindVertexArray(billboard.VAO);
+
+	glGenBuffers(1, &billboard.VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, billboard.VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	track_buffer(billboard.VBO, sizeof(corners));
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+	glBindVertexArray(0);
+
+	return billboard;
+}
+
+// inverse of the hemi octahedral mapping in the impostor shader
+static glm::vec3 hemi_direction(glm::vec2 uv)
+{
+	const float x = uv.x - uv.y;
+	const float z = uv.x + uv.y - 1.f;
+
+	return glm::normalize(glm::vec3(x, 1.f - fabsf(x) - fabsf(z), z));
+}
+
+static GLuint create_atlas_texture(GLsizei size)
+{
+	GLuint texture;
+
+	// the mipmaps are generated after the bake
+	unsigned int levels = 1;
+	while ((size >> levels) > 0) { levels++; }
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	track_texture(texture, texture_bytes(GL_RGBA8, size, size, 1, levels));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return texture;
+}
+
+// without bindless textures the atlases are layers of one array texture, so the draws only need a layer index
+static GLuint create_atlas_array(GLuint color, GLuint normal, GLsizei size)
+{
+	GLsizei levels = 1;
+	while ((size >> levels) > 0) { levels++; }
+
+	GLuint array;
+	glGenTextures(1, &array);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, size, size, 2);
+	track_texture(array, 2 * texture_bytes(GL_RGBA8, size, size, 1, levels));
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	for (GLsizei level = 0; level < levels; level++) {
+		const GLsizei side = std::max(size >> level, 1);
+		glCopyImageSubData(color, GL_TEXTURE_2D, level, 0, 0, 0, array, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, side, side, 1);
+		glCopyImageSubData(normal, GL_TEXTURE_2D, level, 0, 0, 0, array, GL_TEXTURE_2D_ARRAY, level, 0, 0, 1, side, side, 1);
+	}
+
+	return array;
+}
+
+// picks the tree positions from the terrain images only, so it can run before the terrain is uploaded
+std::vector<glm::vec4> plant_forest(const Terrain *terrain, float sealevel, size_t density, unsigned int seed)
+{
+	return scatter_trees(&terrain->heightimage, &terrain->normalimage, terrain->sidelength, sealevel + TREE_SHORE, TREE_LINE, density, seed);
+}
+
+Forest::Forest(const Terrain *terrain, const std::vector<glm::vec4> &trees, const Shader *bakeprogram)
+{
+	MemoryScope scope(MEMORY_FOREST);
+
+	lodistance = TREE_LOD_DISTANCE;
+	heightmap = terrain->heightmap;
+	occlusmap = terrain->occlusmap;
+
+	// counting sort of the trees by cell
+	const float cellsize = float(terrain->sidelength) / FOREST_CELLS;
+	auto cell_of = [&](const glm::vec4 &tree) -> size_t {
+		const size_t col = std::min(size_t(tree.x / cellsize), size_t(FOREST_CELLS - 1));
+		const size_t row = std::min(size_t(tree.z / cellsize), size_t(FOREST_CELLS - 1));
+		return row * FOREST_CELLS + col;
+	};
+
+	cells.resize(FOREST_CELLS * FOREST_CELLS);
+	for (auto &cell : cells) {
+		cell.min = glm::vec3(INFINITY);
+		cell.max = glm::vec3(-INFINITY);
+		cell.first = 0;
+		cell.count = 0;
+	}
+	for (const auto &tree : trees) { cells[cell_of(tree)].count++; }
+	for (size_t i = 1; i < cells.size(); i++) {
+		cells[i].first = cells[i-1].first + cells[i-1].count;
+	}
+
+	std::vector<size_t> cursor(cells.size());
+	for (size_t i = 0; i < cells.size(); i++) { cursor[i] = cells[i].first; }
+
+	instances.resize(trees.size());
+	for (const auto &tree : trees) {
+		const size_t index = cell_of(tree);
+		// sink the root a bit so it does not float on slopes
+		const glm::vec4 instance = glm::vec4(tree.x, tree.y * terrain->amplitude - 0.5f, tree.z, tree.w * TREE_HEIGHT);
+		instances[cursor[index]++] = instance;
+
+		struct forestcell &cell = cells[index];
+		const float reach = 0.35f * instance.w;
+		cell.min = glm::min(cell.min, glm::vec3(instance.x - reach, instance.y, instance.z - reach));
+		cell.max = glm::max(cell.max, glm::vec3(instance.x + reach, instance.y + 1.05f * instance.w, instance.z + reach));
+	}
+
+	tree = gen_tree_mesh();
+	billboard = gen_billboard();
+
+	// the instances never change, the draws pick the range of a cell with their base instance
+	instancebuffer = instance_vec4_VAO(tree.VAO, instances.size());
+	if (instances.empty() == false) {
+		glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(glm::vec4), instances.data());
+	}
+	glBindVertexArray(billboard.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+	glEnableVertexAttribArray(5);
+	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), BUFFER_OFFSET(0));
+	glVertexAttribDivisor(5, 1);
+	glBindVertexArray(0);
+
+	nearqueue = new IndirectQueue { true, sizeof(struct forestdraw), cells.size() };
+	farqueue = new IndirectQueue { false, sizeof(struct forestdraw), cells.size() };
+
+	atlas.center = 0.55f;
+	atlas.radius = 0.56f;
+	bake(bakeprogram);
+
+	atlas.layers = 0;
+	atlas.colorhandle = resident_handle(atlas.color);
+	atlas.normalhandle = resident_handle(atlas.normal);
+	if (atlas.colorhandle == 0 || atlas.normalhandle == 0) {
+		atlas.colorhandle = atlas.normalhandle = 0;
+		atlas.layers = create_atlas_array(atlas.color, atlas.normal, IMPOSTOR_FRAMES * IMPOSTOR_RESOLUTION);
+	}
+}
+
+Forest::~Forest(void)
+{
+	delete nearqueue;
+	delete farqueue;
+	untrack_buffer(instancebuffer);
+	glDeleteBuffers(1, &instancebuffer);
+	delete_mesh(&tree);
+	delete_mesh(&billboard);
+
+	untrack_texture(atlas.color);
+	untrack_texture(atlas.normal);
+	untrack_texture(atlas.layers);
+	if (glIsTexture(atlas.color) == GL_TRUE) { glDeleteTextures(1, &atlas.color); }
+	if (glIsTexture(atlas.normal) == GL_TRUE) { glDeleteTextures(1, &atlas.normal); }
+	if (glIsTexture(atlas.layers) == GL_TRUE) { glDeleteTextures(1, &atlas.layers); }
+}
+
+// renders the tree mesh from views spread over the upper hemisphere into the impostor atlas
+void Forest::bake(const Shader *shader)
+{
+	const GLsizei size = IMPOSTOR_FRAMES * IMPOSTOR_RESOLUTION;
+	atlas.color = create_atlas_texture(size);
+	atlas.normal = create_atlas_texture(size);
+
+	GLuint depth;
+	glGenRenderbuffers(1, &depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+	track_renderbuffer(depth, texture_bytes(GL_DEPTH_COMPONENT24, size, size, 1, 1));
+
+	GLuint FBO;
+	glGenFramebuffers(1, &FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlas.color, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, atlas.normal, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	const GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, attachments);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "error: impostor framebuffer incomplete\n";
+	}
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	GLfloat clearcolor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearcolor);
+	const GLboolean blending = glIsEnabled(GL_BLEND);
+
+	disable_state(GL_BLEND);
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	glViewport(0, 0, size, size);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	shader->bind();
+	shader->uniform_bool("bake", true);
+
+	// a single unrotated tree of scale 1 at the origin
+	glBindVertexArray(tree.VAO);
+	glDisableVertexAttribArray(5);
+	glVertexAttrib4f(5, 0.f, 0.f, 0.f, 1.f);
+
+	const float R = atlas.radius;
+	const glm::vec3 middle = glm::vec3(0.f, atlas.center, 0.f);
+	const glm::mat4 project = glm::ortho(-R, R, -R, R, 0.f, 4.f * R);
+	for (int y = 0; y < IMPOSTOR_FRAMES; y++) {
+		for (int x = 0; x < IMPOSTOR_FRAMES; x++) {
+			const glm::vec3 direction = hemi_direction((glm::vec2(x, y) + 0.5f) / float(IMPOSTOR_FRAMES));
+			// has to match the basis of the billboard in the impostor shader
+			const glm::vec3 right = (fabsf(direction.y) > 0.999f) ? glm::vec3(1.f, 0.f, 0.f) : glm::normalize(glm::cross(glm::vec3(0.f, 1.f, 0.f), direction));
+			const glm::vec3 up = glm::cross(direction, right);
+			const glm::mat4 view = glm::lookAt(middle + 2.f * R * direction, middle, up);
+
+			glViewport(x * IMPOSTOR_RESOLUTION, y * IMPOSTOR_RESOLUTION, IMPOSTOR_RESOLUTION, IMPOSTOR_RESOLUTION);
+			shader->uniform_mat4("VIEW_PROJECT", project * view);
+			glDrawElements(tree.mode, tree.ecount, GL_UNSIGNED_SHORT, NULL);
+		}
+	}
+
+	glEnableVertexAttribArray(5);
+	glBindVertexArray(0);
+	shader->uniform_bool("bake", false);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &FBO);
+	untrack_renderbuffer(depth);
+	glDeleteRenderbuffers(1, &depth);
+
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glClearColor(clearcolor[0], clearcolor[1], clearcolor[2], clearcolor[3]);
+	if (blending) { enable_state(GL_BLEND); }
+
+	glBindTexture(GL_TEXTURE_2D, atlas.color);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, atlas.normal);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// frustum and occlusion culls the cells and adds a draw of the full meshes or the impostors for every visible cell
+// a cell that straddles the lod distance gets both, and the vertex shaders drop the trees on the wrong side of it
+void Forest::cull(const glm::mat4 &VIEW_PROJECT, glm::vec3 camerapos, const OcclusionCuller *culler)
+{
+	const struct frustum frustum = extract_frustum(VIEW_PROJECT);
+	const float nearsquared = lodistance * lodistance;
+
+	nearqueue->clear();
+	farqueue->clear();
+
+	struct forestdraw draw;
+	draw.layers[0] = 0;
+	draw.layers[1] = 1;
+	draw.handles[0] = atlas.colorhandle;
+	draw.handles[1] = atlas.normalhandle;
+
+	for (const auto &cell : cells) {
+		if (cell.count == 0) { continue; }
+		if (AABB_in_frustum(&frustum, cell.min, cell.max) == false) { continue; }
+		if (culler && culler->visible(cell.min, cell.max) == false) { continue; }
+
+		const glm::vec3 closest = glm::clamp(camerapos, cell.min, cell.max);
+		const glm::vec3 furthest = glm::vec3(
+			(camerapos.x - cell.min.x > cell.max.x - camerapos.x) ? cell.min.x : cell.max.x,
+			(camerapos.y - cell.min.y > cell.max.y - camerapos.y) ? cell.min.y : cell.max.y,
+			(camerapos.z - cell.min.z > cell.max.z - camerapos.z) ? cell.min.z : cell.max.z
+		);
+
+		const glm::vec3 tofurthest = furthest - camerapos;
+		const glm::vec3 toclosest = closest - camerapos;
+		const bool hasnear = glm::dot(toclosest, toclosest) < nearsquared;
+		const bool hasfar = glm::dot(tofurthest, tofurthest) >= nearsquared;
+
+		if (hasnear) {
+			const struct elementscommand command = { GLuint(tree.ecount), GLuint(cell.count), 0, 0, GLuint(cell.first) };
+			draw.band[0] = 0.f;
+			draw.band[1] = hasfar ? nearsquared : INFINITY;
+			nearqueue->add(&command, &draw);
+		}
+		if (hasfar) {
+			const struct arrayscommand command = { GLuint(billboard.ecount), GLuint(cell.count), 0, GLuint(cell.first) };
+			draw.band[0] = hasnear ? nearsquared : 0.f;
+			draw.band[1] = INFINITY;
+			farqueue->add(&command, &draw);
+		}
+	}
+}
+
+void Forest::display(void) const
+{
+	if (nearqueue->count() == 0) { return; }
+
+	activate_texture(GL_TEXTURE0, GL_TEXTURE_2D, heightmap);
+	activate_texture(GL_TEXTURE2, GL_TEXTURE_2D, occlusmap);
+
+	glBindVertexArray(tree.VAO);
+	nearqueue->submit(tree.mode);
+}
+
+void Forest::display_impostors(void) const
+{
+	if (farqueue->count() == 0) { return; }
+
+	activate_texture(GL_TEXTURE0, GL_TEXTURE_2D, heightmap);
+	activate_texture(GL_TEXTURE2, GL_TEXTURE_2D, occlusmap);
+	if (atlas.layers) { activate_texture(GL_TEXTURE4, GL_TEXTURE_2D_ARRAY, atlas.layers); }
+
+	glBindVertexArray(billboard.VAO);
+	farqueue->submit(billboard.mode);
+}
@@ -0,0 +1,64 @@
+enum {
+	FOREST_CELLS = 16, // cells per side of the terrain
+	IMPOSTOR_FRAMES = 8, // baked views per side of the impostor atlas
+	IMPOSTOR_RESOLUTION = 128 // texels per side of a baked view
+};
+
+// trees are sorted by cell, a cell is a range of the instance array
+struct forestcell {
+	glm::vec3 min; // bounds of the trees in the cell
+	glm::vec3 max;
+	size_t first;
+	size_t count;
+};
+
+struct impostor {
+	GLuint color;
+	GLuint normal;
+	GLuint layers; // color and normal as layers of an array texture, only without bindless textures
+	GLuint64 colorhandle; // bindless handles, 0 without bindless textures
+	GLuint64 normalhandle;
+	float radius; // bounding sphere of a tree with scale 1
+	float center;
+};
+
+// data of a draw of the forest, std430 layout of the draw data in the tree shaders
+struct forestdraw {
+	GLfloat band[2]; // squared distances from the camera of the trees this draw keeps, for cells that straddle the lod distance
+	GLuint layers[2]; // color and normal layer of the impostor atlas
+	GLuint64 handles[2];
+};
+
+// root of every tree in map space with the normalized height in y and a random scale in w
+std::vector<glm::vec4> plant_forest(const Terrain *terrain, float sealevel, size_t density, unsigned int seed);
+
+class Forest {
+public:
+	float lodistance; // trees further away are drawn as impostors
+public:
+	Forest(const Terrain *terrain, const std::vector<glm::vec4> &trees, const Shader *bakeprogram);
+	~Forest(void);
+	void cull(const glm::mat4 &VIEW_PROJECT, glm::vec3 camerapos, const OcclusionCuller *culler);
+	void display(void) const;
+	void display_impostors(void) const;
+	const struct impostor *impostor_atlas(void) const { return &atlas; }
+	size_t total(void) const { return instances.size(); }
+	// instances in the draws, the trees of cells that straddle the lod distance count on both sides
+	size_t nearcount(void) const { return nearqueue->instances(); }
+	size_t farcount(void) const { return farqueue->instances(); }
+	size_t drawcount(void) const { return nearqueue->count() + farqueue->count(); }
+private:
+	std::vector<glm::vec4> instances; // root and scale of every tree
+	std::vector<struct forestcell> cells;
+	// a draw per visible cell straight from the static instance buffer, so the cost per frame does not grow with the tree count
+	IndirectQueue *nearqueue;
+	IndirectQueue *farqueue;
+	struct mesh tree;
+	struct mesh billboard;
+	GLuint instancebuffer;
+	struct impostor atlas;
+	GLuint heightmap;
+	GLuint occlusmap;
+private:
+	void bake(const Shader *shader);
+};
@@ -1,8 +1,12 @@
 #include <iostream>
+#include <cstdint>
+#include <cstring>
 #include <vector>
+#include <algorithm>
 #include <GL/glew.h>
 #include <GL/gl.h>
 
+#include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
@@ -12,40 +16,98 @@
 #include "external/stbimage/stb_image.h"
 
 #include "imp.h"
+#include "memory.h"
+#include "bcn.h"
 #include "glwrapper.h"
 
-// make a square patch grid along the x and z axis, needs a tessellation shader to render
-struct mesh gen_patch_grid(const size_t sidelength, const float offset)
+#define STATE_CAPABILITIES 8
+
+// shadow of the GL state, a unit is only known once it was bound through here
+static struct {
+	GLenum activeunit; // 0 when unknown
+	struct texturebinding units[STATE_TEXTURE_UNITS];
+	bool known[STATE_TEXTURE_UNITS];
+	GLenum capabilities[STATE_CAPABILITIES];
+	bool enabled[STATE_CAPABILITIES];
+	int ncapabilities;
+	struct statecounters counters;
+} glstate;
+
+static void select_unit(GLenum unit)
+{
+	if (glstate.activeunit == unit) {
+		glstate.counters.skipped++;
+		return;
+	}
+
+	glActiveTexture(unit);
+	glstate.activeunit = unit;
+	glstate.counters.issued++;
+}
+
+// binds to the active unit, the loaders below bind through this so they keep the shadow in sync
+// a unit may have textures bound to several targets, the shadow only holds the last one so it never skips a bind it should not
+static void bind_current(GLenum target, GLuint texture)
+{
+	glBindTexture(target, texture);
+
+	const unsigned int index = glstate.activeunit - GL_TEXTURE0;
+	if (glstate.activeunit == 0) {
+		std::fill_n(glstate.known, STATE_TEXTURE_UNITS, false);
+	} else if (index < STATE_TEXTURE_UNITS) {
+		glstate.units[index] = { target, texture };
+		glstate.known[index] = true;
+	}
+}
+
+static bool texture_bound(unsigned int index, GLenum target, GLuint texture)
+{
+	if (index >= STATE_TEXTURE_UNITS || glstate.known[index] == false) { return false; }
+
+	return glstate.units[index].target == target && glstate.units[index].texture == texture;
+}
+
+static void set_capability(GLenum capability, bool enable)
+{
+	int slot = 0;
+	while (slot < glstate.ncapabilities && glstate.capabilities[slot] != capability) { slot++; }
+
+	if (slot < glstate.ncapabilities && glstate.enabled[slot] == enable) {
+		glstate.counters.skipped++;
+		return;
+	}
+
+	if (enable) {
+		glEnable(capability);
+	} else {
+		glDisable(capability);
+	}
+	glstate.counters.issued++;
+
+	if (slot == glstate.ncapabilities) {
+		if (slot == STATE_CAPABILITIES) { return; }
+		glstate.capabilities[slot] = capability;
+		glstate.ncapabilities++;
+	}
+	glstate.enabled[slot] = enable;
+}
+
+static struct mesh upload_patches(const std::vector<glm::vec3> &vertices)
 {
 	struct mesh patch = {
 		.VAO = 0, .VBO = 0, .EBO = 0,
 		.mode = GL_PATCHES,
-		.ecount = GLsizei(4 * sidelength * sidelength),
+		.ecount = GLsizei(vertices.size()),
 		.indexed = false
 	};
 
-	std::vector<glm::vec3> vertices;
-	vertices.reserve(patch.ecount);
-
-	glm::vec3 origin = glm::vec3(0.f, 0.f, 0.f);
-	for (int x = 0; x < sidelength; x++) {
-		for (int z = 0; z < sidelength; z++) {
-			vertices.push_back(glm::vec3(origin.x, origin.y, origin.z));
-			vertices.push_back(glm::vec3(origin.x+offset, origin.y, origin.z));
-			vertices.push_back(glm::vec3(origin.x, origin.y, origin.z+offset));
-			vertices.push_back(glm::vec3(origin.x+offset, origin.y, origin.z+offset));
-			origin.x += offset;
-		}
-		origin.x = 0.f;
-		origin.z += offset;
-	}
-
 	glGenVertexArrays(1, &patch.VAO);
 	glBindVertexArray(patch.VAO);
 
 	glGenBuffers(1, &patch.VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, patch.VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*vertices.size(), &vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*vertices.size(), vertices.data(), GL_STATIC_DRAW);
+	track_buffer(patch.VBO, sizeof(glm::vec3)*vertices.size());
 
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
@@ -58,6 +120,38 @@ struct mesh gen_patch_grid(const size_t sidelength, const float offset)
 	return patch;
 }
 
+// make a square patch grid along the x and z axis, needs a tessellation shader to render
+struct mesh gen_patch_grid(const size_t sidelength, const float offset)
+{
+	const std::vector<bool> mask(sidelength * sidelength, true);
+
+	return gen_masked_patch_grid(sidelength, offset, mask);
+}
+
+// same as the patch grid but only keeps the patches enabled in the mask, one entry per patch in rows along the x axis
+struct mesh gen_masked_patch_grid(const size_t sidelength, const float offset, const std::vector<bool> &mask)
+{
+	std::vector<glm::vec3> vertices;
+	vertices.reserve(4 * sidelength * sidelength);
+
+	glm::vec3 origin = glm::vec3(0.f, 0.f, 0.f);
+	for (int z = 0; z < sidelength; z++) {
+		for (int x = 0; x < sidelength; x++) {
+			if (mask[z * sidelength + x]) {
+				vertices.push_back(glm::vec3(origin.x, origin.y, origin.z));
+				vertices.push_back(glm::vec3(origin.x+offset, origin.y, origin.z));
+				vertices.push_back(glm::vec3(origin.x, origin.y, origin.z+offset));
+				vertices.push_back(glm::vec3(origin.x+offset, origin.y, origin.z+offset));
+			}
+			origin.x += offset;
+		}
+		origin.x = 0.f;
+		origin.z += offset;
+	}
+
+	return upload_patches(vertices);
+}
+
 /*
  * a -- b
  * |	|
@@ -93,6 +187,7 @@ struct mesh gen_quad(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d)
 	glGenBuffers(1, &quads.VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, quads.VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(positions)+sizeof(texcoords), NULL, GL_STATIC_DRAW);
+	track_buffer(quads.VBO, sizeof(positions)+sizeof(texcoords));
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(positions), positions);
  	glBufferSubData(GL_ARRAY_BUFFER, sizeof(positions), sizeof(texcoords), texcoords);
 
@@ -166,10 +261,12 @@ struct mesh gen_cardinal_quads(void)
 	glGenBuffers(1, &quads.EBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quads.EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW); 
+	track_buffer(quads.EBO, sizeof(indices));
 
 	glGenBuffers(1, &quads.VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, quads.VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(positions)+sizeof(texcoords), NULL, GL_STATIC_DRAW);
+	track_buffer(quads.VBO, sizeof(positions)+sizeof(texcoords));
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(positions), positions);
  	glBufferSubData(GL_ARRAY_BUFFER, sizeof(positions), sizeof(texcoords), texcoords);
 
@@ -215,10 +312,12 @@ struct mesh gen_mapcube(void)
 	glGenBuffers(1, &cube.EBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube.EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW); 
+	track_buffer(cube.EBO, sizeof(indices));
 
 	glGenBuffers(1, &cube.VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, cube.VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+	track_buffer(cube.VBO, sizeof(positions));
 
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
@@ -228,6 +327,8 @@ struct mesh gen_mapcube(void)
 
 void delete_mesh(const struct mesh *m)
 {
+	untrack_buffer(m->EBO);
+	untrack_buffer(m->VBO);
 	glDeleteBuffers(1, &m->EBO);
 	glDeleteBuffers(1, &m->VBO);
 	glDeleteVertexArrays(1, &m->VAO);
@@ -238,17 +339,124 @@ GLuint bind_texture(const struct rawimage *image, GLenum internalformat, GLenum
 	GLuint texture;
 
 	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
+	bind_current(GL_TEXTURE_2D, texture);
 	glTexStorage2D(GL_TEXTURE_2D, 1, internalformat, image->width, image->height);
+	track_texture(texture, texture_bytes(internalformat, image->width, image->height, 1, 1));
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image->width, image->height, format, type, image->data);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	bind_current(GL_TEXTURE_2D, 0);
+
+	return texture;
+}
+
+// replaces the contents of a texture made with bind_texture, the image must have the same size and format
+void update_texture(GLuint texture, const struct rawimage *image)
+{
+	GLenum internalformat, format, type;
+	texture_formats(image, &internalformat, &format, &type);
+
+	bind_current(GL_TEXTURE_2D, texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image->width, image->height, format, type, image->data);
+	bind_current(GL_TEXTURE_2D, 0);
+}
+
+// uploads only an area of the image, the rest of the texture is left as it is
+void update_texture_rect(GLuint texture, const struct rawimage *image, const struct rect *area)
+{
+	GLenum internalformat, format, type;
+	texture_formats(image, &internalformat, &format, &type);
+
+	const size_t texelsize = image->nchannels * format_size(image->format);
+	const unsigned char *first = &image->data[(area->y0 * image->width + area->x0) * texelsize];
+
+	bind_current(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, GLint(image->width));
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, area->x0, area->y0, area->x1 - area->x0, area->y1 - area->y0, format, type, first);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	bind_current(GL_TEXTURE_2D, 0);
+}
+
+// picks the texture formats matching the storage format and channels of the image
+void texture_formats(const struct rawimage *image, GLenum *internalformat, GLenum *format, GLenum *type)
+{
+	const GLenum FORMATS[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+	const GLenum U8_FORMATS[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+	const GLenum U16_FORMATS[4] = { GL_R16, GL_RG16, GL_RGB16, GL_RGBA16 };
+	const GLenum F16_FORMATS[4] = { GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F };
+	const GLenum F32_FORMATS[4] = { GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F };
+
+	const unsigned int channel = glm::clamp(image->nchannels, 1u, 4u) - 1;
+	*format = FORMATS[channel];
+
+	switch (image->format) {
+	case IMAGE_U8:
+		*internalformat = U8_FORMATS[channel];
+		*type = GL_UNSIGNED_BYTE;
+		break;
+	case IMAGE_U16:
+		*internalformat = U16_FORMATS[channel];
+		*type = GL_UNSIGNED_SHORT;
+		break;
+	case IMAGE_F16:
+		*internalformat = F16_FORMATS[channel];
+		*type = GL_HALF_FLOAT;
+		break;
+	case IMAGE_F32:
+		*internalformat = F32_FORMATS[channel];
+		*type = GL_FLOAT;
+		break;
+	}
+}
+
+static GLenum block_internalformat(enum blockformat format)
+{
+	switch (format) {
+	case BLOCK_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BLOCK_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BLOCK_BC4: return GL_COMPRESSED_RED_RGTC1;
+	case BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+	}
+
+	return GL_NONE;
+}
+
+// compressed version of bind_texture, the blocks are uploaded as they are
+GLuint bind_block_texture(const struct blockimage *image)
+{
+	GLuint texture;
+
+	glGenTextures(1, &texture);
+	bind_current(GL_TEXTURE_2D, texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, block_internalformat(image->format), image->width, image->height);
+	track_texture(texture, image->data.size());
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image->width, image->height, block_internalformat(image->format), GLsizei(image->data.size()), image->data.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	bind_current(GL_TEXTURE_2D, 0);
 
 	return texture;
 }
 
+void update_block_texture(GLuint texture, const struct blockimage *image)
+{
+	bind_current(GL_TEXTURE_2D, texture);
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image->width, image->height, block_internalformat(image->format), GLsizei(image->data.size()), image->data.data());
+	bind_current(GL_TEXTURE_2D, 0);
+}
+
+// replaces the blocks of an area starting at x, y, which have to be multiples of 4
+void update_block_texture_rect(GLuint texture, const struct blockimage *image, int x, int y)
+{
+	bind_current(GL_TEXTURE_2D, texture);
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, image->width, image->height, block_internalformat(image->format), GLsizei(image->data.size()), image->data.data());
+	bind_current(GL_TEXTURE_2D, 0);
+}
+
 // generate mip mapped texture
 GLuint bind_mipmap_texture(struct rawimage *image, GLenum internalformat, GLenum format, GLenum type)
 {
@@ -257,8 +465,9 @@ GLuint bind_mipmap_texture(struct rawimage *image, GLenum internalformat, GLenum
 	GLsizei NUM_MIPMAPS = 6;
 
 	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
+	bind_current(GL_TEXTURE_2D, texture);
 	glTexStorage2D(GL_TEXTURE_2D, NUM_MIPMAPS, internalformat, image->width, image->height);
+	track_texture(texture, texture_bytes(internalformat, image->width, image->height, 1, NUM_MIPMAPS));
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image->width, image->height, format, type, image->data);
 
 	glGenerateMipmap(GL_TEXTURE_2D);
@@ -268,36 +477,140 @@ GLuint bind_mipmap_texture(struct rawimage *image, GLenum internalformat, GLenum
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	bind_current(GL_TEXTURE_2D, 0);
 
 	return texture;
 }
 
 void activate_texture(GLenum unit, GLenum target, GLuint texture)
 {
-	glActiveTexture(unit);
-	glBindTexture(target, texture);
+	if (texture_bound(unit - GL_TEXTURE0, target, texture)) {
+		glstate.counters.skipped++;
+		return;
+	}
+
+	select_unit(unit);
+	bind_current(target, texture);
+	glstate.counters.issued++;
 }
 
-GLuint load_TGA_cubemap(const char *fpath[6])
+// binds consecutive units, only the range from the first to the last unit that changed is bound
+// with multi-bind that range is a single call that does not touch the active unit
+void activate_textures(GLenum firstunit, GLsizei count, const struct texturebinding *bindings)
 {
-	GLuint texture;
+	const unsigned int first = firstunit - GL_TEXTURE0;
+	if (first + count > STATE_TEXTURE_UNITS) {
+		for (GLsizei i = 0; i < count; i++) {
+			activate_texture(firstunit + i, bindings[i].target, bindings[i].texture);
+		}
+		return;
+	}
 
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+	GLsizei lo = count;
+	GLsizei hi = -1;
+	for (GLsizei i = 0; i < count; i++) {
+		if (texture_bound(first + i, bindings[i].target, bindings[i].texture) == false) {
+			lo = std::min(lo, i);
+			hi = i;
+		}
+	}
+	if (hi < lo) {
+		glstate.counters.skipped += count;
+		return;
+	}
+	glstate.counters.skipped += count - (hi - lo + 1);
+
+	if (GLEW_ARB_multi_bind) {
+		GLuint names[STATE_TEXTURE_UNITS];
+		for (GLsizei i = lo; i <= hi; i++) {
+			names[i - lo] = bindings[i].texture;
+			glstate.units[first + i] = bindings[i];
+			glstate.known[first + i] = true;
+		}
+		glBindTextures(first + lo, hi - lo + 1, names);
+		glstate.counters.issued++;
+		glstate.counters.batched += hi - lo;
+	} else {
+		for (GLsizei i = lo; i <= hi; i++) {
+			activate_texture(firstunit + i, bindings[i].target, bindings[i].texture);
+		}
+	}
+}
+
+// the handle is resident until the texture is deleted, the texture can not change its parameters after this
+GLuint64 resident_handle(GLuint texture)
+{
+	if (GLEW_ARB_bindless_texture == false) { return 0; }
+
+	const GLuint64 handle = glGetTextureHandleARB(texture);
+	if (handle) { glMakeTextureHandleResidentARB(handle); }
 
+	return handle;
+}
+
+void enable_state(GLenum capability)
+{
+	set_capability(capability, true);
+}
+
+void disable_state(GLenum capability)
+{
+	set_capability(capability, false);
+}
+
+void invalidate_state(void)
+{
+	glstate.activeunit = 0;
+	std::fill_n(glstate.known, STATE_TEXTURE_UNITS, false);
+	glstate.ncapabilities = 0;
+}
+
+struct statecounters state_counters(void)
+{
+	return glstate.counters;
+}
+
+void reset_state_counters(void)
+{
+	glstate.counters = {};
+}
+
+// decodes the six faces of a cubemap, does not touch the GL context
+bool load_TGA_faces(const char *fpath[6], struct rawimage faces[6])
+{
 	for (int face = 0; face < 6; face++) {
-		GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
 		int width, height, nchannels;
-		unsigned char *image = stbi_load(fpath[face], &width, &height, &nchannels, 0);
-		if (image) {
-			glTexImage2D(target, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-			stbi_image_free(image);
-		} else {
+		unsigned char *image = stbi_load(fpath[face], &width, &height, &nchannels, 3);
+		if (image == nullptr) {
 			std::cerr << "cubemap error: failed to load " << fpath[face] << std::endl;
-			return 0;
+			return false;
 		}
+		faces[face].nchannels = 3;
+		faces[face].width = width;
+		faces[face].height = height;
+		faces[face].format = IMAGE_U8;
+		faces[face].data = tracked_alloc(width * height * 3);
+		memcpy(faces[face].data, image, width * height * 3);
+		stbi_image_free(image);
+	}
+
+	return true;
+}
+
+GLuint bind_cubemap(const struct rawimage faces[6])
+{
+	GLuint texture;
+
+	glGenTextures(1, &texture);
+	bind_current(GL_TEXTURE_CUBE_MAP, texture);
+
+	size_t bytes = 0;
+	for (int face = 0; face < 6; face++) {
+		GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+		glTexImage2D(target, 0, GL_RGB, faces[face].width, faces[face].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[face].data);
+		bytes += texture_bytes(GL_RGB, faces[face].width, faces[face].height, 1, 1);
 	}
+	track_texture(texture, bytes);
 
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -305,46 +618,44 @@ GLuint load_TGA_cubemap(const char *fpath[6])
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	bind_current(GL_TEXTURE_CUBE_MAP, 0);
 
 	return texture;
 }
 
-void instance_static_VAO(GLuint VAO, std::vector<glm::mat4> *transforms)
+GLuint load_TGA_cubemap(const char *fpath[6])
 {
-	glBindVertexArray(VAO);
-	GLuint VBO;
+	struct rawimage faces[6];
+	GLuint texture = 0;
+	if (load_TGA_faces(fpath, faces)) { texture = bind_cubemap(faces); }
+
+	for (int face = 0; face < 6; face++) { tracked_free(faces[face].data); }
 
-	auto amount = transforms->size();
+	return texture;
+}
 
+// the buffer stays alive with the VAO, the caller deletes it
+GLuint instance_static_VAO(GLuint VAO, const std::vector<glm::mat4> *transforms)
+{
+	glBindVertexArray(VAO);
+
+	GLuint VBO;
 	glGenBuffers(1, &VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, amount * sizeof(glm::mat4), transforms->data(), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, transforms->size() * sizeof(glm::mat4), transforms->data(), GL_STATIC_DRAW);
+	track_buffer(VBO, transforms->size() * sizeof(glm::mat4));
 
+	// one attribute per column of the matrix
 	const GLuint ATTRIB_START_LOC = 5;
-
-	for (int i = 0; i < amount; i++) {
-		size_t size = 4 * sizeof(float);
-
-		glEnableVertexAttribArray(ATTRIB_START_LOC);
-		glVertexAttribPointer(ATTRIB_START_LOC, 4, GL_FLOAT, GL_FALSE, 4 * size, BUFFER_OFFSET(0));
-
-		glEnableVertexAttribArray(ATTRIB_START_LOC+1);
-		glVertexAttribPointer(ATTRIB_START_LOC+1, 4, GL_FLOAT, GL_FALSE, 4 * size, BUFFER_OFFSET(size));
-		glEnableVertexAttribArray(ATTRIB_START_LOC+2);
-		glVertexAttribPointer(ATTRIB_START_LOC+2, 4, GL_FLOAT, GL_FALSE, 4 * size, BUFFER_OFFSET(2 * size)); 
-		glEnableVertexAttribArray(ATTRIB_START_LOC+3); 
-		glVertexAttribPointer(ATTRIB_START_LOC+3, 4, GL_FLOAT, GL_FALSE, 4 * size, BUFFER_OFFSET(3 * size));
-
-		glVertexAttribDivisor(ATTRIB_START_LOC, 1);
-		glVertexAttribDivisor(ATTRIB_START_LOC+1, 1);
-		glVertexAttribDivisor(ATTRIB_START_LOC+2, 1);
-		glVertexAttribDivisor(ATTRIB_START_LOC+3, 1);
-
-		glBindVertexArray(0);
+	for (int i = 0; i < 4; i++) {
+		glEnableVertexAttribArray(ATTRIB_START_LOC + i);
+		glVertexAttribPointer(ATTRIB_START_LOC + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), BUFFER_OFFSET(i * sizeof(glm::vec4)));
+		glVertexAttribDivisor(ATTRIB_START_LOC + i, 1);
 	}
 
-	glDeleteBuffers(1, &VBO);
+	glBindVertexArray(0);
+
+	return VBO;
 }
 
 GLuint instance_dynamic_VAO(GLuint VAO, size_t instancecount)
@@ -356,6 +667,7 @@ GLuint instance_dynamic_VAO(GLuint VAO, size_t instancecount)
 	glBindBuffer(GL_ARRAY_BUFFER, buffer);
 
 	glBufferData(GL_ARRAY_BUFFER, instancecount * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+	track_buffer(buffer, instancecount * sizeof(glm::mat4));
 
 	// loop over each column of the matrix
 	const GLuint MATRIX_LOC = 5;
@@ -370,19 +682,115 @@ GLuint instance_dynamic_VAO(GLuint VAO, size_t instancecount)
 	return buffer;
 }
 
+// one vec4 per instance at location 5, the buffer is filled later
+GLuint instance_vec4_VAO(GLuint VAO, size_t instancecount)
+{
+	glBindVertexArray(VAO);
+
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, instancecount * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+	track_buffer(buffer, instancecount * sizeof(glm::vec4));
+
+	const GLuint INSTANCE_LOC = 5;
+	glEnableVertexAttribArray(INSTANCE_LOC);
+	glVertexAttribPointer(INSTANCE_LOC, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), BUFFER_OFFSET(0));
+	glVertexAttribDivisor(INSTANCE_LOC, 1);
+
+	glBindVertexArray(0);
+
+	return buffer;
+}
+
 struct TBO create_TBO(GLsizeiptr size, GLenum internalformat)
 {
 	struct TBO tbo;
 
 	glGenTextures(1, &tbo.texture);
-	glBindTexture(GL_TEXTURE_BUFFER, tbo.texture);
+	bind_current(GL_TEXTURE_BUFFER, tbo.texture);
 
 	glGenBuffers(1, &tbo.buffer);
 	glBindBuffer(GL_TEXTURE_BUFFER, tbo.buffer);
 	glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	track_buffer(tbo.buffer, size);
 	glTexBuffer(GL_TEXTURE_BUFFER, internalformat, tbo.buffer);
 
 	return tbo;
 }
 
 
+
+// every region starts at a multiple of the texture buffer alignment
+void create_ring_TBO(struct ringTBO *ring, GLsizeiptr size, GLenum internalformat)
+{
+	GLint alignment = 256;
+	glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	ring->regionsize = ((size + alignment - 1) / alignment) * alignment;
+	ring->current = 0;
+	ring->mapped = nullptr;
+
+	glGenBuffers(1, &ring->buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, ring->buffer);
+	if (GLEW_ARB_buffer_storage) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_TEXTURE_BUFFER, RING_REGIONS * ring->regionsize, NULL, flags);
+		ring->mapped = (unsigned char*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, RING_REGIONS * ring->regionsize, flags);
+	} else {
+		glBufferData(GL_TEXTURE_BUFFER, RING_REGIONS * ring->regionsize, NULL, GL_DYNAMIC_DRAW);
+		ring->staging.resize(ring->regionsize);
+	}
+	track_buffer(ring->buffer, RING_REGIONS * ring->regionsize);
+
+	glGenTextures(RING_REGIONS, ring->textures);
+	for (int i = 0; i < RING_REGIONS; i++) {
+		bind_current(GL_TEXTURE_BUFFER, ring->textures[i]);
+		glTexBufferRange(GL_TEXTURE_BUFFER, internalformat, ring->buffer, i * ring->regionsize, ring->regionsize);
+		ring->fences[i] = 0;
+	}
+	bind_current(GL_TEXTURE_BUFFER, 0);
+}
+
+// waits until the GPU is done with the current region, it was last used RING_REGIONS frames ago so this rarely blocks
+void *map_ring_TBO(struct ringTBO *ring)
+{
+	GLsync &fence = ring->fences[ring->current];
+	if (fence) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	if (ring->mapped) { return ring->mapped + ring->current * ring->regionsize; }
+
+	return ring->staging.data();
+}
+
+void unmap_ring_TBO(struct ringTBO *ring, GLsizeiptr written)
+{
+	if (ring->mapped || written == 0) { return; }
+
+	glBindBuffer(GL_TEXTURE_BUFFER, ring->buffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, ring->current * ring->regionsize, written, ring->staging.data());
+}
+
+// call after the last draw that reads the current region
+void fence_ring_TBO(struct ringTBO *ring)
+{
+	ring->fences[ring->current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	ring->current = (ring->current + 1) % RING_REGIONS;
+}
+
+void delete_ring_TBO(struct ringTBO *ring)
+{
+	for (int i = 0; i < RING_REGIONS; i++) {
+		if (ring->fences[i]) { glDeleteSync(ring->fences[i]); }
+	}
+	glDeleteTextures(RING_REGIONS, ring->textures);
+	if (ring->mapped) {
+		glBindBuffer(GL_TEXTURE_BUFFER, ring->buffer);
+		glUnmapBuffer(GL_TEXTURE_BUFFER);
+	}
+	untrack_buffer(ring->buffer);
+	glDeleteBuffers(1, &ring->buffer);
+}
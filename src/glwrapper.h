@@ -12,8 +12,37 @@ struct TBO {
 	GLuint buffer;
 };
 
+enum { RING_REGIONS = 3 }; // frames the GPU can lag behind the CPU
+
+enum { STATE_TEXTURE_UNITS = 16 }; // units above these are bound without the shadow state
+
+struct texturebinding {
+	GLenum target;
+	GLuint texture;
+};
+
+// calls into the GL state since the last reset
+struct statecounters {
+	unsigned long issued;
+	unsigned long skipped; // binds and enables that were already in place
+	unsigned long batched; // texture binds that went into a multi-bind call with the first one
+};
+
+// texture buffer over a persistently mapped buffer, the CPU writes one region while the GPU still reads the others
+struct ringTBO {
+	GLuint buffer;
+	GLuint textures[RING_REGIONS]; // one texture per region
+	GLsync fences[RING_REGIONS];
+	GLsizeiptr regionsize;
+	unsigned char *mapped; // null if persistent mapping is not supported
+	std::vector<unsigned char> staging; // written instead of the mapping, copied on unmap
+	unsigned int current;
+};
+
 struct mesh gen_patch_grid(const size_t sidelength, const float offset);
 
+struct mesh gen_masked_patch_grid(const size_t sidelength, const float offset, const std::vector<bool> &mask);
+
 struct mesh gen_mapcube(void);
 
 /*
@@ -30,14 +59,59 @@ void delete_mesh(const struct mesh *m);
 
 GLuint bind_texture(const struct rawimage *image, GLenum internalformat, GLenum format, GLenum type);
 
+void update_texture(GLuint texture, const struct rawimage *image);
+
+void update_texture_rect(GLuint texture, const struct rawimage *image, const struct rect *area);
+
+void texture_formats(const struct rawimage *image, GLenum *internalformat, GLenum *format, GLenum *type);
+
 GLuint bind_mipmap_texture(struct rawimage *image, GLenum internalformat, GLenum format, GLenum type);
 
-void activate_texture(GLenum unit, GLenum target, GLuint texture); 
+GLuint bind_block_texture(const struct blockimage *image);
+
+void update_block_texture(GLuint texture, const struct blockimage *image);
+
+void update_block_texture_rect(GLuint texture, const struct blockimage *image, int x, int y);
+
+// the texture binds and enables below go through a shadow of the GL state and skip what would not change it
+// GL calls that bypass them (or deleting a bound texture) leave the shadow stale, call invalidate_state after those
+void activate_texture(GLenum unit, GLenum target, GLuint texture);
+
+void activate_textures(GLenum firstunit, GLsizei count, const struct texturebinding *bindings);
+
+void enable_state(GLenum capability);
+
+void disable_state(GLenum capability);
+
+void invalidate_state(void);
+
+struct statecounters state_counters(void);
+
+void reset_state_counters(void);
+
+// bindless texture handle, 0 without GL_ARB_bindless_texture
+GLuint64 resident_handle(GLuint texture);
 
 GLuint load_TGA_cubemap(const char *fpath[6]);
 
-void instance_static_VAO(GLuint VAO, std::vector<glm::mat4> *transforms);
+bool load_TGA_faces(const char *fpath[6], struct rawimage faces[6]);
+
+GLuint bind_cubemap(const struct rawimage faces[6]);
+
+GLuint instance_static_VAO(GLuint VAO, const std::vector<glm::mat4> *transforms);
 
 GLuint instance_dynamic_VAO(GLuint VAO, size_t instancecount);
 
+GLuint instance_vec4_VAO(GLuint VAO, size_t instancecount);
+
 struct TBO create_TBO(GLsizeiptr size, GLenum internalformat);
+
+void create_ring_TBO(struct ringTBO *ring, GLsizeiptr size, GLenum internalformat);
+
+void *map_ring_TBO(struct ringTBO *ring);
+
+void unmap_ring_TBO(struct ringTBO *ring, GLsizeiptr written);
+
+void fence_ring_TBO(struct ringTBO *ring);
+
+void delete_ring_TBO(struct ringTBO *ring);
@@ -1,10 +1,22 @@
+#include <cstdint>
+#include <cstring>
+#include <cmath>
 #include <iostream>
+#include <vector>
+#include <random>
+#include <mutex>
+#include <functional>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 
 #include "external/fastnoise/FastNoise.h"
 #include "external/heman/heman.h"
+#include "parallel.h"
+#include "noise.h"
 #include "imp.h"
+#include "memory.h"
 
 enum {
 	RED_CHANNEL = 1,
@@ -13,6 +25,189 @@ enum {
 	RGBA_CHANNEL = 4
 };
 
+enum { PACK_BLOCK = 16 }; // side length of a block in a packed image
+
+size_t format_size(enum imageformat format)
+{
+	switch (format) {
+	case IMAGE_U8: return sizeof(uint8_t);
+	case IMAGE_U16: return sizeof(uint16_t);
+	case IMAGE_F16: return sizeof(uint16_t);
+	case IMAGE_F32: return sizeof(float);
+	}
+
+	return 0;
+}
+
+size_t image_size(const struct rawimage *image)
+{
+	return image->width * image->height * image->nchannels * format_size(image->format);
+}
+
+OwnedImage::OwnedImage(OwnedImage &&other) : rawimage(other)
+{
+	other.data = nullptr;
+}
+
+OwnedImage::~OwnedImage(void)
+{
+	tracked_free(data);
+}
+
+OwnedImage &OwnedImage::operator=(OwnedImage &&other)
+{
+	if (this != &other) {
+		tracked_free(data);
+		rawimage::operator=(other);
+		other.data = nullptr;
+	}
+
+	return *this;
+}
+
+// the old data goes back to the pool after the new image is made, so regenerating a map needs two buffers of its size
+OwnedImage &OwnedImage::operator=(const struct rawimage &image)
+{
+	if (image.data != data) { tracked_free(data); }
+	rawimage::operator=(image);
+
+	return *this;
+}
+
+void OwnedImage::reset(void)
+{
+	tracked_free(data);
+	data = nullptr;
+}
+
+// converts to half float with round to nearest even
+uint16_t float_to_half(float value)
+{
+	uint32_t f;
+	memcpy(&f, &value, sizeof(f));
+
+	const uint32_t sign = (f >> 16) & 0x8000;
+	const int32_t exponent = int32_t((f >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = f & 0x7FFFFF;
+
+	// infinity or NaN
+	if (((f >> 23) & 0xFF) == 0xFF) { return sign | 0x7C00 | (mantissa ? 0x200 : 0); }
+	// too large, becomes infinity
+	if (exponent >= 31) { return sign | 0x7C00; }
+
+	// denormalized half
+	if (exponent <= 0) {
+		if (exponent < -10) { return sign; }
+		mantissa |= 0x800000;
+		const uint32_t shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		const uint32_t remainder = mantissa & ((1u << shift) - 1);
+		const uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) { half++; }
+		return sign | half;
+	}
+
+	// rounding can carry into the exponent, which still gives the right result
+	uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+	const uint32_t remainder = mantissa & 0x1FFF;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) { half++; }
+
+	return sign | half;
+}
+
+float half_to_float(uint16_t value)
+{
+	const uint32_t sign = uint32_t(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1F;
+	uint32_t mantissa = value & 0x3FF;
+
+	uint32_t f;
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			f = sign;
+		} else {
+			// normalize the denormalized half
+			exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400) == 0) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3FF;
+			f = sign | (exponent << 23) | (mantissa << 13);
+		}
+	} else if (exponent == 31) {
+		f = sign | 0x7F800000 | (mantissa << 13);
+	} else {
+		f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+
+	float result;
+	memcpy(&result, &f, sizeof(result));
+
+	return result;
+}
+
+// reads an element as a float, integer formats are normalized to [0, 1]
+static inline float fetch_image(const struct rawimage *image, size_t index)
+{
+	switch (image->format) {
+	case IMAGE_U8: return image->data[index] / 255.f;
+	case IMAGE_U16: return reinterpret_cast<const uint16_t*>(image->data)[index] / 65535.f;
+	case IMAGE_F16: return half_to_float(reinterpret_cast<const uint16_t*>(image->data)[index]);
+	case IMAGE_F32: return reinterpret_cast<const float*>(image->data)[index];
+	}
+
+	return 0.f;
+}
+
+static inline void store_image(struct rawimage *image, size_t index, float value)
+{
+	switch (image->format) {
+	case IMAGE_U8:
+		image->data[index] = glm::clamp(value, 0.f, 1.f) * 255.f + 0.5f;
+		break;
+	case IMAGE_U16:
+		reinterpret_cast<uint16_t*>(image->data)[index] = glm::clamp(value, 0.f, 1.f) * 65535.f + 0.5f;
+		break;
+	case IMAGE_F16:
+		reinterpret_cast<uint16_t*>(image->data)[index] = float_to_half(value);
+		break;
+	case IMAGE_F32:
+		reinterpret_cast<float*>(image->data)[index] = value;
+		break;
+	}
+}
+
+// converts a single channel float image to the storage format
+struct rawimage quantize_image(const float *data, size_t width, size_t height, enum imageformat format)
+{
+	struct rawimage image = {
+		.data = tracked_alloc(width * height * format_size(format)),
+		.nchannels = RED_CHANNEL,
+		.width = width,
+		.height = height,
+		.format = format
+	};
+
+	parallel_for(height, [&](size_t begin, size_t end) {
+		for (size_t i = begin * width; i < end * width; i++) {
+			store_image(&image, i, data[i]);
+		}
+	});
+
+	return image;
+}
+
+// converts the first channel back to floats
+void dequantize_image(const struct rawimage *image, float *data)
+{
+	parallel_for(image->height, [&](size_t begin, size_t end) {
+		for (size_t i = begin * image->width; i < end * image->width; i++) {
+			data[i] = fetch_image(image, i * image->nchannels);
+		}
+	});
+}
+
 static inline float sample_height(int x, int y, const struct rawimage *image)
 {
 	if (x < 0 || y < 0 || x > (image->width-1) || y > (image->height-1)) {
@@ -21,7 +216,7 @@ static inline float sample_height(int x, int y, const struct rawimage *image)
 
 	int index = y * image->width * image->nchannels + x * image->nchannels;
 
-	return image->data[index] / 255.f;
+	return fetch_image(image, index);
 }
 
 static glm::vec3 filter_normal(int x, int y, const struct rawimage *image)
@@ -68,41 +263,59 @@ float sample_image(int x, int y, const struct rawimage *image, unsigned int chan
 
 	int index = y * image->width * image->nchannels + x * image->nchannels;
 
-	return image->data[index+channel] / 255.f;
+	return fetch_image(image, index+channel);
 }
 
 struct rawimage gen_normalmap(const struct rawimage *heightmap)
 {
 	struct rawimage normalmap = {
-		.data = new unsigned char[heightmap->width * heightmap->height * RGB_CHANNEL],
+		.data = tracked_alloc(heightmap->width * heightmap->height * RGB_CHANNEL),
 		.nchannels = RGB_CHANNEL,
 		.width = heightmap->width,
 		.height = heightmap->height
 	};
 
-	for (int x = 0; x < heightmap->width; x++) {
-		for (int y = 0; y < heightmap->height; y++) {
-			const unsigned int index = y * normalmap.width * RGB_CHANNEL + x * RGB_CHANNEL;
-			const glm::vec3 normal = filter_normal(x, y, heightmap);
-			normalmap.data[index] = normal.x * 255.f;
-			normalmap.data[index+1] = normal.y * 255.f;
-			normalmap.data[index+2] = normal.z * 255.f;
-		}
-	}
+	const struct rect area = { 0, 0, int(heightmap->width), int(heightmap->height) };
+	update_normalmap(heightmap, &normalmap, area);
 
 	return normalmap;
 }
 
+// derives the normals again inside an area, the filter reads one texel around each normal
+void update_normalmap(const struct rawimage *heightmap, struct rawimage *normalmap, struct rect area)
+{
+	parallel_for(area.y1 - area.y0, [&](size_t begin, size_t end) {
+		for (int y = area.y0 + int(begin); y < area.y0 + int(end); y++) {
+			for (int x = area.x0; x < area.x1; x++) {
+				const unsigned int index = y * normalmap->width * RGB_CHANNEL + x * RGB_CHANNEL;
+				const glm::vec3 normal = filter_normal(x, y, heightmap);
+				normalmap->data[index] = normal.x * 255.f;
+				normalmap->data[index+1] = normal.y * 255.f;
+				normalmap->data[index+2] = normal.z * 255.f;
+			}
+		}
+	});
+}
+
 struct rawimage gen_occlusmap(const struct rawimage *heightmap)
 {
 	struct rawimage occlusmap = {
-		.data = new unsigned char[heightmap->width * heightmap->height],
+		.data = tracked_alloc(heightmap->width * heightmap->height),
 		.nchannels = RED_CHANNEL,
 		.width = heightmap->width,
 		.height = heightmap->height
 	};
 
-	heman_image *retval = heman_import_u8(heightmap->width, heightmap->height, heightmap->nchannels, heightmap->data, 0, 1);;
+	heman_image *retval = nullptr;
+	if (heightmap->format == IMAGE_U8) {
+		retval = heman_import_u8(heightmap->width, heightmap->height, heightmap->nchannels, heightmap->data, 0, 1);
+	} else {
+		// keep the full precision of the heights instead of going through bytes
+		retval = heman_image_create(heightmap->width, heightmap->height, heightmap->nchannels);
+		HEMAN_FLOAT *heights = heman_image_data(retval);
+		const size_t count = heightmap->width * heightmap->height * heightmap->nchannels;
+		for (size_t i = 0; i < count; i++) { heights[i] = fetch_image(heightmap, i); }
+	}
 
 	heman_image *occ = heman_lighting_compute_occlusion(retval);
 	heman_export_u8(occ, 0, 1, occlusmap.data);
@@ -113,6 +326,249 @@ struct rawimage gen_occlusmap(const struct rawimage *heightmap)
 	return occlusmap;
 }
 
+// occlusion looks far along the terrain, so it is derived on a crop with a halo around the area and only the area is kept
+void update_occlusmap(const struct rawimage *heightmap, struct rawimage *occlusmap, struct rect area, int halo)
+{
+	const struct rect crop = expand_rect(area, halo, heightmap->width, heightmap->height);
+
+	struct rawimage heights = crop_image(heightmap, crop);
+	struct rawimage occlusion = gen_occlusmap(&heights);
+
+	for (int y = area.y0; y < area.y1; y++) {
+		const unsigned char *src = &occlusion.data[(y - crop.y0) * occlusion.width + (area.x0 - crop.x0)];
+		std::copy(src, src + (area.x1 - area.x0), &occlusmap->data[y * occlusmap->width + area.x0]);
+	}
+
+	tracked_free(heights.data);
+	tracked_free(occlusion.data);
+}
+
+// value noise used for the strata of the terrain, the same octaves the terrain shader used to run per fragment
+// lattice points are hashed as integers, the sine hash of the shader costs most of the bake time on the CPU
+static inline float strata_hash(glm::vec2 st)
+{
+	uint32_t h = uint32_t(int32_t(st.x)) * 0x8da6b343u ^ uint32_t(int32_t(st.y)) * 0xd8163841u;
+	h = (h ^ (h >> 16)) * 0x7feb352du;
+	h = (h ^ (h >> 15)) * 0x846ca68bu;
+	h ^= h >> 16;
+
+	return (h >> 8) * (1.f / 16777216.f);
+}
+
+static inline float strata_noise(glm::vec2 st)
+{
+	const glm::vec2 i = glm::floor(st);
+	const glm::vec2 f = st - i;
+
+	const float a = strata_hash(i);
+	const float b = strata_hash(i + glm::vec2(1.f, 0.f));
+	const float c = strata_hash(i + glm::vec2(0.f, 1.f));
+	const float d = strata_hash(i + glm::vec2(1.f, 1.f));
+
+	const glm::vec2 u = f * f * (3.f - 2.f * f);
+
+	return glm::mix(a, b, u.x) + (c - a) * u.y * (1.f - u.x) + (d - b) * u.x * u.y;
+}
+
+static inline float strata_fbm(glm::vec2 st)
+{
+	const float c = cosf(0.5f);
+	const float s = sinf(0.5f);
+
+	float value = 0.f;
+	float amplitude = 0.5f;
+	for (int i = 0; i < 5; i++) {
+		value += amplitude * strata_noise(st);
+		// rotate to reduce axial bias
+		st = 2.f * glm::vec2(c * st.x - s * st.y, s * st.x + c * st.y) + glm::vec2(100.f);
+		amplitude *= 0.5f;
+	}
+
+	return value;
+}
+
+static inline float strata_warp(glm::vec2 st)
+{
+	const glm::vec2 q = glm::vec2(strata_fbm(st), strata_fbm(st + glm::vec2(1.f)));
+	const glm::vec2 r = glm::vec2(strata_fbm(st + 20.f * q + glm::vec2(1.85f, 9.35f)), strata_fbm(st + 20.f * q + glm::vec2(8.426f, 2.926f)));
+
+	return strata_fbm(st + r);
+}
+
+// bakes the noisy material weights of the terrain shader, one texel per heightmap texel
+// red is snow over grass and green is rock over the rest, two channels so the map compresses to BC5
+struct rawimage gen_splatmap(const struct rawimage *heightmap, const struct rawimage *normalmap, float mapratio)
+{
+	struct rawimage splatmap = {
+		.data = tracked_alloc(heightmap->width * heightmap->height * RG_CHANNEL),
+		.nchannels = RG_CHANNEL,
+		.width = heightmap->width,
+		.height = heightmap->height
+	};
+
+	const struct rect area = { 0, 0, int(heightmap->width), int(heightmap->height) };
+	update_splatmap(heightmap, normalmap, &splatmap, mapratio, area);
+
+	return splatmap;
+}
+
+void update_splatmap(const struct rawimage *heightmap, const struct rawimage *normalmap, struct rawimage *splatmap, float mapratio, struct rect area)
+{
+	parallel_for(area.y1 - area.y0, [&](size_t begin, size_t end) {
+		for (size_t y = area.y0 + begin; y < area.y0 + end; y++) {
+			for (size_t x = area.x0; x < area.x1; x++) {
+				const size_t texel = y * heightmap->width + x;
+				const float height = fetch_image(heightmap, texel * heightmap->nchannels);
+				const float slope = 1.f - (2.f * fetch_image(normalmap, texel * normalmap->nchannels + 1) - 1.f);
+
+				// the strata noise is in world space like the detail textures
+				const glm::vec2 position = mapratio * glm::vec2(x + 0.5f, y + 0.5f);
+				const float strata = strata_warp(0.05f * position);
+
+				unsigned char *weights = &splatmap->data[texel * RG_CHANNEL];
+				weights[0] = glm::smoothstep(0.55f, 0.6f, height + 0.3f * strata) * 255.f + 0.5f;
+				weights[1] = glm::smoothstep(0.4f, 0.55f, slope - 0.5f * strata) * 255.f + 0.5f;
+			}
+		}
+	});
+}
+
+struct rect expand_rect(struct rect area, int margin, size_t width, size_t height)
+{
+	const struct rect expanded = {
+		std::max(area.x0 - margin, 0),
+		std::max(area.y0 - margin, 0),
+		std::min(area.x1 + margin, int(width)),
+		std::min(area.y1 + margin, int(height))
+	};
+
+	return expanded;
+}
+
+// grows an area outwards to multiples of the alignment, used for the 4x4 blocks of compressed textures
+struct rect align_rect(struct rect area, int alignment, size_t width, size_t height)
+{
+	const struct rect aligned = {
+		area.x0 - area.x0 % alignment,
+		area.y0 - area.y0 % alignment,
+		std::min((area.x1 + alignment - 1) / alignment * alignment, int(width)),
+		std::min((area.y1 + alignment - 1) / alignment * alignment, int(height))
+	};
+
+	return aligned;
+}
+
+struct rect merge_rect(struct rect a, struct rect b)
+{
+	if (empty_rect(a)) { return b; }
+	if (empty_rect(b)) { return a; }
+
+	const struct rect merged = {
+		std::min(a.x0, b.x0),
+		std::min(a.y0, b.y0),
+		std::max(a.x1, b.x1),
+		std::max(a.y1, b.y1)
+	};
+
+	return merged;
+}
+
+bool empty_rect(struct rect area)
+{
+	return area.x0 >= area.x1 || area.y0 >= area.y1;
+}
+
+struct rawimage crop_image(const struct rawimage *image, struct rect area)
+{
+	const size_t texelsize = image->nchannels * format_size(image->format);
+	const size_t width = area.x1 - area.x0;
+	const size_t height = area.y1 - area.y0;
+
+	struct rawimage crop = {
+		.data = tracked_alloc(width * height * texelsize),
+		.nchannels = image->nchannels,
+		.width = width,
+		.height = height,
+		.format = image->format
+	};
+
+	for (size_t y = 0; y < height; y++) {
+		const unsigned char *src = &image->data[((area.y0 + y) * image->width + area.x0) * texelsize];
+		std::copy(src, src + width * texelsize, &crop.data[y * width * texelsize]);
+	}
+
+	return crop;
+}
+
+// falloff of a brush, one at the center and zero at the radius
+static inline float brush_weight(const struct brush *brush, int x, int y)
+{
+	const float distance = glm::length(glm::vec2(x, y) - brush->center) / brush->radius;
+
+	return 1.f - glm::smoothstep(0.f, 1.f, distance);
+}
+
+// edits the heights under a brush, returns the area that changed
+struct rect brush_image(struct rawimage *heightmap, const struct brush *brush)
+{
+	const struct rect unclamped = {
+		int(floorf(brush->center.x - brush->radius)),
+		int(floorf(brush->center.y - brush->radius)),
+		int(ceilf(brush->center.x + brush->radius)) + 1,
+		int(ceilf(brush->center.y + brush->radius)) + 1
+	};
+	const struct rect area = expand_rect(unclamped, 0, heightmap->width, heightmap->height);
+	if (empty_rect(area)) { return area; }
+
+	// smoothing reads the neighbours, so it reads from a copy of the area and its border
+	struct rawimage source = {};
+	struct rect border = {};
+	if (brush->mode == BRUSH_SMOOTH) {
+		border = expand_rect(area, 1, heightmap->width, heightmap->height);
+		source = crop_image(heightmap, border);
+	}
+
+	parallel_for(area.y1 - area.y0, [&](size_t begin, size_t end) {
+		for (int y = area.y0 + int(begin); y < area.y0 + int(end); y++) {
+			for (int x = area.x0; x < area.x1; x++) {
+				const float weight = brush_weight(brush, x, y);
+				if (weight <= 0.f) { continue; }
+
+				const size_t index = (y * heightmap->width + x) * heightmap->nchannels;
+				float height = fetch_image(heightmap, index);
+				switch (brush->mode) {
+				case BRUSH_RAISE:
+					height += brush->strength * weight;
+					break;
+				case BRUSH_LOWER:
+					height -= brush->strength * weight;
+					break;
+				case BRUSH_SMOOTH: {
+					float sum = 0.f;
+					int count = 0;
+					for (int ny = std::max(y - 1, border.y0); ny < std::min(y + 2, border.y1); ny++) {
+						for (int nx = std::max(x - 1, border.x0); nx < std::min(x + 2, border.x1); nx++) {
+							sum += fetch_image(&source, ((ny - border.y0) * source.width + (nx - border.x0)) * source.nchannels);
+							count++;
+						}
+					}
+					height = glm::mix(height, sum / count, glm::clamp(brush->strength * weight, 0.f, 1.f));
+					break;
+				}
+				case BRUSH_FLATTEN:
+					height = glm::mix(height, brush->target, glm::clamp(brush->strength * weight, 0.f, 1.f));
+					break;
+				}
+				store_image(heightmap, index, height);
+			}
+		}
+	});
+
+	if (source.data != nullptr) { tracked_free(source.data); }
+
+	return area;
+}
+
 void billow_3D_image(unsigned char *image, size_t sidelength, float frequency, float cloud_distance)
 {
 	FastNoise billow;
@@ -124,20 +580,187 @@ void billow_3D_image(unsigned char *image, size_t sidelength, float frequency, f
 
 	const float space = cloud_distance; // space between the clouds
 
-	unsigned int index = 0;
-	for (int i = 0; i < sidelength; i++) {
-		for (int j = 0; j < sidelength; j++) {
-			for (int k = 0; k < sidelength; k++) {
-				float p = (billow.GetNoise(i, j, k) + 1.f) / 2.f;
-				p = p - space;
-				image[index++] = glm::clamp(p, 0.f, 1.f) * 255.f;
+	parallel_for(sidelength, [&](size_t begin, size_t end) {
+		unsigned int index = begin * sidelength * sidelength;
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < sidelength; j++) {
+				for (int k = 0; k < sidelength; k++) {
+					float p = (billow.GetNoise(i, j, k) + 1.f) / 2.f;
+					p = p - space;
+					image[index++] = glm::clamp(p, 0.f, 1.f) * 255.f;
+				}
 			}
 		}
+	});
+
+}
+
+// billow detail and cellular ridges, both warped, under a warped radial mask that keeps the center low
+// the noises are compile time pipelines, terrain_image_fastnoise is the same recipe on FastNoise
+// the heights of a texel only depend on its position in the world, so tiles of the world give the same heights as the whole image
+class TerrainRecipe {
+public:
+	TerrainRecipe(size_t worldsize, long seed, float freq) :
+		table(seed_noise(seed)),
+		billow(&table, 0.01f*freq),
+		billowwarp(&table, 0.01f*freq, 40.f),
+		cellnoise(&table, 0.01f*freq),
+		cellwarp(&table, 0.01f*freq, 30.f),
+		perturb(&table, 0.002f*freq, 300.f)
+	{
+		sidelength = worldsize;
+		center = glm::vec2(0.5f*float(sidelength), 0.5f*float(sidelength));
+	}
+	// not normalized, the heights divide it by the largest ridge of the world
+	float ridge(int i, int j) const
+	{
+		float x = i; float y = j;
+		cellwarp.apply(x, y);
+		return cellnoise.sample(x, y);
+	}
+	float height(int i, int j, float ridge) const
+	{
+		const float mountain_amp = 1.0f; // best values between 0.4 and 1.0
+		const float field_amp = 0.3f; // best values between 0.2 and 0.4
+
+		if (i > (sidelength-4) || j > (sidelength-4)) { return 0.f; }
+
+		float x = i; float y = j;
+		billowwarp.apply(x, y);
+		float detail = 1.f - (billow.sample(x, y) + 1.f) / 2.f;
+
+		x = i; y = j;
+		perturb.apply(x, y);
+
+		// add detail
+		float height = glm::mix(detail, ridge, 0.9f);
+
+		// aply mask
+		float mask = glm::distance(center, glm::vec2(float(x), float(y))) / float(0.5f*sidelength);
+		mask = glm::smoothstep(0.4f, 0.8f, mask);
+		mask = glm::clamp(mask, field_amp, mountain_amp);
+
+		return height * mask;
 	}
+private:
+	const struct noiseseed table;
+	// detail
+	const SimplexNoise<FRACTAL_BILLOW, 6> billow;
+	const GradientWarp<6> billowwarp;
+	// ridges, the warp has the default 3 octaves of FastNoise
+	const CellularNoise<CELL_EUCLIDEAN, CELL_DISTANCE2ADD> cellnoise;
+	const GradientWarp<3> cellwarp;
+	// mask perturb
+	const GradientWarp<5> perturb;
+	size_t sidelength;
+	glm::vec2 center;
+};
+
+void terrain_image(float *image, size_t sidelength, long seed, float freq)
+{
+	const TerrainRecipe recipe = { sidelength, seed, freq };
+
+	// the ridges are kept in the image until they can be normalized
+	float max = 1.f;
+	std::mutex maxlock;
+	parallel_for(sidelength, [&](size_t begin, size_t end) {
+		float localmax = 1.f;
+		unsigned int index = begin * sidelength;
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < sidelength; j++) {
+				float val = recipe.ridge(i, j);
+				image[index++] = val;
+				if (val > localmax) { localmax = val; }
+			}
+		}
+		std::lock_guard<std::mutex> guard(maxlock);
+		if (localmax > max) { max = localmax; }
+	});
+
+	parallel_for(sidelength, [&](size_t begin, size_t end) {
+		unsigned int index = begin * sidelength;
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < sidelength; j++) {
+				image[index] = recipe.height(i, j, image[index] / max);
+				index++;
+			}
+		}
+	});
+}
+
+// terrain_image of a world of worldsize texels at a lower resolution, each texel samples the world at its corner
+void terrain_preview(float *image, size_t sidelength, size_t worldsize, long seed, float freq)
+{
+	const TerrainRecipe recipe = { worldsize, seed, freq };
+	// spread over the whole world even when the preview size does not divide it
+	auto world = [&](size_t texel) -> int { return int(texel * worldsize / sidelength); };
+
+	float max = 1.f;
+	std::mutex maxlock;
+	parallel_for(sidelength, [&](size_t begin, size_t end) {
+		float localmax = 1.f;
+		size_t index = begin * sidelength;
+		for (size_t i = begin; i < end; i++) {
+			for (size_t j = 0; j < sidelength; j++) {
+				float val = recipe.ridge(world(i), world(j));
+				image[index++] = val;
+				if (val > localmax) { localmax = val; }
+			}
+		}
+		std::lock_guard<std::mutex> guard(maxlock);
+		if (localmax > max) { max = localmax; }
+	});
 
+	parallel_for(sidelength, [&](size_t begin, size_t end) {
+		size_t index = begin * sidelength;
+		for (size_t i = begin; i < end; i++) {
+			for (size_t j = 0; j < sidelength; j++) {
+				image[index] = recipe.height(world(i), world(j), image[index] / max);
+				index++;
+			}
+		}
+	});
 }
 
-void terrain_image(unsigned char *image, size_t sidelength, long seed, float freq)
+// the largest ridge inside an area of the world, at least 1 like in terrain_image
+float terrain_ridge_max(size_t worldsize, struct rect area, long seed, float freq)
+{
+	const TerrainRecipe recipe = { worldsize, seed, freq };
+
+	float max = 1.f;
+	std::mutex maxlock;
+	parallel_for(area.y1 - area.y0, [&](size_t begin, size_t end) {
+		float localmax = 1.f;
+		for (int i = area.y0 + int(begin); i < area.y0 + int(end); i++) {
+			for (int j = area.x0; j < area.x1; j++) {
+				localmax = std::max(localmax, recipe.ridge(i, j));
+			}
+		}
+		std::lock_guard<std::mutex> guard(maxlock);
+		if (localmax > max) { max = localmax; }
+	});
+
+	return max;
+}
+
+// heights of an area of the world, ridgemax is the largest ridge of the whole world
+void terrain_tile(float *image, size_t worldsize, struct rect area, long seed, float freq, float ridgemax)
+{
+	const TerrainRecipe recipe = { worldsize, seed, freq };
+	const size_t width = area.x1 - area.x0;
+
+	parallel_for(area.y1 - area.y0, [&](size_t begin, size_t end) {
+		for (size_t row = begin; row < end; row++) {
+			const int i = area.y0 + int(row);
+			for (int j = area.x0; j < area.x1; j++) {
+				image[row * width + (j - area.x0)] = recipe.height(i, j, recipe.ridge(i, j) / ridgemax);
+			}
+		}
+	});
+}
+
+// the terrain recipe on runtime configured FastNoise objects, terrain_image gives the same heights
+void terrain_image_fastnoise(float *image, size_t sidelength, long seed, float freq)
 {
 	// detail
 	FastNoise billow;
@@ -172,45 +795,270 @@ void terrain_image(unsigned char *image, size_t sidelength, long seed, float fre
 	const float field_amp = 0.3f; // best values between 0.2 and 0.4
 
 	float max = 1.f;
-	for (int i = 0; i < sidelength; i++) {
-		for (int j = 0; j < sidelength; j++) {
-			float x = i; float y = j;
-			cellnoise.GradientPerturbFractal(x, y);
-			float val = cellnoise.GetNoise(x, y);
-			if (val > max) { max = val; }
+	std::mutex maxlock;
+	parallel_for(sidelength, [&](size_t begin, size_t end) {
+		float localmax = 1.f;
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < sidelength; j++) {
+				float x = i; float y = j;
+				cellnoise.GradientPerturbFractal(x, y);
+				float val = cellnoise.GetNoise(x, y);
+				if (val > localmax) { localmax = val; }
+			}
 		}
-	}
+		std::lock_guard<std::mutex> guard(maxlock);
+		if (localmax > max) { max = localmax; }
+	});
 
 	const glm::vec2 center = glm::vec2(0.5f*float(sidelength), 0.5f*float(sidelength));
-	unsigned int index = 0;
-	for (int i = 0; i < sidelength; i++) {
-		for (int j = 0; j < sidelength; j++) {
-			float x = i; float y = j;
-			billow.GradientPerturbFractal(x, y);
-			float detail = 1.f - (billow.GetNoise(x, y) + 1.f) / 2.f;
+	parallel_for(sidelength, [&](size_t begin, size_t end) {
+		unsigned int index = begin * sidelength;
+		for (int i = begin; i < end; i++) {
+			for (int j = 0; j < sidelength; j++) {
+				float x = i; float y = j;
+				billow.GradientPerturbFractal(x, y);
+				float detail = 1.f - (billow.GetNoise(x, y) + 1.f) / 2.f;
+
+				x = i; y = j;
+				cellnoise.GradientPerturbFractal(x, y);
+				float ridge = cellnoise.GetNoise(x, y) / max;
+
+				x = i; y = j;
+				perturb.GradientPerturbFractal(x, y);
+
+				// add detail
+				float height = glm::mix(detail, ridge, 0.9f);
+
+				// aply mask
+				float mask = glm::distance(center, glm::vec2(float(x), float(y))) / float(0.5f*sidelength);
+				mask = glm::smoothstep(0.4f, 0.8f, mask);
+				mask = glm::clamp(mask, field_amp, mountain_amp);
+
+				height *= mask;
+
+				if (i > (sidelength-4) || j > (sidelength-4)) {
+					image[index++] = 0.f;
+				} else {
+					image[index++] = height;
+				}
+			}
+		}
+	});
+}
+
+// randomly scatters grass roots over the map where it is flat and low enough
+// candidates are generated in fixed size blocks with their own random generator, so the result only depends on the seed
+std::vector<glm::vec2> scatter_grass_roots(const struct rawimage *heightmap, const struct rawimage *normalmap, glm::vec2 min, glm::vec2 max, float mapscale, size_t density, unsigned int seed)
+{
+	const size_t BLOCK_SIZE = 65536;
+	const size_t nblocks = (density + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	std::vector<std::vector<glm::vec2>> blocks(nblocks);
+
+	parallel_for(nblocks, [&](size_t begin, size_t end) {
+		for (size_t block = begin; block < end; block++) {
+			std::mt19937 gen(seed + block);
+			std::uniform_real_distribution<> map_x(min.x, max.x);
+			std::uniform_real_distribution<> map_z(min.y, max.y);
 
-			x = i; y = j;
-			cellnoise.GradientPerturbFractal(x, y);
-			float ridge = cellnoise.GetNoise(x, y) / max;
+			const size_t count = std::min(BLOCK_SIZE, density - block * BLOCK_SIZE);
+			std::vector<glm::vec2> &positions = blocks[block];
+			positions.reserve(count);
+			for (size_t i = 0; i < count; i++) {
+				float x = map_x(gen);
+				float z = map_z(gen);
+				float y = sample_image((int)(mapscale*x), (int)(mapscale*z), heightmap, 0);
+				float slope = sample_image((int)(mapscale*x), (int)(mapscale*z), normalmap, 1);
+				slope = 1.f - ((slope * 2.f) - 1.f);
+				if (slope < 0.6 && y < 0.4) {
+					positions.push_back(glm::vec2(x, z));
+				}
+			}
+		}
+	});
 
-			x = i; y = j;
-			perturb.GradientPerturbFractal(x, y);
+	size_t total = 0;
+	for (const auto &block : blocks) { total += block.size(); }
 
-			// add detail
-			float height = glm::mix(detail, ridge, 0.9f);
+	std::vector<glm::vec2> positions;
+	positions.reserve(total);
+	for (const auto &block : blocks) {
+		positions.insert(positions.end(), block.begin(), block.end());
+	}
 
-			// aply mask
-			float mask = glm::distance(center, glm::vec2(float(x), float(y))) / float(0.5f*sidelength);
-			mask = glm::smoothstep(0.4f, 0.8f, mask);
-			mask = glm::clamp(mask, field_amp, mountain_amp);
+	return positions;
+}
 
-			height *= mask;
+// scatters trees where the terrain is between the heights and flat enough, a low frequency noise groups them into forests
+// returns the root position in map space with the normalized height in y and a random scale in w
+std::vector<glm::vec4> scatter_trees(const struct rawimage *heightmap, const struct rawimage *normalmap, float sidelength, float minheight, float maxheight, size_t density, unsigned int seed)
+{
+	const size_t BLOCK_SIZE = 65536;
+	const size_t nblocks = (density + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	const float mapscale = float(heightmap->width) / sidelength;
 
-			if (i > (sidelength-4) || j > (sidelength-4)) {
-				image[index++] = 0.f;
-			} else {
-				image[index++] = height * 255.f;
+	const struct noiseseed table = seed_noise(seed);
+	const SimplexNoise<FRACTAL_FBM, 3> clusters = { &table, 0.004f };
+
+	std::vector<std::vector<glm::vec4>> blocks(nblocks);
+
+	parallel_for(nblocks, [&](size_t begin, size_t end) {
+		for (size_t block = begin; block < end; block++) {
+			std::mt19937 gen(seed + block);
+			std::uniform_real_distribution<float> map(0.f, sidelength);
+			std::uniform_real_distribution<float> chance(0.f, 1.f);
+			std::uniform_real_distribution<float> scale(0.75f, 1.25f);
+
+			const size_t count = std::min(BLOCK_SIZE, density - block * BLOCK_SIZE);
+			std::vector<glm::vec4> &trees = blocks[block];
+			for (size_t i = 0; i < count; i++) {
+				const float x = map(gen);
+				const float z = map(gen);
+				const float threshold = chance(gen);
+				const float size = scale(gen);
+				const float y = sample_image((int)(mapscale*x), (int)(mapscale*z), heightmap, 0);
+				if (y < minheight || y > maxheight) { continue; }
+				float slope = sample_image((int)(mapscale*x), (int)(mapscale*z), normalmap, 1);
+				slope = 1.f - ((slope * 2.f) - 1.f);
+				if (slope > 0.5f) { continue; }
+				// fewer trees near the tree line and on steeper slopes
+				const float cover = glm::smoothstep(-0.2f, 0.3f, clusters.sample(x, z));
+				const float fitness = cover * (1.f - slope) * (1.f - glm::smoothstep(minheight, maxheight, y));
+				if (threshold < fitness) {
+					trees.push_back(glm::vec4(x, y, z, size));
+				}
 			}
 		}
+	});
+
+	size_t total = 0;
+	for (const auto &block : blocks) { total += block.size(); }
+
+	std::vector<glm::vec4> trees;
+	trees.reserve(total);
+	for (const auto &block : blocks) {
+		trees.insert(trees.end(), block.begin(), block.end());
 	}
+
+	return trees;
+}
+
+struct packedimage pack_image(const struct rawimage *image)
+{
+	struct packedimage packed;
+	packed.width = image->width;
+	packed.height = image->height;
+	packed.blockcols = (image->width + PACK_BLOCK - 1) / PACK_BLOCK;
+
+	const size_t blockrows = (image->height + PACK_BLOCK - 1) / PACK_BLOCK;
+	const size_t nblocks = packed.blockcols * blockrows;
+
+	packed.base.resize(nblocks);
+	packed.bits.resize(nblocks);
+	packed.offsets.resize(nblocks);
+
+	auto quantize = [&](size_t x, size_t y) -> uint32_t {
+		return glm::clamp(sample_height(x, y, image), 0.f, 1.f) * 65535.f + 0.5f;
+	};
+
+	// find the range of each block
+	parallel_for(nblocks, [&](size_t begin, size_t end) {
+		for (size_t block = begin; block < end; block++) {
+			const size_t bx = (block % packed.blockcols) * PACK_BLOCK;
+			const size_t by = (block / packed.blockcols) * PACK_BLOCK;
+			uint32_t min = 0xFFFF;
+			uint32_t max = 0;
+			for (size_t y = by; y < std::min(by + PACK_BLOCK, image->height); y++) {
+				for (size_t x = bx; x < std::min(bx + PACK_BLOCK, image->width); x++) {
+					const uint32_t value = quantize(x, y);
+					min = std::min(min, value);
+					max = std::max(max, value);
+				}
+			}
+			uint8_t bits = 0;
+			while ((max - min) >> bits) { bits++; }
+			packed.base[block] = min;
+			packed.bits[block] = bits;
+		}
+	});
+
+	// every block starts on a word so they can be packed in parallel
+	size_t nwords = 0;
+	for (size_t block = 0; block < nblocks; block++) {
+		packed.offsets[block] = nwords;
+		nwords += (PACK_BLOCK * PACK_BLOCK * packed.bits[block] + 31) / 32;
+	}
+	// one extra word so samples can always read two words
+	packed.words.assign(nwords + 1, 0);
+
+	parallel_for(nblocks, [&](size_t begin, size_t end) {
+		for (size_t block = begin; block < end; block++) {
+			const uint8_t bits = packed.bits[block];
+			if (bits == 0) { continue; }
+			const size_t bx = (block % packed.blockcols) * PACK_BLOCK;
+			const size_t by = (block / packed.blockcols) * PACK_BLOCK;
+			uint32_t *words = &packed.words[packed.offsets[block]];
+			for (size_t y = by; y < std::min(by + PACK_BLOCK, image->height); y++) {
+				for (size_t x = bx; x < std::min(bx + PACK_BLOCK, image->width); x++) {
+					const uint64_t residual = quantize(x, y) - packed.base[block];
+					const size_t bitpos = ((y - by) * PACK_BLOCK + (x - bx)) * bits;
+					const uint64_t shifted = residual << (bitpos % 32);
+					words[bitpos / 32] |= uint32_t(shifted);
+					if (shifted >> 32) { words[bitpos / 32 + 1] |= uint32_t(shifted >> 32); }
+				}
+			}
+		}
+	});
+
+	return packed;
+}
+
+static inline uint16_t fetch_packed(size_t x, size_t y, const struct packedimage *packed)
+{
+	const size_t block = (y / PACK_BLOCK) * packed->blockcols + (x / PACK_BLOCK);
+	const uint8_t bits = packed->bits[block];
+	if (bits == 0) { return packed->base[block]; }
+
+	const size_t bitpos = ((y % PACK_BLOCK) * PACK_BLOCK + (x % PACK_BLOCK)) * bits;
+	const size_t word = packed->offsets[block] + bitpos / 32;
+	const uint64_t pair = uint64_t(packed->words[word]) | (uint64_t(packed->words[word+1]) << 32);
+	const uint32_t residual = (pair >> (bitpos % 32)) & ((1u << bits) - 1);
+
+	return packed->base[block] + residual;
+}
+
+float sample_packed(int x, int y, const struct packedimage *packed)
+{
+	if (x < 0 || y < 0 || x > (packed->width-1) || y > (packed->height-1)) {
+		return 0.f;
+	}
+
+	return fetch_packed(x, y, packed) / 65535.f;
+}
+
+struct rawimage unpack_image(const struct packedimage *packed)
+{
+	struct rawimage image = {
+		.data = tracked_alloc(packed->width * packed->height * sizeof(uint16_t)),
+		.nchannels = RED_CHANNEL,
+		.width = packed->width,
+		.height = packed->height,
+		.format = IMAGE_U16
+	};
+
+	uint16_t *data = reinterpret_cast<uint16_t*>(image.data);
+	parallel_for(packed->height, [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; y++) {
+			for (size_t x = 0; x < packed->width; x++) {
+				data[y * packed->width + x] = fetch_packed(x, y, packed);
+			}
+		}
+	});
+
+	return image;
+}
+
+size_t packed_size(const struct packedimage *packed)
+{
+	return packed->base.size() * sizeof(uint16_t) + packed->bits.size() * sizeof(uint8_t) + packed->offsets.size() * sizeof(uint32_t) + packed->words.size() * sizeof(uint32_t);
 }
@@ -1,16 +1,126 @@
+// storage type of each channel
+enum imageformat {
+	IMAGE_U8, // normalized unsigned byte
+	IMAGE_U16, // normalized unsigned short
+	IMAGE_F16, // half float
+	IMAGE_F32 // float
+};
+
 struct rawimage {
 	unsigned char *data = nullptr;
 	unsigned int nchannels;
 	size_t width;
 	size_t height;
+	enum imageformat format = IMAGE_U8;
+};
+
+// owns the data of the image and frees it with tracked_free, assigning an image adopts its data and frees the old data
+class OwnedImage : public rawimage {
+public:
+	OwnedImage(void) {}
+	explicit OwnedImage(const struct rawimage &image) : rawimage(image) {}
+	OwnedImage(OwnedImage &&other);
+	~OwnedImage(void);
+	OwnedImage(const OwnedImage&) = delete;
+	OwnedImage &operator=(const OwnedImage&) = delete;
+	OwnedImage &operator=(OwnedImage &&other);
+	OwnedImage &operator=(const struct rawimage &image);
+	void reset(void);
+};
+
+// area of an image in texels, from x0, y0 up to but not including x1, y1
+struct rect {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+};
+
+enum brushmode {
+	BRUSH_RAISE,
+	BRUSH_LOWER,
+	BRUSH_SMOOTH,
+	BRUSH_FLATTEN
+};
+
+struct brush {
+	enum brushmode mode;
+	glm::vec2 center; // in texels
+	float radius; // in texels
+	float strength; // normalized height for raise and lower, blend factor for smooth and flatten
+	float target; // normalized height to flatten to
+};
+
+// single channel 16 bit image compressed in blocks, each block stores its minimum and the bit packed residuals to it
+struct packedimage {
+	size_t width;
+	size_t height;
+	size_t blockcols;
+	std::vector<uint16_t> base; // minimum of each block
+	std::vector<uint8_t> bits; // bits per residual of each block
+	std::vector<uint32_t> offsets; // first word of each block
+	std::vector<uint32_t> words; // bit packed residuals
 };
 
-void terrain_image(unsigned char *image, size_t sidelength, long seed, float freq);
+size_t format_size(enum imageformat format);
+
+size_t image_size(const struct rawimage *image);
+
+uint16_t float_to_half(float value);
+
+float half_to_float(uint16_t value);
+
+struct rawimage quantize_image(const float *data, size_t width, size_t height, enum imageformat format);
+
+void dequantize_image(const struct rawimage *image, float *data);
+
+void terrain_image(float *image, size_t sidelength, long seed, float freq);
+
+void terrain_image_fastnoise(float *image, size_t sidelength, long seed, float freq);
+
+// the ridges are normalized by the largest ridge of the samples, so the heights are close to those of the full image
+void terrain_preview(float *image, size_t sidelength, size_t worldsize, long seed, float freq);
+
+float terrain_ridge_max(size_t worldsize, struct rect area, long seed, float freq);
+
+void terrain_tile(float *image, size_t worldsize, struct rect area, long seed, float freq, float ridgemax);
 
 struct rawimage gen_normalmap(const struct rawimage *heightmap);
 
+void update_normalmap(const struct rawimage *heightmap, struct rawimage *normalmap, struct rect area);
+
 struct rawimage gen_occlusmap(const struct rawimage *heightmap);
 
+void update_occlusmap(const struct rawimage *heightmap, struct rawimage *occlusmap, struct rect area, int halo);
+
+struct rawimage gen_splatmap(const struct rawimage *heightmap, const struct rawimage *normalmap, float mapratio);
+
+void update_splatmap(const struct rawimage *heightmap, const struct rawimage *normalmap, struct rawimage *splatmap, float mapratio, struct rect area);
+
+struct rect expand_rect(struct rect area, int margin, size_t width, size_t height);
+
+struct rect align_rect(struct rect area, int alignment, size_t width, size_t height);
+
+struct rect merge_rect(struct rect a, struct rect b);
+
+bool empty_rect(struct rect area);
+
+struct rawimage crop_image(const struct rawimage *image, struct rect area);
+
+struct rect brush_image(struct rawimage *heightmap, const struct brush *brush);
+
 float sample_image(int x, int y, const struct rawimage *image, unsigned int channel);
 
 void billow_3D_image(unsigned char *image, size_t sidelength, float frequency, float cloud_distance);
+
+std::vector<glm::vec2> scatter_grass_roots(const struct rawimage *heightmap, const struct rawimage *normalmap, glm::vec2 min, glm::vec2 max, float mapscale, size_t density, unsigned int seed);
+
+std::vector<glm::vec4> scatter_trees(const struct rawimage *heightmap, const struct rawimage *normalmap, float sidelength, float minheight, float maxheight, size_t density, unsigned int seed);
+
+struct packedimage pack_image(const struct rawimage *image);
+
+struct rawimage unpack_image(const struct packedimage *packed);
+
+float sample_packed(int x, int y, const struct packedimage *packed);
+
+size_t packed_size(const struct packedimage *packed);
@@ -1,7 +1,17 @@
 #include <iostream>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <cstdint>
 #include <vector>
 #include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
 #include <algorithm>
+#include <functional>
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
 #include <GL/gl.h>
@@ -18,12 +28,32 @@
 #include "external/imgui/imgui_impl_opengl3.h"
 
 #include "imp.h"
+#include "memory.h"
+#include "pool.h"
+#include "bcn.h"
 #include "dds.h"
 #include "glwrapper.h"
 #include "shader.h"
 #include "camera.h"
+#include "simulation.h"
+#include "culling.h"
 #include "terrain.h"
 #include "effects.h"
+#include "timer.h"
+#include "pacing.h"
+#include "resolution.h"
+#include "bench.h"
+#include "erosion.h"
+#include "water.h"
+#include "submission.h"
+#include "forest.h"
+#include "animation.h"
+#include "crowd.h"
+#include "parallel.h"
+#include "tasks.h"
+#include "tilefarm.h"
+#include "explore.h"
+#include "capture.h"
 
 #define WINDOW_WIDTH 1920
 #define WINDOW_HEIGHT 1080
@@ -32,8 +62,19 @@
 #define FAR_CLIP 1600.f
 
 #define GRASS_DENSITY 1000000
+#define CROWD_SIZE 400
+#define FOREST_DENSITY 1500000 // tree candidates, about a tenth of them end up as trees
 #define FOG_DENSITY 0.015f
 
+#define TERRAIN_SEED 333
+#define WATER_LEVEL 0.1f // fraction of the terrain amplitude
+#define RECORD_INTERVAL 0.25f // seconds between recorded camera keyframes
+#define BRUSH_RADIUS 32.f // in heightmap texels
+#define BRUSH_RATE 0.05f // normalized height per second at the center of the brush
+#define FRAME_BUDGET 14.f // GPU milliseconds of the scene, a 60 Hz frame with room for the debug UI and the swap
+#define MAX_FPS_CAP 240.f
+#define MEMORY_REPORT "memory.json" // written from the debug window when there is no --memory-report
+
 Shader grass_shader(void)
 {
 	struct shaderinfo pipeline[] = {
@@ -59,8 +100,6 @@ Shader terrain_shader(void)
 {
 	struct shaderinfo pipeline[] = {
 		{GL_VERTEX_SHADER, "shaders/terrain.vert"},
-		{GL_TESS_CONTROL_SHADER, "shaders/terrain.tesc"},
-		{GL_TESS_EVALUATION_SHADER, "shaders/terrain.tese"},
 		{GL_FRAGMENT_SHADER, "shaders/terrain.frag"},
 		{GL_NONE, NULL}
 	};
@@ -71,6 +110,103 @@ Shader terrain_shader(void)
 
 	shader.uniform_vec3("fogcolor", glm::vec3(0.46, 0.7, 0.99));
 	shader.uniform_float("fogfactor", FOG_DENSITY);
+	shader.uniform_int("grid", CLIPMAP_GRID);
+	shader.uniform_float("spacing", CLIPMAP_SPACING);
+
+	return shader;
+}
+
+// the terrain without shading, for the occlusion depth
+Shader terrain_depth_shader(void)
+{
+	struct shaderinfo pipeline[] = {
+		{GL_VERTEX_SHADER, "shaders/terrain.vert"},
+		{GL_FRAGMENT_SHADER, "shaders/depth.frag"},
+		{GL_NONE, NULL}
+	};
+
+	Shader shader(pipeline);
+
+	shader.bind();
+
+	shader.uniform_int("grid", CLIPMAP_GRID);
+	shader.uniform_float("spacing", CLIPMAP_SPACING);
+
+	return shader;
+}
+
+Shader tree_shader(void)
+{
+	struct shaderinfo pipeline[] = {
+		{GL_VERTEX_SHADER, "shaders/tree.vert"},
+		{GL_FRAGMENT_SHADER, "shaders/tree.frag"},
+		{GL_NONE, NULL}
+	};
+
+	Shader shader(pipeline);
+
+	shader.bind();
+
+	shader.uniform_vec3("fogcolor", glm::vec3(0.46, 0.7, 0.99));
+	shader.uniform_float("fogfactor", FOG_DENSITY);
+	shader.uniform_bool("bake", false);
+
+	return shader;
+}
+
+Shader impostor_shader(void)
+{
+	struct shaderinfo pipeline[] = {
+		{GL_VERTEX_SHADER, "shaders/distant_tree.vert"},
+		{GL_FRAGMENT_SHADER, "shaders/distant_tree.frag"},
+		{GL_NONE, NULL}
+	};
+
+	Shader shader(pipeline);
+
+	shader.bind();
+
+	shader.uniform_vec3("fogcolor", glm::vec3(0.46, 0.7, 0.99));
+	shader.uniform_float("fogfactor", FOG_DENSITY);
+	shader.uniform_int("frames", IMPOSTOR_FRAMES);
+
+	return shader;
+}
+
+Shader skinned_shader(void)
+{
+	struct shaderinfo pipeline[] = {
+		{GL_VERTEX_SHADER, "shaders/skinned.vert"},
+		{GL_FRAGMENT_SHADER, "shaders/skinned.frag"},
+		{GL_NONE, NULL}
+	};
+
+	Shader shader(pipeline);
+
+	shader.bind();
+
+	shader.uniform_vec3("basedcolor", glm::vec3(0.45, 0.3, 0.2));
+
+	return shader;
+}
+
+Shader water_shader(void)
+{
+	struct shaderinfo pipeline[] = {
+		{GL_VERTEX_SHADER, "shaders/water.vert"},
+		{GL_TESS_CONTROL_SHADER, "shaders/water.tesc"},
+		{GL_TESS_EVALUATION_SHADER, "shaders/water.tese"},
+		{GL_FRAGMENT_SHADER, "shaders/water.frag"},
+		{GL_NONE, NULL}
+	};
+
+	Shader shader(pipeline);
+
+	shader.bind();
+
+	shader.uniform_vec3("fogcolor", glm::vec3(0.46, 0.7, 0.99));
+	shader.uniform_float("fogfactor", FOG_DENSITY);
+	shader.uniform_float("detail", 16.f);
 
 	return shader;
 }
@@ -130,21 +266,18 @@ Shader compute_shader(void)
 	return shader;
 }
 
-Skybox init_skybox(void)
-{
-	const char *CUBEMAP_TEXTURES[6] = {
+static const char *SKYBOX_FACES[6] = {
 	"media/textures/skybox/dust_ft.tga",
 	"media/textures/skybox/dust_bk.tga",
 	"media/textures/skybox/dust_up.tga",
 	"media/textures/skybox/dust_dn.tga",
 	"media/textures/skybox/dust_rt.tga",
 	"media/textures/skybox/dust_lf.tga",
-	};
-
-	GLuint cubemap = load_TGA_cubemap(CUBEMAP_TEXTURES);
-	Skybox skybox { cubemap };
+};
 
-	return skybox;
+static inline float megabytes(size_t bytes)
+{
+	return float(bytes) / float(1 << 20);
 }
 
 static inline void start_imguiframe(SDL_Window *window)
@@ -170,30 +303,100 @@ static void init_imgui(SDL_Window *window, SDL_GLContext glcontext)
 	ImGui_ImplOpenGL3_Init("#version 430");
 }
 
-void run_terraingen(SDL_Window *window)
+// bench is NULL for an interactive session, otherwise the recorded camera path is replayed with a fixed timestep
+// erosion iterations run in the background after startup, the terrain is updated after each one
+void run_terraingen(SDL_Window *window, const struct benchconfig *bench, long seed, const char *recordpath, unsigned int erosion, const char *worldpath, const char *captureprefix, enum captureformat captureformat, bool prepass, float budget, float fpscap, const char *memoryreport)
 {
-	SDL_SetRelativeMouseMode(SDL_TRUE);
+	const bool benchmode = (bench != nullptr);
 
-	Shader grass_program = grass_shader();
-	Shader terrain_program = terrain_shader();
-	Shader sky_program = skybox_shader();
-	Shader cloud_program = cloud_shader();
+	CameraPath path;
+	if (benchmode && path.load(bench->pathfile) == false) { return; }
+	CameraPath recording;
 
-	Skybox skybox = init_skybox();
+	if (!benchmode) { SDL_SetRelativeMouseMode(SDL_TRUE); }
 
-	Terrain terrain = { 64, 32.f, 256.f };
+	const unsigned int grassseed = benchmode ? (unsigned int)(bench->seed) : std::random_device{}();
 
+	Shader grass_program, terrain_program, sky_program, cloud_program;
+	Shader water_program, tree_program, impostor_program, skinned_program;
+	Shader terrain_depth_program;
+	Terrain terrain = { 64, 32.f, 256.f, seed };
 	Clouds clouds = { terrain.sidelength, terrain.amplitude, 128, 0.03f, 0.5f, };
+	Grass grass = { &terrain, GRASS_DENSITY, grassseed };
+	std::vector<glm::vec4> trees;
+	struct rawimage skyfaces[6];
+	bool skyloaded = false;
+	struct ddsimage windfile;
+	GLuint cubemap = 0;
+
+	// the CPU stages run on a pool of workers, everything that touches GL runs here as soon as its inputs are done
+	TaskGraph startup;
+	startup.add("grass shader", TASK_CONTEXT, {}, [&](void) { grass_program = grass_shader(); });
+	startup.add("terrain shader", TASK_CONTEXT, {}, [&](void) { terrain_program = terrain_shader(); });
+	startup.add("terrain depth shader", TASK_CONTEXT, {}, [&](void) { terrain_depth_program = terrain_depth_shader(); });
+	startup.add("skybox shader", TASK_CONTEXT, {}, [&](void) { sky_program = skybox_shader(); });
+	startup.add("cloud shader", TASK_CONTEXT, {}, [&](void) { cloud_program = cloud_shader(); });
+	startup.add("water shader", TASK_CONTEXT, {}, [&](void) { water_program = water_shader(); });
+	startup.add("tree shader", TASK_CONTEXT, {}, [&](void) { tree_program = tree_shader(); });
+	startup.add("impostor shader", TASK_CONTEXT, {}, [&](void) { impostor_program = impostor_shader(); });
+	startup.add("skinned shader", TASK_CONTEXT, {}, [&](void) { skinned_program = skinned_shader(); });
+
+	const taskid skyfiles = startup.add("skybox files", TASK_WORKER, {}, [&](void) {
+		MemoryScope scope(MEMORY_SKY);
+		skyloaded = load_TGA_faces(SKYBOX_FACES, skyfaces);
+	});
+	startup.add("skybox upload", TASK_CONTEXT, { skyfiles }, [&](void) {
+		MemoryScope scope(MEMORY_SKY);
+		if (skyloaded) { cubemap = bind_cubemap(skyfaces); }
+		for (int face = 0; face < 6; face++) { tracked_free(skyfaces[face].data); }
+	});
+
+	const taskid heights = startup.add("heightmap", TASK_WORKER, {}, [&](void) {
+		// a world generated by the tile farm replaces the heights, normals and occlusion
+		if (worldpath == nullptr || terrain.loadworld(worldpath) == false) { terrain.genheights(); }
+	});
+	const taskid normals = startup.add("normal map", TASK_WORKER, { heights }, [&](void) { terrain.gennormals(); });
+	const taskid occlusion = startup.add("occlusion map", TASK_WORKER, { heights }, [&](void) { terrain.genocclusion(); });
+	const taskid splat = startup.add("splat map", TASK_WORKER, { normals }, [&](void) { terrain.gensplat(); });
+	const taskid surfaces = startup.add("surface files", TASK_WORKER, {}, [&](void) { terrain.loadsurfaces(); });
+	const taskid terrainupload = startup.add("terrain upload", TASK_CONTEXT, { normals, occlusion, splat, surfaces }, [&](void) { terrain.upload(); });
+
+	const taskid cloudvolume = startup.add("cloud volume", TASK_WORKER, {}, [&](void) { clouds.generate(); });
+	startup.add("cloud upload", TASK_CONTEXT, { cloudvolume }, [&](void) { clouds.upload(); });
+
+	const taskid grassroots = startup.add("grass roots", TASK_WORKER, { normals }, [&](void) { grass.scatter(); });
+	const taskid wind = startup.add("wind file", TASK_WORKER, {}, [&](void) {
+		MemoryScope scope(MEMORY_GRASS);
+		windfile = read_DDS("media/textures/distortion.dds");
+	});
+	startup.add("grass upload", TASK_CONTEXT, { grassroots, wind, terrainupload }, [&](void) {
+		MemoryScope scope(MEMORY_GRASS);
+		grass.upload(terrain.heightmap, terrain.normalmap, terrain.occlusmap, terrain.detailmap, upload_DDS_texture(&windfile));
+		tracked_free(windfile.data);
+	});
+
+	startup.add("tree roots", TASK_WORKER, { normals }, [&](void) { trees = plant_forest(&terrain, WATER_LEVEL, FOREST_DENSITY, (unsigned int)seed); });
+
+	// the calling thread is one of the threads
+	startup.run(threadcount() - 1);
 
-	Grass grass = {
-		&terrain,
-		GRASS_DENSITY,
-		terrain.heightmap,
-		terrain.normalmap,
-		terrain.occlusmap,
-		terrain.detailmap,
-		load_DDS_texture("media/textures/distortion.dds"),
-	};
+	Skybox skybox { cubemap };
+
+	Water water = { &terrain.heightimage, 64, 32.f, WATER_LEVEL, terrain.amplitude, (unsigned int)seed, skybox.texture() };
+	water_program.uniform_float("sealevel", water.level);
+	water_program.uniform_float("waveheight", water.waveheight);
+	water_program.uniform_float("wavescale", 1.f / water.tilesize);
+
+	Forest forest = { &terrain, trees, &tree_program };
+	impostor_program.uniform_float("radius", forest.impostor_atlas()->radius);
+	impostor_program.uniform_float("center", forest.impostor_atlas()->center);
+
+	OcclusionCuller culler = { &terrain.heightimage, terrain.mapratio, terrain.amplitude };
+
+	Crowd crowd = { &terrain, WATER_LEVEL, CROWD_SIZE, (unsigned int)seed };
+	skinned_program.uniform_int("JOINT_COUNT", crowd.jointcount());
+
+	std::cout << "startup: " << startup.milliseconds() << " ms of generation, " << startup.critical_path() << " ms on the critical path\n";
 
 	Camera cam = { 
 		glm::vec3(1024.f, 128.f, 1024.f),
@@ -203,40 +406,218 @@ void run_terraingen(SDL_Window *window)
 		FAR_CLIP
 	};
 
+	ErosionJob *erosionjob = nullptr;
+	std::vector<float> erodedheights;
+	if (erosion > 0 && !benchmode) {
+		std::vector<float> heights(terrain.heightimage.width * terrain.heightimage.height);
+		dequantize_image(&terrain.heightimage, heights.data());
+		struct erosionparams params = default_erosionparams(seed);
+		erosionjob = new ErosionJob(heights.data(), terrain.heightimage.width, terrain.heightimage.height, &params, erosion);
+	}
+
+	// the encoders share the machine with the renderer
+	FrameCapture *capture = nullptr;
+	if (captureprefix) {
+		capture = new FrameCapture(captureprefix, captureformat, WINDOW_WIDTH, WINDOW_HEIGHT, std::max(1u, threadcount() / 2));
+	}
+
+	GPUTimer timer;
+	// benchmarks stay at native resolution so their frames and timings compare between runs
+	DynamicResolution resolution = { WINDOW_WIDTH, WINDOW_HEIGHT, budget };
+	resolution.enabled = !benchmode && budget > 0.f;
+	Benchmark results = { bench };
+	const unsigned long benchframes = benchmode ? bench->warmup + (unsigned long)(path.duration() / bench->timestep) : 0;
+
+	float brushradius = BRUSH_RADIUS;
+	float flattenheight = 0.f;
+	bool painting = false;
+
 	float start = 0.f;
  	float end = 0.f;
+	float delta = 0.f;
+	float lastrecord = 0.f;
 	unsigned long frames = 0;
 	unsigned int msperframe = 0;
+	struct statecounters statecalls = {};
+
+	// the startup bound textures behind the state shadow
+	invalidate_state();
 
-	SDL_Event event;
-	while (event.type != SDL_QUIT) {
-		while(SDL_PollEvent(&event));
-		start = 0.001f * float(SDL_GetTicks());
-		const float delta = start - end;
-		cam.update(delta);
+	// the benchmark steps the camera along its path with the frames instead
+	Simulation *simulation = benchmode ? nullptr : new Simulation(&cam);
+
+	// benchmarks run as fast as they can, their frame times are the measurement
+	FramePacer pacer = { benchmode ? 0.f : fpscap };
+	bool lateinput = !benchmode;
+
+	bool running = true;
+	// SDL only reads the keyboard and mouse state from the window system when the events are pumped
+	auto poll_events = [&](void) {
+		SDL_Event event;
+		while (SDL_PollEvent(&event)) {
+			if (event.type == SDL_QUIT) { running = false; }
+		}
+	};
+
+	// with late input the view is sampled just before the view matrix is built, after the erosion and editing work of the frame
+	// the events are pumped again first, otherwise the late sample would see the state of the start of the frame
+	auto sample_view = [&](bool pump) {
+		if (pump) { poll_events(); }
+		const auto now = pacer.input();
+		const struct camerainput input = sample_camerainput();
+		simulation->feed(&input);
+		const struct simstate state = simulation->sample(now);
+		start = float(state.time);
+		delta = start - end;
+		cam.lookat(state.eye, state.direction);
+	};
+
+	while (running) {
+		const auto framestart = pacer.begin();
+		poll_events();
+		if (benchmode) {
+			if (frames >= benchframes) { break; }
+			// the warmup frames stay at the start of the path
+			const unsigned long pathframe = (frames > bench->warmup) ? frames - bench->warmup : 0;
+			start = float(frames) * bench->timestep;
+			delta = bench->timestep;
+			glm::vec3 position, direction;
+			path.sample(float(pathframe) * bench->timestep, &position, &direction);
+			cam.lookat(position, direction);
+		} else if (lateinput == false) {
+			sample_view(false);
+		}
+
+		unsigned int iteration = 0;
+		if (erosionjob && erosionjob->poll(&erodedheights, &iteration)) {
+			terrain.updateheights(erodedheights.data(), iteration == erosionjob->iterations());
+			const struct rect whole = { 0, 0, int(terrain.heightimage.width), int(terrain.heightimage.height) };
+			culler.update(whole);
+		}
+
+		// left mouse raises and right mouse lowers the terrain in the center of the view
+		// with shift held they smooth and flatten, the brackets change the brush size
+		// with late input the brush follows the view and the frame time of the previous frame
+		if (!benchmode) {
+			const Uint8 *keys = SDL_GetKeyboardState(NULL);
+			const Uint32 buttons = SDL_GetMouseState(NULL, NULL);
+			const bool raise = buttons & SDL_BUTTON(SDL_BUTTON_LEFT);
+			const bool lower = buttons & SDL_BUTTON(SDL_BUTTON_RIGHT);
+			const bool shift = keys[SDL_SCANCODE_LSHIFT];
+			if (keys[SDL_SCANCODE_LEFTBRACKET]) { brushradius = std::max(brushradius - 64.f * delta, 4.f); }
+			if (keys[SDL_SCANCODE_RIGHTBRACKET]) { brushradius = std::min(brushradius + 64.f * delta, 128.f); }
+
+			glm::vec3 hit;
+			const bool held = raise || lower;
+			if (held && terrain.raycast(cam.eye, cam.center, FAR_CLIP, &hit)) {
+				if (painting == false) { flattenheight = hit.y / terrain.amplitude; }
+				struct brush brush = {
+					.mode = shift ? (raise ? BRUSH_SMOOTH : BRUSH_FLATTEN) : (raise ? BRUSH_RAISE : BRUSH_LOWER),
+					.center = glm::vec2(hit.x, hit.z) / terrain.mapratio,
+					.radius = brushradius,
+					.strength = shift ? 4.f * delta : BRUSH_RATE * delta,
+					.target = flattenheight
+				};
+				culler.update(terrain.edit(&brush));
+			}
+			painting = held;
+
+			const struct rect completed = terrain.flush_edits(painting == false);
+			if (empty_rect(completed) == false) {
+				grass.regrow(terrain.mapratio * glm::vec2(completed.x0, completed.y0), terrain.mapratio * glm::vec2(completed.x1, completed.y1));
+			}
+		}
 
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+		if (!benchmode && lateinput) { sample_view(true); }
+
+		if (recordpath && start - lastrecord >= RECORD_INTERVAL) {
+			recording.record(start, &cam);
+			lastrecord = start;
+		}
+
+		resolution.begin();
 
 		const glm::mat4 VIEW_PROJECT = cam.project * cam.view;
 		sky_program.uniform_mat4("view", cam.view);
 		terrain_program.uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
 		grass_program.uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
 		cloud_program.uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
+		water_program.uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
+		tree_program.uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
+		impostor_program.uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
+		skinned_program.uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
+		terrain_depth_program.uniform_mat4("VIEW_PROJECT", VIEW_PROJECT);
+
+		// depth only first, so the expensive terrain shading runs once per pixel
+		timer.begin(PASS_PREPASS);
+		terrain_depth_program.bind();
+		terrain_depth_program.uniform_float("amplitude", terrain.amplitude);
+		terrain_depth_program.uniform_float("mapscale", 1.f / terrain.sidelength);
+		terrain_depth_program.uniform_vec3("camerapos", cam.eye);
+		if (prepass) {
+			terrain.display();
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
+		}
 
+		timer.begin(PASS_TERRAIN);
 		terrain_program.bind();
 		terrain_program.uniform_float("amplitude", terrain.amplitude);
 		terrain_program.uniform_float("mapscale", 1.f / terrain.sidelength);
 		terrain_program.uniform_vec3("camerapos", cam.eye);
 		terrain.display();
-
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+
+		// in the mountains most of the grass, trees and water are behind the terrain
+		timer.begin(PASS_CULL);
+		if (culler.enabled) {
+			culler.rasterize(VIEW_PROJECT);
+			if (culler.gpu()) {
+				culler.begin_depth();
+				terrain_depth_program.bind();
+				terrain.display();
+				culler.end_depth();
+			}
+		}
+		const struct frustum frustum = extract_frustum(VIEW_PROJECT);
+		grass.cull(&culler, VIEW_PROJECT, cam.eye);
+		water.cull(&frustum, &culler);
+
+		timer.begin(PASS_FOREST);
+		forest.cull(VIEW_PROJECT, cam.eye, &culler);
+		tree_program.bind();
+		tree_program.uniform_float("mapscale", 1.f / terrain.sidelength);
+		tree_program.uniform_vec3("camerapos", cam.eye);
+		forest.display();
+		impostor_program.bind();
+		impostor_program.uniform_float("mapscale", 1.f / terrain.sidelength);
+		impostor_program.uniform_vec3("camerapos", cam.eye);
+		forest.display_impostors();
+
+		timer.begin(PASS_CROWD);
+		crowd.update(start, delta);
+		skinned_program.bind();
+		skinned_program.uniform_vec3("camerapos", cam.eye);
+		crowd.display();
+
+		timer.begin(PASS_SKY);
 		sky_program.bind();
 		skybox.display();
 
+		timer.begin(PASS_WATER);
+		water.update(start);
+		water_program.bind();
+		water_program.uniform_float("time", start);
+		water_program.uniform_vec3("camerapos", cam.eye);
+		water.display();
+
+		timer.begin(PASS_CLOUDS);
 		cloud_program.bind();
 		cloud_program.uniform_float("time", start);
 		clouds.display();
 
+		timer.begin(PASS_GRASS);
 		grass_program.bind();
 		grass_program.uniform_float("mapscale", 1.f / terrain.sidelength);
 		grass_program.uniform_float("amplitude", terrain.amplitude);
@@ -244,13 +625,69 @@ void run_terraingen(SDL_Window *window)
 		grass_program.uniform_vec3("camerapos", cam.eye);
 		grass.display();
 
+		timer.begin(PASS_UPSCALE);
+		resolution.resolve();
+
+		// captured before the debug UI so the images only depend on the scene
+		if (capture) { capture->capture(frames); }
+
 		// debug UI
+		timer.begin(PASS_UI);
 		start_imguiframe(window);
 
 		ImGui::Begin("Debug");
 		ImGui::SetWindowSize(ImVec2(400, 200));
 		ImGui::Text("%d ms per frame", msperframe);
+		ImGui::Text("frame: %.2f ms, jitter %.2f ms, waited %.2f ms", pacer.frametime(), pacer.jitter(), pacer.waited());
+		ImGui::Text("input to swap: %.2f ms, max %.2f ms", pacer.latency(), pacer.maxlatency());
+		ImGui::Checkbox("late input", &lateinput);
+		ImGui::SliderFloat("frame rate cap", &pacer.cap, 0.f, MAX_FPS_CAP, "%.0f");
 		ImGui::Text("camera position: %.2f, %.2f, %.2f", cam.eye.x, cam.eye.y, cam.eye.z);
+		ImGui::Text("characters: %zu", crowd.count());
+		ImGui::Text("trees: %zu near, %zu far, %zu total in %zu draws", forest.nearcount(), forest.farcount(), forest.total(), forest.drawcount());
+		ImGui::Text("brush radius: %.0f", brushradius);
+		ImGui::Checkbox("occlusion culling", &culler.enabled);
+		ImGui::Checkbox("terrain depth prepass", &prepass);
+		ImGui::Checkbox("dynamic resolution", &resolution.enabled);
+		ImGui::SliderFloat("sharpness", &resolution.sharpness, 0.f, 1.f);
+		ImGui::Text("resolution: %dx%d (%.0f%%), budget %.1f ms", resolution.render_width(), resolution.render_height(), 100.f * resolution.scale(), resolution.budget);
+		if (culler.gpu()) {
+			ImGui::Text("water patches: %zu / %zu, grass culled on the GPU", water.drawnpatches(), water.patchcount());
+		} else {
+			ImGui::Text("water patches: %zu / %zu, grass tiles: %zu / %zu", water.drawnpatches(), water.patchcount(), grass.visibletiles(), grass.tilecount());
+		}
+		ImGui::Text("startup: %.0f ms, critical path %.0f ms", startup.milliseconds(), startup.critical_path());
+		if (simulation) {
+			ImGui::Text("simulation: %lu steps, %lu skipped", simulation->ticks(), simulation->skipped());
+		}
+		if (erosionjob) {
+			ImGui::Text("erosion: %u / %u", erosionjob->progress(), erosionjob->iterations());
+		}
+		if (capture) {
+			ImGui::Text("capture: %lu frames, %lu written, %.0f ms stalled", capture->captured(), capture->written(), capture->stalled());
+		}
+		ImGui::Text("GL state: %lu calls, %lu skipped, %lu batched", statecalls.issued, statecalls.skipped, statecalls.batched);
+		if (ImGui::CollapsingHeader("memory")) {
+			const struct memoryusage cputotal = memory_total(MEMORY_CPU);
+			const struct memoryusage gputotal = memory_total(MEMORY_GPU);
+			ImGui::Text("total: cpu %.1f MB, peak %.1f MB, gpu %.1f MB, peak %.1f MB of %.0f MB", megabytes(cputotal.live), megabytes(cputotal.peak), megabytes(gputotal.live), megabytes(gputotal.peak), megabytes(gputotal.budget));
+			for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+				const struct memoryusage cpu = memory_usage(memsubsystem(i), MEMORY_CPU);
+				const struct memoryusage gpu = memory_usage(memsubsystem(i), MEMORY_GPU);
+				if (cpu.peak == 0 && gpu.peak == 0) { continue; }
+				const bool over = (cpu.budget > 0 && cpu.live > cpu.budget) || (gpu.budget > 0 && gpu.live > gpu.budget);
+				const ImVec4 color = over ? ImVec4(1.f, 0.3f, 0.3f, 1.f) : ImGui::GetStyleColorVec4(ImGuiCol_Text);
+				ImGui::TextColored(color, "%s: cpu %.1f / %.0f MB, gpu %.1f / %.0f MB, peak %.1f and %.1f MB", MEMORY_NAMES[i], megabytes(cpu.live), megabytes(cpu.budget), megabytes(gpu.live), megabytes(gpu.budget), megabytes(cpu.peak), megabytes(gpu.peak));
+			}
+			const struct poolstats pooled = pool_stats();
+			ImGui::Text("pool: %.1f MB idle in %zu buffers, %lu reused, %lu allocated", megabytes(pooled.idle), pooled.idlebuffers, pooled.hits, pooled.misses);
+			if (ImGui::Button("trim pool")) { pool_trim(); }
+			ImGui::SameLine();
+			if (ImGui::Button("write memory report")) { write_memory_json(memoryreport ? memoryreport : MEMORY_REPORT); }
+		}
+		for (int pass = 0; pass < PASS_COUNT; pass++) {
+			ImGui::Text("%s: %.2f ms", PASS_NAMES[pass], timer.milliseconds(pass));
+		}
 
 		//if (ImGui::Button("Exit")) { running = false; }
 
@@ -259,21 +696,170 @@ void run_terraingen(SDL_Window *window)
 		// Render dear imgui into screen
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		timer.collect();
+		resolution.adjust(timer.total() - timer.milliseconds(PASS_UI));
+		statecalls = state_counters();
+		reset_state_counters();
 
 		SDL_GL_SwapWindow(window);
+		pacer.presented();
+
+		if (benchmode) {
+			// wait for the frame to finish so the wall time covers the GPU work
+			glFinish();
+			std::chrono::duration<float, std::milli> frametime = std::chrono::steady_clock::now() - framestart;
+			timer.resolve();
+			if (frames >= bench->warmup) { results.record(frametime.count(), &timer); }
+		}
+
 		end = start;
 		frames++;
 		if (frames % 100 == 0) { 
 			msperframe = (unsigned int)(delta*1000); 
 		}
 	}
+
+	if (benchmode) {
+		const std::string output = bench->output;
+		const char *renderer = (const char *)glGetString(GL_RENDERER);
+		results.write_json((output + ".json").c_str(), renderer);
+		results.write_csv((output + ".csv").c_str());
+		std::cout << "benchmark: " << results.count() << " frames written to " << output << ".json\n";
+	}
+	if (recordpath) { recording.save(recordpath); }
+	if (memoryreport) { write_memory_json(memoryreport); }
+	if (capture) {
+		capture->finish();
+		std::cout << "capture: " << capture->written() << " frames written to " << captureprefix << "\n";
+	}
+
+	delete simulation;
+	delete capture;
+	delete erosionjob;
 }
 
 int main(int argc, char *argv[])
 {
+	struct benchconfig bench = {
+		.pathfile = nullptr,
+		.output = "bench_results",
+		.seed = TERRAIN_SEED,
+		.timestep = 1.f / 60.f,
+		.warmup = 60
+	};
+	const char *recordpath = nullptr;
+	unsigned int erosion = 0;
+	const char *worldpath = nullptr;
+	const char *captureprefix = nullptr;
+	enum captureformat captureformat = CAPTURE_PNG;
+	bool prepass = true;
+	float budget = FRAME_BUDGET;
+	float fpscap = 0.f;
+	int swapinterval = 1;
+	const char *memoryreport = nullptr;
+	const char *workeraddress = nullptr;
+	struct farmconfig farm = {
+		.output = nullptr,
+		.worldsize = 4096,
+		.tilesize = 1024,
+		.seed = TERRAIN_SEED,
+		.localworkers = 1,
+		.port = 7878
+	};
+	struct exploreconfig explore = {
+		.output = nullptr,
+		.firstseed = TERRAIN_SEED,
+		.seeds = 1000,
+		.resolution = 128,
+		.worldsize = HEIGHTMAP_RESOLUTION,
+		.thumbnails = 64,
+		.waterlevel = WATER_LEVEL
+	};
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench") == 0 && i+1 < argc) {
+			bench.pathfile = argv[++i];
+		} else if (strcmp(argv[i], "--output") == 0 && i+1 < argc) {
+			bench.output = argv[++i];
+		} else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+			bench.seed = atol(argv[++i]);
+		} else if (strcmp(argv[i], "--warmup") == 0 && i+1 < argc) {
+			bench.warmup = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--record") == 0 && i+1 < argc) {
+			recordpath = argv[++i];
+		} else if (strcmp(argv[i], "--erode") == 0 && i+1 < argc) {
+			erosion = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--world") == 0 && i+1 < argc) {
+			worldpath = argv[++i];
+		} else if (strcmp(argv[i], "--capture") == 0 && i+1 < argc) {
+			captureprefix = argv[++i];
+		} else if (strcmp(argv[i], "--capture-format") == 0 && i+1 < argc) {
+			captureformat = (strcmp(argv[++i], "raw") == 0) ? CAPTURE_RAW : CAPTURE_PNG;
+		} else if (strcmp(argv[i], "--no-prepass") == 0) {
+			prepass = false;
+		} else if (strcmp(argv[i], "--budget") == 0 && i+1 < argc) {
+			budget = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--fps-cap") == 0 && i+1 < argc) {
+			fpscap = std::min(std::max(float(atof(argv[++i])), 0.f), MAX_FPS_CAP);
+		} else if (strcmp(argv[i], "--vsync") == 0 && i+1 < argc) {
+			i++;
+			swapinterval = (strcmp(argv[i], "off") == 0) ? 0 : (strcmp(argv[i], "adaptive") == 0) ? -1 : 1;
+		} else if (strcmp(argv[i], "--memory-report") == 0 && i+1 < argc) {
+			memoryreport = argv[++i];
+		} else if (strcmp(argv[i], "--gpu-budget") == 0 && i+1 < argc) {
+			set_memory_total_budget(MEMORY_GPU, size_t(atoi(argv[++i])) << 20);
+		} else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+			set_threadcount(atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--farm") == 0 && i+1 < argc) {
+			farm.output = argv[++i];
+		} else if (strcmp(argv[i], "--farm-size") == 0 && i+1 < argc) {
+			farm.worldsize = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--farm-tile") == 0 && i+1 < argc) {
+			farm.tilesize = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--farm-workers") == 0 && i+1 < argc) {
+			farm.localworkers = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--farm-port") == 0 && i+1 < argc) {
+			farm.port = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--explore") == 0 && i+1 < argc) {
+			explore.output = argv[++i];
+		} else if (strcmp(argv[i], "--explore-seeds") == 0 && i+1 < argc) {
+			explore.seeds = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--explore-size") == 0 && i+1 < argc) {
+			explore.resolution = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--explore-thumbnails") == 0 && i+1 < argc) {
+			explore.thumbnails = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--worker") == 0 && i+1 < argc) {
+			workeraddress = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [--bench path] [--output name] [--seed n] [--warmup frames] [--record path] [--erode iterations] [--world path] [--capture prefix] [--capture-format png|raw] [--no-prepass] [--budget ms] [--fps-cap fps] [--vsync on|off|adaptive] [--memory-report path] [--gpu-budget MB] [--threads n]\n", argv[0]);
+			fprintf(stderr, "       %s --farm path [--seed n] [--farm-size texels] [--farm-tile texels] [--farm-workers n] [--farm-port port] [--threads n]\n", argv[0]);
+			fprintf(stderr, "       %s --worker host:port [--threads n]\n", argv[0]);
+			fprintf(stderr, "       %s --explore prefix [--seed first] [--explore-seeds n] [--explore-size texels] [--explore-thumbnails n] [--threads n]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	const bool benchmode = (bench.pathfile != nullptr);
+
+	// the tile farm and the seed exploration run headless, without a window or GL context
+	if (explore.output) {
+		explore.firstseed = bench.seed;
+		exit(run_exploration(&explore) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (workeraddress) {
+		exit(run_worker(workeraddress) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (farm.output) {
+		farm.seed = bench.seed;
+		exit(run_coordinator(&farm, argv[0]) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
 	SDL_Init(SDL_INIT_VIDEO);
 
-	SDL_Window *window = SDL_CreateWindow("terraingen", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_OPENGL);
+	// a hidden window lets the benchmark run on an offscreen context (e.g. SDL_VIDEODRIVER=offscreen with llvmpipe)
+	Uint32 windowflags = SDL_WINDOW_OPENGL;
+	if (benchmode) { windowflags |= SDL_WINDOW_HIDDEN; }
+
+	SDL_Window *window = SDL_CreateWindow("terraingen", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, windowflags);
 	if (window == NULL) {
 		printf("Could not create window: %s\n", SDL_GetError());
 		exit(EXIT_FAILURE);
@@ -287,6 +873,9 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	// adaptive vsync tears instead of halving the frame rate when a frame is late, not every driver has it
+	if (SDL_GL_SetSwapInterval(swapinterval) != 0 && swapinterval == -1) { SDL_GL_SetSwapInterval(1); }
+
 	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 	glClearColor(0.f, 0.f, 0.f, 1.f);
 	glEnable(GL_CULL_FACE);
@@ -300,7 +889,7 @@ int main(int argc, char *argv[])
 
 	init_imgui(window, glcontext);
 
-	run_terraingen(window);
+	run_terraingen(window, benchmode ? &bench : nullptr, bench.seed, recordpath, erosion, worldpath, captureprefix, captureformat, prepass, budget, fpscap, memoryreport);
 
 	SDL_GL_DeleteContext(glcontext);
 	SDL_DestroyWindow(window);
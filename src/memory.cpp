@@ -0,0 +1,359 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "memory.h"
+#include "pool.h"
+
+#define MEGABYTES(n) (size_t(n) << 20)
+
+const char *MEMORY_NAMES[MEMORY_SUBSYSTEM_COUNT] = {
+	"terrain",
+	"grass",
+	"forest",
+	"water",
+	"sky",
+	"clouds",
+	"crowd",
+	"culling",
+	"renderer",
+	"shaders",
+	"world",
+	"scratch",
+	"pool",
+	"other",
+};
+
+// a budget of 0 is no budget, the GPU budgets leave room for the window framebuffer and the driver on a 2 GB card
+static const size_t DEFAULT_BUDGETS[MEMORY_SUBSYSTEM_COUNT][MEMORY_KIND_COUNT] = {
+	{ MEGABYTES(256), MEGABYTES(256) }, // terrain
+	{ MEGABYTES(64), MEGABYTES(128) }, // grass
+	{ MEGABYTES(64), MEGABYTES(128) }, // forest
+	{ MEGABYTES(32), MEGABYTES(64) }, // water
+	{ MEGABYTES(64), MEGABYTES(64) }, // sky
+	{ MEGABYTES(32), MEGABYTES(32) }, // clouds
+	{ MEGABYTES(16), MEGABYTES(32) }, // crowd
+	{ MEGABYTES(16), MEGABYTES(32) }, // culling
+	{ MEGABYTES(64), MEGABYTES(256) }, // renderer
+	{ MEGABYTES(16), MEGABYTES(16) }, // shaders
+	{ MEGABYTES(2048), 0 }, // world
+	{ MEGABYTES(64), 0 }, // scratch
+	{ POOL_MAX_IDLE, 0 }, // pool
+	{ MEGABYTES(256), MEGABYTES(128) }, // other
+};
+
+#define DEFAULT_GPU_TOTAL_BUDGET MEGABYTES(1536)
+
+enum globject {
+	OBJECT_TEXTURE,
+	OBJECT_BUFFER,
+	OBJECT_RENDERBUFFER,
+	OBJECT_COUNT
+};
+
+struct allocation {
+	enum memsubsystem subsystem;
+	size_t bytes;
+};
+
+static struct {
+	std::mutex lock;
+	struct memoryusage usage[MEMORY_SUBSYSTEM_COUNT][MEMORY_KIND_COUNT];
+	struct memoryusage total[MEMORY_KIND_COUNT];
+	bool over[MEMORY_SUBSYSTEM_COUNT][MEMORY_KIND_COUNT];
+	bool totalover[MEMORY_KIND_COUNT];
+	std::unordered_map<GLuint, struct allocation> objects[OBJECT_COUNT];
+	bool initialized = false;
+} tracker;
+
+static thread_local enum memsubsystem currentsubsystem = MEMORY_OTHER;
+
+static const char *KIND_NAMES[MEMORY_KIND_COUNT] = { "cpu", "gpu" };
+
+// has to be called with the lock held
+static void init_tracker(void)
+{
+	if (tracker.initialized) { return; }
+
+	for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+		for (int kind = 0; kind < MEMORY_KIND_COUNT; kind++) {
+			tracker.usage[i][kind] = {};
+			tracker.usage[i][kind].budget = DEFAULT_BUDGETS[i][kind];
+			tracker.over[i][kind] = false;
+		}
+	}
+	for (int kind = 0; kind < MEMORY_KIND_COUNT; kind++) {
+		tracker.total[kind] = {};
+		tracker.totalover[kind] = false;
+	}
+	tracker.total[MEMORY_GPU].budget = DEFAULT_GPU_TOTAL_BUDGET;
+
+	tracker.initialized = true;
+}
+
+// reports when the usage goes over its budget, not again until it was back under it
+static void check_budget(struct memoryusage *usage, bool *over, const char *name, enum memkind kind)
+{
+	const bool exceeded = usage->budget > 0 && usage->live > usage->budget;
+	if (exceeded && *over == false) {
+		usage->overruns++;
+		std::cerr << "error: " << name << " " << KIND_NAMES[kind] << " memory over budget, " << (usage->live >> 20) << " MB of " << (usage->budget >> 20) << " MB\n";
+	}
+	*over = exceeded;
+}
+
+static void charge(enum memsubsystem subsystem, enum memkind kind, size_t bytes)
+{
+	struct memoryusage *usage = &tracker.usage[subsystem][kind];
+	usage->live += bytes;
+	usage->peak = std::max(usage->peak, usage->live);
+	usage->allocations++;
+	check_budget(usage, &tracker.over[subsystem][kind], MEMORY_NAMES[subsystem], kind);
+
+	struct memoryusage *total = &tracker.total[kind];
+	total->live += bytes;
+	total->peak = std::max(total->peak, total->live);
+	total->allocations++;
+	check_budget(total, &tracker.totalover[kind], "total", kind);
+}
+
+static void refund(enum memsubsystem subsystem, enum memkind kind, size_t bytes)
+{
+	struct memoryusage *usage = &tracker.usage[subsystem][kind];
+	usage->live -= bytes;
+	usage->allocations--;
+	check_budget(usage, &tracker.over[subsystem][kind], MEMORY_NAMES[subsystem], kind);
+
+	struct memoryusage *total = &tracker.total[kind];
+	total->live -= bytes;
+	total->allocations--;
+	check_budget(total, &tracker.totalover[kind], "total", kind);
+}
+
+MemoryScope::MemoryScope(enum memsubsystem subsystem)
+{
+	previous = currentsubsystem;
+	currentsubsystem = subsystem;
+}
+
+MemoryScope::~MemoryScope(void)
+{
+	currentsubsystem = previous;
+}
+
+// the idle buffers of the pool are memory the process holds that no subsystem uses, they are charged to the pool
+// has to be called with the lock held
+static void charge_pool(void)
+{
+	const struct poolstats stats = pool_stats();
+	struct memoryusage *usage = &tracker.usage[MEMORY_POOL][MEMORY_CPU];
+	struct memoryusage *total = &tracker.total[MEMORY_CPU];
+
+	total->live = total->live - usage->live + stats.idle;
+	total->allocations = total->allocations - usage->allocations + stats.idlebuffers;
+	total->peak = std::max(total->peak, total->live);
+	usage->live = stats.idle;
+	usage->allocations = stats.idlebuffers;
+	usage->peak = std::max(usage->peak, usage->live);
+
+	check_budget(usage, &tracker.over[MEMORY_POOL][MEMORY_CPU], MEMORY_NAMES[MEMORY_POOL], MEMORY_CPU);
+	check_budget(total, &tracker.totalover[MEMORY_CPU], "total", MEMORY_CPU);
+}
+
+unsigned char *tracked_alloc(size_t bytes)
+{
+	unsigned char *data = pool_acquire(bytes);
+	struct poolheader *header = pool_header(data);
+	header->tag = currentsubsystem;
+
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	charge(currentsubsystem, MEMORY_CPU, bytes);
+	charge_pool();
+
+	return data;
+}
+
+void tracked_free(const void *data)
+{
+	if (data == nullptr) { return; }
+
+	const struct poolheader *header = pool_header(data);
+
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	refund(memsubsystem(header->tag), MEMORY_CPU, header->bytes);
+	pool_release(data);
+	charge_pool();
+}
+
+static void track_object(enum globject type, GLuint name, size_t bytes)
+{
+	if (name == 0) { return; }
+
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	auto found = tracker.objects[type].find(name);
+	if (found != tracker.objects[type].end()) {
+		refund(found->second.subsystem, MEMORY_GPU, found->second.bytes);
+	}
+	tracker.objects[type][name] = { currentsubsystem, bytes };
+	charge(currentsubsystem, MEMORY_GPU, bytes);
+}
+
+static void untrack_object(enum globject type, GLuint name)
+{
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	auto found = tracker.objects[type].find(name);
+	if (found == tracker.objects[type].end()) { return; }
+
+	refund(found->second.subsystem, MEMORY_GPU, found->second.bytes);
+	tracker.objects[type].erase(found);
+}
+
+void track_texture(unsigned int texture, size_t bytes) { track_object(OBJECT_TEXTURE, texture, bytes); }
+void track_buffer(unsigned int buffer, size_t bytes) { track_object(OBJECT_BUFFER, buffer, bytes); }
+void track_renderbuffer(unsigned int renderbuffer, size_t bytes) { track_object(OBJECT_RENDERBUFFER, renderbuffer, bytes); }
+void untrack_texture(unsigned int texture) { untrack_object(OBJECT_TEXTURE, texture); }
+void untrack_buffer(unsigned int buffer) { untrack_object(OBJECT_BUFFER, buffer); }
+void untrack_renderbuffer(unsigned int renderbuffer) { untrack_object(OBJECT_RENDERBUFFER, renderbuffer); }
+
+// bytes per texel, or per 4x4 block of the compressed formats
+static size_t texel_size(GLenum internalformat, bool *compressed)
+{
+	*compressed = false;
+
+	switch (internalformat) {
+	case GL_RED: case GL_R8:
+		return 1;
+	case GL_RG: case GL_RG8: case GL_R16: case GL_R16F:
+		return 2;
+	case GL_RGB: case GL_RGB8: case GL_RGBA: case GL_RGBA8:
+	case GL_RG16: case GL_RG16F: case GL_R32F:
+	case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: case GL_DEPTH24_STENCIL8:
+		return 4;
+	case GL_RGB16: case GL_RGB16F: case GL_RGBA16: case GL_RGBA16F: case GL_RG32F:
+		return 8;
+	case GL_RGB32F: case GL_RGBA32F:
+		return 16;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: case GL_COMPRESSED_RED_RGTC1:
+		*compressed = true;
+		return 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_RG_RGTC2:
+		*compressed = true;
+		return 16;
+	}
+
+	return 4;
+}
+
+size_t texture_bytes(unsigned int internalformat, size_t width, size_t height, size_t depth, unsigned int levels)
+{
+	bool compressed;
+	const size_t size = texel_size(internalformat, &compressed);
+
+	size_t bytes = 0;
+	for (unsigned int level = 0; level < levels; level++) {
+		const size_t w = std::max(width >> level, size_t(1));
+		const size_t h = std::max(height >> level, size_t(1));
+		const size_t d = std::max(depth >> level, size_t(1));
+		if (compressed) {
+			bytes += ((w + 3) / 4) * ((h + 3) / 4) * d * size;
+		} else {
+			bytes += w * h * d * size;
+		}
+	}
+
+	return bytes;
+}
+
+bool memory_would_exceed(enum memkind kind, size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	charge_pool();
+
+	const struct memoryusage *usage = &tracker.usage[currentsubsystem][kind];
+	const struct memoryusage *total = &tracker.total[kind];
+
+	return (usage->budget > 0 && usage->live + bytes > usage->budget) || (total->budget > 0 && total->live + bytes > total->budget);
+}
+
+struct memoryusage memory_usage(enum memsubsystem subsystem, enum memkind kind)
+{
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	charge_pool(); // trimming the pool does not go through the tracker
+
+	return tracker.usage[subsystem][kind];
+}
+
+struct memoryusage memory_total(enum memkind kind)
+{
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	charge_pool();
+
+	return tracker.total[kind];
+}
+
+void set_memory_budget(enum memsubsystem subsystem, enum memkind kind, size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	tracker.usage[subsystem][kind].budget = bytes;
+	check_budget(&tracker.usage[subsystem][kind], &tracker.over[subsystem][kind], MEMORY_NAMES[subsystem], kind);
+}
+
+void set_memory_total_budget(enum memkind kind, size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	tracker.total[kind].budget = bytes;
+	check_budget(&tracker.total[kind], &tracker.totalover[kind], "total", kind);
+}
+
+static void print_usage(FILE *fp, const struct memoryusage *usage)
+{
+	fprintf(fp, "{ \"live\": %zu, \"peak\": %zu, \"budget\": %zu, \"allocations\": %zu, \"overruns\": %lu }", usage->live, usage->peak, usage->budget, usage->allocations, usage->overruns);
+}
+
+bool write_memory_json(const char *fpath)
+{
+	FILE *fp = fopen(fpath, "w");
+	if (fp == nullptr) {
+		perror(fpath);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> guard(tracker.lock);
+	init_tracker();
+	charge_pool();
+
+	fprintf(fp, "{\n");
+	for (int kind = 0; kind < MEMORY_KIND_COUNT; kind++) {
+		fprintf(fp, "\t\"%s\": {\n", KIND_NAMES[kind]);
+		fprintf(fp, "\t\t\"total\": ");
+		print_usage(fp, &tracker.total[kind]);
+		fprintf(fp, ",\n");
+		for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+			fprintf(fp, "\t\t\"%s\": ", MEMORY_NAMES[i]);
+			print_usage(fp, &tracker.usage[i][kind]);
+			fprintf(fp, (i < MEMORY_SUBSYSTEM_COUNT-1) ? ",\n" : "\n");
+		}
+		fprintf(fp, "\t},\n");
+	}
+	const struct poolstats stats = pool_stats();
+	fprintf(fp, "\t\"pool\": { \"idle\": %zu, \"hits\": %lu, \"misses\": %lu }\n", stats.idle, stats.hits, stats.misses);
+	fprintf(fp, "}\n");
+
+	fclose(fp);
+
+	return true;
+}
@@ -0,0 +1,71 @@
+// records the bytes of every CPU image and every GL texture and buffer with the subsystem that owns it
+// allocations are charged to the subsystem of the innermost MemoryScope of the thread that makes them
+enum memsubsystem {
+	MEMORY_TERRAIN,
+	MEMORY_GRASS,
+	MEMORY_FOREST,
+	MEMORY_WATER,
+	MEMORY_SKY,
+	MEMORY_CLOUDS,
+	MEMORY_CROWD,
+	MEMORY_CULLING,
+	MEMORY_RENDERER, // render targets, capture and submission buffers
+	MEMORY_SHADERS,
+	MEMORY_WORLD, // tile farm
+	MEMORY_SCRATCH, // chunks of the scratch arenas
+	MEMORY_POOL, // idle buffers waiting in the pool
+	MEMORY_OTHER,
+	MEMORY_SUBSYSTEM_COUNT
+};
+
+enum memkind {
+	MEMORY_CPU,
+	MEMORY_GPU,
+	MEMORY_KIND_COUNT
+};
+
+extern const char *MEMORY_NAMES[MEMORY_SUBSYSTEM_COUNT];
+
+struct memoryusage {
+	size_t live; // bytes
+	size_t peak;
+	size_t budget;
+	size_t allocations; // live
+	unsigned long overruns; // times it went over the budget
+};
+
+class MemoryScope {
+public:
+	MemoryScope(enum memsubsystem subsystem);
+	~MemoryScope(void);
+private:
+	enum memsubsystem previous;
+};
+
+// buffers from the pool with accounting, the pool keeps the subsystem and size in front of the data
+// tracked_free only takes pointers tracked_alloc returned, everything else is undefined like delete[] of a foreign pointer
+unsigned char *tracked_alloc(size_t bytes);
+void tracked_free(const void *data);
+
+// GL object names, the header does not need GL so the headless generation can include it
+// a name that is tracked again is charged its new size, for buffers that are specified again
+void track_texture(unsigned int texture, size_t bytes);
+void track_buffer(unsigned int buffer, size_t bytes);
+void track_renderbuffer(unsigned int renderbuffer, size_t bytes);
+void untrack_texture(unsigned int texture);
+void untrack_buffer(unsigned int buffer);
+void untrack_renderbuffer(unsigned int renderbuffer);
+
+// of a GL internal format, depth halves with the levels like a 3D texture so array layers are multiplied by the caller
+// counts padded three channel formats as four, like the drivers store them
+size_t texture_bytes(unsigned int internalformat, size_t width, size_t height, size_t depth, unsigned int levels);
+
+// the budgets are enforced by the callers that can do with less, they ask before they allocate
+// true if bytes more for the subsystem of the current scope would take it or the total over its budget
+bool memory_would_exceed(enum memkind kind, size_t bytes);
+
+struct memoryusage memory_usage(enum memsubsystem subsystem, enum memkind kind);
+struct memoryusage memory_total(enum memkind kind);
+void set_memory_budget(enum memsubsystem subsystem, enum memkind kind, size_t bytes);
+void set_memory_total_budget(enum memkind kind, size_t bytes);
+bool write_memory_json(const char *fpath);
@@ -0,0 +1,299 @@
+// noise pipelines configured at compile time
+// they use the algorithms, hashing and tables of FastNoise and give the same values as the FastNoise configuration they replace,
+// but the noise type, fractal type, octave count and distance function are template parameters
+// so a sample has no switches and a recipe of several noises inlines into one loop
+// FastNoise stays for configurations that are only known at runtime
+
+enum fractaltype {
+	FRACTAL_NONE, // a single octave, like the non fractal FastNoise types
+	FRACTAL_FBM,
+	FRACTAL_BILLOW,
+	FRACTAL_RIGIDMULTI
+};
+
+enum interptype {
+	INTERP_LINEAR,
+	INTERP_HERMITE,
+	INTERP_QUINTIC
+};
+
+enum celldistance {
+	CELL_EUCLIDEAN,
+	CELL_MANHATTAN,
+	CELL_NATURAL
+};
+
+// the distance2 types combine the nearest and second nearest distance
+enum cellreturn {
+	CELL_DISTANCE,
+	CELL_DISTANCE2,
+	CELL_DISTANCE2ADD,
+	CELL_DISTANCE2SUB,
+	CELL_DISTANCE2MUL,
+	CELL_DISTANCE2DIV
+};
+
+// permutation table of a seed, the noises with the same seed share one
+struct noiseseed {
+	unsigned char perm[512];
+	unsigned char perm12[512];
+};
+
+extern const float NOISE_GRAD_X[12];
+extern const float NOISE_GRAD_Y[12];
+extern const float NOISE_CELL_X[256];
+extern const float NOISE_CELL_Y[256];
+
+struct noiseseed seed_noise(int seed);
+
+static inline int noise_floor(float f) { return (f >= 0 ? (int)f : (int)f - 1); }
+
+static inline int noise_round(float f) { return (f >= 0) ? (int)(f + 0.5f) : (int)(f - 0.5f); }
+
+static inline float noise_lerp(float a, float b, float t) { return a + t * (b - a); }
+
+static inline unsigned char noise_index(const struct noiseseed *seed, unsigned char offset, int x, int y)
+{
+	return seed->perm[(x & 0xff) + seed->perm[(y & 0xff) + offset]];
+}
+
+// the scale that keeps the sum of the octaves in [-1, 1]
+static inline float fractal_bounding(int octaves, float gain)
+{
+	float amp = gain;
+	float ampfractal = 1.f;
+	for (int i = 1; i < octaves; i++) {
+		ampfractal += amp;
+		amp *= gain;
+	}
+
+	return 1.f / ampfractal;
+}
+
+template <enum interptype INTERP>
+static inline float noise_interp(float t)
+{
+	switch (INTERP) {
+	case INTERP_HERMITE: return t*t*(3 - 2 * t);
+	case INTERP_QUINTIC: return t*t*t*(t*(t * 6 - 15) + 10);
+	default: return t;
+	}
+}
+
+template <enum celldistance DISTANCE>
+static inline float cell_distance(float x, float y)
+{
+	switch (DISTANCE) {
+	case CELL_MANHATTAN: return fabsf(x) + fabsf(y);
+	case CELL_NATURAL: return (fabsf(x) + fabsf(y)) + (x * x + y * y);
+	default: return x * x + y * y;
+	}
+}
+
+static inline float simplex_2D(const struct noiseseed *seed, unsigned char offset, float x, float y)
+{
+	static const float SQRT3 = float(1.7320508075688772935274463415059);
+	static const float F2 = 0.5f * (SQRT3 - 1.f);
+	static const float G2 = (3.f - SQRT3) / 6.f;
+
+	float t = (x + y) * F2;
+	int i = noise_floor(x + t);
+	int j = noise_floor(y + t);
+
+	t = (i + j) * G2;
+	float x0 = x - (i - t);
+	float y0 = y - (j - t);
+
+	const int i1 = (x0 > y0) ? 1 : 0;
+	const int j1 = 1 - i1;
+
+	float x1 = x0 - (float)i1 + G2;
+	float y1 = y0 - (float)j1 + G2;
+	float x2 = x0 - 1 + 2*G2;
+	float y2 = y0 - 1 + 2*G2;
+
+	float n0 = 0.f, n1 = 0.f, n2 = 0.f;
+	unsigned char lut;
+
+	t = 0.5f - x0*x0 - y0*y0;
+	if (t >= 0) {
+		t *= t;
+		lut = seed->perm12[(i & 0xff) + seed->perm[(j & 0xff) + offset]];
+		n0 = t * t * (x0*NOISE_GRAD_X[lut] + y0*NOISE_GRAD_Y[lut]);
+	}
+
+	t = 0.5f - x1*x1 - y1*y1;
+	if (t >= 0) {
+		t *= t;
+		lut = seed->perm12[((i + i1) & 0xff) + seed->perm[((j + j1) & 0xff) + offset]];
+		n1 = t * t * (x1*NOISE_GRAD_X[lut] + y1*NOISE_GRAD_Y[lut]);
+	}
+
+	t = 0.5f - x2*x2 - y2*y2;
+	if (t >= 0) {
+		t *= t;
+		lut = seed->perm12[((i + 1) & 0xff) + seed->perm[((j + 1) & 0xff) + offset]];
+		n2 = t * t * (x2*NOISE_GRAD_X[lut] + y2*NOISE_GRAD_Y[lut]);
+	}
+
+	return 70 * (n0 + n1 + n2);
+}
+
+// FastNoise Simplex (FRACTAL_NONE) or SimplexFractal
+template <enum fractaltype FRACTAL, int OCTAVES>
+class SimplexNoise {
+public:
+	SimplexNoise(const struct noiseseed *noiseseed, float freq, float lacun = 2.f, float gainfactor = 0.5f)
+	{
+		seed = noiseseed;
+		frequency = freq;
+		lacunarity = lacun;
+		gain = gainfactor;
+		bounding = fractal_bounding(OCTAVES, gain);
+	}
+	float sample(float x, float y) const
+	{
+		x *= frequency;
+		y *= frequency;
+
+		if (FRACTAL == FRACTAL_NONE) { return simplex_2D(seed, 0, x, y); }
+
+		float sum = octave(simplex_2D(seed, seed->perm[0], x, y));
+		float amp = 1;
+		for (int i = 1; i < OCTAVES; i++) {
+			x *= lacunarity;
+			y *= lacunarity;
+			amp *= gain;
+			if (FRACTAL == FRACTAL_RIGIDMULTI) {
+				sum -= octave(simplex_2D(seed, seed->perm[i], x, y)) * amp;
+			} else {
+				sum += octave(simplex_2D(seed, seed->perm[i], x, y)) * amp;
+			}
+		}
+
+		return (FRACTAL == FRACTAL_RIGIDMULTI) ? sum : sum * bounding;
+	}
+private:
+	const struct noiseseed *seed;
+	float frequency;
+	float lacunarity;
+	float gain;
+	float bounding;
+private:
+	static float octave(float n)
+	{
+		switch (FRACTAL) {
+		case FRACTAL_BILLOW: return fabsf(n) * 2 - 1;
+		case FRACTAL_RIGIDMULTI: return 1 - fabsf(n);
+		default: return n;
+		}
+	}
+};
+
+// FastNoise Cellular with the default jitter and distance indices 0 and 1
+template <enum celldistance DISTANCE, enum cellreturn RETURN>
+class CellularNoise {
+public:
+	CellularNoise(const struct noiseseed *noiseseed, float freq, float celljitter = 0.45f)
+	{
+		seed = noiseseed;
+		frequency = freq;
+		jitter = celljitter;
+	}
+	float sample(float x, float y) const
+	{
+		x *= frequency;
+		y *= frequency;
+
+		const int xr = noise_round(x);
+		const int yr = noise_round(y);
+
+		float nearest = 999999;
+		float second = 999999;
+		for (int xi = xr - 1; xi <= xr + 1; xi++) {
+			for (int yi = yr - 1; yi <= yr + 1; yi++) {
+				const unsigned char lut = noise_index(seed, 0, xi, yi);
+				const float vx = xi - x + NOISE_CELL_X[lut] * jitter;
+				const float vy = yi - y + NOISE_CELL_Y[lut] * jitter;
+				const float distance = cell_distance<DISTANCE>(vx, vy);
+				second = fmaxf(fminf(second, distance), nearest);
+				nearest = fminf(nearest, distance);
+			}
+		}
+
+		switch (RETURN) {
+		case CELL_DISTANCE: return nearest;
+		case CELL_DISTANCE2: return second;
+		case CELL_DISTANCE2ADD: return second + nearest;
+		case CELL_DISTANCE2SUB: return second - nearest;
+		case CELL_DISTANCE2MUL: return second * nearest;
+		case CELL_DISTANCE2DIV: return nearest / second;
+		}
+
+		return 0.f;
+	}
+private:
+	const struct noiseseed *seed;
+	float frequency;
+	float jitter;
+};
+
+// FastNoise GradientPerturbFractal, offsets the coordinates before they are sampled by a noise
+template <int OCTAVES, enum interptype INTERP = INTERP_QUINTIC>
+class GradientWarp {
+public:
+	GradientWarp(const struct noiseseed *noiseseed, float freq, float amp, float lacun = 2.f, float gainfactor = 0.5f)
+	{
+		seed = noiseseed;
+		frequency = freq;
+		amplitude = amp;
+		lacunarity = lacun;
+		gain = gainfactor;
+		bounding = fractal_bounding(OCTAVES, gain);
+	}
+	void apply(float &x, float &y) const
+	{
+		float amp = amplitude * bounding;
+		float freq = frequency;
+		single(seed->perm[0], amp, freq, x, y);
+		for (int i = 1; i < OCTAVES; i++) {
+			freq *= lacunarity;
+			amp *= gain;
+			single(seed->perm[i], amp, freq, x, y);
+		}
+	}
+private:
+	const struct noiseseed *seed;
+	float frequency;
+	float amplitude;
+	float lacunarity;
+	float gain;
+	float bounding;
+private:
+	void single(unsigned char offset, float warpamp, float freq, float &x, float &y) const
+	{
+		const float xf = x * freq;
+		const float yf = y * freq;
+
+		const int x0 = noise_floor(xf);
+		const int y0 = noise_floor(yf);
+		const int x1 = x0 + 1;
+		const int y1 = y0 + 1;
+
+		const float xs = noise_interp<INTERP>(xf - (float)x0);
+		const float ys = noise_interp<INTERP>(yf - (float)y0);
+
+		int lut0 = noise_index(seed, offset, x0, y0);
+		int lut1 = noise_index(seed, offset, x1, y0);
+		const float lx0x = noise_lerp(NOISE_CELL_X[lut0], NOISE_CELL_X[lut1], xs);
+		const float ly0x = noise_lerp(NOISE_CELL_Y[lut0], NOISE_CELL_Y[lut1], xs);
+
+		lut0 = noise_index(seed, offset, x0, y1);
+		lut1 = noise_index(seed, offset, x1, y1);
+		const float lx1x = noise_lerp(NOISE_CELL_X[lut0], NOISE_CELL_X[lut1], xs);
+		const float ly1x = noise_lerp(NOISE_CELL_Y[lut0], NOISE_CELL_Y[lut1], xs);
+
+		x += noise_lerp(lx0x, lx1x, ys) * warpamp;
+		y += noise_lerp(ly0x, ly1x, ys) * warpamp;
+	}
+};
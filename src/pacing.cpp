@@ -0,0 +1,110 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cmath>
+
+#include "pacing.h"
+
+typedef std::chrono::steady_clock clocktype;
+typedef std::chrono::duration<float, std::milli> milliseconds;
+
+FramePacer::FramePacer(float fps)
+{
+	cap = fps;
+	deadline = clocktype::now();
+	framestart = deadline;
+	inputtime = deadline;
+	frame = 0;
+
+	for (int i = 0; i < PACING_WINDOW; i++) {
+		frametimes[i] = 0.f;
+		latencies[i] = 0.f;
+		waits[i] = 0.f;
+	}
+}
+
+clocktype::time_point FramePacer::begin(void)
+{
+	const auto arrived = clocktype::now();
+
+	if (cap > 0.f) {
+		const auto period = std::chrono::duration_cast<clocktype::duration>(std::chrono::duration<double>(1.0 / cap));
+		const auto spin = std::chrono::duration_cast<clocktype::duration>(std::chrono::duration<double>(PACING_SPIN));
+		deadline += period;
+		// a frame that ran over its slot starts the next one right away instead of rushing the ones after it
+		if (arrived > deadline) { deadline = arrived; }
+		if (deadline - arrived > spin) { std::this_thread::sleep_until(deadline - spin); }
+		while (clocktype::now() < deadline);
+	} else {
+		deadline = arrived;
+	}
+
+	const auto now = clocktype::now();
+	const size_t slot = frame % PACING_WINDOW;
+	frametimes[slot] = milliseconds(now - framestart).count();
+	waits[slot] = milliseconds(now - arrived).count();
+	framestart = now;
+	inputtime = now;
+
+	return now;
+}
+
+clocktype::time_point FramePacer::input(void)
+{
+	inputtime = clocktype::now();
+
+	return inputtime;
+}
+
+void FramePacer::presented(void)
+{
+	latencies[frame % PACING_WINDOW] = milliseconds(clocktype::now() - inputtime).count();
+	frame++;
+}
+
+size_t FramePacer::samples(void) const
+{
+	return std::max(size_t(1), std::min(size_t(frame), size_t(PACING_WINDOW)));
+}
+
+float FramePacer::frametime(void) const
+{
+	float sum = 0.f;
+	for (size_t i = 0; i < samples(); i++) { sum += frametimes[i]; }
+
+	return sum / samples();
+}
+
+float FramePacer::jitter(void) const
+{
+	const float mean = frametime();
+	float sum = 0.f;
+	for (size_t i = 0; i < samples(); i++) { sum += (frametimes[i] - mean) * (frametimes[i] - mean); }
+
+	return sqrtf(sum / samples());
+}
+
+float FramePacer::latency(void) const
+{
+	float sum = 0.f;
+	for (size_t i = 0; i < samples(); i++) { sum += latencies[i]; }
+
+	return sum / samples();
+}
+
+float FramePacer::maxlatency(void) const
+{
+	float longest = 0.f;
+	for (size_t i = 0; i < samples(); i++) { longest = std::max(longest, latencies[i]); }
+
+	return longest;
+}
+
+float FramePacer::waited(void) const
+{
+	float sum = 0.f;
+	for (size_t i = 0; i < samples(); i++) { sum += waits[i]; }
+
+	return sum / samples();
+}
@@ -0,0 +1,29 @@
+// paces the frames to a frame rate cap and measures how long the input of a frame takes to reach the swap
+// the wait sleeps until shortly before the deadline and spins the rest, sleeps overshoot by about a millisecond
+#define PACING_WINDOW 120 // frames the statistics are taken over
+#define PACING_SPIN 0.002 // seconds before the deadline the sleep stops
+
+class FramePacer {
+public:
+	float cap; // frames per second, 0 for no cap
+public:
+	FramePacer(float fps);
+	std::chrono::steady_clock::time_point begin(void); // waits for the slot of the next frame and returns its start
+	std::chrono::steady_clock::time_point input(void); // when the input the frame is drawn with is sampled
+	void presented(void); // after the swap
+	float frametime(void) const; // milliseconds, averages over the window
+	float jitter(void) const; // standard deviation of the frame time
+	float latency(void) const; // from the input to the swap
+	float maxlatency(void) const;
+	float waited(void) const;
+private:
+	std::chrono::steady_clock::time_point deadline;
+	std::chrono::steady_clock::time_point framestart;
+	std::chrono::steady_clock::time_point inputtime;
+	float frametimes[PACING_WINDOW];
+	float latencies[PACING_WINDOW];
+	float waits[PACING_WINDOW];
+	unsigned long frame;
+private:
+	size_t samples(void) const;
+};
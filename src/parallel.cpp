@@ -0,0 +1,141 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+#include "parallel.h"
+
+static unsigned int THREAD_COUNT = 0;
+
+// the ranges of one parallel_for call, it lives on the stack of the caller
+struct batch {
+	const std::function<void(size_t begin, size_t end)> *job;
+	size_t count;
+	size_t chunk;
+	size_t nchunks;
+	size_t next; // the first range nobody took yet
+	size_t finished;
+	struct batch *link; // the next batch waiting for threads
+};
+
+// the worker threads stay alive between calls and sleep while there is nothing to do
+static struct workerpool {
+	std::mutex lock;
+	std::condition_variable wakeup; // a batch was added or the pool stops
+	std::condition_variable done; // a batch finished
+	struct batch *head = nullptr;
+	std::vector<std::thread> threads;
+	bool stop = false;
+	~workerpool(void)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = true;
+		}
+		wakeup.notify_all();
+		for (auto &thread : threads) { thread.join(); }
+	}
+} workers;
+
+void set_threadcount(unsigned int count)
+{
+	THREAD_COUNT = count;
+}
+
+unsigned int threadcount(void)
+{
+	if (THREAD_COUNT > 0) { return THREAD_COUNT; }
+
+	const unsigned int hardware = std::thread::hardware_concurrency();
+
+	return (hardware > 0) ? hardware : 1;
+}
+
+// takes the next range of a batch, a batch with no ranges left leaves the list so nobody looks at it again
+static bool take_range(struct batch *b, size_t *begin, size_t *end)
+{
+	if (b->next >= b->nchunks) { return false; }
+
+	*begin = b->next * b->chunk;
+	*end = std::min(*begin + b->chunk, b->count);
+	if (++b->next == b->nchunks) {
+		struct batch **it = &workers.head;
+		while (*it && *it != b) { it = &(*it)->link; }
+		if (*it) { *it = b->link; }
+	}
+
+	return true;
+}
+
+static void run_range(struct batch *b, size_t begin, size_t end)
+{
+	(*b->job)(begin, end);
+
+	std::lock_guard<std::mutex> guard(workers.lock);
+	if (++b->finished == b->nchunks) { workers.done.notify_all(); }
+}
+
+static void work(void)
+{
+	std::unique_lock<std::mutex> lock(workers.lock);
+	while (true) {
+		workers.wakeup.wait(lock, [](void) { return workers.stop || workers.head != nullptr; });
+		if (workers.stop) { return; }
+
+		struct batch *b = workers.head;
+		size_t begin, end;
+		if (take_range(b, &begin, &end)) {
+			lock.unlock();
+			run_range(b, begin, end);
+			lock.lock();
+		}
+	}
+}
+
+void parallel_for(size_t count, const std::function<void(size_t begin, size_t end)> &job)
+{
+	const size_t nthreads = std::min(size_t(threadcount()), count);
+	if (nthreads <= 1) {
+		job(0, count);
+		return;
+	}
+
+	const size_t chunk = (count + nthreads - 1) / nthreads;
+
+	struct batch b = {
+		.job = &job,
+		.count = count,
+		.chunk = chunk,
+		.nchunks = (count + chunk - 1) / chunk,
+		.next = 0,
+		.finished = 0,
+		.link = nullptr
+	};
+
+	{
+		std::lock_guard<std::mutex> guard(workers.lock);
+		while (workers.threads.size() < nthreads-1) {
+			workers.threads.push_back(std::thread(work));
+		}
+		// the batches are served in the order they came in
+		struct batch **it = &workers.head;
+		while (*it) { it = &(*it)->link; }
+		*it = &b;
+	}
+	workers.wakeup.notify_all();
+
+	// the calling thread takes ranges too, so a call from inside a job never waits on ranges nobody runs
+	while (true) {
+		size_t begin, end;
+		{
+			std::lock_guard<std::mutex> guard(workers.lock);
+			if (take_range(&b, &begin, &end) == false) { break; }
+		}
+		run_range(&b, begin, end);
+	}
+
+	std::unique_lock<std::mutex> lock(workers.lock);
+	workers.done.wait(lock, [&](void) { return b.finished == b.nchunks; });
+}
@@ -0,0 +1,7 @@
+// number of threads used by the parallel generation functions, 0 uses all hardware threads
+void set_threadcount(unsigned int count);
+unsigned int threadcount(void);
+
+// splits [0, count) in contiguous ranges and runs them on the worker threads, blocks until all are done
+// the workers are started by the first call that needs them and wait for the next call afterwards, the calling thread runs ranges too
+void parallel_for(size_t count, const std::function<void(size_t begin, size_t end)> &job);
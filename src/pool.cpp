@@ -0,0 +1,174 @@
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cassert>
+
+#include "memory.h"
+#include "pool.h"
+
+#define POOL_MAGIC_LIVE 0x706f6f6c
+#define POOL_MAGIC_IDLE 0x69646c65
+
+enum { POOL_BUCKETS = 4 * 52 }; // up to 2^64 bytes
+
+static_assert(sizeof(struct poolheader) <= POOL_HEADER, "pool header does not fit in front of the data");
+
+static struct {
+	std::mutex lock;
+	struct poolheader *freelists[POOL_BUCKETS] = {};
+	struct poolstats stats = {};
+} pool;
+
+static size_t bucket_capacity(unsigned int bucket)
+{
+	return (size_t(POOL_MIN_SIZE) << (bucket / 4)) / 4 * (4 + bucket % 4);
+}
+
+static unsigned int bucket_of(size_t bytes)
+{
+	if (bytes <= POOL_MIN_SIZE) { return 0; }
+
+	unsigned int power = 0;
+	while ((bytes >> (power + 1)) > 0) { power++; }
+
+	unsigned int bucket = 4 * (power - 12);
+	while (bucket_capacity(bucket) < bytes) { bucket++; }
+
+	return bucket;
+}
+
+unsigned char *pool_acquire(size_t bytes)
+{
+	const unsigned int bucket = bucket_of(bytes);
+
+	struct poolheader *header = nullptr;
+	{
+		std::lock_guard<std::mutex> guard(pool.lock);
+		header = pool.freelists[bucket];
+		if (header) {
+			pool.freelists[bucket] = header->next;
+			pool.stats.idle -= header->capacity;
+			pool.stats.idlebuffers--;
+			pool.stats.hits++;
+		} else {
+			pool.stats.misses++;
+		}
+	}
+
+	if (header == nullptr) {
+		const size_t capacity = bucket_capacity(bucket);
+		header = (struct poolheader*)new unsigned char[POOL_HEADER + capacity];
+		header->bucket = bucket;
+		header->capacity = capacity;
+	}
+
+	header->magic = POOL_MAGIC_LIVE;
+	header->bytes = bytes;
+	header->tag = 0;
+	header->next = nullptr;
+
+	return (unsigned char*)header + POOL_HEADER;
+}
+
+struct poolheader *pool_header(const void *data)
+{
+	return (struct poolheader*)((const unsigned char*)data - POOL_HEADER);
+}
+
+void pool_release(const void *data)
+{
+	if (data == nullptr) { return; }
+
+	struct poolheader *header = pool_header(data);
+	assert(header->magic == POOL_MAGIC_LIVE && "released a buffer twice");
+
+	header->magic = POOL_MAGIC_IDLE;
+
+	{
+		std::lock_guard<std::mutex> guard(pool.lock);
+		if (pool.stats.idle + header->capacity <= POOL_MAX_IDLE) {
+			header->next = pool.freelists[header->bucket];
+			pool.freelists[header->bucket] = header;
+			pool.stats.idle += header->capacity;
+			pool.stats.idlebuffers++;
+			return;
+		}
+	}
+
+	delete [] (unsigned char*)header;
+}
+
+void pool_trim(void)
+{
+	struct poolheader *idle[POOL_BUCKETS];
+	{
+		std::lock_guard<std::mutex> guard(pool.lock);
+		std::copy(pool.freelists, pool.freelists + POOL_BUCKETS, idle);
+		std::fill(pool.freelists, pool.freelists + POOL_BUCKETS, nullptr);
+		pool.stats.idle = 0;
+		pool.stats.idlebuffers = 0;
+	}
+
+	for (int bucket = 0; bucket < POOL_BUCKETS; bucket++) {
+		while (idle[bucket]) {
+			struct poolheader *next = idle[bucket]->next;
+			delete [] (unsigned char*)idle[bucket];
+			idle[bucket] = next;
+		}
+	}
+}
+
+struct poolstats pool_stats(void)
+{
+	std::lock_guard<std::mutex> guard(pool.lock);
+
+	return pool.stats;
+}
+
+ScratchArena::~ScratchArena(void)
+{
+	for (auto chunk : chunks) { tracked_free(chunk); }
+}
+
+// a chunk that is too small for a request is replaced by a larger one, so a repeated sequence of requests settles on chunks that fit it
+unsigned char *ScratchArena::allocate(size_t bytes)
+{
+	while (true) {
+		if (current < chunks.size()) {
+			const uintptr_t base = uintptr_t(chunks[current]);
+			const size_t start = ((base + offset + ARENA_ALIGNMENT - 1) & ~uintptr_t(ARENA_ALIGNMENT - 1)) - base;
+			if (start + bytes <= sizes[current]) {
+				offset = start + bytes;
+				return chunks[current] + start;
+			}
+			current++;
+			offset = 0;
+		}
+		if (current == chunks.size()) {
+			chunks.push_back(nullptr);
+			sizes.push_back(0);
+		}
+		if (sizes[current] < bytes + ARENA_ALIGNMENT) {
+			MemoryScope scope(MEMORY_SCRATCH);
+			tracked_free(chunks[current]);
+			sizes[current] = std::max(ARENA_CHUNK, bytes + ARENA_ALIGNMENT);
+			chunks[current] = tracked_alloc(sizes[current]);
+		}
+	}
+}
+
+size_t ScratchArena::reserved(void) const
+{
+	size_t total = 0;
+	for (auto size : sizes) { total += size; }
+
+	return total;
+}
+
+ScratchArena *scratch_arena(void)
+{
+	static thread_local ScratchArena arena;
+
+	return &arena;
+}
@@ -0,0 +1,69 @@
+// size bucketed free lists for the image buffers, a released buffer waits for the next request of its bucket instead of going back to the heap
+// the buckets are a quarter power of two apart from POOL_MIN_SIZE up, so a buffer is at most a fifth larger than asked for
+// regenerating the maps again and again reuses the same buffers and stops touching the heap after the first time
+#define POOL_MIN_SIZE 4096
+#define POOL_MAX_IDLE (size_t(256) << 20) // bytes the free lists hold at most, released buffers beyond it go back to the heap
+#define POOL_HEADER 64 // bytes in front of the data, keeps the data aligned like new[]
+
+// in front of the data of every pooled buffer
+struct poolheader {
+	uint32_t magic;
+	uint32_t bucket;
+	size_t capacity; // bytes of data
+	size_t bytes; // asked for by the last acquire
+	int tag; // free for the owner, the memory tracker keeps the subsystem here
+	struct poolheader *next; // in the free list of its bucket
+};
+
+struct poolstats {
+	size_t idle; // bytes waiting in the free lists
+	size_t idlebuffers;
+	unsigned long hits; // acquires served from a free list
+	unsigned long misses; // acquires that went to the heap
+};
+
+// released data has to come from pool_acquire and not be released yet, other pointers are not checked
+unsigned char *pool_acquire(size_t bytes);
+void pool_release(const void *data);
+struct poolheader *pool_header(const void *data); // data has to come from pool_acquire, the header sits right in front of it
+void pool_trim(void); // hands every idle buffer back to the heap
+struct poolstats pool_stats(void);
+
+#define ARENA_CHUNK (size_t(16) << 20)
+#define ARENA_ALIGNMENT 64
+
+struct arenamark {
+	size_t chunk;
+	size_t offset;
+};
+
+// bump allocator for the scratch buffers of a generation step, everything after a mark is freed at once by rewinding to it
+// the chunks come from the pool and stay with the arena, so the same steps run again without allocating
+class ScratchArena {
+public:
+	~ScratchArena(void);
+	unsigned char *allocate(size_t bytes);
+	struct arenamark mark(void) const { return { current, offset }; }
+	void rewind(struct arenamark marker) { current = marker.chunk; offset = marker.offset; }
+	size_t reserved(void) const;
+private:
+	std::vector<unsigned char*> chunks;
+	std::vector<size_t> sizes;
+	size_t current = 0;
+	size_t offset = 0;
+};
+
+ScratchArena *scratch_arena(void); // of the calling thread
+
+// rewinds the arena of the thread to where it was when the scope started
+class ArenaScope {
+public:
+	ArenaScope(void) : arena(scratch_arena()), marker(arena->mark()) {}
+	~ArenaScope(void) { arena->rewind(marker); }
+	ArenaScope(const ArenaScope&) = delete;
+	ArenaScope &operator=(const ArenaScope&) = delete;
+	unsigned char *allocate(size_t bytes) { return arena->allocate(bytes); }
+private:
+	ScratchArena *arena;
+	struct arenamark marker;
+};
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/gl.h>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "glwrapper.h"
+#include "memory.h"
+#include "shader.h"
+#include "timer.h"
+#include "resolution.h"
+
+DynamicResolution::DynamicResolution(GLsizei w, GLsizei h, float budgetms)
+{
+	width = renderwidth = w;
+	height = renderheight = h;
+	budget = budgetms;
+	current = 1.f;
+	std::fill_n(history, TIMER_LATENCY, 1.f);
+	frame = 0;
+
+	struct shaderinfo pipeline[] = {
+		{GL_VERTEX_SHADER, "shaders/upscale.vert"},
+		{GL_FRAGMENT_SHADER, "shaders/upscale.frag"},
+		{GL_NONE, NULL}
+	};
+	upscale = Shader(pipeline);
+
+	MemoryScope scope(MEMORY_RENDERER);
+
+	glGenTextures(1, &colortexture);
+	glBindTexture(GL_TEXTURE_2D, colortexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	track_texture(colortexture, texture_bytes(GL_RGBA8, width, height, 1, 1));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &depthbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	track_renderbuffer(depthbuffer, texture_bytes(GL_DEPTH_COMPONENT24, width, height, 1, 1));
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &FBO);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colortexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "error: scene framebuffer is incomplete" << std::endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenVertexArrays(1, &VAO);
+}
+
+DynamicResolution::~DynamicResolution(void)
+{
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteFramebuffers(1, &FBO);
+	untrack_renderbuffer(depthbuffer);
+	untrack_texture(colortexture);
+	glDeleteRenderbuffers(1, &depthbuffer);
+	glDeleteTextures(1, &colortexture);
+}
+
+// the GPU time is taken to grow with the pixel count, so the wanted scale is the scale of the measured frame times the root of the ratio to the budget
+// the timer results are TIMER_LATENCY - 1 frames old, comparing them to the scale of the current frame would overshoot and oscillate
+void DynamicResolution::adjust(float gpums)
+{
+	history[frame % TIMER_LATENCY] = current;
+	frame++;
+	const float measured = history[frame % TIMER_LATENCY];
+
+	if (enabled == false || budget <= 0.f) {
+		current = 1.f;
+	} else if (gpums > 0.f) {
+		const float wanted = std::min(std::max(measured * std::sqrt(budget / gpums), RESOLUTION_MIN_SCALE), 1.f);
+		// over the budget it always goes down, under it only goes up for a clear gain
+		if (wanted < current || wanted - current > RESOLUTION_DEADBAND || wanted == 1.f) {
+			current += RESOLUTION_GAIN * (wanted - current);
+		}
+		// close enough to native resolution to skip the filter
+		if (current > 1.f - 0.5f / float(height)) { current = 1.f; }
+	}
+
+	renderwidth = std::max(GLsizei(std::lround(width * current)), 1);
+	renderheight = std::max(GLsizei(std::lround(height * current)), 1);
+}
+
+void DynamicResolution::begin(void)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glViewport(0, 0, renderwidth, renderheight);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DynamicResolution::resolve(void)
+{
+	// at full size a copy is enough
+	if (renderwidth == width && renderheight == height) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, width, height);
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+	disable_state(GL_DEPTH_TEST);
+	disable_state(GL_BLEND);
+
+	upscale.bind();
+	upscale.uniform_vec2("extent", glm::vec2(float(renderwidth) / float(width), float(renderheight) / float(height)));
+	upscale.uniform_vec2("texelsize", glm::vec2(1.f / float(width), 1.f / float(height)));
+	// less sharpening when the scale is close to native, where there is little blur to undo
+	upscale.uniform_float("sharpness", sharpness * std::min((1.f - current) / (1.f - RESOLUTION_MIN_SCALE), 1.f));
+	activate_texture(GL_TEXTURE0, GL_TEXTURE_2D, colortexture);
+	glBindVertexArray(VAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	enable_state(GL_DEPTH_TEST);
+	enable_state(GL_BLEND);
+}
@@ -0,0 +1,35 @@
+// the scene is rendered offscreen at a fraction of the window size and scaled up to the window with a sharpening filter
+// every frame a controller picks the fraction that keeps the GPU time of the scene within a budget
+#define RESOLUTION_MIN_SCALE 0.5f
+#define RESOLUTION_GAIN 0.1f // part of the way to the wanted scale that is taken per frame, the timer results are a few frames old
+#define RESOLUTION_DEADBAND 0.05f // smaller steps up are ignored so the image does not shimmer
+#define RESOLUTION_SHARPNESS 0.5f
+
+class DynamicResolution {
+public:
+	bool enabled = true;
+	float budget; // GPU milliseconds per frame
+	float sharpness = RESOLUTION_SHARPNESS;
+public:
+	DynamicResolution(GLsizei w, GLsizei h, float budgetms);
+	~DynamicResolution(void);
+	void adjust(float gpums); // with the GPU time from the timer, after it collected the results of the frame
+	void begin(void); // binds and clears the render target at the current scale
+	void resolve(void); // upscales into the window framebuffer
+	float scale(void) const { return current; }
+	GLsizei render_width(void) const { return renderwidth; }
+	GLsizei render_height(void) const { return renderheight; }
+private:
+	GLsizei width; // of the window, the render target is allocated at full size
+	GLsizei height;
+	GLsizei renderwidth;
+	GLsizei renderheight;
+	float current;
+	float history[TIMER_LATENCY]; // the scale of the frames the timer results are still in flight for
+	unsigned int frame;
+	Shader upscale;
+	GLuint FBO;
+	GLuint colortexture;
+	GLuint depthbuffer;
+	GLuint VAO; // empty, the fullscreen triangle is built in the vertex shader
+};
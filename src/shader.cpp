@@ -8,9 +8,10 @@
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "memory.h"
 #include "shader.h"
 
-static const GLchar *importshader(const char *fpath)
+const GLchar *importshader(const char *fpath)
 {
 	FILE *fp = fopen(fpath, "rb");
 
@@ -23,7 +24,7 @@ static const GLchar *importshader(const char *fpath)
 	const auto len = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 
-	GLchar *source = new GLchar[len+1];
+	GLchar *source = (GLchar*)tracked_alloc(len+1);
 
 	fread(source, 1, len, fp);
 	fclose(fp);
@@ -46,6 +47,8 @@ GLuint Shader::loadshaders(shaderinfo *shaders)
 {
 	if (shaders == NULL) { return 0; }
 
+	MemoryScope scope(MEMORY_SHADERS);
+
 	GLuint program = glCreateProgram();
 
 	shaderinfo *entry = shaders;
@@ -64,7 +67,7 @@ GLuint Shader::loadshaders(shaderinfo *shaders)
 		}
 
 		glShaderSource(shader, 1, &source, NULL);
-		delete [] source;
+		tracked_free(source);
 
 		glCompileShader(shader);
 
@@ -4,8 +4,12 @@ struct shaderinfo {
 	GLuint shader;
 };
 
+// reads a shader source file into a null terminated string, the caller owns the returned buffer
+const GLchar *importshader(const char *fpath);
+
 class Shader {
 public:
+	Shader(void) { program = 0; } // to be assigned a compiled shader later
 	Shader(struct shaderinfo *shaders);
 	void bind(void) const { glUseProgram(program); }
 	void uniform_bool(const GLchar *name, bool boolean) const
@@ -23,6 +27,11 @@ public:
 		glUseProgram(program);
 		glUniform1f(glGetUniformLocation(program, name), scalar);
 	}
+	void uniform_vec2(const GLchar *name, glm::vec2 vector) const
+	{
+		glUseProgram(program);
+		glUniform2fv(glGetUniformLocation(program, name), 1, glm::value_ptr(vector));
+	}
 	void uniform_vec3(const GLchar *name, glm::vec3 vector) const
 	{
 		glUseProgram(program);
@@ -33,6 +42,11 @@ public:
 		glUseProgram(program);
 		glUniform4fv(glGetUniformLocation(program, name), 1, glm::value_ptr(vector));
 	}
+	void uniform_array_vec4(const GLchar *name, size_t count, const glm::vec4 *vectors) const
+	{
+		glUseProgram(program);
+		glUniform4fv(glGetUniformLocation(program, name), count, glm::value_ptr(vectors[0]));
+	}
 	void uniform_mat4(const GLchar *name, glm::mat4 matrix) const
 	{
 		glUseProgram(program);
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <vector>
 #include <algorithm>
 #include <GL/glew.h>
 #include <GL/gl.h>
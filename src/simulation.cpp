@@ -0,0 +1,108 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "camera.h"
+#include "simulation.h"
+
+Simulation::Simulation(const Camera *cam) : camera(*cam)
+{
+	pending = {};
+	running = true;
+	nskipped = 0;
+
+	// every slot starts valid so the render thread can sample before the first step
+	const struct simstate start = { 0.0, camera.eye, camera.center };
+	for (int i = 0; i < 3; i++) {
+		struct simsnapshot *slot = snapshots.back();
+		slot->previous = start;
+		slot->current = start;
+		slot->stamp = std::chrono::steady_clock::now();
+		slot->tick = 0;
+		snapshots.publish();
+	}
+	snapshots.update();
+
+	thread = std::thread(&Simulation::run, this);
+}
+
+Simulation::~Simulation(void)
+{
+	running = false;
+	thread.join();
+}
+
+void Simulation::feed(const struct camerainput *input)
+{
+	std::lock_guard<std::mutex> guard(inputlock);
+	pending.dx += input->dx;
+	pending.dy += input->dy;
+	pending.forward = input->forward;
+	pending.backward = input->backward;
+	pending.left = input->left;
+	pending.right = input->right;
+}
+
+// the frame is drawn between the last two steps, one step behind the simulation, so the motion stays smooth when the frame rate and the step do not line up
+struct simstate Simulation::sample(std::chrono::steady_clock::time_point now)
+{
+	snapshots.update();
+	const struct simsnapshot *latest = snapshots.front();
+
+	const std::chrono::duration<double> since = now - latest->stamp;
+	const float alpha = glm::clamp(float(since.count() / SIMULATION_STEP), 0.f, 1.f);
+
+	struct simstate state;
+	state.time = latest->previous.time + alpha * (latest->current.time - latest->previous.time);
+	state.eye = glm::mix(latest->previous.eye, latest->current.eye, alpha);
+	state.direction = glm::normalize(glm::mix(latest->previous.direction, latest->current.direction, alpha));
+
+	return state;
+}
+
+void Simulation::run(void)
+{
+	const auto step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SIMULATION_STEP));
+	const auto maxbehind = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SIMULATION_MAX_BEHIND));
+
+	struct simstate state = snapshots.back()->current;
+	unsigned long tick = 0;
+	auto next = std::chrono::steady_clock::now();
+
+	while (running) {
+		next += step;
+		std::this_thread::sleep_until(next);
+
+		const auto now = std::chrono::steady_clock::now();
+		if (now - next > maxbehind) {
+			nskipped += (now - next) / step;
+			next = now;
+		}
+
+		struct camerainput input;
+		{
+			std::lock_guard<std::mutex> guard(inputlock);
+			input = pending;
+			pending.dx = 0;
+			pending.dy = 0;
+		}
+		camera.steer(&input, float(SIMULATION_STEP));
+
+		struct simsnapshot *snapshot = snapshots.back();
+		snapshot->previous = state;
+		state.time += SIMULATION_STEP;
+		state.eye = camera.eye;
+		state.direction = camera.center;
+		snapshot->current = state;
+		snapshot->stamp = now;
+		snapshot->tick = ++tick;
+		snapshots.publish();
+	}
+}
@@ -0,0 +1,61 @@
+// the camera and the animation clock run on their own thread with a fixed timestep, so a slow frame does not change how they move
+// the render thread draws the latest two steps interpolated to the time of the frame
+#define SIMULATION_STEP (1.0 / 120.0) // seconds
+#define SIMULATION_MAX_BEHIND 0.25 // seconds, after a longer stall the clock skips ahead instead of catching up step by step
+
+// single writer and single reader without locks, the reader always gets the latest complete slot and neither ever waits
+template <typename T>
+class TripleBuffer {
+public:
+	T *back(void) { return &slots[backindex]; }
+	void publish(void)
+	{
+		backindex = middle.exchange(backindex | FRESH) & INDEX;
+	}
+	bool update(void)
+	{
+		if ((middle.load() & FRESH) == 0) { return false; }
+		frontindex = middle.exchange(frontindex) & INDEX;
+		return true;
+	}
+	const T *front(void) const { return &slots[frontindex]; }
+private:
+	enum { INDEX = 3, FRESH = 4 };
+	T slots[3];
+	std::atomic<unsigned int> middle = { 1 };
+	unsigned int backindex = 0;
+	unsigned int frontindex = 2;
+};
+
+struct simstate {
+	double time; // seconds since the start
+	glm::vec3 eye;
+	glm::vec3 direction;
+};
+
+struct simsnapshot {
+	struct simstate previous;
+	struct simstate current;
+	std::chrono::steady_clock::time_point stamp; // when current was reached
+	unsigned long tick;
+};
+
+class Simulation {
+public:
+	Simulation(const Camera *camera);
+	~Simulation(void);
+	void feed(const struct camerainput *input); // by the thread that pumps the events, the mouse motion adds up until the next step
+	struct simstate sample(std::chrono::steady_clock::time_point now);
+	unsigned long ticks(void) const { return snapshots.front()->tick; }
+	unsigned long skipped(void) const { return nskipped; } // steps dropped after stalls
+private:
+	Camera camera; // only touched by the simulation thread
+	TripleBuffer<struct simsnapshot> snapshots;
+	std::mutex inputlock;
+	struct camerainput pending;
+	std::atomic<bool> running;
+	std::atomic<unsigned long> nskipped;
+	std::thread thread;
+private:
+	void run(void);
+};
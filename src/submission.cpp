@@ -0,0 +1,148 @@
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include "glwrapper.h"
+#include "memory.h"
+#include "submission.h"
+
+static GLsizeiptr align_up(GLsizeiptr size, GLint alignment)
+{
+	return ((size + alignment - 1) / alignment) * alignment;
+}
+
+IndirectQueue::IndirectQueue(bool indexed, size_t drawsize, size_t maxdraws)
+{
+	elements = indexed;
+	commandsize = indexed ? sizeof(struct elementscommand) : sizeof(struct arrayscommand);
+	datasize = drawsize;
+	capacity = maxdraws;
+	ndraws = 0;
+	ninstances = 0;
+	current = 0;
+	mapped = nullptr;
+
+	commands.resize(capacity * commandsize);
+	drawdata.resize(capacity * datasize);
+
+	// the draw data is bound as a range, so it starts at the storage buffer alignment
+	GLint alignment = 256;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	dataoffset = align_up(capacity * commandsize, alignment);
+	regionsize = align_up(dataoffset + capacity * datasize, alignment);
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+	if (GLEW_ARB_buffer_storage) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_DRAW_INDIRECT_BUFFER, RING_REGIONS * regionsize, NULL, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, 0, RING_REGIONS * regionsize, flags);
+	} else {
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, RING_REGIONS * regionsize, NULL, GL_STREAM_DRAW);
+	}
+	track_buffer(buffer, RING_REGIONS * regionsize);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	for (int i = 0; i < RING_REGIONS; i++) { fences[i] = 0; }
+}
+
+IndirectQueue::~IndirectQueue(void)
+{
+	for (int i = 0; i < RING_REGIONS; i++) {
+		if (fences[i]) { glDeleteSync(fences[i]); }
+	}
+	if (mapped) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+		glUnmapBuffer(GL_DRAW_INDIRECT_BUFFER);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	untrack_buffer(buffer);
+	glDeleteBuffers(1, &buffer);
+}
+
+void IndirectQueue::clear(void)
+{
+	ndraws = 0;
+	ninstances = 0;
+}
+
+void IndirectQueue::add(const struct elementscommand *command, const void *data)
+{
+	if (elements == false || ndraws >= capacity) {
+		std::cerr << "error: draw does not fit the indirect queue" << std::endl;
+		return;
+	}
+
+	memcpy(&commands[ndraws * commandsize], command, commandsize);
+	memcpy(&drawdata[ndraws * datasize], data, datasize);
+	ninstances += command->instancecount;
+	ndraws++;
+}
+
+void IndirectQueue::add(const struct arrayscommand *command, const void *data)
+{
+	if (elements == true || ndraws >= capacity) {
+		std::cerr << "error: draw does not fit the indirect queue" << std::endl;
+		return;
+	}
+
+	memcpy(&commands[ndraws * commandsize], command, commandsize);
+	memcpy(&drawdata[ndraws * datasize], data, datasize);
+	ninstances += command->instancecount;
+	ndraws++;
+}
+
+// the region was last drawn from RING_REGIONS submits ago, so the wait on its fence rarely blocks
+void IndirectQueue::submit(GLenum mode)
+{
+	if (ndraws == 0) { return; }
+
+	GLsync &fence = fences[current];
+	if (fence) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	const GLsizeiptr region = current * regionsize;
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+	if (mapped) {
+		memcpy(mapped + region, commands.data(), ndraws * commandsize);
+		memcpy(mapped + region + dataoffset, drawdata.data(), ndraws * datasize);
+	} else {
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, region, ndraws * commandsize, commands.data());
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, region + dataoffset, ndraws * datasize, drawdata.data());
+	}
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, SUBMISSION_DRAWDATA_BINDING, buffer, region + dataoffset, ndraws * datasize);
+
+	if (GLEW_ARB_shader_draw_parameters) {
+		if (elements) {
+			glMultiDrawElementsIndirect(mode, GL_UNSIGNED_SHORT, BUFFER_OFFSET(region), ndraws, 0);
+		} else {
+			glMultiDrawArraysIndirect(mode, BUFFER_OFFSET(region), ndraws, 0);
+		}
+	} else {
+		GLint program = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		const GLint location = glGetUniformLocation(program, "drawid");
+		for (size_t i = 0; i < ndraws; i++) {
+			glUniform1i(location, GLint(i));
+			if (elements) {
+				glDrawElementsIndirect(mode, GL_UNSIGNED_SHORT, BUFFER_OFFSET(region + i * commandsize));
+			} else {
+				glDrawArraysIndirect(mode, BUFFER_OFFSET(region + i * commandsize));
+			}
+		}
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	current = (current + 1) % RING_REGIONS;
+}
@@ -0,0 +1,52 @@
+// the draws of one pipeline are gathered into an indirect command buffer with the data of every draw in a shader storage buffer
+// they go to the GPU as a single multi-draw, the shaders find their draw data with gl_DrawIDARB
+// without GL_ARB_shader_draw_parameters every draw is submitted on its own with the "drawid" uniform of the bound program
+enum {
+	SUBMISSION_DRAWDATA_BINDING = 3 // shader storage binding of the draw data
+};
+
+// layouts of the commands read by glMultiDrawElementsIndirect and glMultiDrawArraysIndirect
+struct elementscommand {
+	GLuint count;
+	GLuint instancecount;
+	GLuint firstindex;
+	GLint basevertex;
+	GLuint baseinstance;
+};
+
+struct arrayscommand {
+	GLuint count;
+	GLuint instancecount;
+	GLuint first;
+	GLuint baseinstance;
+};
+
+class IndirectQueue {
+public:
+	IndirectQueue(bool indexed, size_t drawsize, size_t maxdraws);
+	~IndirectQueue(void);
+	void clear(void);
+	// draw data is drawsize bytes in the std430 layout of the shader
+	void add(const struct elementscommand *command, const void *drawdata);
+	void add(const struct arrayscommand *command, const void *drawdata);
+	// the VAO and program have to be bound, index type of indexed draws is GL_UNSIGNED_SHORT
+	void submit(GLenum mode);
+	size_t count(void) const { return ndraws; }
+	size_t instances(void) const { return ninstances; }
+private:
+	bool elements;
+	size_t commandsize;
+	size_t datasize;
+	size_t capacity;
+	size_t ndraws;
+	size_t ninstances;
+	std::vector<unsigned char> commands; // gathered on the CPU, copied into the ring when submitted
+	std::vector<unsigned char> drawdata;
+	// ring of RING_REGIONS regions, commands first and the draw data after them
+	GLuint buffer;
+	GLsizeiptr regionsize;
+	GLsizeiptr dataoffset;
+	GLsync fences[RING_REGIONS];
+	unsigned char *mapped; // null if persistent mapping is not supported
+	unsigned int current;
+};
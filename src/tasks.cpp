@@ -0,0 +1,161 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+#include "tasks.h"
+
+struct workqueue {
+	std::mutex lock;
+	std::deque<taskid> tasks; // the owner works from the back, thieves take from the front
+};
+
+taskid TaskGraph::add(const char *name, enum taskthread thread, const std::vector<taskid> &dependencies, const std::function<void(void)> &job)
+{
+	const taskid id = tasks.size();
+
+	struct task t;
+	t.name = name;
+	t.thread = thread;
+	t.job = job;
+	t.dependencies = dependencies;
+	t.ms = 0.f;
+	tasks.push_back(t);
+
+	// dependencies are added first so the task list is always in a valid order
+	for (taskid dependency : dependencies) {
+		tasks[dependency].dependents.push_back(id);
+	}
+
+	return id;
+}
+
+// the calling thread runs the context tasks as soon as they are ready and helps with the worker tasks in between
+void TaskGraph::run(unsigned int nworkers)
+{
+	auto begin = std::chrono::steady_clock::now();
+
+	const size_t contextqueue = nworkers; // the queues of the workers come first
+	std::vector<struct workqueue> queues(nworkers + 1);
+	std::vector<std::atomic<size_t>> remaining(tasks.size());
+	std::atomic<size_t> pending(tasks.size());
+	std::atomic<size_t> ready(0); // queued worker tasks
+	std::atomic<size_t> contextready(0);
+	std::atomic<unsigned int> roundrobin(0);
+	std::mutex sleeplock;
+	std::condition_variable wakeup;
+
+	auto notify = [&](void) {
+		std::lock_guard<std::mutex> guard(sleeplock);
+		wakeup.notify_all();
+	};
+
+	// a worker keeps the tasks it unlocks itself, the others are spread over the workers
+	auto push = [&](taskid id, size_t self) {
+		size_t queue = contextqueue;
+		if (tasks[id].thread == TASK_WORKER && nworkers > 0) {
+			queue = (self < nworkers) ? self : roundrobin++ % nworkers;
+		}
+		{
+			std::lock_guard<std::mutex> guard(queues[queue].lock);
+			queues[queue].tasks.push_back(id);
+		}
+		if (queue == contextqueue) { contextready++; } else { ready++; }
+		notify();
+	};
+
+	auto pop = [&](size_t queue, bool back, taskid *id) -> bool {
+		std::lock_guard<std::mutex> guard(queues[queue].lock);
+		std::deque<taskid> &q = queues[queue].tasks;
+		if (q.empty()) { return false; }
+		if (back) {
+			*id = q.back();
+			q.pop_back();
+		} else {
+			*id = q.front();
+			q.pop_front();
+		}
+		if (queue == contextqueue) { contextready--; } else { ready--; }
+		return true;
+	};
+
+	auto steal = [&](size_t self, taskid *id) -> bool {
+		for (size_t i = 1; i <= nworkers; i++) {
+			const size_t victim = (self + i) % nworkers;
+			if (victim != self && pop(victim, false, id)) { return true; }
+		}
+		return false;
+	};
+
+	auto execute = [&](taskid id, size_t self) {
+		auto start = std::chrono::steady_clock::now();
+		tasks[id].job();
+		std::chrono::duration<float, std::milli> duration = std::chrono::steady_clock::now() - start;
+		tasks[id].ms = duration.count();
+
+		for (taskid dependent : tasks[id].dependents) {
+			if (--remaining[dependent] == 0) { push(dependent, self); }
+		}
+		if (--pending == 0) { notify(); }
+	};
+
+	for (taskid id = 0; id < tasks.size(); id++) {
+		remaining[id] = tasks[id].dependencies.size();
+	}
+	for (taskid id = 0; id < tasks.size(); id++) {
+		if (tasks[id].dependencies.empty()) { push(id, contextqueue); }
+	}
+
+	std::vector<std::thread> workers;
+	for (size_t self = 0; self < nworkers; self++) {
+		workers.push_back(std::thread([&, self](void) {
+			while (pending > 0) {
+				taskid id;
+				if ((pop(self, true, &id) || steal(self, &id))) {
+					execute(id, self);
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleeplock);
+				wakeup.wait(lock, [&](void) { return ready > 0 || pending == 0; });
+			}
+		}));
+	}
+
+	while (pending > 0) {
+		taskid id;
+		if (pop(contextqueue, false, &id) || steal(contextqueue, &id)) {
+			execute(id, contextqueue);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleeplock);
+		wakeup.wait(lock, [&](void) { return contextready > 0 || ready > 0 || pending == 0; });
+	}
+
+	for (auto &worker : workers) { worker.join(); }
+
+	std::chrono::duration<float, std::milli> duration = std::chrono::steady_clock::now() - begin;
+	elapsed = duration.count();
+}
+
+// the longest chain of dependencies weighted by the time each job took, the lower bound of run
+float TaskGraph::critical_path(void) const
+{
+	std::vector<float> finish(tasks.size());
+	float longest = 0.f;
+	for (taskid id = 0; id < tasks.size(); id++) {
+		float start = 0.f;
+		for (taskid dependency : tasks[id].dependencies) {
+			start = std::max(start, finish[dependency]);
+		}
+		finish[id] = start + tasks[id].ms;
+		longest = std::max(longest, finish[id]);
+	}
+
+	return longest;
+}
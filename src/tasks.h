@@ -0,0 +1,28 @@
+// where a task is allowed to run
+enum taskthread {
+	TASK_WORKER, // any thread of the pool
+	TASK_CONTEXT // the thread that owns the OpenGL context, the one that calls run
+};
+
+typedef size_t taskid;
+
+// graph of startup work, a task runs once all the tasks it depends on are done
+// worker tasks go to a work stealing pool, context tasks are run by the calling thread in between
+class TaskGraph {
+public:
+	taskid add(const char *name, enum taskthread thread, const std::vector<taskid> &dependencies, const std::function<void(void)> &job);
+	void run(unsigned int nworkers);
+	float milliseconds(void) const { return elapsed; }
+	float critical_path(void) const;
+private:
+	struct task {
+		const char *name;
+		enum taskthread thread;
+		std::function<void(void)> job;
+		std::vector<taskid> dependencies;
+		std::vector<taskid> dependents;
+		float ms; // time the job took
+	};
+	std::vector<struct task> tasks;
+	float elapsed = 0.f;
+};
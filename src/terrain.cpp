@@ -1,5 +1,11 @@
+#include <cstdint>
 #include <vector>
 #include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
 #include <GL/glew.h>
 #include <GL/gl.h>
 
@@ -11,10 +17,25 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "imp.h"
+#include "memory.h"
+#include "pool.h"
+#include "bcn.h"
 #include "dds.h"
 #include "glwrapper.h"
+#include "shader.h"
+#include "camera.h"
+#include "culling.h"
+#include "erosion.h"
+#include "tilefarm.h"
 #include "terrain.h"
 
+#define EROSION_ITERATIONS 4
+
+// heights are generated as floats and stored with 16 bits, 8 bits gives visible terraces at high amplitudes
+#define HEIGHTMAP_FORMAT IMAGE_U16
+
+#define OCCLUSION_HALO 64 // texels around an edit that are part of the occlusion crop
+
 static struct mesh create_slices(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d, size_t slices_count, float offset)
 {
 	struct mesh slices = {
@@ -50,10 +71,12 @@ static struct mesh create_slices(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec
 	glGenBuffers(1, &slices.EBO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, slices.EBO);
 	glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort)*indices.size(), &indices[0], 0);
+	track_buffer(slices.EBO, sizeof(GLushort)*indices.size());
 
 	glGenBuffers(1, &slices.VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, slices.VBO);
 	glBufferStorage(GL_ARRAY_BUFFER, sizeof(glm::vec3)*positions.size(), &positions[0], 0);
+	track_buffer(slices.VBO, sizeof(glm::vec3)*positions.size());
 
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
@@ -61,11 +84,8 @@ static struct mesh create_slices(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec
 	return slices;
 }
 
-static GLuint create_cloud_texture(size_t texsize, float frequency, float cloud_distance)
+static GLuint create_cloud_texture(const unsigned char *volume, size_t texsize)
 {
-	unsigned char *image = new unsigned char[texsize*texsize*texsize];
-	billow_3D_image(image, texsize, frequency, cloud_distance);
-
 	GLuint texture;
 
 	glGenTextures(1, &texture);
@@ -77,49 +97,29 @@ static GLuint create_cloud_texture(size_t texsize, float frequency, float cloud_
 	glTexParameterf(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameterf(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-	glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, texsize, texsize, texsize, 0, GL_RED, GL_UNSIGNED_BYTE, image);
-
-	delete [] image;
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, texsize, texsize, texsize, 0, GL_RED, GL_UNSIGNED_BYTE, volume);
+	track_texture(texture, texture_bytes(GL_RED, texsize, texsize, texsize, 1));
 
 	return texture;
 }
 
 // fills a vertex buffer with the positions of the grass roots, to be used in a geometry shader
-static struct mesh gen_grass_roots(const Terrain *terrain, glm::vec2 min, glm::vec2 max, size_t density)
+static struct mesh upload_grass_roots(const std::vector<glm::vec2> &positions)
 {
 	struct mesh grass = {
 		.VAO = 0, .VBO = 0, .EBO = 0,
 		.mode = GL_POINTS,
-		.ecount = 0,
+		.ecount = GLsizei(positions.size()),
 		.indexed = false
 	};
 
-	const float mapscale = 0.5f;
-
-	std::vector<glm::vec2> positions;
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_real_distribution<> dis(0.f, 1.5f);
-	std::uniform_real_distribution<> map_x(min.x, max.x);
-	std::uniform_real_distribution<> map_z(min.y, max.y);
-
-	for (int i = 0; i < density; i++) {
-		float x = map_x(gen);
-		float z = map_z(gen);
-		float y = terrain->sampleheight(mapscale*x, mapscale*z);
-		if (terrain->sampleslope(mapscale*x, mapscale*z) < 0.6 && y < 0.4) {
-			glm::vec2 position = glm::vec2(x, z);
-			positions.push_back(position);
-		}
-	}
-	grass.ecount = GLsizei(positions.size());
-
 	glGenVertexArrays(1, &grass.VAO);
 	glBindVertexArray(grass.VAO);
 
 	glGenBuffers(1, &grass.VBO);
 	glBindBuffer(GL_ARRAY_BUFFER, grass.VBO);
-	glBufferStorage(GL_ARRAY_BUFFER, sizeof(glm::vec2)*positions.size(), &positions[0], 0);
+	glBufferStorage(GL_ARRAY_BUFFER, sizeof(glm::vec2)*positions.size(), positions.data(), 0);
+	track_buffer(grass.VBO, sizeof(glm::vec2)*positions.size());
 
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
@@ -127,84 +127,266 @@ static struct mesh gen_grass_roots(const Terrain *terrain, glm::vec2 min, glm::v
 	return grass;
 }
 
-Terrain::Terrain(size_t sidelen, float patchoffst, float amp) 
+// encodes the blocks covering an area of a map into blocks and uploads only those
+static void update_block_area(GLuint texture, const struct rawimage *image, struct rect area, struct blockimage *blocks, const std::function<void(const struct rawimage *crop, struct blockimage *blocks)> &encode)
+{
+	const struct rect aligned = align_rect(area, 4, image->width, image->height);
+	const OwnedImage crop { crop_image(image, aligned) };
+	encode(&crop, blocks);
+	update_block_texture_rect(texture, blocks, aligned.x0, aligned.y0);
+}
+
+// only stores the parameters, the maps are generated by the gen functions and need upload before the terrain is drawn
+// the gen functions do not touch the GL context, so they can run on worker threads
+Terrain::Terrain(size_t sidelen, float patchoffst, float amp, long seedvalue) 
 {
 	sidelength = sidelen * patchoffst;
 	amplitude = amp;
-	termesh =  gen_patch_grid(sidelen, patchoffst);
+	seed = seedvalue;
 	mapratio = 0.f;
-
-	genheightmap(1024, 1.f);
-	gennormalmap();
-	genocclusmap();
-
-	detailmap = load_DDS_texture("media/textures/terrain/detailmap.dds");
-
-	tersurface.grass = load_DDS_texture("media/textures/terrain/grass.dds");
-	tersurface.dirt = load_DDS_texture("media/textures/terrain/dirt.dds");
-	tersurface.stone = load_DDS_texture("media/textures/terrain/stone.dds");
-	tersurface.snow = load_DDS_texture("media/textures/terrain/snow.dds");
+	clipmapVAO = 0;
+	heightmap = normalmap = occlusmap = detailmap = splatmap = 0;
+	tersurface = { 0, 0, 0, 0 };
+	dirtyheights = { 0, 0, 0, 0 };
+	dirtyocclusion = { 0, 0, 0, 0 };
 }
 
 Terrain::~Terrain(void) 
 {
-	if (heightimage.data != nullptr) { delete [] heightimage.data; }
-	if (normalimage.data != nullptr) { delete [] normalimage.data; }
-	if (occlusimage.data != nullptr) { delete [] occlusimage.data; }
+	for (auto &file : surfacefiles) { tracked_free(file.data); }
 
+	untrack_texture(heightmap);
+	untrack_texture(normalmap);
+	untrack_texture(occlusmap);
+	untrack_texture(splatmap);
 	if (glIsTexture(heightmap) == GL_TRUE) { glDeleteTextures(1, &heightmap); }
 	if (glIsTexture(normalmap) == GL_TRUE) { glDeleteTextures(1, &normalmap); }
 	if (glIsTexture(occlusmap) == GL_TRUE) { glDeleteTextures(1, &occlusmap); }
+	if (glIsTexture(splatmap) == GL_TRUE) { glDeleteTextures(1, &splatmap); }
 
-	glDeleteBuffers(1, &termesh.VBO);
-	glDeleteVertexArrays(1, &termesh.VAO);
+	glDeleteVertexArrays(1, &clipmapVAO);
 };
 	
-void Terrain::genheightmap(size_t imageres, float freq)
+void Terrain::genheights(void)
 {
-	struct rawimage image = {
-		.data = new unsigned char[imageres*imageres],
-		.nchannels = 1,
-		.width = imageres,
-		.height = imageres
-	};
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	const size_t imageres = HEIGHTMAP_RESOLUTION;
+	ArenaScope scratch;
+	float *heights = (float*)scratch.allocate(imageres*imageres * sizeof(float));
+	terrain_image(heights, imageres, seed, 1.f);
 
-	terrain_image(image.data, imageres, 333, freq);
+	struct erosionparams erosion = default_erosionparams(seed);
+	erode_image(heights, imageres, imageres, &erosion, EROSION_ITERATIONS);
+
+	heightimage = quantize_image(heights, imageres, imageres, HEIGHTMAP_FORMAT);
 
-	heightmap = bind_texture(&image, GL_R8, GL_RED, GL_UNSIGNED_BYTE);
-	heightimage = image;
 	mapratio = float(sidelength) / float(imageres);
 }
 
-void Terrain::gennormalmap(void)
+bool Terrain::loadworld(const char *fpath)
+{
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	struct worldcache world;
+	if (load_worldcache(fpath, &world) == false) { return false; }
+
+	heightimage = world.heights;
+	normalimage = world.normals;
+	occlusimage = world.occlusion;
+
+	mapratio = float(sidelength) / float(heightimage.width);
+
+	return true;
+}
+
+void Terrain::gennormals(void)
+{
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	if (normalimage.data == nullptr) { normalimage = gen_normalmap(&heightimage); }
+	normalblocks = encode_BC5(&normalimage, 0, 2);
+}
+
+void Terrain::genocclusion(void)
 {
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	if (occlusimage.data == nullptr) { occlusimage = gen_occlusmap(&heightimage); }
+	occlusblocks = encode_BC4(&occlusimage, 0);
+}
+
+void Terrain::gensplat(void)
+{
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	splatimage = gen_splatmap(&heightimage, &normalimage, mapratio);
+	splatblocks = encode_BC5(&splatimage, 0, 1);
+}
+
+void Terrain::loadsurfaces(void)
+{
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	const char *SURFACE_FILES[SURFACE_FILE_COUNT] = {
+		"media/textures/terrain/detailmap.dds",
+		"media/textures/terrain/grass.dds",
+		"media/textures/terrain/dirt.dds",
+		"media/textures/terrain/stone.dds",
+		"media/textures/terrain/snow.dds"
+	};
+
+	for (int i = 0; i < SURFACE_FILE_COUNT; i++) {
+		surfacefiles[i] = read_DDS(SURFACE_FILES[i]);
+	}
+}
+
+// creates the textures from the generated maps and the surface files, the encoded blocks and files are freed after
+void Terrain::upload(void)
+{
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	glGenVertexArrays(1, &clipmapVAO);
+
+	GLenum internalformat, format, type;
+	texture_formats(&heightimage, &internalformat, &format, &type);
+	heightmap = bind_texture(&heightimage, internalformat, format, type);
+	normalmap = bind_block_texture(&normalblocks);
+	occlusmap = bind_block_texture(&occlusblocks);
+	splatmap = bind_block_texture(&splatblocks);
+	normalblocks.data = std::vector<uint8_t>();
+	occlusblocks.data = std::vector<uint8_t>();
+	splatblocks.data = std::vector<uint8_t>();
+
+	detailmap = upload_DDS_texture(&surfacefiles[0]);
+	tersurface.grass = upload_DDS_texture(&surfacefiles[1]);
+	tersurface.dirt = upload_DDS_texture(&surfacefiles[2]);
+	tersurface.stone = upload_DDS_texture(&surfacefiles[3]);
+	tersurface.snow = upload_DDS_texture(&surfacefiles[4]);
+	for (auto &file : surfacefiles) {
+		tracked_free(file.data);
+		file.data = nullptr;
+	}
+}
+
+// replaces the heights with new ones of the same resolution and derives the normals again
+// occlusion is expensive so it is only derived for the final heights
+void Terrain::updateheights(const float *heights, bool final)
+{
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	heightimage = quantize_image(heights, heightimage.width, heightimage.height, heightimage.format);
+	update_texture(heightmap, &heightimage);
+
 	normalimage = gen_normalmap(&heightimage);
-	normalmap = bind_texture(&normalimage, GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE);
+	encode_BC5(&normalimage, 0, 2, &editblocks);
+	update_block_texture(normalmap, &editblocks);
+
+	if (final) {
+		occlusimage = gen_occlusmap(&heightimage);
+		encode_BC4(&occlusimage, 0, &editblocks);
+		update_block_texture(occlusmap, &editblocks);
+	}
+
+	splatimage = gen_splatmap(&heightimage, &normalimage, mapratio);
+	encode_BC5(&splatimage, 0, 1, &editblocks);
+	update_block_texture(splatmap, &editblocks);
+}
+
+struct rect Terrain::edit(const struct brush *brush)
+{
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	const struct rect area = brush_image(&heightimage, brush);
+	dirtyheights = merge_rect(dirtyheights, area);
+
+	return area;
+}
+
+// uploads the heights changed by the edits since the last flush and derives the maps again around them
+// occlusion is expensive so it waits for the final flush when the editing stops, returns the area that flush completed
+struct rect Terrain::flush_edits(bool final)
+{
+	MemoryScope scope(MEMORY_TERRAIN);
+
+	if (empty_rect(dirtyheights) == false) {
+		update_texture_rect(heightmap, &heightimage, &dirtyheights);
+
+		// the sobel filter reaches one texel, so the normals around the edit change too
+		const struct rect halo = expand_rect(dirtyheights, 1, heightimage.width, heightimage.height);
+		update_normalmap(&heightimage, &normalimage, halo);
+		update_splatmap(&heightimage, &normalimage, &splatimage, mapratio, halo);
+		update_block_area(normalmap, &normalimage, halo, &editblocks, [](const struct rawimage *crop, struct blockimage *blocks) { encode_BC5(crop, 0, 2, blocks); });
+		update_block_area(splatmap, &splatimage, halo, &editblocks, [](const struct rawimage *crop, struct blockimage *blocks) { encode_BC5(crop, 0, 1, blocks); });
+
+		dirtyocclusion = merge_rect(dirtyocclusion, halo);
+		dirtyheights = { 0, 0, 0, 0 };
+	}
+
+	struct rect completed = { 0, 0, 0, 0 };
+	if (final && empty_rect(dirtyocclusion) == false) {
+		update_occlusmap(&heightimage, &occlusimage, dirtyocclusion, OCCLUSION_HALO);
+		update_block_area(occlusmap, &occlusimage, dirtyocclusion, &editblocks, [](const struct rawimage *crop, struct blockimage *blocks) { encode_BC4(crop, 0, blocks); });
+
+		completed = dirtyocclusion;
+		dirtyocclusion = { 0, 0, 0, 0 };
+	}
+
+	return completed;
 }
 
-void Terrain::genocclusmap(void)
+// marches along a ray in steps of a texel and refines the first step that ends below the terrain
+bool Terrain::raycast(glm::vec3 origin, glm::vec3 direction, float maxdistance, glm::vec3 *hit) const
 {
-	occlusimage = gen_occlusmap(&heightimage);
-	occlusmap = bind_texture(&occlusimage, GL_R8, GL_RED, GL_UNSIGNED_BYTE);
+	float previous = 0.f;
+	for (float t = 0.f; t < maxdistance; t += mapratio) {
+		const glm::vec3 position = origin + t * direction;
+		if (position.x < 0.f || position.z < 0.f || position.x >= sidelength || position.z >= sidelength) {
+			previous = t;
+			continue;
+		}
+		if (position.y < amplitude * sampleheight(position.x / mapratio, position.z / mapratio)) {
+			float above = previous;
+			float below = t;
+			for (int i = 0; i < 8; i++) {
+				const float middle = 0.5f * (above + below);
+				const glm::vec3 p = origin + middle * direction;
+				if (p.y < amplitude * sampleheight(p.x / mapratio, p.z / mapratio)) {
+					below = middle;
+				} else {
+					above = middle;
+				}
+			}
+			*hit = origin + below * direction;
+			return true;
+		}
+		previous = t;
+	}
+
+	return false;
 }
 
 void Terrain::display(void) const
 {
-	glBindVertexArray(termesh.VAO);
+	glBindVertexArray(clipmapVAO);
 
-	activate_texture(GL_TEXTURE0, GL_TEXTURE_2D, heightmap);
-	activate_texture(GL_TEXTURE1, GL_TEXTURE_2D, normalmap);
-	activate_texture(GL_TEXTURE2, GL_TEXTURE_2D, occlusmap);
-	activate_texture(GL_TEXTURE3, GL_TEXTURE_2D, detailmap);
 	/* TODO replace with array texture */
-	activate_texture(GL_TEXTURE4, GL_TEXTURE_2D, tersurface.grass);
-	activate_texture(GL_TEXTURE5, GL_TEXTURE_2D, tersurface.dirt);
-	activate_texture(GL_TEXTURE6, GL_TEXTURE_2D, tersurface.stone);
-	activate_texture(GL_TEXTURE7, GL_TEXTURE_2D, tersurface.snow);
+	const struct texturebinding textures[] = {
+		{ GL_TEXTURE_2D, heightmap },
+		{ GL_TEXTURE_2D, normalmap },
+		{ GL_TEXTURE_2D, occlusmap },
+		{ GL_TEXTURE_2D, detailmap },
+		{ GL_TEXTURE_2D, tersurface.grass },
+		{ GL_TEXTURE_2D, tersurface.dirt },
+		{ GL_TEXTURE_2D, tersurface.stone },
+		{ GL_TEXTURE_2D, tersurface.snow },
+		{ GL_TEXTURE_2D, splatmap }
+	};
+	activate_textures(GL_TEXTURE0, 9, textures);
 
 //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glPatchParameteri(GL_PATCH_VERTICES, 4);
-	glDrawArrays(GL_PATCHES, 0, termesh.ecount);
+	// one instance per level, six vertices per quad
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 6 * CLIPMAP_GRID * CLIPMAP_GRID, CLIPMAP_LEVELS);
 //glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
@@ -219,12 +401,93 @@ float Terrain::sampleslope(float x, float z) const
 	return 1.f - ((slope * 2.f) - 1.f);
 }
 
-Grass::Grass(const Terrain *ter, size_t density, GLuint height, GLuint norm, GLuint occlus, GLuint detail, GLuint wind)
+// the roots are scattered by scatter and uploaded with the textures of the terrain by upload
+Grass::Grass(const Terrain *ter, size_t density, unsigned int seed)
+{
+	terrain = ter;
+	totaldensity = density;
+	regrowths = seed;
+	roots = { 0, 0, 0, GL_POINTS, 0, false };
+	heightmap = normalmap = occlusmap = detailmap = windmap = 0;
+	tilebuffer = commandbuffer = 0;
+	indirect = false;
+	culled = false;
+}
+
+// needs the heights and normals of the terrain, not the GL context
+void Grass::scatter(void)
+{
+	const float minpos = 0.25 * terrain->sidelength; // min grass position
+	const float maxpos = 0.75 * terrain->sidelength; // max grass position
+
+	bounds[0] = glm::vec2(minpos, minpos);
+	bounds[1] = glm::vec2(maxpos, maxpos);
+
+	positions = scatter_grass_roots(&terrain->heightimage, &terrain->normalimage, bounds[0], bounds[1], 1.f / terrain->mapratio, totaldensity, regrowths);
+	sort_tiles();
+}
+
+// counting sort of the roots by tile, the bounds of a tile cover the heights under its roots and the reach of the blades
+void Grass::sort_tiles(void)
 {
-	const float minpos = 0.25 * ter->sidelength; // min grass position
-	const float maxpos = 0.75 * ter->sidelength; // max grass position
+	const glm::vec2 tilesize = (bounds[1] - bounds[0]) / float(GRASS_TILES);
+	auto tile_of = [&](const glm::vec2 &p) -> size_t {
+		const glm::ivec2 cell = glm::clamp(glm::ivec2((p - bounds[0]) / tilesize), glm::ivec2(0), glm::ivec2(GRASS_TILES - 1));
+		return cell.y * GRASS_TILES + cell.x;
+	};
 
-	roots = gen_grass_roots(ter, glm::vec2(minpos, minpos), glm::vec2(maxpos, maxpos), density);
+	std::vector<size_t> offsets(GRASS_TILES * GRASS_TILES + 1, 0);
+	for (const auto &p : positions) { offsets[tile_of(p) + 1]++; }
+	for (size_t i = 1; i < offsets.size(); i++) { offsets[i] += offsets[i - 1]; }
+
+	std::vector<glm::vec2> sorted(positions.size());
+	std::vector<size_t> cursor(offsets.begin(), offsets.end() - 1);
+	for (const auto &p : positions) { sorted[cursor[tile_of(p)]++] = p; }
+	positions.swap(sorted);
+
+	tiles.clear();
+	for (size_t tile = 0; tile < GRASS_TILES * GRASS_TILES; tile++) {
+		const size_t first = offsets[tile];
+		const size_t count = offsets[tile + 1] - first;
+		if (count == 0) { continue; }
+		float lowest = INFINITY;
+		float highest = -INFINITY;
+		for (size_t i = first; i < first + count; i++) {
+			const float height = terrain->amplitude * terrain->sampleheight(positions[i].x / terrain->mapratio, positions[i].y / terrain->mapratio);
+			lowest = std::min(lowest, height);
+			highest = std::max(highest, height);
+		}
+		const glm::vec2 corner = bounds[0] + tilesize * glm::vec2(tile % GRASS_TILES, tile / GRASS_TILES);
+		struct cullbox box = {
+			.min = glm::vec4(corner.x - GRASS_REACH, lowest - GRASS_REACH, corner.y - GRASS_REACH, 0.f),
+			.max = glm::vec4(corner.x + tilesize.x + GRASS_REACH, highest + GRASS_REACH, corner.y + tilesize.y + GRASS_REACH, 0.f),
+			.first = GLuint(first),
+			.count = GLuint(count)
+		};
+		tiles.push_back(box);
+	}
+}
+
+void Grass::upload_tiles(void)
+{
+	if (glIsBuffer(tilebuffer) == GL_FALSE) { glGenBuffers(1, &tilebuffer); }
+	if (glIsBuffer(commandbuffer) == GL_FALSE) { glGenBuffers(1, &commandbuffer); }
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, tilebuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, tiles.size() * sizeof(struct cullbox), tiles.data(), GL_STATIC_DRAW);
+	track_buffer(tilebuffer, tiles.size() * sizeof(struct cullbox));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandbuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, tiles.size() * 4 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	track_buffer(commandbuffer, tiles.size() * 4 * sizeof(GLuint));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Grass::upload(GLuint height, GLuint norm, GLuint occlus, GLuint detail, GLuint wind)
+{
+	MemoryScope scope(MEMORY_GRASS);
+
+	roots = upload_grass_roots(positions);
+	upload_tiles();
 	heightmap = height;
 	normalmap = norm;
 	occlusmap = occlus;
@@ -232,19 +495,89 @@ Grass::Grass(const Terrain *ter, size_t density, GLuint height, GLuint norm, GLu
 	windmap = wind;
 }
 
+// scatters the roots inside an area again after the terrain under it was edited
+void Grass::regrow(glm::vec2 min, glm::vec2 max)
+{
+	MemoryScope scope(MEMORY_GRASS);
+
+	min = glm::max(min, bounds[0]);
+	max = glm::min(max, bounds[1]);
+	if (min.x >= max.x || min.y >= max.y) { return; }
+
+	positions.erase(std::remove_if(positions.begin(), positions.end(), [&](const glm::vec2 &p) {
+		return p.x >= min.x && p.y >= min.y && p.x < max.x && p.y < max.y;
+	}), positions.end());
+
+	// same density as the rest of the field
+	const glm::vec2 area = max - min;
+	const glm::vec2 total = bounds[1] - bounds[0];
+	const size_t density = size_t(double(totaldensity) * (area.x * area.y) / (total.x * total.y));
+	std::vector<glm::vec2> regrown = scatter_grass_roots(&terrain->heightimage, &terrain->normalimage, min, max, 1.f / terrain->mapratio, density, ++regrowths);
+	positions.insert(positions.end(), regrown.begin(), regrown.end());
+	sort_tiles();
+
+	delete_mesh(&roots);
+	roots = upload_grass_roots(positions);
+	upload_tiles();
+}
+
+// tiles out of view, out of reach of the blades or behind the terrain never reach the geometry shader
+// with compute shaders the culling writes indirect draws on the GPU, otherwise the visible ranges are gathered here
+void Grass::cull(const OcclusionCuller *culler, const glm::mat4 &VIEW_PROJECT, glm::vec3 camerapos)
+{
+	culled = true;
+	indirect = (culler != nullptr && culler->gpu());
+	if (indirect) {
+		culler->cull_indirect(tilebuffer, commandbuffer, tiles.size(), VIEW_PROJECT, camerapos, GRASS_DISTANCE);
+		firsts.clear();
+		counts.clear();
+		return;
+	}
+
+	const struct frustum frustum = extract_frustum(VIEW_PROJECT);
+	firsts.clear();
+	counts.clear();
+	for (const auto &tile : tiles) {
+		const glm::vec3 min = glm::vec3(tile.min);
+		const glm::vec3 max = glm::vec3(tile.max);
+		if (glm::distance(glm::clamp(camerapos, min, max), camerapos) >= GRASS_DISTANCE) { continue; }
+		if (AABB_in_frustum(&frustum, min, max) == false) { continue; }
+		if (culler && culler->visible(min, max) == false) { continue; }
+		// neighbouring tiles are consecutive in the vertex buffer, so they merge into one range
+		if (!firsts.empty() && GLuint(firsts.back() + counts.back()) == tile.first) {
+			counts.back() += tile.count;
+		} else {
+			firsts.push_back(tile.first);
+			counts.push_back(tile.count);
+		}
+	}
+}
+
 void Grass::display(void) const
 {
-	activate_texture(GL_TEXTURE0, GL_TEXTURE_2D, heightmap);
-	activate_texture(GL_TEXTURE1, GL_TEXTURE_2D, normalmap);
-	activate_texture(GL_TEXTURE2, GL_TEXTURE_2D, occlusmap);
-	activate_texture(GL_TEXTURE3, GL_TEXTURE_2D, detailmap);
-	activate_texture(GL_TEXTURE4, GL_TEXTURE_2D, windmap);
-	glDisable(GL_CULL_FACE);
+	// the same maps on the same units as the terrain, the ones still bound are skipped
+	const struct texturebinding textures[] = {
+		{ GL_TEXTURE_2D, heightmap },
+		{ GL_TEXTURE_2D, normalmap },
+		{ GL_TEXTURE_2D, occlusmap },
+		{ GL_TEXTURE_2D, detailmap },
+		{ GL_TEXTURE_2D, windmap }
+	};
+	activate_textures(GL_TEXTURE0, 5, textures);
+	disable_state(GL_CULL_FACE);
 	glBindVertexArray(roots.VAO);
 //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glDrawArrays(GL_POINTS, 0, roots.ecount);
+	if (indirect) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandbuffer);
+		glMultiDrawArraysIndirect(GL_POINTS, NULL, tiles.size(), 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	} else if (culled) {
+		glMultiDrawArrays(GL_POINTS, firsts.data(), counts.data(), firsts.size());
+	} else {
+		glDrawArrays(GL_POINTS, 0, roots.ecount);
+	}
 //glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	glEnable(GL_CULL_FACE);
+	enable_state(GL_CULL_FACE);
 }
 
 void Skybox::display(void) const
@@ -258,18 +591,43 @@ void Skybox::display(void) const
 
 Clouds::Clouds(size_t terrain_length, float terrain_amp, size_t texsize, float freq, float cloud_distance)
 {
-	float overcast = 0.25f * terrain_length;
-	float height = 2.f * terrain_amp;
-	slices = create_slices(glm::vec3(-overcast, height, terrain_length+overcast), glm::vec3(terrain_length+overcast, height, terrain_length+overcast), glm::vec3(-overcast, height, -overcast), glm::vec3(terrain_length+overcast, height, -overcast), 64, 2.f);
+	length = terrain_length;
+	amplitude = terrain_amp;
+	volumesize = texsize;
+	frequency = freq;
+	distance = cloud_distance;
+	slices = { 0, 0, 0, GL_TRIANGLES, 0, true };
+	texture = 0;
+	volume = nullptr;
+}
+
+// the noise volume does not need the GL context
+void Clouds::generate(void)
+{
+	MemoryScope scope(MEMORY_CLOUDS);
+
+	volume = tracked_alloc(volumesize*volumesize*volumesize);
+	billow_3D_image(volume, volumesize, frequency, distance);
+}
+
+void Clouds::upload(void)
+{
+	MemoryScope scope(MEMORY_CLOUDS);
+
+	float overcast = 0.25f * length;
+	float height = 2.f * amplitude;
+	slices = create_slices(glm::vec3(-overcast, height, length+overcast), glm::vec3(length+overcast, height, length+overcast), glm::vec3(-overcast, height, -overcast), glm::vec3(length+overcast, height, -overcast), 64, 2.f);
 
-	texture = create_cloud_texture(texsize, freq, cloud_distance);
+	texture = create_cloud_texture(volume, volumesize);
+	tracked_free(volume);
+	volume = nullptr;
 }
 
 void Clouds::display(void)
 {
-	glDisable(GL_CULL_FACE);
+	disable_state(GL_CULL_FACE);
 	activate_texture(GL_TEXTURE0, GL_TEXTURE_3D, texture);
 	glBindVertexArray(slices.VAO);
 	glDrawElements(slices.mode, slices.ecount, GL_UNSIGNED_SHORT, NULL);
-	glEnable(GL_CULL_FACE);
+	enable_state(GL_CULL_FACE);
 }
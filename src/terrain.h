@@ -1,3 +1,21 @@
+// the terrain is drawn as nested square rings of CLIPMAP_GRID quads per side around the camera
+// each level has twice the quad size of the level inside it
+enum {
+	CLIPMAP_GRID = 64,
+	CLIPMAP_LEVELS = 7
+};
+
+#define CLIPMAP_SPACING 1.f // quad size of the finest level
+
+enum { SURFACE_FILE_COUNT = 5 }; // the detail map and the four surfaces
+
+enum { HEIGHTMAP_RESOLUTION = 1024 }; // texels per side of the generated heightmap
+
+enum { GRASS_TILES = 32 }; // tiles per side of the grass field, the roots of a tile are culled together
+
+#define GRASS_REACH 5.f // blades grow this far from their root
+#define GRASS_DISTANCE 100.f // blades only grow closer to the camera than this, has to match grass.geom
+
 struct surface {
 	GLuint grass;
 	GLuint dirt;
@@ -14,34 +32,78 @@ public:
 	GLuint normalmap;
 	GLuint occlusmap;
 	GLuint detailmap;
+	GLuint splatmap; // baked material weights
+	OwnedImage heightimage;
+	OwnedImage normalimage;
+	OwnedImage occlusimage;
+	OwnedImage splatimage;
 public:
-	Terrain(size_t sidelen, float patchoffst, float amp);
+	Terrain(size_t sidelen, float patchoffst, float amp, long seedvalue);
 	~Terrain(void);
+	// startup stages, normals need the heights, occlusion and splat weights need the normals
+	void genheights(void);
+	bool loadworld(const char *fpath); // instead of genheights, also brings the normals and occlusion
+	void gennormals(void);
+	void genocclusion(void);
+	void gensplat(void);
+	void loadsurfaces(void);
+	void upload(void); // needs the GL context and all the stages above
 	void display(void) const;
 	float sampleheight(float x, float z) const;
 	float sampleslope(float x, float z) const;
+	void updateheights(const float *heights, bool final);
+	struct rect edit(const struct brush *brush); // returns the area of the heightmap it changed
+	struct rect flush_edits(bool final);
+	bool raycast(glm::vec3 origin, glm::vec3 direction, float maxdistance, glm::vec3 *hit) const;
 private:
-	struct rawimage heightimage;
-	struct rawimage normalimage;
-	struct rawimage occlusimage;
-	struct mesh termesh;
+	GLuint clipmapVAO; // empty, the vertex shader builds the positions
 	struct surface tersurface;
-private:
-	void genheightmap(size_t imageres, float freq);
-	void gennormalmap(void);
-	void genocclusmap(void);
+	struct rect dirtyheights; // edited since the last flush
+	struct rect dirtyocclusion; // edited since the last final flush
+	long seed;
+	// generated or read by the startup stages, waiting for upload
+	struct blockimage normalblocks;
+	struct blockimage occlusblocks;
+	struct blockimage splatblocks;
+	struct blockimage editblocks; // reused by the updates after the upload
+	struct ddsimage surfacefiles[SURFACE_FILE_COUNT];
 };
 
 class Grass {
 public:
-	Grass(const Terrain *ter, size_t density, GLuint height, GLuint norm, GLuint occlus, GLuint detail, GLuint wind);
+	Grass(const Terrain *ter, size_t density, unsigned int seed);
 	~Grass(void) 
 	{
 		delete_mesh(&roots);
+		untrack_buffer(tilebuffer);
+		untrack_buffer(commandbuffer);
+		if (glIsBuffer(tilebuffer) == GL_TRUE) { glDeleteBuffers(1, &tilebuffer); }
+		if (glIsBuffer(commandbuffer) == GL_TRUE) { glDeleteBuffers(1, &commandbuffer); }
 	}
+	void scatter(void);
+	void upload(GLuint height, GLuint norm, GLuint occlus, GLuint detail, GLuint wind);
 	void display(void) const;
+	void regrow(glm::vec2 min, glm::vec2 max);
+	void cull(const OcclusionCuller *culler, const glm::mat4 &VIEW_PROJECT, glm::vec3 camerapos);
+	size_t tilecount(void) const { return tiles.size(); }
+	size_t visibletiles(void) const { return firsts.size(); } // only counted when culled on the CPU
 private:
+	const Terrain *terrain;
+	glm::vec2 bounds[2];
+	size_t totaldensity;
+	unsigned int regrowths; // seed of the next regrowth
+	std::vector<glm::vec2> positions; // sorted by tile
+	std::vector<struct cullbox> tiles;
 	struct mesh roots;
+	GLuint tilebuffer;
+	GLuint commandbuffer; // indirect draws written by the cull compute shader
+	bool indirect; // culled on the GPU
+	bool culled;
+	std::vector<GLint> firsts; // visible tiles when culled on the CPU
+	std::vector<GLsizei> counts;
+private:
+	void sort_tiles(void);
+	void upload_tiles(void);
 	GLuint heightmap;
 	GLuint normalmap;
 	GLuint occlusmap;
@@ -57,6 +119,7 @@ public:
 		cube = gen_mapcube();
 	};
 	void display(void) const;
+	GLuint texture(void) const { return cubemap; }
 private:
 	GLuint cubemap;
 	struct mesh cube;
@@ -68,10 +131,20 @@ public:
 	~Clouds(void) 
 	{
 		delete_mesh(&slices);
+		tracked_free(volume);
+		untrack_texture(texture);
 		if (glIsTexture(texture) == GL_TRUE) { glDeleteTextures(1, &texture); }
 	}
+	void generate(void);
+	void upload(void);
 	void display(void);
 private:
+	size_t length;
+	float amplitude;
+	size_t volumesize;
+	float frequency;
+	float distance;
+	unsigned char *volume; // generated, waiting for upload
 	struct mesh slices; // mesh containing slices to sample a 3D texture
 	GLuint texture; // 3D texture containing noise 
 };
@@ -0,0 +1,595 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <glm/glm.hpp>
+
+#include "imp.h"
+#include "memory.h"
+#include "pool.h"
+#include "parallel.h"
+#include "tilefarm.h"
+
+extern char **environ;
+
+#define FARM_MAGIC 0x4d524146 // "FARM"
+#define WORLD_MAGIC 0x444c5257 // "WRLD"
+#define WORLD_VERSION 1
+#define FARM_FREQUENCY 1.f // the frequency the terrain is generated with
+#define TILE_HALO 64 // texels around a tile that are generated for the occlusion and normals and then dropped
+#define FARM_TIMEOUT 30 // seconds the coordinator waits while no worker is connected
+#define CONNECT_RETRIES 50 // the coordinator might still be starting up
+
+enum farmmessage {
+	FARM_RIDGE, // largest ridge value of a tile, the heights are normalized by the largest of the world
+	FARM_TILE,
+	FARM_QUIT,
+	FARM_RIDGE_DONE,
+	FARM_TILE_DONE
+};
+
+struct farmheader {
+	uint32_t magic;
+	uint32_t type;
+	uint64_t size; // payload bytes after the header
+};
+
+// every reply starts with the job it answers
+struct farmjob {
+	uint32_t tile;
+	uint32_t worldsize;
+	int64_t seed;
+	float frequency;
+	float ridgemax;
+	int32_t halo;
+	struct rect area;
+};
+
+struct worldheader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t padding;
+	int64_t seed;
+};
+
+static bool send_all(int fd, const void *buffer, size_t size)
+{
+	const char *data = (const char*)buffer;
+	while (size > 0) {
+		const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+		if (sent <= 0) { return false; }
+		data += sent;
+		size -= sent;
+	}
+
+	return true;
+}
+
+static bool recv_all(int fd, void *buffer, size_t size)
+{
+	char *data = (char*)buffer;
+	while (size > 0) {
+		const ssize_t received = recv(fd, data, size, 0);
+		if (received <= 0) { return false; }
+		data += received;
+		size -= received;
+	}
+
+	return true;
+}
+
+static bool send_message(int fd, enum farmmessage type, const void *payload, size_t size)
+{
+	const struct farmheader header = { FARM_MAGIC, uint32_t(type), size };
+
+	return send_all(fd, &header, sizeof(header)) && send_all(fd, payload, size);
+}
+
+// the size comes from the network, a payload larger than maxsize is not a farm message and is refused before it is allocated
+static bool recv_message(int fd, struct farmheader *header, std::vector<unsigned char> &payload, size_t maxsize)
+{
+	if (!recv_all(fd, header, sizeof(struct farmheader))) { return false; }
+	if (header->magic != FARM_MAGIC) {
+		std::cerr << "error: tile farm message has a bad magic number" << std::endl;
+		return false;
+	}
+	if (header->size > maxsize) {
+		std::cerr << "error: tile farm message of " << header->size << " bytes is larger than " << maxsize << " bytes" << std::endl;
+		return false;
+	}
+
+	payload.resize(header->size);
+
+	return recv_all(fd, payload.data(), payload.size());
+}
+
+// copies a tile into its place in the world image
+static void stitch_tile(struct rawimage *world, const unsigned char *tile, struct rect area)
+{
+	const size_t texelsize = world->nchannels * format_size(world->format);
+	const size_t rowsize = (area.x1 - area.x0) * texelsize;
+	for (int y = area.y0; y < area.y1; y++) {
+		std::copy(tile, tile + rowsize, &world->data[(y * world->width + area.x0) * texelsize]);
+		tile += rowsize;
+	}
+}
+
+static size_t tile_texels(struct rect area)
+{
+	return (area.x1 - area.x0) * (area.y1 - area.y0);
+}
+
+// shared by the threads that talk to the workers
+struct farmstate {
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<struct farmjob> jobs; // one for each tile
+	std::deque<uint32_t> queue; // tiles of the current phase waiting for a worker
+	enum farmmessage phase;
+	size_t remaining; // tiles of the current phase that are not done
+	size_t maxreply; // bytes of the largest reply, a tile with its heights, normals and occlusion
+	unsigned int connected;
+	bool finished;
+	std::vector<float> ridges;
+	struct worldcache *world;
+};
+
+// hands out jobs to one worker until there is no more work, a job of a lost worker goes back in the queue
+static void serve_worker(struct farmstate *state, int fd)
+{
+	std::vector<unsigned char> payload;
+	bool alive = true;
+
+	while (alive) {
+		struct farmjob job;
+		enum farmmessage phase;
+		{
+			std::unique_lock<std::mutex> lock(state->lock);
+			state->changed.wait(lock, [&](void) { return !state->queue.empty() || state->finished; });
+			if (state->queue.empty()) { break; }
+			job = state->jobs[state->queue.front()];
+			state->queue.pop_front();
+			phase = state->phase;
+		}
+
+		struct farmheader header;
+		const enum farmmessage reply = (phase == FARM_RIDGE) ? FARM_RIDGE_DONE : FARM_TILE_DONE;
+		alive = send_message(fd, phase, &job, sizeof(job)) && recv_message(fd, &header, payload, state->maxreply) && header.type == reply && payload.size() >= sizeof(job);
+
+		if (alive && phase == FARM_RIDGE) {
+			float ridgemax;
+			alive = payload.size() == sizeof(job) + sizeof(float);
+			if (alive) {
+				memcpy(&ridgemax, &payload[sizeof(job)], sizeof(float));
+				state->ridges[job.tile] = ridgemax;
+			}
+		} else if (alive) {
+			// tiles are disjoint so they are stitched without holding the lock
+			const size_t texels = tile_texels(job.area);
+			alive = payload.size() == sizeof(job) + texels * (2 + 3 + 1);
+			if (alive) {
+				const unsigned char *data = &payload[sizeof(job)];
+				stitch_tile(&state->world->heights, data, job.area);
+				stitch_tile(&state->world->normals, data + texels * 2, job.area);
+				stitch_tile(&state->world->occlusion, data + texels * 5, job.area);
+			}
+		}
+
+		std::lock_guard<std::mutex> guard(state->lock);
+		if (alive) {
+			state->remaining--;
+		} else {
+			std::cerr << "error: lost a tile farm worker, tile " << job.tile << " goes to another worker" << std::endl;
+			state->queue.push_front(job.tile);
+		}
+		state->changed.notify_all();
+	}
+
+	if (alive) { send_message(fd, FARM_QUIT, nullptr, 0); }
+	close(fd);
+
+	std::lock_guard<std::mutex> guard(state->lock);
+	state->connected--;
+	state->changed.notify_all();
+}
+
+// queues every tile for the phase and waits until they are done
+static bool run_phase(struct farmstate *state, enum farmmessage phase)
+{
+	std::unique_lock<std::mutex> lock(state->lock);
+	state->phase = phase;
+	state->remaining = state->jobs.size();
+	for (uint32_t tile = 0; tile < state->jobs.size(); tile++) {
+		state->queue.push_back(tile);
+	}
+	state->changed.notify_all();
+
+	auto lastworker = std::chrono::steady_clock::now();
+	while (state->remaining > 0) {
+		state->changed.wait_for(lock, std::chrono::seconds(1));
+		if (state->connected > 0) {
+			lastworker = std::chrono::steady_clock::now();
+		} else if (std::chrono::steady_clock::now() - lastworker > std::chrono::seconds(FARM_TIMEOUT)) {
+			std::cerr << "error: no tile farm workers for " << FARM_TIMEOUT << " seconds" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static int listen_socket(unsigned short port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		std::cerr << "error: could not create tile farm socket" << std::endl;
+		return -1;
+	}
+
+	const int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+
+	if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 16) < 0) {
+		std::cerr << "error: could not listen on port " << port << std::endl;
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// starts this binary in worker mode, the threads of the machine are split over the local workers
+static bool spawn_worker(const char *executable, unsigned short port, unsigned int threads, pid_t *pid)
+{
+	std::string address = "127.0.0.1:" + std::to_string(port);
+	std::string nthreads = std::to_string(threads);
+	char *argv[] = {
+		(char*)executable,
+		(char*)"--worker", (char*)address.c_str(),
+		(char*)"--threads", (char*)nthreads.c_str(),
+		nullptr
+	};
+
+	if (posix_spawn(pid, executable, nullptr, nullptr, argv, environ) != 0) {
+		std::cerr << "error: could not start tile farm worker " << executable << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool run_coordinator(const struct farmconfig *config, const char *executable)
+{
+	MemoryScope scope(MEMORY_WORLD);
+
+	if (config->tilesize == 0 || config->worldsize == 0) {
+		std::cerr << "error: tile farm world and tile size must be larger than zero" << std::endl;
+		return false;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	const size_t worldsize = config->worldsize;
+	struct worldcache world;
+	world.seed = config->seed;
+	world.heights = {
+		.data = tracked_alloc(worldsize * worldsize * 2),
+		.nchannels = 1,
+		.width = worldsize,
+		.height = worldsize,
+		.format = IMAGE_U16
+	};
+	world.normals = {
+		.data = tracked_alloc(worldsize * worldsize * 3),
+		.nchannels = 3,
+		.width = worldsize,
+		.height = worldsize
+	};
+	world.occlusion = {
+		.data = tracked_alloc(worldsize * worldsize),
+		.nchannels = 1,
+		.width = worldsize,
+		.height = worldsize
+	};
+
+	struct farmstate state;
+	state.phase = FARM_RIDGE;
+	state.remaining = 0;
+	state.maxreply = sizeof(struct farmjob) + config->tilesize * config->tilesize * (2 + 3 + 1) + sizeof(float);
+	state.connected = 0;
+	state.finished = false;
+	state.world = &world;
+
+	for (size_t y = 0; y < worldsize; y += config->tilesize) {
+		for (size_t x = 0; x < worldsize; x += config->tilesize) {
+			struct farmjob job;
+			job.tile = state.jobs.size();
+			job.worldsize = worldsize;
+			job.seed = config->seed;
+			job.frequency = FARM_FREQUENCY;
+			job.ridgemax = 0.f;
+			job.halo = TILE_HALO;
+			job.area = {
+				int(x), int(y),
+				int(std::min(x + config->tilesize, worldsize)), int(std::min(y + config->tilesize, worldsize))
+			};
+			state.jobs.push_back(job);
+		}
+	}
+	state.ridges.resize(state.jobs.size());
+
+	int listenfd = listen_socket(config->port);
+	if (listenfd < 0) {
+		tracked_free(world.heights.data);
+		tracked_free(world.normals.data);
+		tracked_free(world.occlusion.data);
+		return false;
+	}
+
+	std::vector<pid_t> children;
+	const unsigned int workerthreads = std::max(1u, threadcount() / std::max(1u, config->localworkers));
+	for (unsigned int i = 0; i < config->localworkers; i++) {
+		pid_t pid;
+		if (spawn_worker(executable, config->port, workerthreads, &pid)) { children.push_back(pid); }
+	}
+
+	// workers can connect at any time, also from other machines
+	std::thread acceptor([&](void) {
+		std::vector<std::thread> connections;
+		while (true) {
+			{
+				std::lock_guard<std::mutex> guard(state.lock);
+				if (state.finished) { break; }
+			}
+			struct pollfd request = { listenfd, POLLIN, 0 };
+			if (poll(&request, 1, 200) <= 0) { continue; }
+			int fd = accept(listenfd, nullptr, nullptr);
+			if (fd < 0) { continue; }
+			std::lock_guard<std::mutex> guard(state.lock);
+			state.connected++;
+			connections.push_back(std::thread(serve_worker, &state, fd));
+		}
+		for (auto &connection : connections) { connection.join(); }
+	});
+
+	bool success = run_phase(&state, FARM_RIDGE);
+	if (success) {
+		float ridgemax = 1.f;
+		for (float ridge : state.ridges) { ridgemax = std::max(ridgemax, ridge); }
+		for (auto &job : state.jobs) { job.ridgemax = ridgemax; }
+		success = run_phase(&state, FARM_TILE);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(state.lock);
+		state.finished = true;
+		state.queue.clear();
+		state.changed.notify_all();
+	}
+	acceptor.join();
+	close(listenfd);
+
+	for (pid_t pid : children) {
+		int status;
+		waitpid(pid, &status, 0);
+	}
+
+	if (success) {
+		success = save_worldcache(config->output, &world);
+		std::chrono::duration<float> duration = std::chrono::steady_clock::now() - start;
+		std::cout << "generated " << state.jobs.size() << " tiles of a " << worldsize << " world in " << duration.count() << " s" << std::endl;
+	}
+
+	tracked_free(world.heights.data);
+	tracked_free(world.normals.data);
+	tracked_free(world.occlusion.data);
+
+	return success;
+}
+
+static int connect_socket(const char *address)
+{
+	const char *colon = strrchr(address, ':');
+	if (!colon) {
+		std::cerr << "error: tile farm address " << address << " is not host:port" << std::endl;
+		return -1;
+	}
+	const std::string host(address, colon);
+	const std::string port(colon + 1);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo *info = nullptr;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &info) != 0) {
+		std::cerr << "error: could not resolve tile farm address " << address << std::endl;
+		return -1;
+	}
+
+	int fd = -1;
+	for (int attempt = 0; attempt < CONNECT_RETRIES && fd < 0; attempt++) {
+		for (struct addrinfo *i = info; i && fd < 0; i = i->ai_next) {
+			fd = socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+			if (fd >= 0 && connect(fd, i->ai_addr, i->ai_addrlen) < 0) {
+				close(fd);
+				fd = -1;
+			}
+		}
+		if (fd < 0) { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }
+	}
+	freeaddrinfo(info);
+
+	if (fd < 0) { std::cerr << "error: could not connect to tile farm " << address << std::endl; }
+
+	return fd;
+}
+
+// heights, normals and occlusion of the tile, derived on the tile with a halo so the borders match the neighbouring tiles
+static void generate_tile(const struct farmjob *job, std::vector<unsigned char> &reply)
+{
+	const struct rect crop = expand_rect(job->area, job->halo, job->worldsize, job->worldsize);
+	const size_t width = crop.x1 - crop.x0;
+	const size_t height = crop.y1 - crop.y0;
+
+	ArenaScope scratch;
+	float *heights = (float*)scratch.allocate(width * height * sizeof(float));
+	terrain_tile(heights, job->worldsize, crop, job->seed, job->frequency, job->ridgemax);
+	struct rawimage heightmap = quantize_image(heights, width, height, IMAGE_U16);
+
+	struct rawimage normalmap = gen_normalmap(&heightmap);
+	struct rawimage occlusmap = gen_occlusmap(&heightmap);
+
+	const struct rect inner = {
+		job->area.x0 - crop.x0, job->area.y0 - crop.y0,
+		job->area.x1 - crop.x0, job->area.y1 - crop.y0
+	};
+	const struct rawimage images[] = { heightmap, normalmap, occlusmap };
+	for (const auto &image : images) {
+		struct rawimage tile = crop_image(&image, inner);
+		const size_t size = tile.width * tile.height * tile.nchannels * format_size(tile.format);
+		reply.insert(reply.end(), tile.data, tile.data + size);
+		tracked_free(tile.data);
+	}
+
+	tracked_free(heightmap.data);
+	tracked_free(normalmap.data);
+	tracked_free(occlusmap.data);
+}
+
+bool run_worker(const char *address)
+{
+	MemoryScope scope(MEMORY_WORLD);
+
+	int fd = connect_socket(address);
+	if (fd < 0) { return false; }
+
+	std::vector<unsigned char> payload;
+	std::vector<unsigned char> reply;
+	bool success = false;
+
+	while (true) {
+		struct farmheader header;
+		if (!recv_message(fd, &header, payload, sizeof(struct farmjob))) { break; }
+		if (header.type == FARM_QUIT) {
+			success = true;
+			break;
+		}
+		if (payload.size() != sizeof(struct farmjob)) {
+			std::cerr << "error: tile farm job has the wrong size" << std::endl;
+			break;
+		}
+
+		struct farmjob job;
+		memcpy(&job, payload.data(), sizeof(job));
+		reply.assign((unsigned char*)&job, (unsigned char*)&job + sizeof(job));
+
+		bool sent = false;
+		if (header.type == FARM_RIDGE) {
+			const float ridgemax = terrain_ridge_max(job.worldsize, job.area, job.seed, job.frequency);
+			reply.insert(reply.end(), (const unsigned char*)&ridgemax, (const unsigned char*)&ridgemax + sizeof(float));
+			sent = send_message(fd, FARM_RIDGE_DONE, reply.data(), reply.size());
+		} else if (header.type == FARM_TILE) {
+			generate_tile(&job, reply);
+			sent = send_message(fd, FARM_TILE_DONE, reply.data(), reply.size());
+		}
+		if (!sent) { break; }
+	}
+
+	close(fd);
+
+	return success;
+}
+
+bool save_worldcache(const char *fpath, const struct worldcache *world)
+{
+	std::ofstream file(fpath, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "error: could not write world cache " << fpath << std::endl;
+		return false;
+	}
+
+	const size_t size = world->heights.width;
+	const struct worldheader header = { WORLD_MAGIC, WORLD_VERSION, uint32_t(size), 0, world->seed };
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)world->heights.data, size * size * 2);
+	file.write((const char*)world->normals.data, size * size * 3);
+	file.write((const char*)world->occlusion.data, size * size);
+
+	return file.good();
+}
+
+bool load_worldcache(const char *fpath, struct worldcache *world)
+{
+	std::ifstream file(fpath, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "error: could not open world cache " << fpath << std::endl;
+		return false;
+	}
+
+	struct worldheader header;
+	file.read((char*)&header, sizeof(header));
+	if (!file.good() || header.magic != WORLD_MAGIC || header.version != WORLD_VERSION || header.size == 0) {
+		std::cerr << "error: " << fpath << " is not a world cache" << std::endl;
+		return false;
+	}
+
+	const size_t size = header.size;
+	world->seed = header.seed;
+	world->heights = {
+		.data = tracked_alloc(size * size * 2),
+		.nchannels = 1,
+		.width = size,
+		.height = size,
+		.format = IMAGE_U16
+	};
+	world->normals = {
+		.data = tracked_alloc(size * size * 3),
+		.nchannels = 3,
+		.width = size,
+		.height = size
+	};
+	world->occlusion = {
+		.data = tracked_alloc(size * size),
+		.nchannels = 1,
+		.width = size,
+		.height = size
+	};
+	file.read((char*)world->heights.data, size * size * 2);
+	file.read((char*)world->normals.data, size * size * 3);
+	file.read((char*)world->occlusion.data, size * size);
+
+	if (!file.good()) {
+		std::cerr << "error: world cache " << fpath << " is truncated" << std::endl;
+		tracked_free(world->heights.data);
+		tracked_free(world->normals.data);
+		tracked_free(world->occlusion.data);
+		return false;
+	}
+
+	return true;
+}
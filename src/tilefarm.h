@@ -0,0 +1,29 @@
+// a world generated in tiles by worker processes, the coordinator stitches the tiles into a world cache
+// workers are this binary started with --worker, they connect to the coordinator over TCP
+// the messages are the raw structs, so all the machines need the same byte order
+
+struct farmconfig {
+	const char *output; // world cache to write
+	size_t worldsize; // heightmap texels per side
+	size_t tilesize;
+	long seed;
+	unsigned int localworkers; // worker processes started on this machine, more can connect from elsewhere
+	unsigned short port;
+};
+
+// heights, normals and occlusion of a whole world
+struct worldcache {
+	long seed;
+	struct rawimage heights; // 16 bit
+	struct rawimage normals; // RGB
+	struct rawimage occlusion;
+};
+
+bool run_coordinator(const struct farmconfig *config, const char *executable);
+
+// address is host:port of the coordinator, returns when the coordinator has no more work
+bool run_worker(const char *address);
+
+bool save_worldcache(const char *fpath, const struct worldcache *world);
+
+bool load_worldcache(const char *fpath, struct worldcache *world);
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include "timer.h"
+
+const char *PASS_NAMES[PASS_COUNT] = {
+	"depth prepass",
+	"terrain",
+	"culling",
+	"forest",
+	"crowd",
+	"sky",
+	"water",
+	"clouds",
+	"grass",
+	"upscale",
+	"ui",
+};
+
+GPUTimer::GPUTimer(void)
+{
+	glGenQueries(TIMER_LATENCY * PASS_COUNT, &queries[0][0]);
+
+	for (int i = 0; i < TIMER_LATENCY; i++) {
+		for (int j = 0; j < PASS_COUNT; j++) {
+			issued[i][j] = false;
+		}
+	}
+	for (int j = 0; j < PASS_COUNT; j++) {
+		results[j] = 0.f;
+	}
+
+	frame = 0;
+	active = -1;
+}
+
+GPUTimer::~GPUTimer(void)
+{
+	glDeleteQueries(TIMER_LATENCY * PASS_COUNT, &queries[0][0]);
+}
+
+void GPUTimer::begin(unsigned int pass)
+{
+	if (active >= 0) { end(); }
+
+	const unsigned int slot = frame % TIMER_LATENCY;
+	glBeginQuery(GL_TIME_ELAPSED, queries[slot][pass]);
+	issued[slot][pass] = true;
+	active = pass;
+}
+
+void GPUTimer::end(void)
+{
+	if (active < 0) { return; }
+
+	glEndQuery(GL_TIME_ELAPSED);
+	active = -1;
+}
+
+// call once per frame after the last pass, reads the results of the oldest frame in flight
+void GPUTimer::collect(void)
+{
+	end();
+
+	frame++;
+	read(frame % TIMER_LATENCY);
+}
+
+// reads the results of the frame collect just closed, waits for the GPU to finish it
+// benchmarks wait for every frame anyway, so their pass times belong to the frame they are recorded with
+void GPUTimer::resolve(void)
+{
+	read((frame + TIMER_LATENCY - 1) % TIMER_LATENCY);
+}
+
+void GPUTimer::read(unsigned int slot)
+{
+	for (int pass = 0; pass < PASS_COUNT; pass++) {
+		if (issued[slot][pass] == false) {
+			results[pass] = 0.f;
+			continue;
+		}
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[slot][pass], GL_QUERY_RESULT, &elapsed);
+		results[pass] = float(elapsed) / 1000000.f;
+		issued[slot][pass] = false;
+	}
+}
+
+float GPUTimer::total(void) const
+{
+	float sum = 0.f;
+	for (int pass = 0; pass < PASS_COUNT; pass++) {
+		sum += results[pass];
+	}
+
+	return sum;
+}
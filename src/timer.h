@@ -0,0 +1,40 @@
+enum {
+	PASS_PREPASS,
+	PASS_TERRAIN,
+	PASS_CULL,
+	PASS_FOREST,
+	PASS_CROWD,
+	PASS_SKY,
+	PASS_WATER,
+	PASS_CLOUDS,
+	PASS_GRASS,
+	PASS_UPSCALE,
+	PASS_UI,
+	PASS_COUNT
+};
+
+// results are read back a few frames later so the queries never stall the pipeline
+enum { TIMER_LATENCY = 3 };
+
+extern const char *PASS_NAMES[PASS_COUNT];
+
+// measures the GPU time of each render pass with timer queries
+class GPUTimer {
+public:
+	GPUTimer(void);
+	~GPUTimer(void);
+	void begin(unsigned int pass);
+	void end(void);
+	void collect(void);
+	void resolve(void);
+	float milliseconds(unsigned int pass) const { return results[pass]; }
+	float total(void) const;
+private:
+	GLuint queries[TIMER_LATENCY][PASS_COUNT];
+	bool issued[TIMER_LATENCY][PASS_COUNT];
+	float results[PASS_COUNT];
+	unsigned int frame;
+	int active;
+private:
+	void read(unsigned int slot);
+};
@@ -0,0 +1,370 @@
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <GL/glew.h>
+#include <GL/gl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "imp.h"
+#include "dds.h"
+#include "glwrapper.h"
+#include "memory.h"
+#include "shader.h"
+#include "camera.h"
+#include "culling.h"
+#include "water.h"
+
+#define GRAVITY 9.81f
+#define WAVE_STEEPNESS 0.6f // overall choppiness, 0 gives sine waves and 1 sharp crests
+#define WAVE_SLOPE 0.015f // amplitude / wavelength of the longest wave
+#define WAVE_SPREAD 0.6f // standard deviation in radians of the wave directions around the wind
+
+std::vector<struct wave> gen_wave_spectrum(unsigned int seed, float tilesize, glm::vec2 wind, unsigned int count)
+{
+	std::vector<struct wave> waves;
+
+	count = std::min(count, unsigned(MAX_WAVES));
+	if (count == 0) { return waves; }
+
+	std::mt19937 gen(seed);
+	std::normal_distribution<float> spread(0.f, WAVE_SPREAD);
+	std::uniform_real_distribution<float> variation(0.5f, 1.f);
+
+	const float windangle = atan2f(wind.y, wind.x);
+	for (unsigned int i = 0; i < count; i++) {
+		// wavelengths from half the tile down, shorter waves are flatter
+		const float wavelength = 0.5f * tilesize / (1.f + 1.5f * i);
+		const float angle = windangle + spread(gen);
+
+		// snap the wave vector to the lattice 2 pi (m, n) / tilesize
+		float m = roundf(cosf(angle) * tilesize / wavelength);
+		float n = roundf(sinf(angle) * tilesize / wavelength);
+		if (m == 0.f && n == 0.f) { m = 1.f; }
+
+		const glm::vec2 k = (2.f * float(M_PI) / tilesize) * glm::vec2(m, n);
+		const float wavenumber = glm::length(k);
+
+		struct wave w;
+		w.direction = k / wavenumber;
+		w.wavenumber = wavenumber;
+		w.amplitude = WAVE_SLOPE * variation(gen) * (2.f * float(M_PI) / wavenumber) / sqrtf(1.f + i);
+		w.steepness = WAVE_STEEPNESS / (wavenumber * w.amplitude * count);
+		w.frequency = sqrtf(GRAVITY * wavenumber); // deep water dispersion
+		waves.push_back(w);
+	}
+
+	return waves;
+}
+
+static void normalize_texel(float *n)
+{
+	const float len = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+	n[0] /= len;
+	n[1] /= len;
+	n[2] /= len;
+	n[3] = 0.f;
+}
+
+#ifdef __SSE2__
+static inline float horizontal_sum(__m128 v)
+{
+	__m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, sums);
+
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+// four waves per register, along a row the sine and cosine of each phase are advanced with a rotation
+// instead of calling sin and cos for every texel, the rotation starts from exact values at each row
+void gerstner_field(const std::vector<struct wave> &waves, float time, size_t resolution, float tilesize, float *displacement, float *normals)
+{
+	const size_t groups = (waves.size() + 3) / 4;
+	const float spacing = tilesize / float(resolution);
+
+	// structure of arrays padded with flat waves
+	std::vector<float> kx(4*groups, 0.f), kz(4*groups, 0.f), omega(4*groups, 0.f);
+	std::vector<float> qax(4*groups, 0.f), qaz(4*groups, 0.f), amp(4*groups, 0.f);
+	std::vector<float> kax(4*groups, 0.f), kaz(4*groups, 0.f), qka(4*groups, 0.f);
+	std::vector<float> stepcos(4*groups, 1.f), stepsin(4*groups, 0.f);
+	for (size_t i = 0; i < waves.size(); i++) {
+		const struct wave &w = waves[i];
+		kx[i] = w.wavenumber * w.direction.x;
+		kz[i] = w.wavenumber * w.direction.y;
+		omega[i] = w.frequency;
+		qax[i] = w.steepness * w.amplitude * w.direction.x;
+		qaz[i] = w.steepness * w.amplitude * w.direction.y;
+		amp[i] = w.amplitude;
+		kax[i] = w.wavenumber * w.amplitude * w.direction.x;
+		kaz[i] = w.wavenumber * w.amplitude * w.direction.y;
+		qka[i] = w.steepness * w.wavenumber * w.amplitude;
+		stepcos[i] = cosf(kx[i] * spacing);
+		stepsin[i] = sinf(kx[i] * spacing);
+	}
+
+	std::vector<float> rowsin(4*groups), rowcos(4*groups);
+	for (size_t y = 0; y < resolution; y++) {
+		const float z = float(y) * spacing;
+		for (size_t i = 0; i < 4*groups; i++) {
+			const float phase = kz[i] * z - omega[i] * time;
+			rowsin[i] = sinf(phase);
+			rowcos[i] = cosf(phase);
+		}
+
+		for (size_t g = 0; g < groups; g++) {
+			const size_t o = 4 * g;
+			__m128 s = _mm_loadu_ps(&rowsin[o]);
+			__m128 c = _mm_loadu_ps(&rowcos[o]);
+			const __m128 rc = _mm_loadu_ps(&stepcos[o]);
+			const __m128 rs = _mm_loadu_ps(&stepsin[o]);
+			const __m128 QAX = _mm_loadu_ps(&qax[o]);
+			const __m128 QAZ = _mm_loadu_ps(&qaz[o]);
+			const __m128 A = _mm_loadu_ps(&amp[o]);
+			const __m128 KAX = _mm_loadu_ps(&kax[o]);
+			const __m128 KAZ = _mm_loadu_ps(&kaz[o]);
+			const __m128 QKA = _mm_loadu_ps(&qka[o]);
+
+			float *dst = &displacement[4 * y * resolution];
+			float *nrm = &normals[4 * y * resolution];
+			for (size_t x = 0; x < resolution; x++) {
+				if (g == 0) {
+					dst[4*x+0] = 0.f; dst[4*x+1] = 0.f; dst[4*x+2] = 0.f; dst[4*x+3] = 0.f;
+					nrm[4*x+0] = 0.f; nrm[4*x+1] = 1.f; nrm[4*x+2] = 0.f; nrm[4*x+3] = 0.f;
+				}
+				dst[4*x+0] += horizontal_sum(_mm_mul_ps(QAX, c));
+				dst[4*x+1] += horizontal_sum(_mm_mul_ps(A, s));
+				dst[4*x+2] += horizontal_sum(_mm_mul_ps(QAZ, c));
+				nrm[4*x+0] -= horizontal_sum(_mm_mul_ps(KAX, c));
+				nrm[4*x+1] -= horizontal_sum(_mm_mul_ps(QKA, s));
+				nrm[4*x+2] -= horizontal_sum(_mm_mul_ps(KAZ, c));
+
+				// sin(a+b) = sin a cos b + cos a sin b, cos(a+b) = cos a cos b - sin a sin b
+				const __m128 next = _mm_add_ps(_mm_mul_ps(s, rc), _mm_mul_ps(c, rs));
+				c = _mm_sub_ps(_mm_mul_ps(c, rc), _mm_mul_ps(s, rs));
+				s = next;
+			}
+		}
+
+		for (size_t x = 0; x < resolution; x++) {
+			normalize_texel(&normals[4 * (y * resolution + x)]);
+		}
+	}
+}
+#else
+void gerstner_field(const std::vector<struct wave> &waves, float time, size_t resolution, float tilesize, float *displacement, float *normals)
+{
+	const float spacing = tilesize / float(resolution);
+
+	for (size_t y = 0; y < resolution; y++) {
+		for (size_t x = 0; x < resolution; x++) {
+			float *dst = &displacement[4 * (y * resolution + x)];
+			float *nrm = &normals[4 * (y * resolution + x)];
+			dst[0] = 0.f; dst[1] = 0.f; dst[2] = 0.f; dst[3] = 0.f;
+			nrm[0] = 0.f; nrm[1] = 1.f; nrm[2] = 0.f;
+			for (const auto &w : waves) {
+				const float phase = w.wavenumber * (w.direction.x * x + w.direction.y * y) * spacing - w.frequency * time;
+				const float c = cosf(phase);
+				const float s = sinf(phase);
+				const float ka = w.wavenumber * w.amplitude;
+				dst[0] += w.steepness * w.amplitude * w.direction.x * c;
+				dst[1] += w.amplitude * s;
+				dst[2] += w.steepness * w.amplitude * w.direction.y * c;
+				nrm[0] -= w.direction.x * ka * c;
+				nrm[1] -= w.steepness * ka * s;
+				nrm[2] -= w.direction.y * ka * c;
+			}
+			normalize_texel(nrm);
+		}
+	}
+}
+#endif
+
+std::vector<bool> water_mask(const struct rawimage *heightmap, size_t patches, float sealevel, float margin)
+{
+	std::vector<bool> mask(patches * patches, false);
+
+	const float threshold = sealevel + margin;
+	for (size_t row = 0; row < patches; row++) {
+		const size_t miny = row * heightmap->height / patches;
+		const size_t maxy = std::min((row + 1) * heightmap->height / patches, heightmap->height - 1);
+		for (size_t col = 0; col < patches; col++) {
+			const size_t minx = col * heightmap->width / patches;
+			const size_t maxx = std::min((col + 1) * heightmap->width / patches, heightmap->width - 1);
+			// the border texels are shared with the neighbours so their edges agree
+			float lowest = 1.f;
+			for (size_t y = miny; y <= maxy && lowest >= threshold; y++) {
+				for (size_t x = minx; x <= maxx; x++) {
+					lowest = std::min(lowest, sample_image(x, y, heightmap, 0));
+				}
+			}
+			mask[row * patches + col] = (lowest < threshold);
+		}
+	}
+
+	return mask;
+}
+
+static GLuint create_wave_texture(size_t resolution)
+{
+	GLuint texture;
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, resolution, resolution, 0, GL_RGBA, GL_FLOAT, NULL);
+	track_texture(texture, texture_bytes(GL_RGBA16F, resolution, resolution, 1, 1));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return texture;
+}
+
+Water::Water(const struct rawimage *heightmap, size_t patches, float patchoffset, float sealevel, float amplitude, unsigned int seed, GLuint cubemapbind)
+{
+	MemoryScope scope(MEMORY_WATER);
+
+	level = sealevel * amplitude;
+	tilesize = 8.f * patchoffset;
+
+	waves = gen_wave_spectrum(seed, tilesize, glm::vec2(1.f, 0.4f), MAX_WAVES);
+	waveheight = 0.f;
+	for (const auto &w : waves) { waveheight += w.amplitude; }
+
+	std::vector<bool> mask = water_mask(heightmap, patches, sealevel, waveheight / amplitude);
+	surface = gen_masked_patch_grid(patches, patchoffset, mask);
+
+	// the waves also move the surface sideways, by less than their height
+	for (size_t i = 0; i < mask.size(); i++) {
+		if (mask[i] == false) { continue; }
+		const glm::vec2 corner = patchoffset * glm::vec2(i % patches, i / patches);
+		struct cullbox box = {
+			.min = glm::vec4(corner.x - waveheight, level - waveheight, corner.y - waveheight, 0.f),
+			.max = glm::vec4(corner.x + patchoffset + waveheight, level + waveheight, corner.y + patchoffset + waveheight, 0.f),
+			.first = GLuint(4 * patchboxes.size()),
+			.count = 4
+		};
+		patchboxes.push_back(box);
+	}
+	drawn = patchboxes.size();
+
+	displacement = create_wave_texture(WAVE_RESOLUTION);
+	normals = create_wave_texture(WAVE_RESOLUTION);
+	normalmap = load_DDS_texture("media/textures/water/normal.dds");
+	cubemap = cubemapbind;
+
+	simulation = nullptr;
+	if (GLEW_ARB_compute_shader) {
+		struct shaderinfo pipeline[] = {
+			{GL_COMPUTE_SHADER, "shaders/water.comp"},
+			{GL_NONE, NULL}
+		};
+		simulation = new Shader { pipeline };
+	} else {
+		displacementfield.resize(4 * WAVE_RESOLUTION * WAVE_RESOLUTION);
+		normalfield.resize(4 * WAVE_RESOLUTION * WAVE_RESOLUTION);
+	}
+}
+
+Water::~Water(void)
+{
+	delete simulation;
+
+	untrack_texture(displacement);
+	untrack_texture(normals);
+	untrack_texture(normalmap);
+	if (glIsTexture(displacement) == GL_TRUE) { glDeleteTextures(1, &displacement); }
+	if (glIsTexture(normals) == GL_TRUE) { glDeleteTextures(1, &normals); }
+	if (glIsTexture(normalmap) == GL_TRUE) { glDeleteTextures(1, &normalmap); }
+
+	delete_mesh(&surface);
+}
+
+void Water::update(float time)
+{
+	if (visible() == false) { return; }
+
+	if (simulation == nullptr) {
+		gerstner_field(waves, time, WAVE_RESOLUTION, tilesize, displacementfield.data(), normalfield.data());
+		// uploaded on the units they are drawn from, so the draw does not bind them again
+		activate_texture(GL_TEXTURE1, GL_TEXTURE_2D, displacement);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WAVE_RESOLUTION, WAVE_RESOLUTION, GL_RGBA, GL_FLOAT, displacementfield.data());
+		activate_texture(GL_TEXTURE2, GL_TEXTURE_2D, normals);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WAVE_RESOLUTION, WAVE_RESOLUTION, GL_RGBA, GL_FLOAT, normalfield.data());
+		return;
+	}
+
+	glm::vec4 shape[MAX_WAVES];
+	glm::vec4 motion[MAX_WAVES];
+	for (size_t i = 0; i < waves.size(); i++) {
+		shape[i] = glm::vec4(waves[i].direction.x, waves[i].direction.y, waves[i].wavenumber, waves[i].amplitude);
+		motion[i] = glm::vec4(waves[i].steepness, waves[i].frequency, 0.f, 0.f);
+	}
+
+	simulation->bind();
+	simulation->uniform_int("wavecount", waves.size());
+	simulation->uniform_array_vec4("waves", waves.size(), shape);
+	simulation->uniform_array_vec4("wavemotion", waves.size(), motion);
+	simulation->uniform_float("tilesize", tilesize);
+	simulation->uniform_float("time", time);
+
+	glBindImageTexture(0, displacement, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, normals, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glDispatchCompute(WAVE_RESOLUTION / 16, WAVE_RESOLUTION / 16, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+// gathers the patches in view and not behind the terrain into ranges of the surface
+void Water::cull(const struct frustum *frustum, const OcclusionCuller *culler)
+{
+	firsts.clear();
+	counts.clear();
+	drawn = 0;
+	for (const auto &patch : patchboxes) {
+		const glm::vec3 min = glm::vec3(patch.min);
+		const glm::vec3 max = glm::vec3(patch.max);
+		if (AABB_in_frustum(frustum, min, max) == false) { continue; }
+		if (culler && culler->visible(min, max) == false) { continue; }
+		if (!firsts.empty() && GLuint(firsts.back() + counts.back()) == patch.first) {
+			counts.back() += patch.count;
+		} else {
+			firsts.push_back(patch.first);
+			counts.push_back(patch.count);
+		}
+		drawn++;
+	}
+}
+
+void Water::display(void) const
+{
+	if (visible() == false || drawn == 0) { return; }
+
+	const struct texturebinding textures[] = {
+		{ GL_TEXTURE_CUBE_MAP, cubemap },
+		{ GL_TEXTURE_2D, displacement },
+		{ GL_TEXTURE_2D, normals }
+	};
+	activate_textures(GL_TEXTURE0, 3, textures);
+	activate_texture(GL_TEXTURE4, GL_TEXTURE_2D, normalmap);
+
+	glBindVertexArray(surface.VAO);
+	glPatchParameteri(GL_PATCH_VERTICES, 4);
+	if (firsts.empty()) {
+		glDrawArrays(GL_PATCHES, 0, surface.ecount);
+	} else {
+		glMultiDrawArrays(GL_PATCHES, firsts.data(), counts.data(), firsts.size());
+	}
+}
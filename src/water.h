@@ -0,0 +1,51 @@
+enum {
+	MAX_WAVES = 16, // has to match the array size in the water compute shader
+	WAVE_RESOLUTION = 128 // texels per side of the wave textures
+};
+
+struct wave {
+	glm::vec2 direction;
+	float wavenumber;
+	float amplitude;
+	float steepness; // horizontal displacement, sum of steepness * wavenumber * amplitude stays below 1 so crests don't loop
+	float frequency; // angular frequency
+};
+
+// wave vectors lie on the lattice of the tile so the wave field repeats seamlessly
+std::vector<struct wave> gen_wave_spectrum(unsigned int seed, float tilesize, glm::vec2 wind, unsigned int count);
+
+// CPU version of the water compute shader, writes RGBA texels of displacement and normals
+void gerstner_field(const std::vector<struct wave> &waves, float time, size_t resolution, float tilesize, float *displacement, float *normals);
+
+// one entry per terrain patch, true if the terrain of the patch dips below the water surface
+std::vector<bool> water_mask(const struct rawimage *heightmap, size_t patches, float sealevel, float margin);
+
+class Water {
+public:
+	float level; // height of the water surface
+	float waveheight; // max vertical displacement of the waves
+	float tilesize; // size of the repeating wave tile
+public:
+	Water(const struct rawimage *heightmap, size_t patches, float patchoffset, float sealevel, float amplitude, unsigned int seed, GLuint cubemapbind);
+	~Water(void);
+	void update(float time);
+	void cull(const struct frustum *frustum, const OcclusionCuller *culler);
+	void display(void) const;
+	bool visible(void) const { return surface.ecount > 0; }
+	size_t patchcount(void) const { return patchboxes.size(); }
+	size_t drawnpatches(void) const { return drawn; }
+private:
+	struct mesh surface; // only the patches with water
+	std::vector<struct cullbox> patchboxes; // four vertices each, in the order of the surface
+	std::vector<GLint> firsts; // visible ranges of patches
+	std::vector<GLsizei> counts;
+	size_t drawn;
+	std::vector<struct wave> waves;
+	Shader *simulation; // null if compute shaders are not supported
+	std::vector<float> displacementfield; // CPU fallback
+	std::vector<float> normalfield;
+	GLuint displacement;
+	GLuint normals;
+	GLuint normalmap;
+	GLuint cubemap;
+};